@@ -134,6 +134,11 @@ void ControlSocketConfigureDirectory(const char *optarg)
     snprintf(config_unix_socket_fn, sizeof(config_unix_socket_fn), "%s%s%s", optarg, sep, CONTROL_FILE);
 }
 
+void ControlSocketResetDirectory(void)
+{
+    config_unix_socket_fn[0] = '\0';
+}
+
 int ControlSocketRegisterHandler(uint16_t type, OOBPreControlFunc oobpre, IBControlFunc ib,
                                  OOBPostControlFunc oobpost)
 {
@@ -805,6 +810,10 @@ void ControlSocketConfigureDirectory(const char *optarg)
     FatalError("%s\n", "Control socket is not available.");
 }
 
+void ControlSocketResetDirectory(void)
+{
+}
+
 int ControlSocketRegisterHandler(uint16_t type, OOBPreControlFunc oobpre, IBControlFunc ib,
                                  OOBPostControlFunc oobpost)
 {
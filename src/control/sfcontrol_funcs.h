@@ -32,6 +32,7 @@
 #include "sfcontrol.h"
 
 void ControlSocketConfigureDirectory(const char *optarg);
+void ControlSocketResetDirectory(void);
 void ControlSocketInit(void);
 void ControlSocketCleanUp(void);
 int ControlSocketRegisterHandler(uint16_t type, OOBPreControlFunc oobpre, IBControlFunc ib,
@@ -61,6 +61,7 @@
 #include "sf_types.h"
 #include "active.h"
 #include "detection_util.h"
+#include "encode.h"
 #include "preprocids.h"
 #if defined(FEAT_OPEN_APPID)
 #include "sp_appid.h"
@@ -81,6 +82,10 @@ PreprocStats detectPerfStats;
 
 /* #define ITERATIVE_ENGINE */
 
+/* network preprocessors that don't read the payload, so a rebuilt one
+ * still held as stream segments (Encode_SetSpans) isn't gathered for them */
+#define PP_HEADERS_ONLY ( PP_CLASS_NETWORK & ~( UINT64_C(1) << PP_NORMALIZE ) )
+
 OptTreeNode *otn_tmp = NULL;       /* OptTreeNode temp ptr */
 
 int do_detect;
@@ -138,7 +143,12 @@ static void DispatchPreprocessors( Packet *p, tSfPolicyId policy_id, SnortPolicy
             break;
 
         if ( preprocHandlesProto( p, ppn ) && IsPreprocessorEnabled( p, ppn->preproc_bit ) )
+        {
+            if ( !( ppn->preproc_bit & PP_HEADERS_ONLY ) )
+                Encode_Gather( p );
+
             ppn->func( p, ppn->context );
+        }
 
         if( !alerts_processed && ( p->ips_os_selected || ppn->preproc_id == PP_FW_RULE_ENGINE ) )
             alerts_processed = processDecoderAlertsActionQ( p );
@@ -383,6 +393,8 @@ void CallLogFuncs(Packet *p, const char *message, ListHead *head, Event *event)
 {
     OutputFuncNode *idx = NULL;
 
+    Encode_Flatten(p);
+
     if (event->sig_generator != GENERATOR_TAG)
     {
         event->ref_time.tv_sec = p->pkth->ts.tv_sec;
@@ -427,6 +439,9 @@ void CallSigOutputFuncs(Packet *p, OptTreeNode *otn, Event *event)
 
     idx = otn->outputFuncs;
 
+    if ( idx )
+        Encode_Flatten(p);
+
     while(idx)
     {
         idx->func(p, otn->sigInfo.message, idx->arg, event);
@@ -438,6 +453,8 @@ void CallAlertFuncs(Packet * p, const char *message, ListHead * head, Event *eve
 {
     OutputFuncNode *idx = NULL;
 
+    Encode_Flatten(p);
+
     event->ref_time.tv_sec = p->pkth->ts.tv_sec;
     event->ref_time.tv_usec = p->pkth->ts.tv_usec;
 
@@ -875,6 +875,44 @@ static bool PacketSelection(Packet *p)
 
 uint64_t rule_eval_pkt_count = 0;
 
+/* Options that only look at headers or flow state.  For any other the
+ * payload of a rebuilt packet still held as stream segments has to be
+ * gathered first (see Encode_SetSpans). */
+static inline int OptionReadsPayload(option_type_t type)
+{
+    switch (type)
+    {
+        case RULE_OPTION_TYPE_LEAF_NODE:
+        case RULE_OPTION_TYPE_FLOW:
+        case RULE_OPTION_TYPE_DSIZE:
+        case RULE_OPTION_TYPE_FLOWBIT:
+        case RULE_OPTION_TYPE_ICMP_CODE:
+        case RULE_OPTION_TYPE_ICMP_ID:
+        case RULE_OPTION_TYPE_ICMP_SEQ:
+        case RULE_OPTION_TYPE_ICMP_TYPE:
+        case RULE_OPTION_TYPE_IP_FRAGBITS:
+        case RULE_OPTION_TYPE_IP_FRAG_OFFSET:
+        case RULE_OPTION_TYPE_IP_ID:
+        case RULE_OPTION_TYPE_IP_OPTION:
+        case RULE_OPTION_TYPE_IP_PROTO:
+        case RULE_OPTION_TYPE_IP_SAME:
+        case RULE_OPTION_TYPE_IP_TOS:
+        case RULE_OPTION_TYPE_TCP_ACK:
+        case RULE_OPTION_TYPE_TCP_FLAG:
+        case RULE_OPTION_TYPE_TCP_SEQ:
+        case RULE_OPTION_TYPE_TCP_WIN:
+        case RULE_OPTION_TYPE_TTL:
+        case RULE_OPTION_TYPE_HDR_OPT_CHECK:
+#if defined(FEAT_OPEN_APPID)
+        case RULE_OPTION_TYPE_APPID:
+#endif
+            return 0;
+
+        default:
+            return 1;
+    }
+}
+
 /* Include "detection_leaf_node.c"
  *
  * Service matches, toggles 'check_ports' and then evaluation
@@ -930,6 +968,9 @@ int detection_option_node_evaluate(detection_option_tree_node_t *node, detection
 
     NODE_PROFILE_START(node);
 
+    if (OptionReadsPayload(node->option_type))
+        Encode_Gather(eval_data->p);
+
     node->last_check.ts.tv_sec = eval_data->p->pkth->ts.tv_sec;
     node->last_check.ts.tv_usec = eval_data->p->pkth->ts.tv_usec;
     node->last_check.packet_number = cur_eval_pkt_count;
@@ -1460,6 +1501,7 @@ typedef struct node_profile_stats
     uint64_t ticks_no_match;
     uint64_t checks;
     uint64_t disables;
+    PerfCounters hw;
 } node_profile_stats_t;
 
 static void detection_option_node_update_otn_stats(detection_option_tree_node_t *node,
@@ -1474,6 +1516,8 @@ static void detection_option_node_update_otn_stats(detection_option_tree_node_t
 
     if (stats)
     {
+        local_stats.hw = stats->hw;
+        PerfCountersAdd(&local_stats.hw, &node->hw);
         local_stats.ticks = stats->ticks + node->ticks;
         local_stats.ticks_match = stats->ticks_match + node->ticks_match;
         local_stats.ticks_no_match = stats->ticks_no_match + node->ticks_no_match;
@@ -1487,6 +1531,7 @@ static void detection_option_node_update_otn_stats(detection_option_tree_node_t
     }
     else
     {
+        local_stats.hw = node->hw;
         local_stats.ticks = node->ticks;
         local_stats.ticks_match = node->ticks_match;
         local_stats.ticks_no_match = node->ticks_no_match;
@@ -1503,6 +1548,7 @@ static void detection_option_node_update_otn_stats(detection_option_tree_node_t
         otn->ticks += local_stats.ticks;
         otn->ticks_match += local_stats.ticks_match;
         otn->ticks_no_match += local_stats.ticks_no_match;
+        PerfCountersAdd(&otn->hw, &local_stats.hw);
         if (local_stats.checks > otn->checks)
             otn->checks = local_stats.checks;
 #ifdef PPM_MGR
@@ -39,6 +39,7 @@
 #include "decode.h"
 #include "sfutil/sfxhash.h"
 #include "rule_option_types.h"
+#include "profiler.h"
 
 #define DETECTION_OPTION_EQUAL 0
 #define DETECTION_OPTION_NOT_EQUAL 1
@@ -76,6 +77,7 @@ typedef struct _detection_option_tree_node
     uint64_t ticks_match;
     uint64_t ticks_no_match;
     uint64_t checks;
+    PerfCounters hw;
 #endif
 #ifdef PPM_MGR
     uint64_t ppm_disable_cnt; /*PPM */
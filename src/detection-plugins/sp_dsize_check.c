@@ -25,6 +25,7 @@
 #endif
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -102,6 +103,36 @@ int DSizeCheckCompare(void *l, void *r)
     return DETECTION_OPTION_NOT_EQUAL;
 }
 
+int OtnDsizeRange(OptTreeNode *otn, int *lo, int *hi)
+{
+    DsizeCheckData *ds_ptr = (DsizeCheckData *)otn->ds_list[PLUGIN_DSIZE_CHECK];
+
+    if (!ds_ptr)
+        return 0;
+
+    switch (ds_ptr->operator)
+    {
+        case DSIZE_EQ:
+            *lo = *hi = ds_ptr->dsize;
+            break;
+        case DSIZE_GT:
+            *lo = ds_ptr->dsize + 1;
+            *hi = INT_MAX;
+            break;
+        case DSIZE_LT:
+            *lo = 0;
+            *hi = ds_ptr->dsize - 1;
+            break;
+        case DSIZE_RANGE:
+            *lo = ds_ptr->dsize;
+            *hi = ds_ptr->dsize2;
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
 /****************************************************************************
  *
  * Function: SetupDsizeCheck()
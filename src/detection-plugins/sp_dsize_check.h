@@ -27,4 +27,8 @@ void SetupDsizeCheck(void);
 uint32_t DSizeCheckHash(void *d);
 int DSizeCheckCompare(void *l, void *r);
 
+/* Sets lo..hi to the payload sizes the rule's dsize accepts.  Returns 0 if
+ * the rule has no dsize. */
+int OtnDsizeRange(struct _OptTreeNode *otn, int *lo, int *hi);
+
 #endif  /* __SP_DSIZE_CHECK_H__ */
@@ -90,7 +90,8 @@ int flowbits_toggle = 1;
 
 #define DEFAULT_FLOWBIT_SIZE  1024
 #define MAX_FLOWBIT_SIZE      2048
-#define CONVERT_BITS_TO_BYTES(size)    ( (size > 1)?(((size -1) >> 3)+ 1):0)
+/* whole 64 bit words so the bitsets can be worked on a word at a time */
+#define CONVERT_BITS_TO_BYTES(size)    ((((size) + 63) >> 6) << 3)
 static unsigned int giFlowbitSizeInBytes = CONVERT_BITS_TO_BYTES(DEFAULT_FLOWBIT_SIZE);
 static unsigned int giFlowbitSize = DEFAULT_FLOWBIT_SIZE;
 
@@ -166,6 +167,8 @@ void FlowBitsFree(void *d)
     FLOWBITS_OP *data = (FLOWBITS_OP *)d;
     if (data->ids)
         free(data->ids);
+    if (data->masks)
+        free(data->masks);
     if (data->name)
         free(data->name);
     if (data->group)
@@ -353,6 +356,8 @@ static void FlowBitsInit(struct _SnortConfig *sc, char *data, OptTreeNode *otn,
         flowbits = idx_dup;
     }
 
+    FlowBitsCompile(flowbits);
+
     fpl = AddOptFuncToList(FlowBitsCheck, otn);
     fpl->type = RULE_OPTION_TYPE_FLOWBIT;
 
@@ -839,72 +844,120 @@ static void FlowBitsParse(struct _SnortConfig *sc, char *data, FLOWBITS_OP *flow
     mSplitFree(&toks, num_toks);
 }
 
-static inline int boUnSetGrpBit(BITOP *BitOp, char *group)
+/*
+ * The session bitset and the group bitsets are worked on a 64 bit word at
+ * a time.  Both are sized in whole words (see CONVERT_BITS_TO_BYTES) and
+ * their buffers are word aligned.
+ */
+static inline uint64_t *flowbitWords(BITOP *BitOp, unsigned *num_words)
 {
-    FLOWBITS_GRP *flowbits_grp;
-    BITOP *GrpBitOp;
-    unsigned int i, max_bytes;
+    *num_words = BitOp->uiBitBufferSize >> 3;
+    return (uint64_t *)BitOp->pucBitBuffer;
+}
 
-    if( group == NULL )
-        return 0;
-    flowbits_grp = (FLOWBITS_GRP *)sfghash_find(flowbits_grp_hash, group);
-    if( flowbits_grp == NULL )
+/* Returns the number of words of the session bitset the group covers or
+ * 0 if the group can't be applied to it. */
+static inline unsigned flowbitGrpWords(FLOWBITS_GRP *flowbits_grp, BITOP *BitOp)
+{
+    if ((flowbits_grp == NULL) || (flowbits_grp->count == 0) ||
+            (BitOp->uiMaxBits <= flowbits_grp->max_id))
         return 0;
-    if((BitOp == NULL) || (BitOp->uiMaxBits <= flowbits_grp->max_id) || flowbits_grp->count == 0)
+
+    /* note, max_id is an index, not a count */
+    return (flowbits_grp->max_id >> 6) + 1;
+}
+
+static inline FLOWBITS_GRP *flowbitFindGrp(char *group)
+{
+    if ((group == NULL) || (flowbits_grp_hash == NULL))
+        return NULL;
+
+    return (FLOWBITS_GRP *)sfghash_find(flowbits_grp_hash, group);
+}
+
+static inline int boUnSetGrpBit(BITOP *BitOp, FLOWBITS_GRP *flowbits_grp)
+{
+    unsigned int i, n, num_words;
+    uint64_t *w, *g;
+
+    if (!(n = flowbitGrpWords(flowbits_grp, BitOp)))
         return 0;
-    GrpBitOp = &(flowbits_grp->GrpBitOp);
 
-    /* note, max_id is an index, not a count.
-     * Calculate max_bytes by adding 8 to max_id, then dividing by 8.  */
-    max_bytes = (flowbits_grp->max_id + 8) >> 3;
-    for ( i = 0; i < max_bytes; i++ )
-    {
-        BitOp->pucBitBuffer[i] &= ~GrpBitOp->pucBitBuffer[i];
-    }
+    w = flowbitWords(BitOp, &num_words);
+    g = (uint64_t *)flowbits_grp->GrpBitOp.pucBitBuffer;
+
+    for ( i = 0; i < n; i++ )
+        w[i] &= ~g[i];
+
     return 1;
 }
 
-static inline int boToggleGrpBit(BITOP *BitOp, char *group)
+static inline int boToggleGrpBit(BITOP *BitOp, FLOWBITS_GRP *flowbits_grp)
 {
-    FLOWBITS_GRP *flowbits_grp;
-    BITOP *GrpBitOp;
-    unsigned int i, max_bytes;
+    unsigned int i, n, num_words;
+    uint64_t *w, *g;
 
-    if( group == NULL )
+    if (!(n = flowbitGrpWords(flowbits_grp, BitOp)))
         return 0;
-    flowbits_grp = (FLOWBITS_GRP *)sfghash_find(flowbits_grp_hash, group);
-    if( flowbits_grp == NULL )
-        return 0;
-    if((BitOp == NULL) || (BitOp->uiMaxBits <= flowbits_grp->max_id) || flowbits_grp->count == 0)
-        return 0;
-    GrpBitOp = &(flowbits_grp->GrpBitOp);
 
-    /* note, max_id is an index, not a count.
-     * Calculate max_bytes by adding 8 to max_id, then dividing by 8.  */
-    max_bytes = (flowbits_grp->max_id + 8) >> 3;
-    for ( i = 0; i < max_bytes; i++ )
-    {
-        BitOp->pucBitBuffer[i] ^= GrpBitOp->pucBitBuffer[i];
-    }
+    w = flowbitWords(BitOp, &num_words);
+    g = (uint64_t *)flowbits_grp->GrpBitOp.pucBitBuffer;
+
+    for ( i = 0; i < n; i++ )
+        w[i] ^= g[i];
+
     return 1;
 }
 
-static inline int boSetxBitsToGrp(BITOP *BitOp, uint16_t *ids, uint16_t num_ids, char *group)
+static inline int boSetxBitsToGrp(BITOP *BitOp, uint16_t *ids, uint16_t num_ids,
+        FLOWBITS_GRP *flowbits_grp)
 {
     unsigned int i;
-    if (!boUnSetGrpBit(BitOp, group))
+    if (!boUnSetGrpBit(BitOp, flowbits_grp))
         return 0;
     for(i = 0; i < num_ids; i++)
         boSetBit(BitOp,ids[i]);
     return 1;
 }
 
+static inline int issetFlowbitsGrp(BITOP *BitOp, Flowbits_eval evalType,
+        FLOWBITS_GRP *flowbits_grp)
+{
+    unsigned int i, n, num_words;
+    uint64_t *w, *g;
+
+    if (flowbits_grp == NULL)
+        return 0;
+
+    w = flowbitWords(BitOp, &num_words);
+    g = (uint64_t *)flowbits_grp->GrpBitOp.pucBitBuffer;
+    n = (flowbits_grp->max_id >> 6) + 1;
+
+    if (n > num_words)
+        return 0;
+
+    if (evalType == FLOWBITS_ALL)
+    {
+        for ( i = 0; i < n; i++ )
+        {
+            if ((w[i] & g[i]) != g[i])
+                return 0;
+        }
+        return 1;
+    }
+
+    for ( i = 0; i < n; i++ )
+    {
+        if (w[i] & g[i])
+            return 1;
+    }
+    return 0;
+}
 
 static inline int issetFlowbits(StreamFlowData *flowdata, uint8_t eval, uint16_t *ids,
-        uint16_t num_ids, char *group )
+        uint16_t num_ids, FLOWBITS_GRP *flowbits_grp)
 {
     unsigned int i;
-    FLOWBITS_GRP *flowbits_grp;
     Flowbits_eval  evalType = (Flowbits_eval)eval;
 
     switch (evalType)
@@ -926,29 +979,8 @@ static inline int issetFlowbits(StreamFlowData *flowdata, uint8_t eval, uint16_t
         return 0;
         break;
     case FLOWBITS_ALL:
-        flowbits_grp = (FLOWBITS_GRP *)sfghash_find(flowbits_grp_hash, group);
-        if( flowbits_grp == NULL )
-            return 0;
-        for ( i = 0; i <= (unsigned int)(flowbits_grp->max_id >>3) ; i++ )
-        {
-            uint8_t val = flowdata->boFlowbits.pucBitBuffer[i] & flowbits_grp->GrpBitOp.pucBitBuffer[i];
-            if (val != flowbits_grp->GrpBitOp.pucBitBuffer[i])
-                return 0;
-        }
-        return 1;
-        break;
     case FLOWBITS_ANY:
-        flowbits_grp = (FLOWBITS_GRP *)sfghash_find(flowbits_grp_hash, group);
-        if( flowbits_grp == NULL )
-            return 0;
-        for ( i = 0; i <= (unsigned int)(flowbits_grp->max_id >>3) ; i++ )
-        {
-            uint8_t val = flowdata->boFlowbits.pucBitBuffer[i] & flowbits_grp->GrpBitOp.pucBitBuffer[i];
-            if (val)
-                return 1;
-        }
-        return 0;
-        break;
+        return issetFlowbitsGrp(&(flowdata->boFlowbits), evalType, flowbits_grp);
     default:
         return 0;
     }
@@ -975,6 +1007,7 @@ int checkFlowBits( uint8_t type, uint8_t evalType, uint16_t *ids, uint16_t num_i
     int rval = DETECTION_OPTION_NO_MATCH;
     StreamFlowData *flowdata;
     Flowbits_eval eval = (Flowbits_eval) evalType;
+    FLOWBITS_GRP *flowbits_grp;
     int result = 0;
     int i;
 
@@ -990,6 +1023,8 @@ int checkFlowBits( uint8_t type, uint8_t evalType, uint16_t *ids, uint16_t num_i
         return rval;
     }
 
+    flowbits_grp = flowbitFindGrp(group);
+
     switch(type)
     {
     case FLOWBITS_SET:
@@ -999,12 +1034,12 @@ int checkFlowBits( uint8_t type, uint8_t evalType, uint16_t *ids, uint16_t num_i
         break;
 
     case FLOWBITS_SETX:
-        result = boSetxBitsToGrp(&(flowdata->boFlowbits), ids, num_ids, group);
+        result = boSetxBitsToGrp(&(flowdata->boFlowbits), ids, num_ids, flowbits_grp);
         break;
 
     case FLOWBITS_UNSET:
         if (eval == FLOWBITS_ALL )
-            boUnSetGrpBit(&(flowdata->boFlowbits), group);
+            boUnSetGrpBit(&(flowdata->boFlowbits), flowbits_grp);
         else
         {
             for(i = 0; i < num_ids; i++)
@@ -1017,13 +1052,13 @@ int checkFlowBits( uint8_t type, uint8_t evalType, uint16_t *ids, uint16_t num_i
         if (!group)
             boResetBITOP(&(flowdata->boFlowbits));
         else
-            boUnSetGrpBit(&(flowdata->boFlowbits), group);
+            boUnSetGrpBit(&(flowdata->boFlowbits), flowbits_grp);
         result = 1;
         break;
 
     case FLOWBITS_ISSET:
 
-        if(issetFlowbits(flowdata,(uint8_t)eval, ids, num_ids, group))
+        if(issetFlowbits(flowdata,(uint8_t)eval, ids, num_ids, flowbits_grp))
         {
             result = 1;
         }
@@ -1035,7 +1070,7 @@ int checkFlowBits( uint8_t type, uint8_t evalType, uint16_t *ids, uint16_t num_i
         break;
 
     case FLOWBITS_ISNOTSET:
-        if(!issetFlowbits(flowdata, (uint8_t)eval, ids, num_ids, group))
+        if(!issetFlowbits(flowdata, (uint8_t)eval, ids, num_ids, flowbits_grp))
         {
             result = 1;
         }
@@ -1047,7 +1082,7 @@ int checkFlowBits( uint8_t type, uint8_t evalType, uint16_t *ids, uint16_t num_i
 
     case FLOWBITS_TOGGLE:
         if (group)
-            boToggleGrpBit(&(flowdata->boFlowbits),group);
+            boToggleGrpBit(&(flowdata->boFlowbits), flowbits_grp);
         else
         {
             for(i = 0; i < num_ids; i++)
@@ -1092,6 +1127,172 @@ int checkFlowBits( uint8_t type, uint8_t evalType, uint16_t *ids, uint16_t num_i
     return rval;
 }
 
+static inline uint64_t flowbitMask(uint16_t id)
+{
+    uint8_t b[8];
+    uint64_t m;
+
+    /* same bit boSetBit would set, at its place in the word */
+    memset(b, 0, sizeof(b));
+    b[(id >> 3) & 7] = (uint8_t)(0x80 >> (id & 7));
+    memcpy(&m, b, sizeof(m));
+    return m;
+}
+
+void FlowBitsCompile(FLOWBITS_OP *flowbits)
+{
+    unsigned i, j;
+
+    flowbits->grp = flowbitFindGrp(flowbits->group);
+
+    if (flowbits->masks || !flowbits->num_ids)
+        return;
+
+    flowbits->masks = SnortAlloc(flowbits->num_ids * sizeof(*flowbits->masks));
+
+    for (i = 0; i < flowbits->num_ids; i++)
+    {
+        uint16_t word = flowbits->ids[i] >> 6;
+        uint64_t bit = flowbitMask(flowbits->ids[i]);
+
+        for (j = 0; j < flowbits->num_masks; j++)
+        {
+            if (flowbits->masks[j].word == word)
+                break;
+        }
+        if (j == flowbits->num_masks)
+        {
+            flowbits->masks[j].word = word;
+            flowbits->num_masks++;
+        }
+
+        /* toggling a bit listed twice leaves it as it was */
+        if (flowbits->type == FLOWBITS_TOGGLE)
+            flowbits->masks[j].bits ^= bit;
+        else
+            flowbits->masks[j].bits |= bit;
+    }
+}
+
+/*
+ * checkFlowBits for a compiled option.  Words past the end of the session
+ * bitset can only be there if flowbits_size shrank on reload; the bits in
+ * them are never set.
+ */
+static inline int evalFlowBits(FLOWBITS_OP *flowbits, Packet *p)
+{
+    const FLOWBITS_MASK *m = flowbits->masks;
+    const FLOWBITS_MASK *end = m + flowbits->num_masks;
+    StreamFlowData *flowdata;
+    unsigned num_words;
+    uint64_t *w;
+    int set;
+
+    if ((stream_api == NULL) || (p->ssnptr == NULL))
+        return DETECTION_OPTION_NO_MATCH;
+
+    flowdata = session_api->get_flow_data(p);
+    if(!flowdata)
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_FLOWBITS, "No FLOWBITS_DATA"););
+        return DETECTION_OPTION_NO_MATCH;
+    }
+
+    w = flowbitWords(&flowdata->boFlowbits, &num_words);
+
+    switch (flowbits->type)
+    {
+    case FLOWBITS_SET:
+        for (; m < end; m++)
+        {
+            if (m->word < num_words)
+                w[m->word] |= m->bits;
+        }
+        return DETECTION_OPTION_MATCH;
+
+    case FLOWBITS_SETX:
+        if (!boUnSetGrpBit(&flowdata->boFlowbits, flowbits->grp))
+            return DETECTION_OPTION_NO_MATCH;
+
+        for (; m < end; m++)
+        {
+            if (m->word < num_words)
+                w[m->word] |= m->bits;
+        }
+        return DETECTION_OPTION_MATCH;
+
+    case FLOWBITS_UNSET:
+        if (flowbits->eval == FLOWBITS_ALL)
+        {
+            boUnSetGrpBit(&flowdata->boFlowbits, flowbits->grp);
+            return DETECTION_OPTION_MATCH;
+        }
+        for (; m < end; m++)
+        {
+            if (m->word < num_words)
+                w[m->word] &= ~m->bits;
+        }
+        return DETECTION_OPTION_MATCH;
+
+    case FLOWBITS_RESET:
+        if (!flowbits->group)
+            boResetBITOP(&flowdata->boFlowbits);
+        else
+            boUnSetGrpBit(&flowdata->boFlowbits, flowbits->grp);
+        return DETECTION_OPTION_MATCH;
+
+    case FLOWBITS_TOGGLE:
+        if (flowbits->group)
+        {
+            boToggleGrpBit(&flowdata->boFlowbits, flowbits->grp);
+            return DETECTION_OPTION_MATCH;
+        }
+        for (; m < end; m++)
+        {
+            if (m->word < num_words)
+                w[m->word] ^= m->bits;
+        }
+        return DETECTION_OPTION_MATCH;
+
+    case FLOWBITS_ISSET:
+    case FLOWBITS_ISNOTSET:
+        switch (flowbits->eval)
+        {
+        case FLOWBITS_AND:
+            for (set = 1; set && (m < end); m++)
+            {
+                if ((m->word >= num_words) || ((w[m->word] & m->bits) != m->bits))
+                    set = 0;
+            }
+            break;
+
+        case FLOWBITS_OR:
+            for (set = 0; !set && (m < end); m++)
+            {
+                if ((m->word < num_words) && (w[m->word] & m->bits))
+                    set = 1;
+            }
+            break;
+
+        default:
+            set = issetFlowbitsGrp(&flowdata->boFlowbits, flowbits->eval,
+                flowbits->grp);
+            break;
+        }
+
+        if ((flowbits->type == FLOWBITS_ISSET) ? set : !set)
+            return DETECTION_OPTION_MATCH;
+
+        return DETECTION_OPTION_FAILED_BIT;
+
+    case FLOWBITS_NOALERT:
+        return DETECTION_OPTION_NO_ALERT;
+
+    default:
+        return DETECTION_OPTION_NO_MATCH;
+    }
+}
+
 /****************************************************************************
  *
  * Function: FlowBitsCheck(Packet *, struct _OptTreeNode *, OptFpList *)
@@ -1116,13 +1317,61 @@ int FlowBitsCheck(void *option_data, Packet *p)
 
     PREPROC_PROFILE_START(flowBitsPerfStats);
 
-    rval = checkFlowBits( flowbits->type, (uint8_t)flowbits->eval,
-            flowbits->ids, flowbits->num_ids, flowbits->group, p);
+    rval = evalFlowBits(flowbits, p);
 
     PREPROC_PROFILE_END(flowBitsPerfStats);
     return rval;
 }
 
+unsigned FlowBitsOtnIsset(OptTreeNode *otn, uint16_t *ids, unsigned max)
+{
+    OptFpList *fpl;
+
+    for (fpl = otn->opt_func; fpl != NULL; fpl = fpl->next)
+    {
+        FLOWBITS_OP *flowbits = (FLOWBITS_OP *)fpl->context;
+
+        if ((fpl->OptTestFunc != FlowBitsCheck) || (flowbits == NULL) ||
+            (flowbits->type != FLOWBITS_ISSET) || !flowbits->num_ids)
+            continue;
+
+        /* any one of an and must be set too */
+        if (flowbits->eval == FLOWBITS_AND)
+        {
+            ids[0] = flowbits->ids[0];
+            return 1;
+        }
+
+        if ((flowbits->eval == FLOWBITS_OR) && (flowbits->num_ids <= max))
+        {
+            memcpy(ids, flowbits->ids, flowbits->num_ids * sizeof(*ids));
+            return flowbits->num_ids;
+        }
+    }
+    return 0;
+}
+
+int FlowBitsAnySet(Packet *p, const uint16_t *ids, unsigned num_ids)
+{
+    StreamFlowData *flowdata;
+    unsigned i;
+
+    if ((stream_api == NULL) || (p->ssnptr == NULL))
+        return 0;
+
+    flowdata = session_api->get_flow_data(p);
+
+    if (!flowdata)
+        return 0;
+
+    for (i = 0; i < num_ids; i++)
+    {
+        if (boIsBitSet(&(flowdata->boFlowbits), ids[i]))
+            return 1;
+    }
+    return 0;
+}
+
 /****************************************************************************
  *
  * Function: FlowBitsVerify()
@@ -71,6 +71,17 @@ typedef enum
     FLOWBITS_ALL
 }Flowbits_eval;
 
+/**
+**  The ids of an option compiled into the 64 bit words of the bitset
+**  they fall in, so each word is tested or updated in one operation.
+**  The bits of a word are in the BITOP layout.
+*/
+typedef struct _FLOWBITS_MASK
+{
+    uint16_t word;
+    uint64_t bits;
+} FLOWBITS_MASK;
+
 /**
 **  This structure is the context ptr for each detection option
 **  on a rule.  The id is associated with a FLOWBITS_OBJECT id.
@@ -86,6 +97,11 @@ typedef struct _FLOWBITS_OP
     char *name;
     char *group;
     uint32_t group_id;
+
+    /* filled in by FlowBitsCompile */
+    FLOWBITS_MASK *masks;
+    uint8_t num_masks;
+    struct _FLOWBITS_GRP *grp;
 } FLOWBITS_OP;
 
 typedef struct _FLOWBITS_GRP
@@ -107,6 +123,10 @@ typedef struct _FLOWBITS_GRP
 #define FLOWBITS_SETX      0x80
 
 void processFlowBitsWithGroup(char *flowbitsName, char *groupName, FLOWBITS_OP *flowbits);
+
+/* Resolves the group of an option about to be added to a rule and builds
+ * its masks if that wasn't already done for a duplicate. */
+void FlowBitsCompile(FLOWBITS_OP *flowbits);
 int checkFlowBits( uint8_t type, uint8_t evalType, uint16_t *ids, uint16_t num_ids, char *group, Packet *p);
 
 static inline int FlowBits_SetOperation(void *option_data)
@@ -119,6 +139,14 @@ static inline int FlowBits_SetOperation(void *option_data)
     return 0;
 }
 
+/* Stores up to max flowbit ids, at least one of which must be set for the
+ * rule's isset options to pass, and returns how many; 0 if there are none
+ * or they don't fit. */
+unsigned FlowBitsOtnIsset(struct _OptTreeNode *otn, uint16_t *ids, unsigned max);
+
+/* Returns non-zero if any of ids is set in the packet's session. */
+int FlowBitsAnySet(Packet *p, const uint16_t *ids, unsigned num_ids);
+
 void setFlowbitSize(char *);
 unsigned int getFlowbitSize(void);
 unsigned int getFlowbitSizeInBytes(void);
@@ -78,7 +78,7 @@ void PcreFree(void *d)
 
     free(data->expression);
     free(data->re);
-    free(data->pe);
+    PcreFreeStudy(data->pe);
     free(data);
 }
 
@@ -239,6 +239,133 @@ void PcreCapture(struct _SnortConfig *sc, const void *code, const void *extra)
 
 }
 
+/*
+ * Studies a compiled regex, JIT compiling it when asked to and enabled by
+ * config pcre_jit, and applies the configured match limits unless the
+ * rule overrides them.  Returns NULL if no extra data is needed.
+ */
+pcre_extra *PcreStudy(struct _SnortConfig *sc, const pcre *re,
+    int override_limits, int jit, const char **error)
+{
+    pcre_extra *pe;
+    int study_options = 0;
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+    if (jit && sc->pcre_jit)
+        study_options |= PCRE_STUDY_JIT_COMPILE;
+#endif
+
+    *error = NULL;
+    pe = pcre_study(re, study_options, error);
+
+    if (*error != NULL)
+        return pe;
+
+    if (!override_limits &&
+        ((sc->pcre_match_limit != -1) || (sc->pcre_match_limit_recursion != -1)))
+    {
+        if (pe == NULL)
+            pe = (pcre_extra *)SnortAlloc(sizeof(pcre_extra));
+
+        if (sc->pcre_match_limit != -1)
+        {
+            pe->flags |= PCRE_EXTRA_MATCH_LIMIT;
+            pe->match_limit = sc->pcre_match_limit;
+        }
+
+#ifdef PCRE_EXTRA_MATCH_LIMIT_RECURSION
+        if (sc->pcre_match_limit_recursion != -1)
+        {
+            pe->flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+            pe->match_limit_recursion = sc->pcre_match_limit_recursion;
+        }
+#endif
+    }
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+    if ((pe != NULL) && (pe->flags & PCRE_EXTRA_EXECUTABLE_JIT))
+    {
+        /* The default machine stack JIT code runs on is only 32K, which
+         * deep backtracking rules exhaust quickly.  Packet processing is
+         * single threaded so one stack per configuration is enough. */
+        if (sc->pcre_jit_stack == NULL)
+        {
+            sc->pcre_jit_stack = pcre_jit_stack_alloc(32 * 1024,
+                sc->pcre_jit_stack_size * 1024);
+
+            if (sc->pcre_jit_stack == NULL)
+                FatalError("pcre: unable to allocate a %ld KB JIT stack\n",
+                           sc->pcre_jit_stack_size);
+        }
+        pcre_assign_jit_stack(pe, NULL, (pcre_jit_stack *)sc->pcre_jit_stack);
+    }
+#endif
+
+    return pe;
+}
+
+void PcreFreeStudy(pcre_extra *pe)
+{
+    if (pe == NULL)
+        return;
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+    /* also releases any JIT code; handles the extra blocks we allocated
+     * ourselves for match limits since those have no study data */
+    pcre_free_study(pe);
+#else
+    free(pe);
+#endif
+}
+
+void PcreFreeJitStack(struct _SnortConfig *sc)
+{
+#ifdef PCRE_STUDY_JIT_COMPILE
+    if (sc->pcre_jit_stack != NULL)
+        pcre_jit_stack_free((pcre_jit_stack *)sc->pcre_jit_stack);
+#endif
+    sc->pcre_jit_stack = NULL;
+}
+
+/* For rule profiling: "yes" if every pcre option of the rule runs JIT
+ * code, "partial" if only some do, "no" if none do and "-" if the rule
+ * has no pcre option. */
+const char *PcreJitStatus(struct _OptTreeNode *otn)
+{
+    OptFpList *fpl;
+    int total = 0, jitted = 0;
+
+    for (fpl = otn->opt_func; fpl != NULL; fpl = fpl->next)
+    {
+        PcreData *pcre_data;
+
+        if (fpl->type != RULE_OPTION_TYPE_PCRE)
+            continue;
+
+        pcre_data = (PcreData *)fpl->context;
+        total++;
+
+#ifdef PCRE_INFO_JIT
+        {
+            int jit = 0;
+
+            if ((pcre_fullinfo(pcre_data->re, pcre_data->pe, PCRE_INFO_JIT, &jit) == 0) && jit)
+                jitted++;
+        }
+#else
+        (void)pcre_data;
+#endif
+    }
+
+    if (total == 0)
+        return "-";
+
+    if (jitted == total)
+        return "yes";
+
+    return jitted ? "partial" : "no";
+}
+
 void SnortPcreInit(struct _SnortConfig *sc, char *data, OptTreeNode *otn, int protocol)
 {
     PcreData *pcre_data;
@@ -269,7 +396,7 @@ void SnortPcreInit(struct _SnortConfig *sc, char *data, OptTreeNode *otn, int pr
         if (pcre_data->expression)
             free(pcre_data->expression);
         if (pcre_data->pe)
-            free(pcre_data->pe);
+            PcreFreeStudy(pcre_data->pe);
         if (pcre_data->re)
             free(pcre_data->re);
 
@@ -434,59 +561,8 @@ void SnortPcreParse(struct _SnortConfig *sc, char *data, PcreData *pcre_data, Op
 
 
     /* now study it... */
-    pcre_data->pe = pcre_study(pcre_data->re, 0, &error);
-
-    if (pcre_data->pe)
-    {
-        if ((ScPcreMatchLimit() != -1) && !(pcre_data->options & SNORT_OVERRIDE_MATCH_LIMIT))
-        {
-            if (pcre_data->pe->flags & PCRE_EXTRA_MATCH_LIMIT)
-            {
-                pcre_data->pe->match_limit = ScPcreMatchLimit();
-            }
-            else
-            {
-                pcre_data->pe->flags |= PCRE_EXTRA_MATCH_LIMIT;
-                pcre_data->pe->match_limit = ScPcreMatchLimit();
-            }
-        }
-
-#ifdef PCRE_EXTRA_MATCH_LIMIT_RECURSION
-        if ((ScPcreMatchLimitRecursion() != -1) && !(pcre_data->options & SNORT_OVERRIDE_MATCH_LIMIT))
-        {
-            if (pcre_data->pe->flags & PCRE_EXTRA_MATCH_LIMIT_RECURSION)
-            {
-                pcre_data->pe->match_limit_recursion = ScPcreMatchLimitRecursion();
-            }
-            else
-            {
-                pcre_data->pe->flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
-                pcre_data->pe->match_limit_recursion = ScPcreMatchLimitRecursion();
-            }
-        }
-#endif
-    }
-    else
-    {
-        if (!(pcre_data->options & SNORT_OVERRIDE_MATCH_LIMIT) &&
-             ((ScPcreMatchLimit() != -1) || (ScPcreMatchLimitRecursion() != -1)))
-        {
-            pcre_data->pe = (pcre_extra *)SnortAlloc(sizeof(pcre_extra));
-            if (ScPcreMatchLimit() != -1)
-            {
-                pcre_data->pe->flags |= PCRE_EXTRA_MATCH_LIMIT;
-                pcre_data->pe->match_limit = ScPcreMatchLimit();
-            }
-
-#ifdef PCRE_EXTRA_MATCH_LIMIT_RECURSION
-            if (ScPcreMatchLimitRecursion() != -1)
-            {
-                pcre_data->pe->flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
-                pcre_data->pe->match_limit_recursion = ScPcreMatchLimitRecursion();
-            }
-#endif
-        }
-    }
+    pcre_data->pe = PcreStudy(sc, pcre_data->re,
+        pcre_data->options & SNORT_OVERRIDE_MATCH_LIMIT, 1, &error);
 
     if(error != NULL)
     {
@@ -629,6 +705,23 @@ static int pcre_search(const PcreData *pcre_data,
     {
         matched = 0;
     }
+    else if((result == PCRE_ERROR_MATCHLIMIT)
+#ifdef PCRE_ERROR_RECURSIONLIMIT
+            || (result == PCRE_ERROR_RECURSIONLIMIT)
+#endif
+#ifdef PCRE_ERROR_JIT_STACKLIMIT
+            || (result == PCRE_ERROR_JIT_STACKLIMIT)
+#endif
+           )
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_PATTERN_MATCH, "pcre_exec limit hit : %d \n", result););
+        pc.pcre_limit++;
+
+        /* the search was given up so neither sense of the match is known;
+         * the policy decides whether the rest of the rule gets a chance.
+         * The detection pointer is left where it was either way. */
+        return (ScPcreMatchLimitPolicy() == PCRE_MATCH_LIMIT_POLICY__MATCH);
+    }
     else
     {
         DEBUG_WRAP(DebugMessage(DEBUG_PATTERN_MATCH, "pcre_exec error : %d \n", result););
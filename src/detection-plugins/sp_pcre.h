@@ -60,6 +60,10 @@ typedef struct _PcreData
 } PcreData;
 
 void PcreCapture(struct _SnortConfig *sc, const void *code, const void *extra);
+pcre_extra *PcreStudy(struct _SnortConfig *sc, const pcre *re, int override_limits, int jit, const char **error);
+void PcreFreeStudy(pcre_extra *pe);
+void PcreFreeJitStack(struct _SnortConfig *sc);
+const char *PcreJitStatus(struct _OptTreeNode *otn);
 void PcreFree(void *d);
 uint32_t PcreHash(void *d);
 int PcreCompare(void *l, void *r);
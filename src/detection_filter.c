@@ -43,6 +43,7 @@
 #endif
 
 static SFXHASH *detection_filter_hash = NULL;
+static SF_TWHEEL *detection_filter_wheel = NULL;
 
 DetectionFilterConfig * DetectionFilterConfigNew(void)
 {
@@ -71,6 +72,9 @@ void detection_filter_cleanup(void)
 
     sfxhash_delete(detection_filter_hash);
     detection_filter_hash = NULL;
+
+    sftwheel_free(detection_filter_wheel);
+    detection_filter_wheel = NULL;
 }
 
 /*
@@ -113,7 +117,7 @@ int detection_filter_test (
     if (pv == NULL)
         return 0;
 
-    return sfthd_test_rule(detection_filter_hash, (THD_NODE*)pv,
+    return sfthd_test_rule(detection_filter_hash, detection_filter_wheel, (THD_NODE*)pv,
                            sip, dip, curtime);
 }
 
@@ -140,6 +144,8 @@ void * detection_filter_create(DetectionFilterConfig *df_config, THDX_STRUCT *th
         detection_filter_hash = sfthd_local_new(df_config->memcap);
         if (detection_filter_hash == NULL)
             return NULL;
+
+        detection_filter_wheel = sfthd_new_wheel(detection_filter_hash);
     }
 
     df_config->count++;
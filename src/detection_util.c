@@ -41,6 +41,8 @@ uint8_t doe_buf_flags;
 uint16_t detect_flags;
 
 uint32_t http_mask;
+uint32_t http_pending;
+HttpBufferResolver http_resolver;
 HttpBuffer http_buffer[HTTP_BUFFER_MAX];
 
 DataPointer DetectBuffer;
@@ -63,6 +65,20 @@ const char* http_buffer_name[HTTP_BUFFER_MAX] =
     "http_raw_cookie",
 };
 
+const HttpBuffer* ResolveHttpBuffer (HTTP_BUFFER b)
+{
+    http_resolver(b);
+
+    if ( (1 << b) & http_pending )
+    {
+        /* the resolver had nothing for it after all */
+        http_pending &= ~(1 << b);
+        http_mask &= ~(1 << b);
+        return NULL;
+    }
+    return http_buffer + b;
+}
+
 static const char* rule_type[RULE_TYPE__MAX] = {
     "none", "activate", "alert", "drop", "dynamic",
     "log", "pass", "reject", "sdrop"
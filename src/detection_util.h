@@ -89,6 +89,9 @@ typedef struct
     uint32_t encode_type;
 } HttpBuffer;
 
+/* Fills in a pending buffer (see SetHttpBufferPending) or leaves it out. */
+typedef void (*HttpBufferResolver)(HTTP_BUFFER);
+
 typedef struct {
     const uint8_t *data;
     uint16_t len;
@@ -113,6 +116,8 @@ extern void *global_ssl_callback;
 extern uint16_t detect_flags;
 
 extern uint32_t http_mask;
+extern uint32_t http_pending;
+extern HttpBufferResolver http_resolver;
 extern HttpBuffer http_buffer[HTTP_BUFFER_MAX];
 extern const char* http_buffer_name[HTTP_BUFFER_MAX];
 
@@ -120,9 +125,12 @@ extern DataPointer DetectBuffer;
 extern DataPointer file_data_ptr;
 extern DataBuffer DecodeBuffer;
 
+const HttpBuffer* ResolveHttpBuffer(HTTP_BUFFER);
+
 static inline void ClearHttpBuffers (void)
 {
     http_mask = 0;
+    http_pending = 0;
 }
 
 static inline uint32_t GetHttpBufferMask (void)
@@ -135,6 +143,9 @@ static inline const HttpBuffer* GetHttpBuffer (HTTP_BUFFER b)
     if ( !((1 << b) & http_mask) )
         return NULL;
 
+    if ( (1 << b) & http_pending )
+        return ResolveHttpBuffer(b);
+
     return http_buffer + b;
 }
 
@@ -148,6 +159,7 @@ static inline void SetHttpBufferEncoding (
     hb->length = len;
     hb->encode_type = enc;
     http_mask |= (1 << b);
+    http_pending &= ~(1 << b);
 }
 
 static inline void SetHttpBuffer (HTTP_BUFFER b, const uint8_t* buf, unsigned len)
@@ -155,6 +167,22 @@ static inline void SetHttpBuffer (HTTP_BUFFER b, const uint8_t* buf, unsigned le
     SetHttpBufferEncoding(b, buf, len, 0);
 }
 
+/*
+ * Marks b as present without filling it in, for buffers that are costly
+ * to build and often not looked at.  The first GetHttpBuffer(b) calls
+ * resolve, which must set b (or may leave it out); until then b counts
+ * in GetHttpBufferMask().  Pending buffers are dropped by ClearHttpBuffers
+ * so resolve only has to stay valid for the current packet.
+ */
+static inline void SetHttpBufferPending (HTTP_BUFFER b, HttpBufferResolver resolve)
+{
+    assert(b < HTTP_BUFFER_MAX && resolve);
+
+    http_resolver = resolve;
+    http_mask |= (1 << b);
+    http_pending |= (1 << b);
+}
+
 #define SetDetectLimit(pktPtr, altLen) \
 { \
     pktPtr->alt_dsize = altLen; \
@@ -53,7 +53,6 @@ extern void ParsePattern(char *, OptTreeNode *, int);
 extern void ParseProtectedPattern(char *, OptTreeNode *, int);
 extern void *pcreCompile(const char *pattern, int options, const char **errptr,
     int *erroffset, const unsigned char *tableptr);
-extern void *pcreStudy(const void *code, int options, const char **errptr);
 
 extern int SnortPcre(void *option_data, Packet *p);
 extern int FlowBitsCheck(void *option_data, Packet *p);
@@ -538,9 +537,13 @@ static int ConvertPcreOption(SnortConfig *sc, Rule *rule, int index, OptTreeNode
         return -1;
     }
 
-    pcre_data->pe = pcreStudy(
+    /* The converted option is matched by SnortPcre, not the SO rule, so
+     * it owns its study data and can run JIT code. */
+    pcre_data->pe = PcreStudy(
+        sc,
         pcre_data->re,
-        pcre_info->compile_flags,
+        pcre_info->compile_flags & SNORT_PCRE_OVERRIDE_MATCH_LIMIT,
+        1,
         &error
         );
 
@@ -582,7 +585,7 @@ static int ConvertPcreOption(SnortConfig *sc, Rule *rule, int index, OptTreeNode
         if (pcre_data->expression)
             free(pcre_data->expression);
         if (pcre_data->pe)
-            free(pcre_data->pe);
+            PcreFreeStudy(pcre_data->pe);
         if (pcre_data->re)
             free(pcre_data->re);
 
@@ -631,6 +634,8 @@ static int ConvertFlowbitOption(SnortConfig *sc, Rule *rule, int index, OptTreeN
         flowbits = idx_dup;
     }
 
+    FlowBitsCompile(flowbits);
+
     /* Add detection function to otn */
     fpl = AddOptFuncToList(FlowBitsCheck, otn);
     fpl->type = RULE_OPTION_TYPE_FLOWBIT;
@@ -1194,64 +1194,10 @@ void *pcreCompile(const char *pattern, int options, const char **errptr, int *er
 
 void *pcreStudy(const void *code, int options, const char **errptr)
 {
-    pcre_extra *extra_extra;
-    int snort_options = options & SNORT_PCRE_OVERRIDE_MATCH_LIMIT;
-
-    extra_extra = pcre_study((const pcre*)code, 0, errptr);
-
-    if (extra_extra)
-    {
-        if ((ScPcreMatchLimit() != -1) && !(snort_options & SNORT_PCRE_OVERRIDE_MATCH_LIMIT))
-        {
-            if (extra_extra->flags & PCRE_EXTRA_MATCH_LIMIT)
-            {
-                extra_extra->match_limit = ScPcreMatchLimit();
-            }
-            else
-            {
-                extra_extra->flags |= PCRE_EXTRA_MATCH_LIMIT;
-                extra_extra->match_limit = ScPcreMatchLimit();
-            }
-        }
-
-#ifdef PCRE_EXTRA_MATCH_LIMIT_RECURSION
-        if ((ScPcreMatchLimitRecursion() != -1) && !(snort_options & SNORT_PCRE_OVERRIDE_MATCH_LIMIT))
-        {
-            if (extra_extra->flags & PCRE_EXTRA_MATCH_LIMIT_RECURSION)
-            {
-                extra_extra->match_limit_recursion = ScPcreMatchLimitRecursion();
-            }
-            else
-            {
-                extra_extra->flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
-                extra_extra->match_limit_recursion = ScPcreMatchLimitRecursion();
-            }
-        }
-#endif
-    }
-    else
-    {
-        if (!(snort_options & SNORT_PCRE_OVERRIDE_MATCH_LIMIT) &&
-            ((ScPcreMatchLimit() != -1) || (ScPcreMatchLimitRecursion() != -1)))
-        {
-            extra_extra = (pcre_extra *)SnortAlloc(sizeof(pcre_extra));
-            if (ScPcreMatchLimit() != -1)
-            {
-                extra_extra->flags |= PCRE_EXTRA_MATCH_LIMIT;
-                extra_extra->match_limit = ScPcreMatchLimit();
-            }
-
-#ifdef PCRE_EXTRA_MATCH_LIMIT_RECURSION
-            if (ScPcreMatchLimitRecursion() != -1)
-            {
-                extra_extra->flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
-                extra_extra->match_limit_recursion = ScPcreMatchLimitRecursion();
-            }
-#endif
-        }
-    }
-
-    return extra_extra;
+    /* SO rules free the study data themselves with free(), so their
+     * expressions are never JIT compiled. */
+    return (void *)PcreStudy(snort_conf, (const pcre *)code,
+        options & SNORT_PCRE_OVERRIDE_MATCH_LIMIT, 0, errptr);
 }
 
 /* pcreOvectorInfo
@@ -1467,6 +1413,22 @@ int DynamicProfilingPreprocs(void)
 #endif
 }
 
+int DynamicProfilingPreprocCounters(void)
+{
+#ifdef PERF_PROFILING
+    return ScProfilePreprocCounters();
+#else
+    return 0;
+#endif
+}
+
+void DynamicPerfCountersRead(struct _PerfCounters *pc)
+{
+#ifdef PERF_PROFILING
+    PerfCountersRead(pc);
+#endif
+}
+
 int DynamicPreprocess(void *packet)
 {
     return Preprocess( ( Packet * ) packet );
@@ -2547,6 +2509,8 @@ int InitDynamicPreprocessors(void)
     preprocData.isTestMode = &DynamicIsTestMode;
 
     preprocData.getCurrentSnortConfig = GetCurrentSnortConfig;
+    preprocData.profilingPreprocCountersFunc = &DynamicProfilingPreprocCounters;
+    preprocData.perfCountersRead = &DynamicPerfCountersRead;
     return InitDynamicPreprocessorPlugins(&preprocData);
 }
 
@@ -2929,6 +2893,9 @@ int InitDynamicSideChannelPlugins(void)
             return -1;
         }
 
+        /* It has the TX functions and may call them from its own threads. */
+        SideChannelAddSharedTXProducer();
+
         plugin = plugin->next;
     }
 
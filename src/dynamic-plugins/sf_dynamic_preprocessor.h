@@ -52,10 +52,18 @@
 #undef PROFILING_PREPROCS
 #endif
 #define PROFILING_PREPROCS _dpd.profilingPreprocsFunc()
+#ifdef PROFILING_PREPROC_COUNTERS
+#undef PROFILING_PREPROC_COUNTERS
+#endif
+#define PROFILING_PREPROC_COUNTERS _dpd.profilingPreprocCountersFunc()
+#ifdef PERF_COUNTERS_READ
+#undef PERF_COUNTERS_READ
+#endif
+#define PERF_COUNTERS_READ(pc) _dpd.perfCountersRead(pc)
 #endif
 #endif
 
-#define PREPROCESSOR_DATA_VERSION 12
+#define PREPROCESSOR_DATA_VERSION 13
 
 #include "sf_dynamic_common.h"
 #include "sf_dynamic_engine.h"
@@ -119,6 +127,7 @@ typedef void (*TokenFreeFunc)(char ***, int);
 typedef void (*PreprocStatsNodeFreeFunc)(struct _PreprocStats *stats);
 typedef void (*AddPreprocProfileFunc)(const char *, void *, int, void *, PreprocStatsNodeFreeFunc freefn);
 typedef int (*ProfilingFunc)(void);
+typedef void (*PerfCountersReadFunc)(struct _PerfCounters *);
 typedef int (*PreprocessFunc)(void *);
 typedef void (*PreprocStatsRegisterFunc)(const char *, void (*pp_stats_func)(int));
 typedef void (*AddPreprocReset)(void (*pp_rst_func) (int, void *), void *arg, uint16_t, uint32_t);
@@ -526,6 +535,8 @@ typedef struct _DynamicPreprocessorData
     ReadModeFunc isReadMode;
     IsTestModeFunc isTestMode;
     GetCurrentSnortConfigFunc getCurrentSnortConfig;
+    ProfilingFunc profilingPreprocCountersFunc;
+    PerfCountersReadFunc perfCountersRead;
 } DynamicPreprocessorData;
 
 /* Function prototypes for Dynamic Preprocessor Plugins */
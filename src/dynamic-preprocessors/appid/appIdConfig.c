@@ -108,6 +108,22 @@ void appIdConfigParse(char *args)
             if (appidStaticConfig.memcap == 0)
                 appidStaticConfig.memcap = APP_ID_MEMCAP_LOWER_BOUND;
         }
+        else if(!strcasecmp(stoks[0], "shared_service_cache"))
+        {
+            unsigned long mb;
+
+            if (!stoks[1])
+            {
+                _dpd.fatalMsg("%s(%d) => %s\n", *(_dpd.config_file), *(_dpd.config_line), "Invalid shared_service_cache");
+            }
+
+            mb = strtoul(stoks[1], &endPtr, 10);
+            if (!*stoks[1] || *endPtr || mb > 4095)
+            {
+                _dpd.fatalMsg("%s(%d) => %s\n", *(_dpd.config_file), *(_dpd.config_line), "Invalid shared_service_cache, 0 to 4095 MB");
+            }
+            appidStaticConfig.shared_service_cache = mb << 20;
+        }
         else if(!strcasecmp(stoks[0], "app_stats_filename"))
         {
             if (!stoks[1] || strlen(stoks[1]) >= sizeof(appidStaticConfig.app_stats_filename))
@@ -229,6 +245,8 @@ void appIdConfigDump(void)
     _dpd.logMsg("    appStats Period:        %d secs\n", appidStaticConfig.app_stats_period);
     _dpd.logMsg("    appStats Rollover Size: %d bytes\n", appidStaticConfig.app_stats_rollover_size);
     _dpd.logMsg("    appStats Rollover time: %d secs\n", appidStaticConfig.app_stats_rollover_time);
+    if (appidStaticConfig.shared_service_cache)
+        _dpd.logMsg("    Shared Service Cache:   %lu MB\n", appidStaticConfig.shared_service_cache >> 20);
     _dpd.logMsg("\n");
 }
 
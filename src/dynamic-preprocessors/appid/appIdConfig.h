@@ -105,6 +105,7 @@ struct AppidStaticConfig
     unsigned long app_stats_rollover_time;
     char app_id_detector_path[PATH_MAX];
     unsigned long memcap;
+    unsigned long shared_service_cache;   /* bytes, 0 if service state is not shared */
     int app_id_dump_ports;
     int app_id_debug;
     uint32_t instance_id;
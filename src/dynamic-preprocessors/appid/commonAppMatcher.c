@@ -1033,6 +1033,7 @@ int AppIdCommonInit(tAppidStaticConfig *config)
 #endif
         if (AppIdServiceStateInit(appidStaticConfig.memcap))
             exit(-1);
+        AppIdSharedServiceStateInit(appidStaticConfig.shared_service_cache);
         rnaFwConfigState = RNA_FW_CONFIG_STATE_INIT;
         return 0;
     }
@@ -1054,6 +1055,7 @@ int AppIdCommonFini(void)
         luaModuleFini();
         hostPortAppCacheFini(pAppidActiveConfig);
         AppIdServiceStateCleanup();
+        AppIdSharedServiceStateFini();
         appIdStatsFini();
         fwAppIdFini(pAppidActiveConfig);
         http_detector_clean(&pAppidActiveConfig->detectorHttpConfig);
@@ -1146,6 +1148,9 @@ void *AppIdCommonReloadSwap(void *swap_config)
     appIdPolicyId++;
     pAppidPassiveConfig = NULL;
 
+    /* services shared by other instances were found by the old detectors */
+    AppIdSharedServiceStateFlush();
+
     // Return old configuration data structure
     pAppidOldConfig = pAppidActiveConfig;
     // Make new configuration the active configuration
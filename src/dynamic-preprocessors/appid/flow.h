@@ -236,6 +236,10 @@ typedef struct AppIdData
     SF_LIST * candidate_service_list;
     unsigned int num_candidate_services_tried;
     int got_incompatible_services;
+    /**first payload byte and length in each direction, for ranking */
+    uint8_t  first_payload_seen;
+    uint8_t  first_payload_byte[2];
+    uint16_t first_payload_size[2];
 
     /**AppId matching client side */
     tAppId clientAppId;
@@ -68,6 +68,18 @@ tAppId lengthAppCacheFind(const tLengthKey *key, const tAppIdConfig *pConfig)
     }
 }
 
+unsigned lengthAppCacheBucket(uint16_t length)
+{
+    unsigned bucket = 0;
+
+    while (length && (bucket < LENGTH_BUCKET_CNT - 1))
+    {
+        length >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
 int lengthAppCacheAdd(const tLengthKey *key, tAppId val, tAppIdConfig *pConfig)
 {
     if (sfxhash_add(pConfig->lengthCache, (void *)key, (void *)&val))
@@ -26,6 +26,10 @@
 
 #define LENGTH_SEQUENCE_CNT_MAX (5)
 
+/* Coarse (log2) payload length classes; the service detectors learn which
+ * classes their first payloads fall in to rank brute force candidates. */
+#define LENGTH_BUCKET_CNT (16)
+
 #pragma pack(1)
 
 // Forward declaration for AppId config. Cannot include appIdConfig.h because of
@@ -48,5 +52,6 @@ void lengthAppCacheInit(struct appIdConfig_ *pConfig);
 void lengthAppCacheFini(struct appIdConfig_ *pConfig);
 tAppId lengthAppCacheFind(const tLengthKey *key, const struct appIdConfig_ *pConfig);
 int lengthAppCacheAdd(const tLengthKey *key, tAppId val, struct appIdConfig_ *pConfig);
+unsigned lengthAppCacheBucket(uint16_t length);
 
 #endif
@@ -38,6 +38,7 @@
 #include "luaDetectorModule.h"
 #include "luaDetectorApi.h"
 #include "luaDetectorFlowApi.h"
+#include "luaDetectorLower.h"
 #include <pcre.h>
 #include "httpCommon.h"
 #include "sf_multi_mpse.h"
@@ -51,6 +52,7 @@
 #include "detector_dns.h"
 #include "app_forecast.h"
 #include "detector_pattern.h"
+#include "cpuclock.h"
 
 #define DETECTOR "Detector"
 #define OVECCOUNT 30    /* should be a multiple of 3 */
@@ -227,6 +229,7 @@ void freeDetector(Detector *detector)
 
     free(detector->name);
     free(detector->validatorBuffer);
+    luaFreeLoweredValidator(detector->serverLowered);
 
 #ifdef LUA_DETECTOR_DEBUG
     _dpd.debugMsg(DEBUG_LOG,"Detector %p: freed\n\n",detector);
@@ -322,6 +325,8 @@ static int service_init(lua_State *L)
     if (!detector->server.serviceModule.name)
         storeLuaString(pServiceName, (char **)&detector->server.serviceModule.name);
     storeLuaString(pValidator, &detector->packageInfo.server.validateFunctionName);
+    luaFreeLoweredValidator(detector->serverLowered);
+    detector->serverLowered = NULL;
     storeLuaString(pFini, &detector->packageInfo.server.cleanFunctionName);
 
     /*create a ServiceElement */
@@ -544,6 +549,18 @@ static int service_analyzePayload(
     return 1;
 }
 
+static inline void chargeValidateTicks(Detector *detector, uint64_t start)
+{
+    uint64_t ticks;
+
+    get_clockticks(ticks);
+    ticks -= start;
+    detector->validateCalls++;
+    detector->validateTicks += ticks;
+    if (ticks > detector->validateMaxTicks)
+        detector->validateMaxTicks = ticks;
+}
+
 /**Design notes: Due to following two design limitations:
  * a. lua validate functions, known only at runtime, can not be wrapped inside unique
  *    C functions at runtime and
@@ -569,6 +586,7 @@ int validateAnyService(
     int retValue;
     lua_State *myLuaState = NULL;
     const char *serverName;
+    uint64_t start;
     PROFILE_VARS;
 #ifdef PERF_PROFILING
     PreprocStats *pPerfStats1;
@@ -613,13 +631,28 @@ int validateAnyService(
         return SERVICE_ENULL;
     }
 
+    if (detector->serverLowered)
+    {
+        get_clockticks(start);
+        retValue = luaRunLoweredValidator(detector->serverLowered, detector);
+        chargeValidateTicks(detector, start);
+        detector->validateParams.pkt = NULL;
+        PREPROC_PROFILE_END((*pPerfStats2));
+        PREPROC_PROFILE_END((*pPerfStats1));
+        PREPROC_PROFILE_END(luaDetectorsPerfStats);
+        return retValue;
+    }
+
     lua_getglobal(myLuaState, detector->packageInfo.server.validateFunctionName);
 
 #ifdef LUA_DETECTOR_DEBUG
     _dpd.debugMsg(DEBUG_LOG,"server %s: Lua Memory usage %d\n",serverName, lua_gc(myLuaState, LUA_GCCOUNT,0));
     _dpd.debugMsg(DEBUG_LOG,"server %s: validating\n",serverName);
 #endif
-    if (lua_pcall(myLuaState, 0, 1, 0 ))
+    get_clockticks(start);
+    retValue = lua_pcall(myLuaState, 0, 1, 0);
+    chargeValidateTicks(detector, start);
+    if (retValue)
     {
         /*Runtime Lua errors are suppressed in production code since detectors are written for efficiency */
         /*and with defensive minimum checks. Errors are dealt as exceptions that dont impact processing */
@@ -930,6 +963,8 @@ static int service_setValidator(
         lua_pushnumber(L, -1);
         return 1;
     }
+    luaFreeLoweredValidator(detector->serverLowered);
+    detector->serverLowered = NULL;
 
     lua_pushnumber(L, 0);
     return 1;
@@ -1486,6 +1521,7 @@ int validateAnyClientApp(
     lua_State *myLuaState;
     char *validateFn;
     char *clientName;
+    uint64_t start;
     PROFILE_VARS;
 #ifdef PERF_PROFILING
     PreprocStats *pPerfStats1;
@@ -1533,7 +1569,10 @@ int validateAnyClientApp(
     _dpd.debugMsg(DEBUG_LOG,"client %s: Lua Memory usage %d\n",clientName, lua_gc(myLuaState, LUA_GCCOUNT,0));
     _dpd.debugMsg(DEBUG_LOG,"client %s: validating\n",clientName);
 #endif
-    if (lua_pcall(myLuaState, 0, 1, 0 ))
+    get_clockticks(start);
+    retValue = lua_pcall(myLuaState, 0, 1, 0);
+    chargeValidateTicks(detector, start);
+    if (retValue)
     {
         _dpd.errMsg("client %s: error validating %s\n",clientName, lua_tostring(myLuaState, -1));
         detector->validateParams.pkt = NULL;
@@ -120,12 +120,22 @@ typedef struct _Detector
 
     unsigned detector_version;
     char *validatorBuffer;
+    unsigned validatorBufferLen;
     unsigned char digest[16];
 
     tAppIdConfig *pAppidActiveConfig;     ///< AppId context in which this detector should be used; used during packet processing
     tAppIdConfig *pAppidOldConfig;        ///< AppId context in which this detector should be cleaned; used at reload free and exit
     tAppIdConfig *pAppidNewConfig;        ///< AppId context in which this detector should be loaded; used at initialization and reload
 
+    /**CPU spent in the Lua validator, in clock ticks. Kept with or without
+     * PERF_PROFILING so expensive detectors can be found in production. */
+    uint64_t validateCalls;
+    uint64_t validateTicks;
+    uint64_t validateMaxTicks;
+
+    /**Server validator lowered to native code after init, NULL if it runs in Lua. */
+    struct _LuaLoweredValidator *serverLowered;
+
 #ifdef PERF_PROFILING
     /**Snort profiling stats for individual Lua detector.*/
     struct _PreprocStats *pPerfStats;
@@ -0,0 +1,1613 @@
+/*
+** Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+** Copyright (C) 2005-2013 Sourcefire, Inc.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/** @defgroup LuaDetectorLower LuaDetectorLower
+ * Lowers declarative Lua server validators into native matchers.
+ *
+ * Most detectors register their patterns and ports from the init function
+ * and keep a validator that only checks the packet size, direction or ports
+ * and compares a few bytes at fixed offsets before reporting the service.
+ * Running those through lua_pcall costs far more than the checks.  After
+ * init, the validator's source is parsed against that small subset of Lua:
+ *
+ *   local NAME = EXPR
+ *   if COND then BLOCK {elseif COND then BLOCK} [else BLOCK] end
+ *   return EXPR
+ *   [return] D:addService(EXPR [, STRING [, STRING]]) and its service_ alias
+ *   [return] D:failService(), D:inProcessService(), D:inCompatibleData()
+ *
+ * where EXPR is made of numbers, +, -, #STRING, the packet getters
+ * D:getPacketSize(), getPacketDir(), getPktSrcPort(), getPktDstPort(),
+ * D:memcmp() or matchSimplePattern() with a constant pattern and length,
+ * comparisons, and, or, not, and constants read from globals or upvalues
+ * (gPatterns.init[1]) as they are after init.  D must be the detector
+ * object.  Anything else, including calls into other Lua functions, keeps
+ * the detector in Lua.
+ *
+ * The global holding the validator must be the function parsed here, which
+ * is checked against the line Lua recorded for it.  Detectors that also
+ * have a client validator stay in Lua since it may change those constants.
+ *@{
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "luaDetectorLower.h"
+#include "service_base.h"
+#include "fw_appid.h"
+
+#define LOWER_MAX_NODES   512
+#define LOWER_MAX_LOCALS  32
+#define LOWER_MAX_DEPTH   32
+#define LOWER_MAX_STRING  1024
+
+/*tokens, single character operators are their own character */
+enum
+{
+    TK_EOF = 256,
+    TK_ERROR,
+    TK_NAME,
+    TK_NUMBER,
+    TK_STRING,
+    TK_EQ,
+    TK_NE,
+    TK_LE,
+    TK_GE,
+    TK_CONCAT,
+    TK_DOTS
+};
+
+typedef enum
+{
+    LN_NUMBER,
+    LN_BOOLEAN,
+    LN_STRING,
+    LN_NIL,
+    LN_LOCAL,
+    LN_SIZE,
+    LN_DIR,
+    LN_SRC_PORT,
+    LN_DST_PORT,
+    LN_MEMCMP,
+    LN_ADD,
+    LN_SUB,
+    LN_NEG,
+    LN_EQ,
+    LN_NE,
+    LN_LT,
+    LN_LE,
+    LN_GT,
+    LN_GE,
+    LN_AND,
+    LN_OR,
+    LN_NOT,
+
+    /*service calls, numbers like the Lua functions return */
+    LN_ADD_SERVICE,
+    LN_FAIL_SERVICE,
+    LN_IN_PROCESS,
+    LN_INCOMPATIBLE,
+
+    /*statements */
+    LN_SET_LOCAL,
+    LN_IF,
+    LN_RETURN
+} LowerOp;
+
+/*What an expression yields.  LT_COND is an and/or/not over operands that are
+ * not all booleans; Lua would yield one of the operands, so only its truth is
+ * known and it may only be tested. */
+typedef enum
+{
+    LT_NUMBER,
+    LT_BOOLEAN,
+    LT_COND,
+    LT_STRING,
+    LT_NIL,
+    LT_STATEMENT
+} LowerType;
+
+typedef struct _LowerNode
+{
+    uint8_t op;
+    uint8_t type;
+    uint8_t slot;
+    double num;
+    char *str;                  /*pattern, or vendor for addService */
+    size_t strLen;
+    char *version;
+    struct _LowerNode *a;       /*operands, or condition and branches */
+    struct _LowerNode *b;
+    struct _LowerNode *c;
+    struct _LowerNode *next;    /*next statement of the block */
+} LowerNode;
+
+struct _LuaLoweredValidator
+{
+    LowerNode *body;
+    unsigned numNodes;
+    unsigned numLocals;
+    LowerNode nodes[];
+};
+
+typedef struct
+{
+    const char *p;
+    const char *end;
+    int line;
+
+    int tok;
+    int tokLine;
+    const char *name;
+    size_t nameLen;
+    double num;
+    char str[LOWER_MAX_STRING];
+    size_t strLen;
+} LowerLexer;
+
+typedef struct
+{
+    char name[64];
+    uint8_t slot;
+    uint8_t type;
+} LowerLocal;
+
+typedef struct
+{
+    LowerLexer lex;
+    LowerNode *nodes;
+    unsigned numNodes;
+    unsigned numLocals;
+    Detector *detector;
+    lua_State *L;
+    int funcIndex;
+    int depth;
+    int failed;
+    unsigned numScoped;
+    LowerLocal scoped[LOWER_MAX_LOCALS];
+} LowerParser;
+
+/*------------------------------------------------------------------------
+ * lexer
+ *------------------------------------------------------------------------*/
+
+static int lowerLongBracket(
+        LowerLexer *lex
+        )
+{
+    const char *p = lex->p;
+    int level = 0;
+
+    if (p >= lex->end || *p != '[')
+        return -1;
+    for (p++; p < lex->end && *p == '='; p++)
+        level++;
+    if (p >= lex->end || *p != '[')
+        return -1;
+    lex->p = p + 1;
+    return level;
+}
+
+/*Skips to the close of a long bracket, copying the contents if keep is set. */
+static int lowerLongString(
+        LowerLexer *lex,
+        int level,
+        int keep
+        )
+{
+    const char *p = lex->p;
+
+    lex->strLen = 0;
+    if (p < lex->end && *p == '\r')
+        p++;
+    if (p < lex->end && *p == '\n')
+    {
+        lex->line++;
+        p++;
+    }
+    for (; p < lex->end; p++)
+    {
+        if (*p == ']')
+        {
+            const char *q = p + 1;
+            int l = 0;
+
+            while (q < lex->end && *q == '=')
+                q++, l++;
+            if (l == level && q < lex->end && *q == ']')
+            {
+                lex->p = q + 1;
+                return 0;
+            }
+        }
+        if (*p == '\n')
+            lex->line++;
+        if (keep)
+        {
+            if (lex->strLen >= sizeof(lex->str))
+                return -1;
+            lex->str[lex->strLen++] = *p;
+        }
+    }
+    return -1;
+}
+
+static int lowerQuotedString(
+        LowerLexer *lex
+        )
+{
+    char quote = *lex->p++;
+
+    lex->strLen = 0;
+    while (lex->p < lex->end && *lex->p != quote)
+    {
+        int c = (unsigned char)*lex->p++;
+
+        if (c == '\n' || c == '\r')
+            return -1;
+        if (c == '\\')
+        {
+            if (lex->p >= lex->end)
+                return -1;
+            c = (unsigned char)*lex->p++;
+            switch (c)
+            {
+            case 'a': c = '\a'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'v': c = '\v'; break;
+            case '\\': case '"': case '\'':
+                break;
+            case '\n':
+                lex->line++;
+                break;
+            case 'x':
+                {
+                    int i, v = 0;
+
+                    for (i = 0; i < 2; i++)
+                    {
+                        int h;
+
+                        if (lex->p >= lex->end)
+                            return -1;
+                        h = (unsigned char)*lex->p++;
+                        if (h >= '0' && h <= '9')
+                            v = v * 16 + h - '0';
+                        else if (h >= 'a' && h <= 'f')
+                            v = v * 16 + h - 'a' + 10;
+                        else if (h >= 'A' && h <= 'F')
+                            v = v * 16 + h - 'A' + 10;
+                        else
+                            return -1;
+                    }
+                    c = v;
+                }
+                break;
+            default:
+                if (c >= '0' && c <= '9')
+                {
+                    int i, v = c - '0';
+
+                    for (i = 1; i < 3 && lex->p < lex->end && *lex->p >= '0' && *lex->p <= '9'; i++)
+                        v = v * 10 + *lex->p++ - '0';
+                    if (v > 255)
+                        return -1;
+                    c = v;
+                }
+                else
+                    return -1;
+            }
+        }
+        if (lex->strLen >= sizeof(lex->str))
+            return -1;
+        lex->str[lex->strLen++] = (char)c;
+    }
+    if (lex->p >= lex->end)
+        return -1;
+    lex->p++;
+    return 0;
+}
+
+static int lowerReadNumber(
+        LowerLexer *lex
+        )
+{
+    char buf[64];
+    const char *start = lex->p;
+    size_t len;
+    char *endp;
+
+    while (lex->p < lex->end)
+    {
+        char c = *lex->p;
+
+        if ((c >= '0' && c <= '9') || c == '.' || c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            lex->p++;
+        else if ((c == '+' || c == '-') && (lex->p[-1] == 'e' || lex->p[-1] == 'E') &&
+                 !(start[0] == '0' && (start[1] == 'x' || start[1] == 'X')))
+            lex->p++;
+        else
+            break;
+    }
+    len = lex->p - start;
+    if (len >= sizeof(buf))
+        return -1;
+    memcpy(buf, start, len);
+    buf[len] = 0;
+
+    lex->num = strtod(buf, &endp);
+    if (*endp)
+    {
+        lex->num = (double)strtoul(buf, &endp, 16);
+        if (*endp)
+            return -1;
+    }
+    return 0;
+}
+
+static void lowerNext(
+        LowerLexer *lex
+        )
+{
+    for (;;)
+    {
+        char c;
+
+        if (lex->p >= lex->end)
+        {
+            lex->tok = TK_EOF;
+            lex->tokLine = lex->line;
+            return;
+        }
+        c = *lex->p;
+        if (c == '\n')
+        {
+            lex->line++;
+            lex->p++;
+        }
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+            lex->p++;
+        else if (c == '-' && lex->p + 1 < lex->end && lex->p[1] == '-')
+        {
+            int level;
+
+            lex->p += 2;
+            if ((level = lowerLongBracket(lex)) >= 0)
+            {
+                if (lowerLongString(lex, level, 0))
+                {
+                    lex->tok = TK_ERROR;
+                    return;
+                }
+            }
+            else
+            {
+                while (lex->p < lex->end && *lex->p != '\n')
+                    lex->p++;
+            }
+        }
+        else
+            break;
+    }
+
+    lex->tokLine = lex->line;
+    switch (*lex->p)
+    {
+    case '"': case '\'':
+        lex->tok = lowerQuotedString(lex) ? TK_ERROR : TK_STRING;
+        return;
+
+    case '[':
+        {
+            const char *save = lex->p;
+            int level = lowerLongBracket(lex);
+
+            if (level >= 0)
+            {
+                lex->tok = lowerLongString(lex, level, 1) ? TK_ERROR : TK_STRING;
+                return;
+            }
+            lex->p = save + 1;
+            lex->tok = '[';
+            return;
+        }
+
+    case '=': case '~': case '<': case '>':
+        if (lex->p + 1 < lex->end && lex->p[1] == '=')
+        {
+            switch (*lex->p)
+            {
+            case '=': lex->tok = TK_EQ; break;
+            case '~': lex->tok = TK_NE; break;
+            case '<': lex->tok = TK_LE; break;
+            default:  lex->tok = TK_GE; break;
+            }
+            lex->p += 2;
+            return;
+        }
+        lex->tok = (*lex->p == '~') ? TK_ERROR : *lex->p;
+        lex->p++;
+        return;
+
+    case '.':
+        if (lex->p + 1 < lex->end && lex->p[1] == '.')
+        {
+            if (lex->p + 2 < lex->end && lex->p[2] == '.')
+            {
+                lex->tok = TK_DOTS;
+                lex->p += 3;
+            }
+            else
+            {
+                lex->tok = TK_CONCAT;
+                lex->p += 2;
+            }
+            return;
+        }
+        if (lex->p + 1 < lex->end && lex->p[1] >= '0' && lex->p[1] <= '9')
+            break;
+        lex->tok = '.';
+        lex->p++;
+        return;
+
+    default:
+        break;
+    }
+
+    {
+        char c = *lex->p;
+
+        if ((c >= '0' && c <= '9') || c == '.')
+        {
+            lex->tok = lowerReadNumber(lex) ? TK_ERROR : TK_NUMBER;
+            return;
+        }
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+        {
+            lex->name = lex->p;
+            while (lex->p < lex->end &&
+                   ((*lex->p >= 'a' && *lex->p <= 'z') || (*lex->p >= 'A' && *lex->p <= 'Z') ||
+                    (*lex->p >= '0' && *lex->p <= '9') || *lex->p == '_'))
+                lex->p++;
+            lex->nameLen = lex->p - lex->name;
+            lex->tok = TK_NAME;
+            return;
+        }
+        lex->tok = (unsigned char)c;
+        lex->p++;
+    }
+}
+
+/*------------------------------------------------------------------------
+ * parser
+ *------------------------------------------------------------------------*/
+
+static int lowerIsName(
+        const LowerParser *ps,
+        const char *name
+        )
+{
+    size_t len = strlen(name);
+
+    return ps->lex.tok == TK_NAME && ps->lex.nameLen == len && !memcmp(ps->lex.name, name, len);
+}
+
+static int lowerIsKeyword(
+        const LowerParser *ps
+        )
+{
+    static const char *keywords[] = {
+        "and", "break", "do", "else", "elseif", "end", "false", "for", "function", "if", "in",
+        "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while", NULL
+    };
+    unsigned i;
+
+    for (i = 0; keywords[i]; i++)
+        if (lowerIsName(ps, keywords[i]))
+            return 1;
+    return 0;
+}
+
+static int lowerBlockEnd(
+        const LowerParser *ps
+        )
+{
+    return ps->lex.tok == TK_EOF || lowerIsName(ps, "end") || lowerIsName(ps, "else") || lowerIsName(ps, "elseif");
+}
+
+static void lowerExpect(
+        LowerParser *ps,
+        int tok
+        )
+{
+    if (ps->lex.tok != tok)
+        ps->failed = 1;
+    else
+        lowerNext(&ps->lex);
+}
+
+static void lowerExpectName(
+        LowerParser *ps,
+        const char *name
+        )
+{
+    if (!lowerIsName(ps, name))
+        ps->failed = 1;
+    else
+        lowerNext(&ps->lex);
+}
+
+static LowerNode *lowerNewNode(
+        LowerParser *ps,
+        LowerOp op,
+        LowerType type
+        )
+{
+    LowerNode *n;
+
+    if (ps->numNodes >= LOWER_MAX_NODES)
+    {
+        ps->failed = 1;
+        return NULL;
+    }
+    n = &ps->nodes[ps->numNodes++];
+    memset(n, 0, sizeof(*n));
+    n->op = op;
+    n->type = type;
+    return n;
+}
+
+static LowerNode *lowerNewString(
+        LowerParser *ps,
+        const char *s,
+        size_t len
+        )
+{
+    LowerNode *n = lowerNewNode(ps, LN_STRING, LT_STRING);
+
+    if (!n)
+        return NULL;
+    if (!(n->str = malloc(len + 1)))
+    {
+        ps->failed = 1;
+        return NULL;
+    }
+    memcpy(n->str, s, len);
+    n->str[len] = 0;
+    n->strLen = len;
+    return n;
+}
+
+/*Turns the Lua value on top of the stack into a constant and pops it. */
+static LowerNode *lowerConstant(
+        LowerParser *ps
+        )
+{
+    LowerNode *n = NULL;
+
+    switch (lua_type(ps->L, -1))
+    {
+    case LUA_TNUMBER:
+        if ((n = lowerNewNode(ps, LN_NUMBER, LT_NUMBER)))
+            n->num = lua_tonumber(ps->L, -1);
+        break;
+    case LUA_TSTRING:
+        {
+            size_t len;
+            const char *s = lua_tolstring(ps->L, -1, &len);
+
+            n = lowerNewString(ps, s, len);
+        }
+        break;
+    case LUA_TBOOLEAN:
+        if ((n = lowerNewNode(ps, LN_BOOLEAN, LT_BOOLEAN)))
+            n->num = lua_toboolean(ps->L, -1);
+        break;
+    default:
+        ps->failed = 1;
+        break;
+    }
+    lua_pop(ps->L, 1);
+    return n;
+}
+
+/*Pushes the value a name that is not a local of the validator refers to:
+ * an upvalue if the validator closes over a chunk local of that name,
+ * otherwise the global from its environment. */
+static void lowerPushName(
+        LowerParser *ps
+        )
+{
+    char name[64];
+    const char *upName;
+    int i;
+
+    if (ps->lex.nameLen >= sizeof(name))
+    {
+        lua_pushnil(ps->L);
+        return;
+    }
+    memcpy(name, ps->lex.name, ps->lex.nameLen);
+    name[ps->lex.nameLen] = 0;
+
+    for (i = 1; (upName = lua_getupvalue(ps->L, ps->funcIndex, i)); i++)
+    {
+        if (!strcmp(upName, name))
+            return;
+        lua_pop(ps->L, 1);
+    }
+    lua_getfenv(ps->L, ps->funcIndex);
+    lua_pushstring(ps->L, name);
+    lua_rawget(ps->L, -2);
+    lua_remove(ps->L, -2);
+}
+
+static const LowerLocal *lowerFindLocal(
+        const LowerParser *ps
+        )
+{
+    unsigned i;
+
+    for (i = ps->numScoped; i > 0; i--)
+    {
+        const LowerLocal *l = &ps->scoped[i-1];
+
+        if (strlen(l->name) == ps->lex.nameLen && !memcmp(l->name, ps->lex.name, ps->lex.nameLen))
+            return l;
+    }
+    return NULL;
+}
+
+static LowerNode *lowerExpr(LowerParser *ps);
+
+/*Parses the arguments of a call, up to LOWER_MAX_ARGS of them. */
+#define LOWER_MAX_ARGS 4
+
+static unsigned lowerArgs(
+        LowerParser *ps,
+        LowerNode **args
+        )
+{
+    unsigned n = 0;
+
+    lowerExpect(ps, '(');
+    if (ps->lex.tok == ')')
+    {
+        lowerNext(&ps->lex);
+        return 0;
+    }
+    for (;;)
+    {
+        if (ps->failed || n >= LOWER_MAX_ARGS)
+        {
+            ps->failed = 1;
+            return 0;
+        }
+        args[n++] = lowerExpr(ps);
+        if (ps->lex.tok != ',')
+            break;
+        lowerNext(&ps->lex);
+    }
+    lowerExpect(ps, ')');
+    return n;
+}
+
+static int lowerIsConstString(
+        const LowerNode *n
+        )
+{
+    return n && (n->op == LN_STRING || n->op == LN_NIL);
+}
+
+/*D:method(...) where D is the detector object */
+static LowerNode *lowerMethod(
+        LowerParser *ps
+        )
+{
+    static const struct
+    {
+        const char *name;
+        LowerOp op;
+        unsigned minArgs;
+        unsigned maxArgs;
+    } methods[] = {
+        {"getPacketSize",              LN_SIZE,         0, 0},
+        {"getPacketDir",               LN_DIR,          0, 0},
+        {"getPktSrcPort",              LN_SRC_PORT,     0, 0},
+        {"getPktDstPort",              LN_DST_PORT,     0, 0},
+        {"memcmp",                     LN_MEMCMP,       3, 3},
+        {"matchSimplePattern",         LN_MEMCMP,       3, 3},
+        {"addService",                 LN_ADD_SERVICE,  1, 3},
+        {"service_addService",         LN_ADD_SERVICE,  1, 3},
+        {"failService",                LN_FAIL_SERVICE, 0, 0},
+        {"service_failService",        LN_FAIL_SERVICE, 0, 0},
+        {"inProcessService",           LN_IN_PROCESS,   0, 0},
+        {"service_inProcessService",   LN_IN_PROCESS,   0, 0},
+        {"inCompatibleData",           LN_INCOMPATIBLE, 0, 0},
+        {"service_inCompatibleData",   LN_INCOMPATIBLE, 0, 0},
+        {"markIncompleteData",         LN_INCOMPATIBLE, 0, 0},
+        {"service_markIncompleteData", LN_INCOMPATIBLE, 0, 0},
+        {NULL, 0, 0, 0}
+    };
+    LowerNode *args[LOWER_MAX_ARGS];
+    LowerNode *n;
+    unsigned i, numArgs;
+
+    if (ps->lex.tok != TK_NAME)
+    {
+        ps->failed = 1;
+        return NULL;
+    }
+    for (i = 0; methods[i].name; i++)
+        if (lowerIsName(ps, methods[i].name))
+            break;
+    if (!methods[i].name)
+    {
+        ps->failed = 1;
+        return NULL;
+    }
+    lowerNext(&ps->lex);
+
+    numArgs = lowerArgs(ps, args);
+    if (ps->failed || numArgs < methods[i].minArgs || numArgs > methods[i].maxArgs)
+    {
+        ps->failed = 1;
+        return NULL;
+    }
+    if (!(n = lowerNewNode(ps, methods[i].op, LT_NUMBER)))
+        return NULL;
+
+    switch (n->op)
+    {
+    case LN_MEMCMP:
+        /*the pattern and its length are fixed so the length can be checked
+         * here; Detector_memcmp would read past a shorter pattern */
+        if (args[0]->op != LN_STRING || args[1]->op != LN_NUMBER || args[2]->type != LT_NUMBER ||
+            args[1]->num < 0 || args[1]->num > args[0]->strLen || args[1]->num != (unsigned)args[1]->num)
+        {
+            ps->failed = 1;
+            return NULL;
+        }
+        n->str = args[0]->str;
+        n->strLen = (unsigned)args[1]->num;
+        args[0]->str = NULL;
+        n->a = args[2];
+        break;
+
+    case LN_ADD_SERVICE:
+        if (args[0]->type != LT_NUMBER || (numArgs > 1 && !lowerIsConstString(args[1])) ||
+            (numArgs > 2 && !lowerIsConstString(args[2])))
+        {
+            ps->failed = 1;
+            return NULL;
+        }
+        n->a = args[0];
+        if (numArgs > 1)
+        {
+            n->str = args[1]->str;
+            args[1]->str = NULL;
+        }
+        if (numArgs > 2)
+        {
+            n->version = args[2]->str;
+            args[2]->str = NULL;
+        }
+        break;
+
+    default:
+        break;
+    }
+    return n;
+}
+
+/*NAME{.NAME|[NUMBER]|[STRING]} read once as a constant, or D:method() */
+static LowerNode *lowerName(
+        LowerParser *ps
+        )
+{
+    const LowerLocal *local;
+    LowerNode *n;
+
+    if (lowerIsKeyword(ps))
+    {
+        ps->failed = 1;
+        return NULL;
+    }
+    if ((local = lowerFindLocal(ps)))
+    {
+        lowerNext(&ps->lex);
+        if (!(n = lowerNewNode(ps, LN_LOCAL, local->type)))
+            return NULL;
+        n->slot = local->slot;
+        return n;
+    }
+
+    lowerPushName(ps);
+    lowerNext(&ps->lex);
+
+    if (ps->lex.tok == ':')
+    {
+        int isDetector;
+
+        lua_rawgeti(ps->L, LUA_REGISTRYINDEX, ps->detector->detectorUserDataRef);
+        isDetector = lua_rawequal(ps->L, -1, -2);
+        lua_pop(ps->L, 2);
+        if (!isDetector)
+        {
+            ps->failed = 1;
+            return NULL;
+        }
+        lowerNext(&ps->lex);
+        return lowerMethod(ps);
+    }
+
+    for (;;)
+    {
+        if (ps->lex.tok == '.')
+        {
+            lowerNext(&ps->lex);
+            if (ps->lex.tok != TK_NAME || !lua_istable(ps->L, -1))
+                break;
+            lua_pushlstring(ps->L, ps->lex.name, ps->lex.nameLen);
+        }
+        else if (ps->lex.tok == '[')
+        {
+            lowerNext(&ps->lex);
+            if (!lua_istable(ps->L, -1))
+                break;
+            if (ps->lex.tok == TK_NUMBER)
+                lua_pushnumber(ps->L, ps->lex.num);
+            else if (ps->lex.tok == TK_STRING)
+                lua_pushlstring(ps->L, ps->lex.str, ps->lex.strLen);
+            else
+                break;
+            lowerNext(&ps->lex);
+            if (ps->lex.tok != ']')
+            {
+                lua_pop(ps->L, 1);
+                break;
+            }
+        }
+        else
+            return lowerConstant(ps);
+
+        lua_rawget(ps->L, -2);
+        lua_remove(ps->L, -2);
+        lowerNext(&ps->lex);
+    }
+    lua_pop(ps->L, 1);
+    ps->failed = 1;
+    return NULL;
+}
+
+static LowerNode *lowerPrimary(
+        LowerParser *ps
+        )
+{
+    LowerNode *n = NULL;
+
+    switch (ps->lex.tok)
+    {
+    case TK_NUMBER:
+        if ((n = lowerNewNode(ps, LN_NUMBER, LT_NUMBER)))
+            n->num = ps->lex.num;
+        lowerNext(&ps->lex);
+        return n;
+
+    case TK_STRING:
+        n = lowerNewString(ps, ps->lex.str, ps->lex.strLen);
+        lowerNext(&ps->lex);
+        return n;
+
+    case '(':
+        lowerNext(&ps->lex);
+        n = lowerExpr(ps);
+        lowerExpect(ps, ')');
+        return n;
+
+    case TK_NAME:
+        if (lowerIsName(ps, "true") || lowerIsName(ps, "false"))
+        {
+            if ((n = lowerNewNode(ps, LN_BOOLEAN, LT_BOOLEAN)))
+                n->num = lowerIsName(ps, "true");
+            lowerNext(&ps->lex);
+            return n;
+        }
+        if (lowerIsName(ps, "nil"))
+        {
+            n = lowerNewNode(ps, LN_NIL, LT_NIL);
+            lowerNext(&ps->lex);
+            return n;
+        }
+        return lowerName(ps);
+
+    default:
+        ps->failed = 1;
+        return NULL;
+    }
+}
+
+static LowerNode *lowerUnary(
+        LowerParser *ps
+        )
+{
+    LowerNode *a, *n;
+
+    if (++ps->depth > LOWER_MAX_DEPTH)
+    {
+        ps->failed = 1;
+        return NULL;
+    }
+
+    if (lowerIsName(ps, "not") || ps->lex.tok == '-' || ps->lex.tok == '#')
+    {
+        int tok = lowerIsName(ps, "not") ? 'n' : ps->lex.tok;
+
+        lowerNext(&ps->lex);
+        if (!(a = lowerUnary(ps)))
+            return NULL;
+
+        if (tok == '#')
+        {
+            /*only the length of a constant string */
+            if (a->op != LN_STRING || !(n = lowerNewNode(ps, LN_NUMBER, LT_NUMBER)))
+            {
+                ps->failed = 1;
+                return NULL;
+            }
+            n->num = a->strLen;
+        }
+        else if (tok == '-')
+        {
+            if (a->type != LT_NUMBER)
+            {
+                ps->failed = 1;
+                return NULL;
+            }
+            if (a->op == LN_NUMBER)
+            {
+                a->num = -a->num;
+                n = a;
+            }
+            else if ((n = lowerNewNode(ps, LN_NEG, LT_NUMBER)))
+                n->a = a;
+        }
+        else
+        {
+            if (a->type != LT_NUMBER && a->type != LT_BOOLEAN && a->type != LT_COND)
+            {
+                ps->failed = 1;
+                return NULL;
+            }
+            if ((n = lowerNewNode(ps, LN_NOT, LT_BOOLEAN)))
+                n->a = a;
+        }
+    }
+    else
+        n = lowerPrimary(ps);
+
+    ps->depth--;
+    return ps->failed ? NULL : n;
+}
+
+static LowerNode *lowerAdditive(
+        LowerParser *ps
+        )
+{
+    LowerNode *n = lowerUnary(ps);
+
+    while (n && (ps->lex.tok == '+' || ps->lex.tok == '-'))
+    {
+        LowerOp op = (ps->lex.tok == '+') ? LN_ADD : LN_SUB;
+        LowerNode *b, *sum;
+
+        lowerNext(&ps->lex);
+        if (!(b = lowerUnary(ps)))
+            return NULL;
+        if (n->type != LT_NUMBER || b->type != LT_NUMBER)
+        {
+            ps->failed = 1;
+            return NULL;
+        }
+        if (n->op == LN_NUMBER && b->op == LN_NUMBER)
+        {
+            n->num = (op == LN_ADD) ? n->num + b->num : n->num - b->num;
+            continue;
+        }
+        if (!(sum = lowerNewNode(ps, op, LT_NUMBER)))
+            return NULL;
+        sum->a = n;
+        sum->b = b;
+        n = sum;
+    }
+    return n;
+}
+
+static LowerNode *lowerComparison(
+        LowerParser *ps
+        )
+{
+    LowerNode *n = lowerAdditive(ps);
+
+    while (n)
+    {
+        LowerNode *b, *cmp;
+        LowerOp op;
+
+        switch (ps->lex.tok)
+        {
+        case TK_EQ: op = LN_EQ; break;
+        case TK_NE: op = LN_NE; break;
+        case '<':   op = LN_LT; break;
+        case TK_LE: op = LN_LE; break;
+        case '>':   op = LN_GT; break;
+        case TK_GE: op = LN_GE; break;
+        default:
+            return n;
+        }
+        lowerNext(&ps->lex);
+        if (!(b = lowerAdditive(ps)))
+            return NULL;
+
+        /*numbers only, so no coercion or type errors to mirror */
+        if (n->type != LT_NUMBER || b->type != LT_NUMBER)
+        {
+            ps->failed = 1;
+            return NULL;
+        }
+        if (!(cmp = lowerNewNode(ps, op, LT_BOOLEAN)))
+            return NULL;
+        cmp->a = n;
+        cmp->b = b;
+        n = cmp;
+    }
+    return NULL;
+}
+
+static LowerNode *lowerLogical(
+        LowerParser *ps,
+        int isOr
+        )
+{
+    LowerNode *n = isOr ? lowerLogical(ps, 0) : lowerComparison(ps);
+
+    while (n && lowerIsName(ps, isOr ? "or" : "and"))
+    {
+        LowerNode *b, *l;
+
+        lowerNext(&ps->lex);
+        if (!(b = isOr ? lowerLogical(ps, 0) : lowerComparison(ps)))
+            return NULL;
+        if ((n->type != LT_NUMBER && n->type != LT_BOOLEAN && n->type != LT_COND) ||
+            (b->type != LT_NUMBER && b->type != LT_BOOLEAN && b->type != LT_COND))
+        {
+            ps->failed = 1;
+            return NULL;
+        }
+        if (!(l = lowerNewNode(ps, isOr ? LN_OR : LN_AND,
+                        (n->type == LT_BOOLEAN && b->type == LT_BOOLEAN) ? LT_BOOLEAN : LT_COND)))
+            return NULL;
+        l->a = n;
+        l->b = b;
+        n = l;
+    }
+    return n;
+}
+
+static LowerNode *lowerExpr(
+        LowerParser *ps
+        )
+{
+    if (ps->failed)
+        return NULL;
+    return lowerLogical(ps, 1);
+}
+
+static LowerNode *lowerBlock(LowerParser *ps);
+
+/*if COND then BLOCK {elseif COND then BLOCK} [else BLOCK] end */
+static LowerNode *lowerIf(
+        LowerParser *ps
+        )
+{
+    LowerNode *n = lowerNewNode(ps, LN_IF, LT_STATEMENT);
+
+    if (!n)
+        return NULL;
+
+    lowerNext(&ps->lex);
+    n->a = lowerExpr(ps);
+    if (!n->a || n->a->type == LT_STRING || n->a->type == LT_NIL)
+    {
+        ps->failed = 1;
+        return NULL;
+    }
+    lowerExpectName(ps, "then");
+    n->b = lowerBlock(ps);
+
+    if (lowerIsName(ps, "elseif"))
+        n->c = lowerIf(ps);
+    else
+    {
+        if (lowerIsName(ps, "else"))
+        {
+            lowerNext(&ps->lex);
+            n->c = lowerBlock(ps);
+        }
+        lowerExpectName(ps, "end");
+    }
+    return ps->failed ? NULL : n;
+}
+
+static LowerNode *lowerStatement(
+        LowerParser *ps,
+        int *last
+        )
+{
+    LowerNode *n = NULL;
+
+    if (lowerIsName(ps, "local"))
+    {
+        char name[sizeof(ps->scoped[0].name)];
+        LowerLocal *l;
+
+        lowerNext(&ps->lex);
+        if (ps->lex.tok != TK_NAME || lowerIsKeyword(ps) || ps->lex.nameLen >= sizeof(name) ||
+            ps->numScoped >= LOWER_MAX_LOCALS || ps->numLocals >= LOWER_MAX_LOCALS)
+        {
+            ps->failed = 1;
+            return NULL;
+        }
+        memcpy(name, ps->lex.name, ps->lex.nameLen);
+        name[ps->lex.nameLen] = 0;
+        lowerNext(&ps->lex);
+        lowerExpect(ps, '=');
+
+        /*the local is only in scope after its own initializer */
+        if (!(n = lowerNewNode(ps, LN_SET_LOCAL, LT_STATEMENT)) || !(n->a = lowerExpr(ps)) ||
+            (n->a->type != LT_NUMBER && n->a->type != LT_BOOLEAN) || ps->lex.tok == ',')
+        {
+            ps->failed = 1;
+            return NULL;
+        }
+        n->slot = ps->numLocals++;
+        l = &ps->scoped[ps->numScoped++];
+        strcpy(l->name, name);
+        l->slot = n->slot;
+        l->type = n->a->type;
+    }
+    else if (lowerIsName(ps, "if"))
+        n = lowerIf(ps);
+
+    else if (lowerIsName(ps, "return"))
+    {
+        lowerNext(&ps->lex);
+        if (!(n = lowerNewNode(ps, LN_RETURN, LT_STATEMENT)))
+            return NULL;
+        if (!lowerBlockEnd(ps) && ps->lex.tok != ';')
+        {
+            if (!(n->a = lowerExpr(ps)) || n->a->type != LT_NUMBER || ps->lex.tok == ',')
+            {
+                ps->failed = 1;
+                return NULL;
+            }
+        }
+        *last = 1;
+    }
+    else if (ps->lex.tok == TK_NAME && !lowerIsKeyword(ps))
+    {
+        /*a call whose result is dropped, nothing else can start with a name
+         * here without assigning */
+        LowerNode *call = lowerName(ps);
+
+        if (!call || call->op < LN_SIZE || call->op > LN_INCOMPATIBLE || call->op == LN_LOCAL ||
+            (call->op >= LN_ADD && call->op <= LN_NOT))
+        {
+            ps->failed = 1;
+            return NULL;
+        }
+        n = call;
+    }
+    else
+        ps->failed = 1;
+
+    if (ps->lex.tok == ';')
+        lowerNext(&ps->lex);
+
+    return ps->failed ? NULL : n;
+}
+
+static LowerNode *lowerBlock(
+        LowerParser *ps
+        )
+{
+    LowerNode *head = NULL, **tail = &head;
+    unsigned numScoped = ps->numScoped;
+    int last = 0;
+
+    if (++ps->depth > LOWER_MAX_DEPTH)
+    {
+        ps->failed = 1;
+        return NULL;
+    }
+    while (!ps->failed && !lowerBlockEnd(ps))
+    {
+        LowerNode *n;
+
+        /*return has to be the last statement of a block */
+        if (last || !(n = lowerStatement(ps, &last)))
+        {
+            ps->failed = 1;
+            break;
+        }
+        *tail = n;
+        tail = &n->next;
+    }
+    ps->numScoped = numScoped;
+    ps->depth--;
+    return head;
+}
+
+/*Positions the lexer after "function NAME" at the line Lua says the
+ * validator was defined on, if there is exactly one such definition. */
+static int lowerFindFunction(
+        LowerParser *ps,
+        const char *source,
+        size_t len,
+        const char *name,
+        int line
+        )
+{
+    LowerLexer found;
+    unsigned matches = 0;
+
+    memset(&ps->lex, 0, sizeof(ps->lex));
+    ps->lex.p = source;
+    ps->lex.end = source + len;
+    ps->lex.line = 1;
+
+    /*skip a #! line like luaL_loadfile would */
+    if (len && *source == '#')
+        while (ps->lex.p < ps->lex.end && *ps->lex.p != '\n')
+            ps->lex.p++;
+
+    for (lowerNext(&ps->lex); ps->lex.tok != TK_EOF; lowerNext(&ps->lex))
+    {
+        int tokLine;
+
+        if (ps->lex.tok == TK_ERROR)
+            return -1;
+        if (!lowerIsName(ps, "function"))
+            continue;
+        tokLine = ps->lex.tokLine;
+        lowerNext(&ps->lex);
+        if (tokLine == line && lowerIsName(ps, name))
+        {
+            lowerNext(&ps->lex);
+            if (ps->lex.tok == '(')
+            {
+                found = ps->lex;
+                matches++;
+            }
+        }
+        if (ps->lex.tok == TK_ERROR)
+            return -1;
+    }
+    if (matches != 1)
+        return -1;
+    ps->lex = found;
+    return 0;
+}
+
+static void lowerFreeStrings(
+        LowerNode *nodes,
+        unsigned numNodes
+        )
+{
+    unsigned i;
+
+    for (i = 0; i < numNodes; i++)
+    {
+        free(nodes[i].str);
+        free(nodes[i].version);
+    }
+}
+
+static LowerNode *lowerRelocate(
+        LowerNode *n,
+        const LowerNode *from,
+        LowerNode *to
+        )
+{
+    return n ? to + (n - from) : NULL;
+}
+
+LuaLoweredValidator *luaLowerServerValidator(
+        Detector *detector
+        )
+{
+    LowerParser *ps;
+    LuaLoweredValidator *validator = NULL;
+    lua_State *L = detector->myLuaState;
+    const char *name = detector->packageInfo.server.validateFunctionName;
+    lua_Debug ar;
+    LowerNode *body;
+    int top;
+    unsigned i;
+
+    /*precompiled chunks have no source to look at, and a client validator
+     * running in the same state could change the constants read here */
+    if (!name || detector->packageInfo.client.validateFunctionName || !detector->validatorBuffer || !detector->validatorBufferLen ||
+        detector->validatorBuffer[0] == '\033' || !lua_checkstack(L, 8))
+        return NULL;
+
+    top = lua_gettop(L);
+    lua_getglobal(L, name);
+    if (!lua_isfunction(L, -1) || lua_iscfunction(L, -1))
+    {
+        lua_settop(L, top);
+        return NULL;
+    }
+    lua_pushvalue(L, -1);
+    if (!lua_getinfo(L, ">S", &ar) || strcmp(ar.what, "Lua"))
+    {
+        lua_settop(L, top);
+        return NULL;
+    }
+
+    if (!(ps = calloc(1, sizeof(*ps))) || !(ps->nodes = malloc(LOWER_MAX_NODES * sizeof(*ps->nodes))))
+    {
+        free(ps);
+        lua_settop(L, top);
+        return NULL;
+    }
+    ps->detector = detector;
+    ps->L = L;
+    ps->funcIndex = lua_gettop(L);
+
+    if (!lowerFindFunction(ps, detector->validatorBuffer, detector->validatorBufferLen, name, ar.linedefined))
+    {
+        /*the validator is called without arguments */
+        lowerExpect(ps, '(');
+        lowerExpect(ps, ')');
+        body = lowerBlock(ps);
+        if (!ps->failed && lowerIsName(ps, "end") && ps->lex.tokLine == ar.lastlinedefined &&
+            (validator = malloc(sizeof(*validator) + ps->numNodes * sizeof(LowerNode))))
+        {
+            validator->numNodes = ps->numNodes;
+            validator->numLocals = ps->numLocals;
+            memcpy(validator->nodes, ps->nodes, ps->numNodes * sizeof(LowerNode));
+            for (i = 0; i < ps->numNodes; i++)
+            {
+                LowerNode *n = &validator->nodes[i];
+
+                n->a = lowerRelocate(n->a, ps->nodes, validator->nodes);
+                n->b = lowerRelocate(n->b, ps->nodes, validator->nodes);
+                n->c = lowerRelocate(n->c, ps->nodes, validator->nodes);
+                n->next = lowerRelocate(n->next, ps->nodes, validator->nodes);
+            }
+            validator->body = lowerRelocate(body, ps->nodes, validator->nodes);
+        }
+    }
+    if (!validator)
+        lowerFreeStrings(ps->nodes, ps->numNodes);
+
+    free(ps->nodes);
+    free(ps);
+    lua_settop(L, top);
+    return validator;
+}
+
+void luaFreeLoweredValidator(
+        LuaLoweredValidator *validator
+        )
+{
+    if (!validator)
+        return;
+    lowerFreeStrings(validator->nodes, validator->numNodes);
+    free(validator);
+}
+
+/*------------------------------------------------------------------------
+ * evaluation
+ *------------------------------------------------------------------------*/
+
+typedef struct
+{
+    Detector *detector;
+    double locals[LOWER_MAX_LOCALS];
+} LowerRun;
+
+static int lowerTruth(const LowerNode *n, LowerRun *run);
+
+static double lowerNumber(
+        const LowerNode *n,
+        LowerRun *run
+        )
+{
+    Detector *detector = run->detector;
+
+    switch (n->op)
+    {
+    case LN_NUMBER:
+        return n->num;
+    case LN_LOCAL:
+        return run->locals[n->slot];
+    case LN_SIZE:
+        return detector->validateParams.size;
+    case LN_DIR:
+        return detector->validateParams.dir;
+    case LN_SRC_PORT:
+        return detector->validateParams.pkt->src_port;
+    case LN_DST_PORT:
+        return detector->validateParams.pkt->dst_port;
+
+    case LN_MEMCMP:
+        {
+            double offset = lowerNumber(n->a, run);
+
+            /*Detector_memcmp does not check, a pattern past the payload
+             * simply does not match here */
+            if (offset < 0 || offset + n->strLen > detector->validateParams.size)
+                return 1;
+            return memcmp(detector->validateParams.data + (unsigned)offset, n->str, n->strLen);
+        }
+
+    case LN_ADD:
+        return lowerNumber(n->a, run) + lowerNumber(n->b, run);
+    case LN_SUB:
+        return lowerNumber(n->a, run) - lowerNumber(n->b, run);
+    case LN_NEG:
+        return -lowerNumber(n->a, run);
+
+    case LN_ADD_SERVICE:
+        {
+            unsigned serviceId = lowerNumber(n->a, run);
+
+            if (!checkServiceElement(detector))
+                return SERVICE_ENULL;
+            return AppIdServiceAddService(detector->validateParams.flowp, detector->validateParams.pkt,
+                    detector->validateParams.dir, detector->server.pServiceElement,
+                    appGetAppFromServiceId(serviceId, detector->pAppidActiveConfig), n->str, n->version, NULL);
+        }
+    case LN_FAIL_SERVICE:
+        if (!checkServiceElement(detector))
+            return SERVICE_ENULL;
+        return AppIdServiceFailService(detector->validateParams.flowp, detector->validateParams.pkt,
+                detector->validateParams.dir, detector->server.pServiceElement, APPID_SESSION_DATA_NONE,
+                detector->pAppidActiveConfig);
+    case LN_IN_PROCESS:
+        if (!checkServiceElement(detector))
+            return SERVICE_ENULL;
+        return AppIdServiceInProcess(detector->validateParams.flowp, detector->validateParams.pkt,
+                detector->validateParams.dir, detector->server.pServiceElement);
+    case LN_INCOMPATIBLE:
+        if (!checkServiceElement(detector))
+            return SERVICE_ENULL;
+        return AppIdServiceIncompatibleData(detector->validateParams.flowp, detector->validateParams.pkt,
+                detector->validateParams.dir, detector->server.pServiceElement, APPID_SESSION_DATA_NONE,
+                detector->pAppidActiveConfig);
+
+    default:
+        return lowerTruth(n, run);
+    }
+}
+
+static int lowerTruth(
+        const LowerNode *n,
+        LowerRun *run
+        )
+{
+    switch (n->op)
+    {
+    case LN_BOOLEAN:
+        return n->num != 0;
+    case LN_LOCAL:
+        return (n->type == LT_BOOLEAN) ? run->locals[n->slot] != 0 : 1;
+    case LN_EQ:
+        return lowerNumber(n->a, run) == lowerNumber(n->b, run);
+    case LN_NE:
+        return lowerNumber(n->a, run) != lowerNumber(n->b, run);
+    case LN_LT:
+        return lowerNumber(n->a, run) < lowerNumber(n->b, run);
+    case LN_LE:
+        return lowerNumber(n->a, run) <= lowerNumber(n->b, run);
+    case LN_GT:
+        return lowerNumber(n->a, run) > lowerNumber(n->b, run);
+    case LN_GE:
+        return lowerNumber(n->a, run) >= lowerNumber(n->b, run);
+    case LN_AND:
+        return lowerTruth(n->a, run) && lowerTruth(n->b, run);
+    case LN_OR:
+        return lowerTruth(n->a, run) || lowerTruth(n->b, run);
+    case LN_NOT:
+        return !lowerTruth(n->a, run);
+    default:
+        /*numbers are true in Lua, but the call still has to happen */
+        lowerNumber(n, run);
+        return 1;
+    }
+}
+
+/*Returns 1 when the block returned a number, 2 when it returned nothing. */
+static int lowerRunBlock(
+        const LowerNode *s,
+        LowerRun *run,
+        int *retValue
+        )
+{
+    int rval;
+
+    for (; s; s = s->next)
+    {
+        switch (s->op)
+        {
+        case LN_SET_LOCAL:
+            run->locals[s->slot] = (s->a->type == LT_BOOLEAN) ? lowerTruth(s->a, run) : lowerNumber(s->a, run);
+            break;
+
+        case LN_IF:
+            if (lowerTruth(s->a, run))
+                rval = lowerRunBlock(s->b, run, retValue);
+            else
+                rval = lowerRunBlock(s->c, run, retValue);
+            if (rval)
+                return rval;
+            break;
+
+        case LN_RETURN:
+            if (!s->a)
+                return 2;
+            *retValue = lowerNumber(s->a, run);
+            return 1;
+
+        default:
+            lowerNumber(s, run);
+            break;
+        }
+    }
+    return 0;
+}
+
+int luaRunLoweredValidator(
+        const LuaLoweredValidator *validator,
+        Detector *detector
+        )
+{
+    LowerRun run;
+    int retValue = SERVICE_ENULL;
+
+    run.detector = detector;
+    if (lowerRunBlock(validator->body, &run, &retValue) != 1)
+    {
+        _dpd.errMsg("server %s:  validator returned non-numeric value\n", detector->name);
+        return SERVICE_ENULL;
+    }
+    return retValue;
+}
+
+/** @} */ /* end of LuaDetectorLower */
@@ -0,0 +1,54 @@
+/*
+** Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+** Copyright (C) 2005-2013 Sourcefire, Inc.
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef _LUA_DETECTOR_LOWER_H_
+#define _LUA_DETECTOR_LOWER_H_
+
+#include "luaDetectorApi.h"
+
+/**Native form of a server validator whose body only tests the packet size,
+ * direction, ports and patterns at fixed offsets and returns the result of
+ * addService, failService, inProcessService or inCompatibleData.
+ */
+typedef struct _LuaLoweredValidator LuaLoweredValidator;
+
+/**Lowers the server validator of a detector whose init function has run.
+ * Constants the validator reads from globals and upvalues are taken as they
+ * are now.  Returns NULL if the validator does anything else, in which case
+ * it keeps running in Lua.
+ */
+LuaLoweredValidator *luaLowerServerValidator(
+        Detector *detector
+        );
+
+/**Runs a lowered validator on detector->validateParams and returns what the
+ * Lua validator would have.
+ */
+int luaRunLoweredValidator(
+        const LuaLoweredValidator *validator,
+        Detector *detector
+        );
+
+void luaFreeLoweredValidator(
+        LuaLoweredValidator *validator
+        );
+
+#endif
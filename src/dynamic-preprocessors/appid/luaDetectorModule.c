@@ -31,6 +31,7 @@
 #include <regex.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <glob.h>
@@ -42,6 +43,7 @@
 #include "appIdConfig.h"
 #include "luaDetectorApi.h"
 #include "luaDetectorFlowApi.h"
+#include "luaDetectorLower.h"
 #include "luaDetectorModule.h"
 #include "fw_appid.h"
 
@@ -380,6 +382,8 @@ static void luaServerInit(
     {
         if (detector->server.pServiceElement)
             detector->server.pServiceElement->ref_count = 1;
+        luaFreeLoweredValidator(detector->serverLowered);
+        detector->serverLowered = luaLowerServerValidator(detector);
         _dpd.debugMsg(DEBUG_LOG,"Initialized %s\n",detector->name);
     }
 }
@@ -551,6 +555,7 @@ static void luaCustomLoad(
     getDetectorPackageInfo(myLuaState, detector, 0);
 
     detector->validatorBuffer = validator;
+    detector->validatorBufferLen = validatorLen;
     /*detector->detector_version = version; */
     detector->isActive = 1;
     detector->pAppidNewConfig = detector->pAppidActiveConfig = detector->pAppidOldConfig = pConfig;
@@ -905,8 +910,10 @@ static void luaDetectorsCleanInactive(void)
                 {
                     free(detector->name);
                     free(detector->validatorBuffer);
+                    luaFreeLoweredValidator(detector->serverLowered);
                     detector->name = NULL;
                     detector->validatorBuffer = NULL;
+                    detector->serverLowered = NULL;
                 }
 
 
@@ -1085,6 +1092,8 @@ void luaModuleFini(void)
     allocatedDetectorList = NULL;
 }
 
+#define LUA_STATS_TOP_DETECTORS 10
+
 void RNAPndDumpLuaStats (void)
 {
     Detector *detector_list;
@@ -1092,6 +1101,12 @@ void RNAPndDumpLuaStats (void)
     SFGHASH_NODE *node;
     unsigned long long totalMem = 0;
     unsigned long long mem;
+    Detector *top[LUA_STATS_TOP_DETECTORS];
+    unsigned numTop = 0;
+    uint64_t totalTicks = 0;
+    unsigned numServers = 0;
+    unsigned numLowered = 0;
+    unsigned i, j;
 
     if (!allocatedDetectorList)
         return;
@@ -1109,10 +1124,49 @@ void RNAPndDumpLuaStats (void)
                 mem = lua_gc(detector->myLuaState, LUA_GCCOUNT,0);
                 totalMem += mem;
                 _dpd.logMsg("    Detector %s: Lua Memory usage %d kb", detector->name, mem);
+
+                if (detector->server.pServiceElement)
+                {
+                    numServers++;
+                    if (detector->serverLowered)
+                        numLowered++;
+                }
+                if (!detector->validateCalls)
+                    continue;
+                totalTicks += detector->validateTicks;
+
+                /*keep the most expensive detectors, most expensive first */
+                i = numTop;
+                while (i > 0 && top[i-1]->validateTicks < detector->validateTicks)
+                    i--;
+                if (i >= LUA_STATS_TOP_DETECTORS)
+                    continue;
+                if (numTop < LUA_STATS_TOP_DETECTORS)
+                    numTop++;
+                for (j = numTop - 1; j > i; j--)
+                    top[j] = top[j-1];
+                top[i] = detector;
             }
         }
     }
     _dpd.logMsg("Lua Stats total memory usage %d kb", totalMem);
+    _dpd.logMsg("Lua server validators lowered to native code: %u of %u", numLowered, numServers);
+
+    if (!numTop)
+        return;
+
+    _dpd.logMsg("Validator CPU, top %u of %" PRIu64 " ticks total", numTop, totalTicks);
+    for (i = 0; i < numTop; i++)
+    {
+        detector = top[i];
+        _dpd.logMsg("    Detector %s%s: %" PRIu64 " calls, %" PRIu64 " ticks (%.1f%%), "
+                    "%" PRIu64 " avg, %" PRIu64 " max", detector->name,
+                    detector->serverLowered ? " (native)" : "",
+                    detector->validateCalls, detector->validateTicks,
+                    100.0 * detector->validateTicks / totalTicks,
+                    detector->validateTicks / detector->validateCalls,
+                    detector->validateMaxTicks);
+    }
 }
 
 
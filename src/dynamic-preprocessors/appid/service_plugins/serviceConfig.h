@@ -104,6 +104,9 @@ typedef struct
     void                        *udp_patterns;
     tServicePatternData         *udp_pattern_data;
     int                         udp_pattern_count;
+
+    /**services that identified flows per server port (SFXHASH) */
+    void                        *port_rank;
 } tServiceConfig;
 
 #endif // SERVICE_CONFIG_H_
@@ -113,6 +113,15 @@ struct RNAServiceElement
     int provides_user;
 
     const char *name;
+
+    /**first payload bytes and length buckets, by direction, of flows this
+     * service identified; seeded from patterns anchored at offset 0. */
+    uint8_t rank_first_bytes[2][32];
+    uint16_t rank_lengths[2];
+
+    /**hash of name, identifies the service in state shared with other
+     * instances; set on first use. */
+    uint32_t name_hash;
 };
 typedef struct RNAServiceElement tRNAServiceElement;
 
@@ -76,6 +76,8 @@
 #include "appIdConfig.h"
 #include "ip_funcs.h"
 #include "luaDetectorApi.h"
+#include "lengthAppCache.h"
+#include "sfxhash.h"
 
 /*#define SERVICE_DEBUG 1 */
 /*#define SERVICE_DEBUG_PORT  0 */
@@ -92,6 +94,13 @@
  * already exist). */
 #define MAX_CANDIDATE_SERVICES 10
 
+/* Brute force candidates are ranked and up to this many with the best
+ * scores are validated together on the same packet. */
+#define RANK_MAX_CANDIDATES     4
+#define RANK_PORT_SLOTS         4
+#define RANK_PORT_ROWS          1024
+#define RANK_PORT_MEMCAP        (1024*1024)
+
 static void *service_flowdata_get(tAppIdData *flow, unsigned service_id);
 static int service_flowdata_add(tAppIdData *flow, void *data, unsigned service_id, AppIdFreeFCN fcn);
 static void AppIdAddHostInfo(tAppIdData *flow, SERVICE_HOST_INFO_CODE code, const void *info);
@@ -441,6 +450,33 @@ const tRNAServiceElement *ServiceGetServiceElement(RNAServiceValidationFCN fcn,
     return NULL;
 }
 
+/* Service identified by another instance, which only knows it by name. */
+static const tRNAServiceElement *AppIdGetServiceByNameHash(uint32_t protocol, uint32_t name_hash,
+                                                          const tAppIdConfig *pConfig)
+{
+    tRNAServiceElement *li;
+
+    li = (protocol == IPPROTO_TCP) ? pConfig->serviceConfig.tcp_service_list:pConfig->serviceConfig.udp_service_list;
+    for (; li; li=li->next)
+    {
+        if (!li->name_hash)
+            li->name_hash = AppIdServiceNameHash(li->name);
+        if (li->name_hash == name_hash && li->current_ref_count)
+            return li;
+    }
+    return NULL;
+}
+
+static inline void rankSetBit(uint8_t *bits, unsigned bit)
+{
+    bits[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+}
+
+static inline int rankTestBit(const uint8_t *bits, unsigned bit)
+{
+    return bits[bit >> 3] & (1 << (bit & 7));
+}
+
 static void ServiceRegisterPattern(RNAServiceValidationFCN fcn,
                                    u_int8_t proto, const u_int8_t *pattern, unsigned size,
                                    int position, struct _Detector *userdata, int provides_user,
@@ -520,6 +556,8 @@ static void ServiceRegisterPattern(RNAServiceValidationFCN fcn,
     pd->svc = li;
     pd->size = size;
     pd->position = position;
+    if (!position && size)
+        rankSetBit(li->rank_first_bytes[APP_ID_FROM_RESPONDER], pattern[0]);
     _dpd.searchAPI->search_instance_add_ex(*patterns, (void *)pattern, size, pd, STR_SEARCH_CASE_SENSITIVE);
     (*count)++;
     pd->next = *pd_list;
@@ -895,6 +933,12 @@ void UnconfigureServices(tAppIdConfig *pConfig)
 
     RemoveAllServicePorts(&pConfig->serviceConfig);
 
+    if (pConfig->serviceConfig.port_rank)
+    {
+        sfxhash_delete(pConfig->serviceConfig.port_rank);
+        pConfig->serviceConfig.port_rank = NULL;
+    }
+
     for (svm=pConfig->serviceConfig.active_service_list; svm; svm=svm->next)
     {
         if (svm->clean)
@@ -1003,6 +1047,12 @@ void CleanupServices(tAppIdConfig *pConfig)
 
     RemoveAllServicePorts(&pConfig->serviceConfig);
 
+    if (pConfig->serviceConfig.port_rank)
+    {
+        sfxhash_delete(pConfig->serviceConfig.port_rank);
+        pConfig->serviceConfig.port_rank = NULL;
+    }
+
     for (svm=pConfig->serviceConfig.active_service_list; svm; svm=svm->next)
     {
         if (svm->clean)
@@ -1168,6 +1218,241 @@ static inline tRNAServiceElement * AppIdGetServiceByBruteForce(
     return service;
 }
 
+/* Candidate ranking.  Rather than stepping through every detector one flow
+ * at a time, detectors are scored on what they identified before: flows to
+ * the same server port, the first payload byte and the first payload length
+ * class in each direction.  Detectors are keyed by validate and userdata
+ * since the elements themselves are per configuration. */
+typedef struct _ServiceRankKey
+{
+    uint16_t port;
+    uint16_t proto;
+} ServiceRankKey;
+
+typedef struct _ServiceRankSlot
+{
+    RNAServiceValidationFCN validate;
+    struct _Detector *userdata;
+    uint32_t count;
+} ServiceRankSlot;
+
+typedef struct _ServiceRankPort
+{
+    ServiceRankSlot slot[RANK_PORT_SLOTS];
+} ServiceRankPort;
+
+static void ServiceRankLearn(tAppIdData *flow, const tRNAServiceElement *svc_element,
+                             uint16_t port, tServiceConfig *pServiceConfig)
+{
+    tRNAServiceElement *li;
+    ServiceRankPort *rp;
+    ServiceRankSlot *slot;
+    ServiceRankKey key;
+    unsigned i;
+    int dir;
+
+    li = (flow->proto == IPPROTO_TCP) ? pServiceConfig->tcp_service_list : pServiceConfig->udp_service_list;
+    for (; li; li = li->next)
+    {
+        if ((li->validate == svc_element->validate) && (li->userdata == svc_element->userdata))
+            break;
+    }
+    if (li)
+    {
+        for (dir = APP_ID_FROM_INITIATOR; dir <= APP_ID_FROM_RESPONDER; dir++)
+        {
+            if (!(flow->first_payload_seen & (1 << dir)))
+                continue;
+            rankSetBit(li->rank_first_bytes[dir], flow->first_payload_byte[dir]);
+            li->rank_lengths[dir] |= 1 << lengthAppCacheBucket(flow->first_payload_size[dir]);
+        }
+    }
+
+    if (!pServiceConfig->port_rank)
+    {
+        /* the least recently used ports are recycled at the memcap */
+        if (!(pServiceConfig->port_rank = sfxhash_new(RANK_PORT_ROWS, sizeof(ServiceRankKey),
+                                                      sizeof(ServiceRankPort), RANK_PORT_MEMCAP,
+                                                      1, NULL, NULL, 1)))
+            return;
+    }
+
+    key.port = port;
+    key.proto = flow->proto;
+    switch (sfxhash_add_return_data_ptr(pServiceConfig->port_rank, &key, (void **)&rp))
+    {
+    case SFXHASH_OK:
+        memset(rp, 0, sizeof(*rp));
+        break;
+    case SFXHASH_INTABLE:
+        break;
+    default:
+        return;
+    }
+
+    /* bump this detector, or replace the one with the fewest hits */
+    slot = &rp->slot[0];
+    for (i = 0; i < RANK_PORT_SLOTS; i++)
+    {
+        if ((rp->slot[i].validate == svc_element->validate) && (rp->slot[i].userdata == svc_element->userdata))
+        {
+            slot = &rp->slot[i];
+            break;
+        }
+        if (rp->slot[i].count < slot->count)
+            slot = &rp->slot[i];
+    }
+    if ((slot->validate != svc_element->validate) || (slot->userdata != svc_element->userdata))
+    {
+        slot->validate = svc_element->validate;
+        slot->userdata = svc_element->userdata;
+        slot->count = 0;
+    }
+    if (slot->count < UINT32_MAX)
+        slot->count++;
+}
+
+static unsigned ServiceRankScore(const tRNAServiceElement *li, const ServiceRankPort *rp,
+                                 const tAppIdData *flow, int dir)
+{
+    unsigned score = 0;
+    unsigned i;
+
+    if (rp)
+    {
+        for (i = 0; i < RANK_PORT_SLOTS; i++)
+        {
+            if ((rp->slot[i].validate == li->validate) && (rp->slot[i].userdata == li->userdata))
+            {
+                score += 8 * ((rp->slot[i].count < 8) ? rp->slot[i].count : 8);
+                break;
+            }
+        }
+    }
+    if (flow->first_payload_seen & (1 << dir))
+    {
+        if (rankTestBit(li->rank_first_bytes[dir], flow->first_payload_byte[dir]))
+            score += 4;
+        if (li->rank_lengths[dir] & (1 << lengthAppCacheBucket(flow->first_payload_size[dir])))
+            score += 2;
+    }
+    return score;
+}
+
+static inline int AppIdServiceIsCandidate(SF_LIST *list, const tRNAServiceElement *svc)
+{
+    const tRNAServiceElement *service;
+
+    for (service = sflist_first(list); service; service = sflist_next(list))
+    {
+        if (service == svc)
+            return 1;
+    }
+    return 0;
+}
+
+/* Adds up to limit detectors to the flow's candidate list, best score
+ * first, so they are all validated on this packet.  Only detectors with
+ * some history are ranked; with fill set, the brute force order makes up
+ * the rest and always gets at least one slot, so id_state->svc keeps
+ * advancing even when the ranked detectors fail on every flow.  Returns
+ * the number added. */
+static unsigned AppIdAddRankedServices(const SFSnortPacket *p, const int dir, tAppIdData *rnaData,
+                                       AppIdServiceIDState *id_state, const tAppIdConfig *pConfig,
+                                       uint16_t port, unsigned limit, int fill)
+{
+    const tRNAServiceElement *best[RANK_MAX_CANDIDATES];
+    unsigned score[RANK_MAX_CANDIDATES];
+    const ServiceRankPort *rp = NULL;
+    tRNAServiceElement *li;
+    ServiceRankKey key;
+    unsigned n = 0, added = 0, i, s;
+    unsigned rank_limit;
+
+    if (limit > RANK_MAX_CANDIDATES)
+        limit = RANK_MAX_CANDIDATES;
+
+    if (!limit)
+        return 0;
+
+    rank_limit = fill ? limit - 1 : limit;
+
+    if (!rnaData->candidate_service_list)
+    {
+        if (!(rnaData->candidate_service_list = malloc(sizeof(SF_LIST))))
+        {
+            _dpd.errMsg("Could not allocate a candidate service list.");
+            return 0;
+        }
+        sflist_init(rnaData->candidate_service_list);
+        rnaData->num_candidate_services_tried = 0;
+    }
+
+    if (pConfig->serviceConfig.port_rank)
+    {
+        key.port = port;
+        key.proto = rnaData->proto;
+        rp = sfxhash_find(pConfig->serviceConfig.port_rank, &key);
+    }
+
+    li = (rnaData->proto == IPPROTO_TCP) ? pConfig->serviceConfig.tcp_service_list : pConfig->serviceConfig.udp_service_list;
+    for (; li; li = li->next)
+    {
+        if (!li->current_ref_count)
+            continue;
+
+        if (!(s = ServiceRankScore(li, rp, rnaData, dir)))
+            continue;
+
+        if ((n == rank_limit) && (!n || (s <= score[n-1])))
+            continue;
+
+        if (AppIdServiceIsCandidate(rnaData->candidate_service_list, li))
+            continue;
+
+        if (n < rank_limit)
+            n++;
+
+        for (i = n - 1; (i > 0) && (score[i-1] < s); i--)
+        {
+            best[i] = best[i-1];
+            score[i] = score[i-1];
+        }
+        best[i] = li;
+        score[i] = s;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (!sflist_add_tail(rnaData->candidate_service_list, (void *)best[i]))
+            added++;
+    }
+
+    while (fill && (added < limit))
+    {
+        /* at the end, the next brute force starts over (as it does
+         * without ranking) */
+        id_state->svc = li = AppIdGetServiceByBruteForce(rnaData->proto, id_state->svc, pConfig);
+
+        if (!li)
+            break;
+
+        if (AppIdServiceIsCandidate(rnaData->candidate_service_list, li))
+            continue;
+
+        if (!sflist_add_tail(rnaData->candidate_service_list, li))
+            added++;
+    }
+
+    rnaData->num_candidate_services_tried += added;
+
+    if (app_id_debug_session_flag && n)
+        _dpd.logMsg("AppIdDbg %s %u ranked service candidates, best %s\n", app_id_debug_session,
+                    n, best[0]->name ? best[0]->name : "UNKNOWN");
+
+    return added;
+}
+
 static void AppIdAddHostInfo(tAppIdData *flow, SERVICE_HOST_INFO_CODE code, const void *info)
 {
 }
@@ -1396,6 +1681,10 @@ static int AppIdServiceAddServiceEx(tAppIdData *flow, const SFSnortPacket *pkt,
 #endif
     }
     id_state->reset_time = 0;
+    if (id_state->state != SERVICE_ID_VALID || id_state->svc != svc_element)
+        AppIdSharedServiceStatePublish(&flow->service_ip, flow->proto, flow->service_port,
+                                       AppIdServiceDetectionLevel(flow),
+                                       AppIdServiceNameHash(svc_element->name));
     if (id_state->state != SERVICE_ID_VALID)
     {
         id_state->state = SERVICE_ID_VALID;
@@ -1407,6 +1696,9 @@ static int AppIdServiceAddServiceEx(tAppIdData *flow, const SFSnortPacket *pkt,
     }
     id_state->svc = svc_element;
 
+    if (pAppidActiveConfig)
+        ServiceRankLearn(flow, svc_element, port, &pAppidActiveConfig->serviceConfig);
+
 #ifdef SERVICE_DEBUG
 #if SERVICE_DEBUG_PORT
 if (pkt->dst_port == SERVICE_DEBUG_PORT || pkt->src_port == SERVICE_DEBUG_PORT)
@@ -1871,6 +2163,8 @@ static void HandleFailure(tAppIdData *flowp,
             if (id_state->valid_count <= 1)
             {
                 id_state->state = SERVICE_ID_NEW;
+                AppIdSharedServiceStateForget(&flowp->service_ip, flowp->proto, flowp->service_port,
+                                              AppIdServiceDetectionLevel(flowp));
                 id_state->invalid_client_count = 0;
                 IP_CLEAR(id_state->last_invalid_client);
                 id_state->valid_count = 0;
@@ -1898,6 +2192,8 @@ static void HandleFailure(tAppIdData *flowp,
                 if (id_state->valid_count <= 1)
                 {
                     id_state->state = SERVICE_ID_NEW;
+                    AppIdSharedServiceStateForget(&flowp->service_ip, flowp->proto, flowp->service_port,
+                                                  AppIdServiceDetectionLevel(flowp));
                     id_state->invalid_client_count = 0;
                     IP_CLEAR(id_state->last_invalid_client);
                     id_state->valid_count = 0;
@@ -2118,6 +2414,7 @@ int AppIdDiscoverService(SFSnortPacket *p, const int dir, tAppIdData *rnaData, c
     AppIdServiceIDState *id_state;
     uint8_t proto;
     uint16_t port;
+    uint32_t name_hash;
     SF_LNODE *node;
 
     /* Get packet info. */
@@ -2156,10 +2453,24 @@ int AppIdDiscoverService(SFSnortPacket *p, const int dir, tAppIdData *rnaData, c
                 return SERVICE_ENOMEM;
             }
             memset(id_state, 0, sizeof(*id_state));
+
+            /* another instance may already know what runs here */
+            if ((name_hash = AppIdSharedServiceStateLookup(ip, proto, port, AppIdServiceDetectionLevel(rnaData)))
+                && (id_state->svc = AppIdGetServiceByNameHash(proto, name_hash, pConfig)))
+            {
+                id_state->state = SERVICE_ID_VALID;
+            }
         }
         rnaData->id_state = id_state;
     }
 
+    if (p->payload_size && !(rnaData->first_payload_seen & (1 << dir)))
+    {
+        rnaData->first_payload_seen |= 1 << dir;
+        rnaData->first_payload_byte[dir] = p->payload[0];
+        rnaData->first_payload_size[dir] = p->payload_size;
+    }
+
     if (rnaData->serviceData == NULL)
     {
         /* If a valid service already exists in host tracker, give it a try. */
@@ -2167,13 +2478,18 @@ int AppIdDiscoverService(SFSnortPacket *p, const int dir, tAppIdData *rnaData, c
         {
             rnaData->serviceData = id_state->svc;
         }
-        /* If we've gotten to brute force, give next detector a try. */
+        /* If we've gotten to brute force, give the best ranked detectors
+         * (or else the next one) a try. */
         else if (    (id_state->state == SERVICE_ID_BRUTE_FORCE)
                   && (rnaData->num_candidate_services_tried == 0)
                   && !id_state->searching )
         {
-            rnaData->serviceData = AppIdGetServiceByBruteForce(proto, id_state->svc, pConfig);
-            id_state->svc = rnaData->serviceData;
+            if (!p->payload_size
+                || !AppIdAddRankedServices(p, dir, rnaData, id_state, pConfig, port, RANK_MAX_CANDIDATES, 1))
+            {
+                rnaData->serviceData = AppIdGetServiceByBruteForce(proto, id_state->svc, pConfig);
+                id_state->svc = rnaData->serviceData;
+            }
         }
     }
 
@@ -2236,6 +2552,15 @@ int AppIdDiscoverService(SFSnortPacket *p, const int dir, tAppIdData *rnaData, c
                     break;
                 }
             }
+
+            /* Out of port and pattern detectors; rather than leave the rest
+             * to brute force on later flows, add the ranked ones now. */
+            if (    (id_state->state == SERVICE_ID_BRUTE_FORCE) && p->payload_size
+                 && (rnaData->num_candidate_services_tried < MAX_CANDIDATE_SERVICES) )
+            {
+                AppIdAddRankedServices(p, dir, rnaData, id_state, pConfig, port,
+                                       MAX_CANDIDATE_SERVICES - rnaData->num_candidate_services_tried, 0);
+            }
         }
 
         /* Run all of the detectors that we currently have. */
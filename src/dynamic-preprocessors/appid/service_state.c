@@ -30,13 +30,21 @@
 #include <fcntl.h>
 #include <syslog.h>
 #include <strings.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 
 #include "sfxhash.h"
 #include "sf_dynamic_preprocessor.h"
 #include "service_state.h"
 #include "service_api.h"
 #include "service_base.h"
+#include "common_util.h"
+
+#ifdef SHARED_REP
+#include "shmem_config.h"
+#include "shmem_lib.h"
+#endif
 
 /*#define DEBUG_SERVICE_STATE 1 */
 
@@ -45,6 +53,57 @@ static SFXHASH *serviceStateCache6;
 
 #define SERVICE_STATE_CACHE_ROWS    65536
 
+/* Service state shared by all instances on the box.  A fixed size table of
+ * buckets of SHARED_STATE_WAYS entries in a shared memory segment, mapping
+ * ip/proto/port/level to the name of the detector that identified the
+ * service there.  Each entry is a seqlock: a writer makes the sequence odd
+ * with a compare and swap, writes and makes it even again; a writer that
+ * loses the swap drops its update and readers that see an odd or changed
+ * sequence treat the entry as a miss, so nobody ever waits.  Entries from
+ * an older generation are empty; the generation is bumped when detectors
+ * are reloaded.  A full bucket evicts its least recently written entry. */
+#define SHARED_STATE_SEGMENT    "SFAppIdServiceState"
+#define SHARED_STATE_MAGIC      0x53534941  /* "AISS" */
+#define SHARED_STATE_VERSION    1
+#define SHARED_STATE_WAYS       4
+
+#define SHARED_STATE_NEW        0
+#define SHARED_STATE_INIT       1
+#define SHARED_STATE_READY      2
+
+typedef struct
+{
+    volatile uint32_t seq;
+    uint32_t generation;
+    uint32_t name_hash;     /* 0 is empty */
+    uint32_t written;
+    AppIdServiceStateKey6 key;
+} SharedServiceStateEntry;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    volatile uint32_t ready;
+    uint32_t num_buckets;
+    volatile uint32_t generation;
+    volatile uint32_t adds;
+    volatile uint32_t evictions;
+    volatile uint32_t instances;
+    SharedServiceStateEntry entry[];
+} SharedServiceState;
+
+static SharedServiceState *sharedState;
+static size_t sharedStateSize;
+
+static struct
+{
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t publishes;
+    uint32_t contended;
+} sharedStateStats;
+
 static int AppIdServiceStateFree(void *key, void *data)
 {
     AppIdServiceIDState* id_state = (AppIdServiceIDState*)data;
@@ -123,6 +182,7 @@ void AppIdRemoveServiceIDState(sfaddr_t *ip, uint16_t proto, uint16_t port, uint
         k.key4.level = level;
         cache = serviceStateCache4;
     }
+    AppIdSharedServiceStateForget(ip, proto, port, level);
     if (sfxhash_remove(cache, &k) != SFXHASH_OK)
     {
         char ipstr[INET6_ADDRSTRLEN];
@@ -229,5 +289,282 @@ void AppIdServiceStateDumpStats(void)
         _dpd.logMsg("    IPv6 Memory Limit: %u\n", serviceStateCache6->mc.memcap);
         _dpd.logMsg("     IPv6 Memory Used: %u\n", serviceStateCache6->mc.memused);
     }
+    if (sharedState)
+    {
+        _dpd.logMsg("   Shared Table Slots: %u\n", sharedState->num_buckets * SHARED_STATE_WAYS);
+        _dpd.logMsg("     Shared Instances: %u\n", sharedState->instances);
+        _dpd.logMsg("    Shared Generation: %u\n", sharedState->generation);
+        _dpd.logMsg("          Shared Adds: %u\n", sharedState->adds);
+        _dpd.logMsg("     Shared Evictions: %u\n", sharedState->evictions);
+        _dpd.logMsg("       Shared Lookups: %u\n", sharedStateStats.lookups);
+        _dpd.logMsg("          Shared Hits: %u\n", sharedStateStats.hits);
+        _dpd.logMsg("     Shared Publishes: %u\n", sharedStateStats.publishes);
+        _dpd.logMsg("     Shared Contended: %u\n", sharedStateStats.contended);
+    }
+}
+
+uint32_t AppIdServiceNameHash(const char *name)
+{
+    uint32_t h = 2166136261U;
+
+    if (!name)
+        return 0;
+
+    while (*name)
+    {
+        h ^= (uint8_t)*name++;
+        h *= 16777619U;
+    }
+    /* 0 marks an empty shared entry */
+    return h ? h : 1;
+}
+
+static inline void sharedStateKey(AppIdServiceStateKey6 *k, sfaddr_t *ip, uint16_t proto,
+                                  uint16_t port, uint32_t level)
+{
+    memset(k, 0, sizeof(*k));
+    k->port = port;
+    k->proto = proto;
+    memcpy(k->ip, sfaddr_get_ip6_ptr(ip), sizeof(k->ip));
+    k->level = level;
+}
+
+static inline SharedServiceStateEntry *sharedStateBucket(const AppIdServiceStateKey6 *k)
+{
+    const uint8_t *b = (const uint8_t *)k;
+    uint32_t h = 2166136261U;
+    unsigned i;
+
+    for (i = 0; i < sizeof(*k); i++)
+    {
+        h ^= b[i];
+        h *= 16777619U;
+    }
+    return &sharedState->entry[(h & (sharedState->num_buckets - 1)) * SHARED_STATE_WAYS];
+}
+
+static inline int sharedStateLive(const SharedServiceStateEntry *e, uint32_t generation)
+{
+    return e->generation == generation && e->name_hash;
+}
+
+/* Returns the entry's name hash if it holds the key, 0 otherwise. */
+static inline uint32_t sharedStateRead(const SharedServiceStateEntry *e,
+                                       const AppIdServiceStateKey6 *k, uint32_t generation)
+{
+    uint32_t seq, name_hash;
+
+    seq = e->seq;
+    if (seq & 1)
+        return 0;
+    __sync_synchronize();
+
+    if (e->generation != generation || memcmp(&e->key, k, sizeof(*k)))
+        return 0;
+    name_hash = e->name_hash;
+
+    __sync_synchronize();
+    return (e->seq == seq) ? name_hash : 0;
+}
+
+static inline int sharedStateWrite(SharedServiceStateEntry *e, uint32_t seq,
+                                   const AppIdServiceStateKey6 *k, uint32_t generation,
+                                   uint32_t name_hash)
+{
+    if ((seq & 1) || !__sync_bool_compare_and_swap(&e->seq, seq, seq + 1))
+    {
+        sharedStateStats.contended++;
+        return -1;
+    }
+    e->key = *k;
+    e->generation = generation;
+    e->name_hash = name_hash;
+    e->written = (uint32_t)GetPacketRealTime;
+    __sync_synchronize();
+    e->seq = seq + 2;
+    return 0;
+}
+
+int AppIdSharedServiceStateInit(unsigned long size)
+{
+#ifdef SHARED_REP
+    SharedServiceState *s;
+    uint32_t buckets = 1;
+    off_t existing;
+    unsigned wait;
+
+    if (sharedState || !size)
+        return 0;
+
+    /* largest power of two number of buckets that fits */
+    while ((sizeof(*s) + (uint64_t)buckets * 2 * SHARED_STATE_WAYS * sizeof(*s->entry) <= size)
+           && buckets < (1U << 30))
+        buckets <<= 1;
+    sharedStateSize = sizeof(*s) + (size_t)buckets * SHARED_STATE_WAYS * sizeof(*s->entry);
+
+    /* mapping a segment created with another size would resize it under
+     * the instances already using it */
+    if (ShmemExists(SHARED_STATE_SEGMENT, &existing) && (size_t)existing != sharedStateSize)
+    {
+        _dpd.errMsg("AppId: shared service state segment %s is %lu bytes, expected %lu; not sharing\n",
+                    SHARED_STATE_SEGMENT, (unsigned long)existing, (unsigned long)sharedStateSize);
+        return -1;
+    }
+
+    if (!(s = ShmemMap(SHARED_STATE_SEGMENT, sharedStateSize, WRITE)))
+    {
+        _dpd.errMsg("AppId: failed to map shared service state segment %s\n", SHARED_STATE_SEGMENT);
+        return -1;
+    }
+
+    /* a new segment is zero filled; the first instance lays it out */
+    if (__sync_bool_compare_and_swap(&s->ready, SHARED_STATE_NEW, SHARED_STATE_INIT))
+    {
+        s->magic = SHARED_STATE_MAGIC;
+        s->version = SHARED_STATE_VERSION;
+        s->num_buckets = buckets;
+        s->generation = 1;
+        __sync_synchronize();
+        s->ready = SHARED_STATE_READY;
+    }
+
+    for (wait = 0; s->ready != SHARED_STATE_READY && wait < 1000; wait++)
+        usleep(1000);
+
+    if (s->ready != SHARED_STATE_READY || s->magic != SHARED_STATE_MAGIC
+        || s->version != SHARED_STATE_VERSION || s->num_buckets != buckets)
+    {
+        _dpd.errMsg("AppId: shared service state segment %s is not usable; not sharing\n",
+                    SHARED_STATE_SEGMENT);
+        munmap(s, sharedStateSize);
+        return -1;
+    }
+
+    __sync_fetch_and_add(&s->instances, 1);
+    sharedState = s;
+    _dpd.logMsg("AppId: sharing service state in %s, %u slots\n",
+                SHARED_STATE_SEGMENT, buckets * SHARED_STATE_WAYS);
+    return 0;
+#else
+    if (size)
+        _dpd.errMsg("AppId: shared service state needs shared memory support (--enable-shared-rep); not sharing\n");
+    return 0;
+#endif
+}
+
+void AppIdSharedServiceStateFini(void)
+{
+    if (!sharedState)
+        return;
+
+    /* the segment stays for the other instances and the next start */
+    __sync_fetch_and_sub(&sharedState->instances, 1);
+    munmap(sharedState, sharedStateSize);
+    sharedState = NULL;
+}
+
+void AppIdSharedServiceStateFlush(void)
+{
+    if (sharedState)
+        __sync_fetch_and_add(&sharedState->generation, 1);
+}
+
+uint32_t AppIdSharedServiceStateLookup(sfaddr_t *ip, uint16_t proto, uint16_t port, uint32_t level)
+{
+    AppIdServiceStateKey6 k;
+    SharedServiceStateEntry *bucket;
+    uint32_t generation, name_hash;
+    unsigned i;
+
+    if (!sharedState)
+        return 0;
+
+    sharedStateStats.lookups++;
+    sharedStateKey(&k, ip, proto, port, level);
+    bucket = sharedStateBucket(&k);
+    generation = sharedState->generation;
+
+    for (i = 0; i < SHARED_STATE_WAYS; i++)
+    {
+        if ((name_hash = sharedStateRead(&bucket[i], &k, generation)))
+        {
+            sharedStateStats.hits++;
+            return name_hash;
+        }
+    }
+    return 0;
+}
+
+void AppIdSharedServiceStatePublish(sfaddr_t *ip, uint16_t proto, uint16_t port, uint32_t level,
+                                    uint32_t name_hash)
+{
+    AppIdServiceStateKey6 k;
+    SharedServiceStateEntry *bucket, *victim = NULL;
+    uint32_t generation, seq;
+    unsigned i;
+    int evict;
+
+    if (!sharedState || !name_hash)
+        return;
+
+    sharedStateKey(&k, ip, proto, port, level);
+    bucket = sharedStateBucket(&k);
+    generation = sharedState->generation;
+
+    /* the key's own entry, else an empty one, else the oldest */
+    for (i = 0; i < SHARED_STATE_WAYS; i++)
+    {
+        SharedServiceStateEntry *e = &bucket[i];
+
+        if (e->generation == generation && !memcmp(&e->key, &k, sizeof(k)))
+        {
+            if (e->name_hash == name_hash)
+                return;
+            victim = e;
+            break;
+        }
+        if (!sharedStateLive(e, generation))
+        {
+            if (!victim || sharedStateLive(victim, generation))
+                victim = e;
+        }
+        else if (!victim || (sharedStateLive(victim, generation)
+                             && (int32_t)(e->written - victim->written) < 0))
+            victim = e;
+    }
+
+    evict = (i == SHARED_STATE_WAYS) && sharedStateLive(victim, generation);
+    seq = victim->seq;
+    if (sharedStateWrite(victim, seq, &k, generation, name_hash))
+        return;
+
+    if (evict)
+        __sync_fetch_and_add(&sharedState->evictions, 1);
+    __sync_fetch_and_add(&sharedState->adds, 1);
+    sharedStateStats.publishes++;
+}
+
+void AppIdSharedServiceStateForget(sfaddr_t *ip, uint16_t proto, uint16_t port, uint32_t level)
+{
+    AppIdServiceStateKey6 k;
+    SharedServiceStateEntry *bucket;
+    uint32_t generation;
+    unsigned i;
+
+    if (!sharedState)
+        return;
+
+    sharedStateKey(&k, ip, proto, port, level);
+    bucket = sharedStateBucket(&k);
+    generation = sharedState->generation;
+
+    for (i = 0; i < SHARED_STATE_WAYS; i++)
+    {
+        if (sharedStateRead(&bucket[i], &k, generation))
+        {
+            sharedStateWrite(&bucket[i], bucket[i].seq, &k, generation, 0);
+            return;
+        }
+    }
 }
 
@@ -135,5 +135,18 @@ AppIdServiceIDState* AppIdGetServiceIDState(sfaddr_t *ip, uint16_t proto, uint16
 AppIdServiceIDState* AppIdAddServiceIDState(sfaddr_t *ip, uint16_t proto, uint16_t port, uint32_t level);
 void AppIdServiceStateDumpStats(void);
 
+/* Service state shared across instances through shared memory (appid
+ * option shared_service_cache).  Services are recorded by the hash of the
+ * name of the detector that found them; all calls are no ops when sharing
+ * is off. */
+uint32_t AppIdServiceNameHash(const char *name);
+int AppIdSharedServiceStateInit(unsigned long size);
+void AppIdSharedServiceStateFini(void);
+void AppIdSharedServiceStateFlush(void);
+uint32_t AppIdSharedServiceStateLookup(sfaddr_t *ip, uint16_t proto, uint16_t port, uint32_t level);
+void AppIdSharedServiceStatePublish(sfaddr_t *ip, uint16_t proto, uint16_t port, uint32_t level,
+                                    uint32_t name_hash);
+void AppIdSharedServiceStateForget(sfaddr_t *ip, uint16_t proto, uint16_t port, uint32_t level);
+
 #endif
 
@@ -4086,8 +4086,10 @@ int SnortTelnet(FTPTELNET_GLOBAL_CONF *GlobalConf, TELNET_SESSION *TelnetSession
     if (ftppDetectCalled)
     {
         telnetPerfStats.ticks -= ftppDetectPerfStats.ticks;
+        PerfCountersSub(&telnetPerfStats.hw, &ftppDetectPerfStats.hw);
         /* And Reset ticks to 0 */
         ftppDetectPerfStats.ticks = 0;
+        memset(&ftppDetectPerfStats.hw, 0, sizeof(ftppDetectPerfStats.hw));
         ftppDetectCalled = 0;
     }
 #endif
@@ -4206,8 +4208,10 @@ int SnortFTP(FTPTELNET_GLOBAL_CONF *GlobalConf, FTP_SESSION *FTPSession,
     if (ftppDetectCalled)
     {
         ftpPerfStats.ticks -= ftppDetectPerfStats.ticks;
+        PerfCountersSub(&ftpPerfStats.hw, &ftppDetectPerfStats.hw);
         /* And Reset ticks to 0 */
         ftppDetectPerfStats.ticks = 0;
+        memset(&ftppDetectPerfStats.hw, 0, sizeof(ftppDetectPerfStats.hw));
         ftppDetectCalled = 0;
     }
 #endif
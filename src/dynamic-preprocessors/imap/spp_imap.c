@@ -292,8 +292,10 @@ static void IMAPDetect(void *pkt, void *context)
     if (PROFILING_PREPROCS && imapDetectCalled)
     {
         imapPerfStats.ticks -= imapDetectPerfStats.ticks;
+        PerfCountersSub(&imapPerfStats.hw, &imapDetectPerfStats.hw);
         /* And Reset ticks to 0 */
         imapDetectPerfStats.ticks = 0;
+        memset(&imapDetectPerfStats.hw, 0, sizeof(imapDetectPerfStats.hw));
         imapDetectCalled = 0;
     }
 #endif
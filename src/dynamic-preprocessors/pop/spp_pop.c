@@ -297,8 +297,10 @@ static void POPDetect(void *pkt, void *context)
     if (PROFILING_PREPROCS && popDetectCalled)
     {
         popPerfStats.ticks -= popDetectPerfStats.ticks;
+        PerfCountersSub(&popPerfStats.hw, &popDetectPerfStats.hw);
         /* And Reset ticks to 0 */
         popDetectPerfStats.ticks = 0;
+        memset(&popDetectPerfStats.hw, 0, sizeof(popDetectPerfStats.hw));
         popDetectCalled = 0;
     }
 #endif
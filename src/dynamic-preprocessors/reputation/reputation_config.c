@@ -41,6 +41,7 @@
 #include "reputation_utils.h"
 #include "./shmem/shmem_common.h"
 #include "./shmem/shmem_datamgmt.h"
+#include "./shmem/shmem_image.h"
 #ifdef SHARED_REP
 #include "./shmem/shmem_mgmt.h"
 #include <sys/stat.h>
@@ -75,6 +76,9 @@ enum
 
 #define MAX_ADDR_LINE_LENGTH    8192
 
+/*Image of the local IP lists, saved next to the first list file*/
+#define LOCAL_IMAGE_SUFFIX      ".img"
+
 /*
  * Keyword strings for parsing configuration options.
  */
@@ -152,6 +156,9 @@ static void IpListInit(uint32_t,ReputationConfig *config);
 static void LoadListFile(char *filename, INFO info, ReputationConfig *config);
 static void DisplayIPlistStats(ReputationConfig *);
 static void DisplayReputationConfig(ReputationConfig *);
+#ifdef SHARED_REP
+static int UpdateShmemFromFile(void*, const void*, uint32_t, const char*);
+#endif
 
 //redBorder GeoIP prototype funtions
 #ifdef REPUTATION_GEOIP
@@ -230,6 +237,48 @@ static int CheckIPlistDir(char *path)
     return 1;
 }
 
+/* ********************************************************************
+ * Function: GetImageKey
+ *
+ * The key of a shared memory image: the contents and attributes of every
+ * list file plus everything the table layout depends on.
+ *
+ * Arguments:
+ *
+ * ShmemDataFileList** file_list: the list of whitelist/blacklist files
+ * int num_files: number of files
+ * uint64_t *key: (output) the key
+ *
+ * RETURNS:
+ *     0: success
+ *     other value fails
+ *********************************************************************/
+static int GetImageKey(ShmemDataFileList** file_list, int num_files, uint64_t *key)
+{
+    uint32_t layout[6];
+    int i;
+
+    layout[0] = sizeof(table_flat_t);
+    layout[1] = sizeof(ListInfo);
+    layout[2] = sizeof(IPrepInfo);
+    layout[3] = reputation_shmem_config->numEntries;
+    layout[4] = reputation_shmem_config->memcap;
+    layout[5] = reputation_shmem_config->memsize;
+
+    *key = ShmemImageHash(SHMEM_IMAGE_KEY_INIT, layout, sizeof(layout));
+
+    for (i = 0; i < num_files; i++)
+    {
+        *key = ShmemImageHash(*key, &file_list[i]->filetype, sizeof(file_list[i]->filetype));
+        *key = ShmemImageHash(*key, &file_list[i]->listid, sizeof(file_list[i]->listid));
+        *key = ShmemImageHash(*key, file_list[i]->zones, sizeof(file_list[i]->zones));
+
+        if (ShmemImageHashFile(key, file_list[i]->filename) != SF_SUCCESS)
+            return -1;
+    }
+    return 0;
+}
+
 /* ********************************************************************
  * Function: LoadFileIntoShmem
  *
@@ -253,6 +302,9 @@ int LoadFileIntoShmem(void* ptrSegment, ShmemDataFileList** file_list, int num_f
     MEM_OFFSET list_ptr;
     ListInfo *listInfo;
     uint8_t *base;
+    char image_file[PATH_MAX];
+    uint64_t key;
+    int have_key;
 
     if (num_files > MAX_IPLIST_FILES)
     {
@@ -262,6 +314,34 @@ int LoadFileIntoShmem(void* ptrSegment, ShmemDataFileList** file_list, int num_f
         num_files = MAX_IPLIST_FILES;
     }
 
+    /*A compiled image of the same lists saves parsing them*/
+    snprintf(image_file, sizeof(image_file), "%s/%s", shmusr_ptr->path, IMAGE_FILENAME);
+    have_key = !GetImageKey(file_list, num_files, &key);
+
+    if (have_key && (ShmemImageLoad(image_file, key, ptrSegment,
+            reputation_shmem_config->memsize) == SF_SUCCESS) &&
+        (((table_flat_t *)ptrSegment)->mem_used >= sizeof(table_flat_t)) &&
+        (((table_flat_t *)ptrSegment)->mem_used <= reputation_shmem_config->memsize))
+    {
+        table = (table_flat_t *)ptrSegment;
+        base = (uint8_t *)ptrSegment;
+
+        /*The statistics and later allocations use this segment*/
+        segment_meminit((uint8_t*)ptrSegment, reputation_shmem_config->memsize);
+        segment_malloc(table->mem_used);
+
+        reputation_shmem_config->iplist = table;
+        reputation_shmem_config->listInfo = (ListInfo *)&base[table->list_info];
+        reputation_shmem_config->memCapReached = false;
+        total_duplicates = 0;
+        total_invalids = 0;
+
+        _dpd.logMsg("    Loaded IP lists from image %s\n", image_file);
+        _dpd.logMsg("Reputation Preprocessor shared memory summary:\n");
+        DisplayIPlistStats(reputation_shmem_config);
+        return 0;
+    }
+
     segment_meminit((uint8_t*)ptrSegment, reputation_shmem_config->memsize);
 
     /*DIR_16x7_4x4 for performance, but memory usage is high
@@ -289,6 +369,7 @@ int LoadFileIntoShmem(void* ptrSegment, ShmemDataFileList** file_list, int num_f
 
     listInfo = (ListInfo *)&base[list_ptr];
     table->list_info = list_ptr;
+    table->list_count = num_files;
 
     reputation_shmem_config->listInfo = listInfo;
 
@@ -306,6 +387,14 @@ int LoadFileIntoShmem(void* ptrSegment, ShmemDataFileList** file_list, int num_f
         list_ptr += sizeof(ListInfo);
 
     }
+    table->mem_used = reputation_shmem_config->memsize - segment_unusedmem();
+
+    /*Only complete lists are worth keeping*/
+    if (have_key && !reputation_shmem_config->memCapReached &&
+        (ShmemImageSave(image_file, key, ptrSegment, table->mem_used) == SF_SUCCESS))
+    {
+        _dpd.logMsg("    Saved IP lists to image %s\n", image_file);
+    }
 
     _dpd.logMsg("Reputation Preprocessor shared memory summary:\n");
     DisplayIPlistStats(reputation_shmem_config);
@@ -364,7 +453,8 @@ uint32_t GetSegmentSizeFromFileList(ShmemDataFileList** file_list, int file_coun
     {
         return ZEROSEG;
     }
-    reputation_shmem_config->numEntries = totalLines + 1;
+    /*Leave room for entries added by updates, see UpdateShmemFromFile*/
+    reputation_shmem_config->numEntries = totalLines + (totalLines >> 4) + 1;
 
     reputation_shmem_config->memsize =  estimateSizeFromEntries(reputation_shmem_config->numEntries, reputation_shmem_config->memcap);
     return reputation_shmem_config->memsize;
@@ -456,7 +546,7 @@ void initShareMemory(struct _SnortConfig *sc, void *conf)
     switch_state = SWITCHING;
     reputation_shmem_config = config;
     if (InitShmemDataMgmtFunctions(InitPerProcessZeroSegment,
-            GetSegmentSizeFromFileList,LoadFileIntoShmem))
+            GetSegmentSizeFromFileList,LoadFileIntoShmem,UpdateShmemFromFile))
     {
         DynamicPreprocessorFatalMessage("Unable to initialize DataManagement functions\n");
     }
@@ -484,6 +574,55 @@ void initShareMemory(struct _SnortConfig *sc, void *conf)
     }
     SetupReputationUpdate(config->sharedMem.updateInterval);
 }
+
+/* ********************************************************************
+ * Function: compileShareMemoryImage
+ *
+ * Compile the IP lists into an image in the IP list directory, so the
+ * shared memory writer can load it instead of parsing the lists.
+ * This is called during initialization in test mode (-T)
+ *
+ * Arguments:
+ *
+ * ReputationConfig *config: the configure file
+ *
+ * RETURNS: Nothing.
+ *********************************************************************/
+void compileShareMemoryImage(struct _SnortConfig *sc, void *conf)
+{
+    ReputationConfig *config = (ReputationConfig *)conf;
+    uint32_t size;
+    void *segment;
+
+    /*Only records the list directory and segment names as the writer would,
+     *no shared memory is created or attached. Test mode runs as the writer
+     *whatever instance it was given, the image is the writer's.*/
+    reputation_shmem_config = config;
+    if (InitShmemUser(SHMEM_SERVER_ID, WRITE, IPREP, getInstancesGroupId(),
+            NUMA_0, config->sharedMem.path, config->sharedMem.updateInterval,
+            config->sharedMem.maxInstances) != SF_SUCCESS)
+    {
+        _dpd.errMsg("Reputation preprocessor: Unable to compile IP list image.\n");
+        return;
+    }
+
+    if ((GetSortedListOfShmemDataFiles() == SF_SUCCESS) &&
+        ((size = GetSegmentSizeFromFileList(filelist_ptr, filelist_count)) != ZEROSEG))
+    {
+        if ((segment = calloc(1, size)) == NULL)
+        {
+            DynamicPreprocessorFatalMessage("Failed to allocate memory for "
+                    "reputation image\n");
+        }
+        LoadFileIntoShmem(segment, filelist_ptr, filelist_count);
+        free(segment);
+    }
+
+    reputation_shmem_config->iplist = NULL;
+    reputation_shmem_config->listInfo = NULL;
+    FreeShmemDataFileList();
+    FreeShmemUser();
+}
 #endif
 /* ********************************************************************
  * Function: DisplayIPlistStats
@@ -603,6 +742,7 @@ static void IpListInit(uint32_t maxEntries, ReputationConfig *config)
         }
 
         segment_meminit((uint8_t*)config->localSegment,mem_size);
+        config->memsize = mem_size;
         base = (uint8_t *)config->localSegment;
 
         /*DIR_16x7_4x4 for performance, but memory usage is high
@@ -1408,6 +1548,407 @@ static void LoadListFile(char *filename, INFO info, ReputationConfig *config)
     fclose(fp);
 }
 
+#ifdef SHARED_REP
+/* List index that removeEntryInfo() takes out of the entries it visits */
+static char removeListIndex;
+
+/*********************************************************************
+ * Remove a list from the IP reputation information, the opposite
+ * of updateEntryInfo().
+ *
+ * Entries inside the range lose the list as well, and an entry that
+ * splits a less specific one keeps what it inherited from it, except
+ * for the list.
+ *
+ * Arguments:
+ *
+ * INFO *current: (address to the location of) current IP reputation information
+ * INFO new: (location of) new IP reputation information
+ * uint8_t *base: the base pointer in shared memory
+ * SaveDest saveDest: whether to update reputation at current location
+ *                    or update at new location
+ *
+ * Returns: number of bytes allocated, -1 if out of memory
+ *
+ *********************************************************************/
+static int64_t removeEntryInfo (INFO *current, INFO new, SaveDest saveDest, uint8_t *base)
+{
+    IPrepInfo *destInfo;
+    IPrepInfo *readInfo;
+    IPrepInfo *writeInfo;
+    int64_t bytesAllocated = 0;
+    int i, j = 0;
+
+    if(!(*current))
+    {
+        *current = segment_calloc(1,sizeof(IPrepInfo));
+        if (!(*current))
+        {
+            return -1;
+        }
+        bytesAllocated = sizeof(IPrepInfo);
+    }
+
+    if (SAVE_TO_NEW == saveDest)
+    {
+        int bytesDuplicated;
+
+        destInfo = (IPrepInfo *)&base[new];
+
+        if ((bytesDuplicated = duplicateInfo(destInfo,
+                (IPrepInfo *)&base[*current], base)) < 0)
+            return -1;
+        else
+            bytesAllocated += bytesDuplicated;
+    }
+    else
+    {
+        destInfo = (IPrepInfo *)&base[*current];
+    }
+
+    /* Shift the other indexes down over the removed one, so the order
+     * (and priority) of the remaining lists is preserved */
+    readInfo = writeInfo = destInfo;
+
+    while (readInfo)
+    {
+        for (i = 0; i < NUM_INDEX_PER_ENTRY; i++)
+        {
+            char index = readInfo->listIndexes[i];
+
+            if (!index)
+                break;
+
+            if (index == removeListIndex)
+                continue;
+
+            if (j == NUM_INDEX_PER_ENTRY)
+            {
+                writeInfo = (IPrepInfo *)&base[writeInfo->next];
+                j = 0;
+            }
+            writeInfo->listIndexes[j++] = index;
+        }
+        readInfo = readInfo->next ? (IPrepInfo *)&base[readInfo->next] : NULL;
+    }
+
+    for (i = j; i < NUM_INDEX_PER_ENTRY; i++)
+        writeInfo->listIndexes[i] = 0;
+
+    /* The segment is never freed, what is left is only unlinked */
+    writeInfo->next = 0;
+
+    return bytesAllocated;
+}
+
+/*********************************************************************
+ * Check whether IP reputation information has the list that
+ * removeEntryInfo() takes out.
+ *
+ * Arguments:
+ *
+ * INFO info: (location of) IP reputation information
+ * uint8_t *base: the base pointer in shared memory
+ *
+ * Returns: 1 if the list is in the information, 0 otherwise
+ *
+ *********************************************************************/
+static int hasRemovedList (INFO info, uint8_t *base)
+{
+    IPrepInfo *repInfo = (IPrepInfo *)&base[info];
+    int i;
+
+    while (repInfo)
+    {
+        for (i = 0; i < NUM_INDEX_PER_ENTRY; i++)
+        {
+            if (!repInfo->listIndexes[i])
+                break;
+            if (repInfo->listIndexes[i] == removeListIndex)
+                return 1;
+        }
+        repInfo = repInfo->next ? (IPrepInfo *)&base[repInfo->next] : NULL;
+    }
+
+    return 0;
+}
+
+/********************************************************************
+ * Function: RemoveIPfromList
+ *
+ * Remove ip address from a list
+ *
+ * Arguments:
+ *  sfcidr_t *: ip address
+ *  char: the index of the list
+ *  ReputationConfig *:      The configuration to be update.
+ *
+ * Returns:
+ *  IP_INSERT_SUCCESS=0,
+ *  IP_INSERT_FAILURE,
+ *  IP_MEM_ALLOC_FAILURE
+ *
+ ********************************************************************/
+static int RemoveIPfromList(sfcidr_t *ipAddr, char listIndex, ReputationConfig *config)
+{
+    int iRet;
+
+    removeListIndex = listIndex;
+
+    /* Inserting the range takes a table entry and memory from the update
+     * headroom even when there is nothing to remove */
+    if (!sfrt_flat_range_match(ipAddr, (unsigned char)ipAddr->bits,
+            config->iplist, &hasRemovedList))
+        return IP_INSERT_SUCCESS;
+
+    iRet = sfrt_flat_insert(ipAddr, (unsigned char)ipAddr->bits, 0, RT_FAVOR_ALL,
+            config->iplist, &removeEntryInfo);
+
+    if (RT_SUCCESS == iRet)
+    {
+        if (sfrt_flat_usage(config->iplist) > (config->memcap << 20))
+            return IP_MEM_ALLOC_FAILURE;
+        return IP_INSERT_SUCCESS;
+    }
+    else if (MEM_ALLOC_FAILURE == iRet)
+        return IP_MEM_ALLOC_FAILURE;
+
+    return IP_INSERT_FAILURE;
+}
+
+/********************************************************************
+ * Function: ProcessUpdateLine
+ *
+ * Process one line of an update file:
+ *
+ *   +<ip address>[/<bits>] <list id>   add the address to the list
+ *   -<ip address>[/<bits>] <list id>   remove the address from the list
+ *
+ * Arguments:
+ *  line: the line
+ *  ipInfo: the information for each list index, created when first needed
+ *  ReputationConfig *:  The configuration to be update.
+ *
+ * Returns:
+ *  IP_INSERT_SUCCESS,
+ *  IP_INVALID,
+ *  IP_INSERT_FAILURE,
+ *  IP_INSERT_DUPLICATE,
+ *  IP_MEM_ALLOC_FAILURE
+ *
+ ********************************************************************/
+static int ProcessUpdateLine(char *line, MEM_OFFSET *ipInfo, ReputationConfig *config)
+{
+    sfcidr_t address;
+    char *addr, *id, *end, *save;
+    ListInfo *listInfo;
+    unsigned long listId;
+    uint32_t i;
+    uint8_t listIndex;
+    char op;
+
+    while (isspace((int)*line))
+        line++;
+
+    if (*line == '\0')
+        return IP_INSERT_SUCCESS;
+
+    op = *line++;
+
+    if ((op != '+') && (op != '-'))
+        return IP_INVALID;
+
+    addr = strtok_r(line, REPUTATION_SEPARATORS, &save);
+    id = strtok_r(NULL, REPUTATION_SEPARATORS, &save);
+
+    if (!addr || !id || strtok_r(NULL, REPUTATION_SEPARATORS, &save))
+        return IP_INVALID;
+
+    if (snort_pton(addr, &address) < 1)
+        return IP_INVALID;
+
+    errno = 0;
+    listId = strtoul(id, &end, 10);
+
+    if (*end || errno || (listId > MAX_LIST_ID))
+        return IP_INVALID;
+
+    listInfo = config->listInfo;
+
+    for (i = 0; i < config->iplist->list_count; i++)
+    {
+        if (listInfo[i].listId == (uint32_t)listId)
+            break;
+    }
+
+    if (i == config->iplist->list_count)
+        return IP_INVALID;
+
+    listIndex = listInfo[i].listIndex;
+
+    if (op == '-')
+        return RemoveIPfromList(&address, listIndex, config);
+
+    if (!ipInfo[listIndex])
+    {
+        uint8_t *base = (uint8_t *)config->iplist;
+
+        if (!(ipInfo[listIndex] = segment_calloc(1,sizeof(IPrepInfo))))
+            return IP_MEM_ALLOC_FAILURE;
+
+        ((IPrepInfo *)&base[ipInfo[listIndex]])->listIndexes[0] = listIndex;
+    }
+
+    return AddIPtoList(&address, ipInfo[listIndex], config);
+}
+
+/* ********************************************************************
+ * Function: UpdateShmemFromFile
+ *
+ * Call back function for shared memory
+ * This is called to apply an update file to the active IP list without
+ * loading the list files again. The active segment is copied as is,
+ * everything in it is an offset, and the update is applied to the copy.
+ * An update that doesn't fit fails as a whole; reloading the list
+ * files rebuilds the table.
+ *
+ * Arguments:
+ *
+ * void* ptrSegment: start of the new shared memory segment.
+ * const void* activeSegment: start of the active segment.
+ * uint32_t size: size of both segments
+ * const char *filename: the update file
+ *
+ * RETURNS:
+ *     0: success
+ *     other value fails
+ *********************************************************************/
+static int UpdateShmemFromFile(void* ptrSegment, const void* activeSegment,
+        uint32_t size, const char *filename)
+{
+    const table_flat_t *active = (const table_flat_t *)activeSegment;
+    MEM_OFFSET ipInfo[MAX_IPLIST_FILES + 1];
+    char linebuf[MAX_ADDR_LINE_LENGTH];
+    table_flat_t *table;
+    uint8_t *base;
+    FILE *fp;
+    char *cmt;
+    int addrline = 0;
+    unsigned int added = 0, removed = 0, invalid_count = 0;
+    uint32_t num_loaded_before;
+
+    if (!active->list_count || (active->mem_used < sizeof(*active)) ||
+        (active->mem_used > size))
+    {
+        _dpd.errMsg("Reputation preprocessor: IP list in shared memory "
+                "can't be updated, reload the IP lists instead.\n");
+        return -1;
+    }
+
+    if ((fp = fopen(filename, "r")) == NULL)
+    {
+        char errBuf[STD_BUF];
+        strerror_r(errno, errBuf, STD_BUF);
+        errBuf[STD_BUF-1] = '\0';
+        _dpd.errMsg("Reputation preprocessor: Unable to open update file %s, Error: %s\n",
+                filename, errBuf);
+        return -1;
+    }
+
+    memcpy(ptrSegment, activeSegment, active->mem_used);
+    segment_meminit((uint8_t*)ptrSegment, size);
+    segment_malloc(active->mem_used);
+
+    table = (table_flat_t *)ptrSegment;
+    base = (uint8_t *)ptrSegment;
+
+    reputation_shmem_config->iplist = table;
+    reputation_shmem_config->listInfo = (ListInfo *)&base[table->list_info];
+    reputation_shmem_config->memsize = size;
+    reputation_shmem_config->numEntries = table->max_size;
+    reputation_shmem_config->memCapReached = false;
+
+    memset(ipInfo, 0, sizeof(ipInfo));
+    num_loaded_before = sfrt_flat_num_entries(table);
+
+    _dpd.logMsg("    Processing update file %s\n", filename);
+
+    while( fgets(linebuf, MAX_ADDR_LINE_LENGTH, fp) )
+    {
+        int iRet;
+        char *line = linebuf;
+        addrline++;
+
+        // Remove comments
+        if( (cmt = strchr(linebuf, '#')) )
+            *cmt = '\0';
+
+        // Remove newline as well, prevent double newline in logging.
+        if( (cmt = strchr(linebuf, '\n')) )
+            *cmt = '\0';
+
+        while (isspace((int)*line))
+            line++;
+
+        if (*line == '\0')
+            continue;
+
+        if (*line == '-')
+            removed++;
+        else
+            added++;
+
+        iRet = ProcessUpdateLine(line, ipInfo, reputation_shmem_config);
+
+        if ((IP_INSERT_SUCCESS == iRet) || (IP_INSERT_DUPLICATE == iRet))
+        {
+            continue;
+        }
+        else if (IP_INVALID == iRet)
+        {
+            if (*line == '-')
+                removed--;
+            else
+                added--;
+
+            if (invalid_count++ < MAX_MSGS_TO_PRINT)
+                _dpd.errMsg("      (%d) => Invalid update: \'%s\'\n", addrline, linebuf);
+        }
+        else
+        {
+            _dpd.errMsg("WARNING: %s(%d) => %s when updating IP Address: %s, "
+                "reload the IP lists instead\n", filename, addrline,
+                (IP_MEM_ALLOC_FAILURE == iRet) ? "Memcap reached" : "IP list full",
+                linebuf);
+
+            if (reputation_shmem_config->statusBuf)
+            {
+                snprintf(reputation_shmem_config->statusBuf,
+                    reputation_shmem_config->statusBuf_len,
+                    "WARNING: %s(%d) => %s when updating IP Address: %s, "
+                    "reload the IP lists instead\n", filename, addrline,
+                    (IP_MEM_ALLOC_FAILURE == iRet) ? "Memcap reached" : "IP list full",
+                    linebuf);
+            }
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+
+    if (invalid_count > MAX_MSGS_TO_PRINT)
+        _dpd.errMsg("    Additional invalid updates were not listed.\n");
+
+    table->mem_used = size - segment_unusedmem();
+
+    _dpd.logMsg("    Reputation updates applied: %u added, %u removed, "
+            "%u new entries, invalid: %u (from file %s)\n", added, removed,
+            sfrt_flat_num_entries(table) - num_loaded_before,
+            invalid_count, filename);
+    return 0;
+}
+#endif
+
 /********************************************************************
  * Function: Reputation_FreeConfig
  *
@@ -1454,6 +1995,11 @@ void Reputation_FreeConfig (ReputationConfig *config)
         GeoIP_delete(config->geoip);
         config->geoip=NULL;
     }
+
+    if (config->geoip_index) {
+        free(config->geoip_index);
+        config->geoip_index = NULL;
+    }
 #endif
 
     free(config);
@@ -1642,6 +2188,132 @@ static int EstimateNumEntries(ReputationConfig *config, u_char* argp)
     return totalLines;
 }
 
+/* ********************************************************************
+ * Function: GetLocalImageKey
+ *
+ * The key of a local IP list image: the configuration arguments, the
+ * contents of every list file they name and the table layout. The image
+ * is named after the first list file.
+ *
+ * Arguments:
+ *
+ * ReputationConfig *config: Reputation preprocessor configuration.
+ * u_char* argp: the configuration arguments
+ * char *image_file: (output) the image file name, of PATH_MAX + 1 bytes
+ * uint64_t *key: (output) the key
+ *
+ * RETURNS:
+ *     0: success
+ *     other value fails
+ *********************************************************************/
+static int GetLocalImageKey(ReputationConfig *config, u_char* argp,
+        char *image_file, uint64_t *key)
+{
+    char* cur_sectionp = NULL;
+    char* next_sectionp = NULL;
+    char* argcpyp = NULL;
+    uint32_t layout[6];
+    int rval = 0;
+
+    layout[0] = sizeof(table_flat_t);
+    layout[1] = sizeof(ListInfo);
+    layout[2] = sizeof(IPrepInfo);
+    layout[3] = config->numEntries;
+    layout[4] = config->memcap;
+    layout[5] = config->memsize;
+
+    *key = ShmemImageHash(SHMEM_IMAGE_KEY_INIT, layout, sizeof(layout));
+    *key = ShmemImageHash(*key, argp, strlen((char *)argp));
+    image_file[0] = '\0';
+
+    argcpyp = strdup( (char*) argp );
+
+    if ( !argcpyp )
+        return -1;
+
+    cur_sectionp = strtok_r( argcpyp, REPUTATION_CONFIG_SECTION_SEPERATORS, &next_sectionp);
+
+    while ( cur_sectionp && !rval )
+    {
+        char full_path_filename[PATH_MAX+1];
+        char* next_tokenp = NULL;
+        char* cur_tokenp =  strtok_r( cur_sectionp, REPUTATION_CONFIG_VALUE_SEPERATORS, &next_tokenp);
+
+        if (cur_tokenp && (!strcasecmp( cur_tokenp, REPUTATION_BLACKLIST_KEYWORD )
+                ||!strcasecmp( cur_tokenp, REPUTATION_WHITELIST_KEYWORD )))
+        {
+            cur_tokenp = strtok_r( next_tokenp, REPUTATION_CONFIG_VALUE_SEPERATORS, &next_tokenp);
+
+            /*Checked by EstimateNumEntries already*/
+            if (cur_tokenp)
+            {
+                UpdatePathToFile(full_path_filename, PATH_MAX, cur_tokenp);
+
+                if (!image_file[0] && (strlen(full_path_filename) +
+                        sizeof(LOCAL_IMAGE_SUFFIX) > PATH_MAX + 1))
+                    rval = -1;
+                else if (!image_file[0])
+                    snprintf(image_file, PATH_MAX + 1, "%s%s",
+                            full_path_filename, LOCAL_IMAGE_SUFFIX);
+
+                if (!rval && (ShmemImageHashFile(key, full_path_filename) != SF_SUCCESS))
+                    rval = -1;
+            }
+        }
+
+        cur_sectionp = strtok_r( next_sectionp, REPUTATION_CONFIG_SECTION_SEPERATORS, &next_sectionp);
+    }
+
+    free(argcpyp);
+
+    if (!image_file[0])
+        return -1;
+
+    return rval;
+}
+
+/* ********************************************************************
+ * Function: LoadLocalImage
+ *
+ * Copy a valid image of the local IP lists into the local segment, in
+ * place of the table IpListInit created. The table is always the first
+ * allocation, so offsets in the image are valid in the local segment.
+ *
+ * Arguments:
+ *
+ * ReputationConfig *config: Reputation preprocessor configuration.
+ * char *image_file: the image file name
+ * uint64_t key: the key of the image
+ *
+ * RETURNS:
+ *     0: success
+ *     other value fails
+ *********************************************************************/
+static int LoadLocalImage(ReputationConfig *config, char *image_file, uint64_t key)
+{
+    table_flat_t *table;
+
+    if (ShmemImageLoad(image_file, key, config->localSegment,
+            config->memsize) != SF_SUCCESS)
+        return -1;
+
+    table = (table_flat_t *)config->localSegment;
+
+    if ((table->mem_used < sizeof(*table)) || (table->mem_used > config->memsize))
+    {
+        DynamicPreprocessorFatalMessage("Reputation preprocessor: Invalid IP list "
+                "image %s, remove it and restart.\n", image_file);
+    }
+
+    /*Later allocations, GeoIP lists, go after the loaded table*/
+    segment_meminit((uint8_t*)config->localSegment, config->memsize);
+    segment_malloc(table->mem_used);
+    config->iplist = table;
+
+    _dpd.logMsg("    Loaded IP lists from image %s\n", image_file);
+    return 0;
+}
+
 /*********************************************************************
  * Function: ParseReputationArgs
  *
@@ -1660,6 +2332,10 @@ void ParseReputationArgs(ReputationConfig *config, u_char* argp)
     char* cur_sectionp = NULL;
     char* next_sectionp = NULL;
     char* argcpyp = NULL;
+    char image_file[PATH_MAX+1];
+    uint64_t key;
+    int have_key = 0;
+    int image_loaded = 0;
 #ifdef SHARED_REP
     long nprocs;
 #endif
@@ -1730,8 +2406,15 @@ void ParseReputationArgs(ReputationConfig *config, u_char* argp)
         return;
     }
     if (!config->sharedMem.path)
+    {
         IpListInit(config->numEntries + 1,config);
 
+        /*A compiled image of the same lists saves parsing them*/
+        have_key = !GetLocalImageKey(config, argp, image_file, &key);
+        if (have_key)
+            image_loaded = !LoadLocalImage(config, image_file, key);
+    }
+
     cur_sectionp = strtok_r( argcpyp, REPUTATION_CONFIG_SECTION_SEPERATORS, &next_sectionp);
     DEBUG_WRAP(DebugMessage(DEBUG_REPUTATION, "Arguments token: %s\n",cur_sectionp ););
     /*Reset the log message count*/
@@ -1774,7 +2457,10 @@ void ParseReputationArgs(ReputationConfig *config, u_char* argp)
                         *(_dpd.config_file), *(_dpd.config_line));
             }
             if (!config->sharedMem.path)
-                LoadListFile(cur_tokenp, config->local_black_ptr, config);
+            {
+                if (!image_loaded)
+                    LoadListFile(cur_tokenp, config->local_black_ptr, config);
+            }
             else
             {
                 _dpd.logMsg("WARNING: %s(%d) => List file %s is not loaded "
@@ -1794,7 +2480,10 @@ void ParseReputationArgs(ReputationConfig *config, u_char* argp)
             }
 
             if (!config->sharedMem.path)
-                LoadListFile(cur_tokenp, config->local_white_ptr, config);
+            {
+                if (!image_loaded)
+                    LoadListFile(cur_tokenp, config->local_white_ptr, config);
+            }
             else
             {
                 _dpd.logMsg("WARNING: %s(%d) => List file %s is not loaded "
@@ -2041,6 +2730,13 @@ void ParseReputationArgs(ReputationConfig *config, u_char* argp)
         DEBUG_WRAP(DebugMessage(DEBUG_REPUTATION, "Arguments token: %s\n",cur_sectionp ););
     }
 
+    /*Save the lists for the next start, unless they didn't fit*/
+    if (have_key && !image_loaded && !config->memCapReached)
+    {
+        config->iplist->mem_used = config->memsize - segment_unusedmem();
+        ShmemImageSave(image_file, key, config->localSegment, config->iplist->mem_used);
+    }
+
 #ifdef REPUTATION_GEOIP
     //redBorder: Open GeoIP database
     if (config->geoip_db) {
@@ -2345,6 +3041,244 @@ void LoadGeoListFile(DataGeoFileList *listItem, ReputationConfig *config)
     fclose(fp);
 }
 
+/********************************************************************
+ * GeoIP index
+ *
+ * Networks of the countries that have an action are copied out of the
+ * GeoIP database into a flat sfrt table keyed by binary address, so
+ * per packet lookups neither format the address nor parse it back.
+ * The networks are the leaves of the database trie: a lookup reports
+ * the prefix length of the leaf it ended in and the walk steps to the
+ * first address after it.
+ ********************************************************************/
+typedef struct _GeoIndexBuild
+{
+    ReputationConfig *config;
+    table_flat_t *table;    /* NULL while counting */
+    MEM_OFFSET info_ptr;    /* GeoIPrepInfo for each country */
+    uint32_t numNetworks;
+    int failed;
+
+} GeoIndexBuild;
+
+static int64_t updateGeoEntryInfo(INFO *current, INFO new, SaveDest saveDest, uint8_t *base)
+{
+    *current = new;
+    return 0;
+}
+
+static void GeoIndexAddNetwork(GeoIndexBuild *build, const void *addr, int family,
+        int len, int countryId)
+{
+    sfcidr_t network;
+    int iRet;
+
+    if ((countryId <= 0) || (countryId >= GeoIP_num_countries()) ||
+        (DECISION_NULL == build->config->geoip_actions[countryId]))
+        return;
+
+    build->numNetworks++;
+
+    if (!build->table)
+        return;
+
+    sfip_set_raw(&network.addr, addr, family);
+    network.bits = (family == AF_INET) ? len + 96 : len;
+
+    iRet = sfrt_flat_insert(&network, (unsigned char)network.bits,
+            build->info_ptr + countryId * sizeof(GeoIPrepInfo), RT_FAVOR_SPECIFIC,
+            build->table, &updateGeoEntryInfo);
+
+    if (RT_SUCCESS != iRet)
+        build->failed = 1;
+}
+
+static int GeoIndexWalkIPv4(GeoIndexBuild *build)
+{
+    GeoIP *gi = build->config->geoip;
+    uint64_t ipnum = 0;
+
+    while (ipnum <= UINT32_MAX)
+    {
+        int countryId = GeoIP_id_by_ipnum(gi, (unsigned long)ipnum);
+        int len = GeoIP_last_netmask(gi);
+        uint32_t addr;
+
+        if ((len <= 0) || (len > 32))
+            return -1;
+
+        addr = htonl((uint32_t)ipnum);
+        GeoIndexAddNetwork(build, &addr, AF_INET, len, countryId);
+
+        if (build->failed)
+            return -1;
+
+        ipnum += (uint64_t)1 << (32 - len);
+    }
+    return 0;
+}
+
+/* Steps addr to the first address after the /len network,
+ * returns nonzero once the whole space has been walked */
+static int GeoIndexNextNetwork6(geoipv6_t *addr, int len)
+{
+    int i = (len - 1) >> 3;
+    unsigned carry = 1 << (7 - ((len - 1) & 7));
+
+    for ( ; i >= 0; i--)
+    {
+        carry += addr->s6_addr[i];
+        addr->s6_addr[i] = (uint8_t)carry;
+        carry >>= 8;
+
+        if (!carry)
+            return 0;
+    }
+    return 1;
+}
+
+static int GeoIndexWalkIPv6(GeoIndexBuild *build)
+{
+    GeoIP *gi = build->config->geoip;
+    geoipv6_t ipnum;
+    int len;
+
+    memset(&ipnum, 0, sizeof(ipnum));
+
+    do
+    {
+        int countryId = GeoIP_id_by_ipnum_v6(gi, ipnum);
+        len = GeoIP_last_netmask(gi);
+
+        if ((len <= 0) || (len > 128))
+            return -1;
+
+        /* IPv4 networks are stored as ::a.b.c.d or ::ffff:a.b.c.d */
+        if ((len >= 96) && !ipnum.s6_addr32[0] && !ipnum.s6_addr32[1] &&
+            (!ipnum.s6_addr32[2] || (ipnum.s6_addr32[2] == htonl(0xffff))))
+        {
+            GeoIndexAddNetwork(build, &ipnum.s6_addr32[3], AF_INET, len - 96, countryId);
+        }
+        else
+        {
+            GeoIndexAddNetwork(build, &ipnum, AF_INET6, len, countryId);
+        }
+
+        if (build->failed)
+            return -1;
+
+    } while (!GeoIndexNextNetwork6(&ipnum, len));
+
+    return 0;
+}
+
+static void GeoIndexInit(ReputationConfig *config)
+{
+    GeoIndexBuild build;
+    int (*walk)(GeoIndexBuild *);
+    char tableType;
+    uint64_t size;
+    uint8_t *segment;
+
+    if (!config->geoip || !config->geoip_actions || !config->geoip_enabled)
+        return;
+
+    /* DIR_16x7_4x4 takes 5 steps for IPv4 but a 16 bit table for every new
+     * IPv6 prefix, so IPv6 databases use the DIR_8x16 of the IP lists */
+    switch (GeoIP_database_edition(config->geoip))
+    {
+    case GEOIP_COUNTRY_EDITION:
+        walk = GeoIndexWalkIPv4;
+        tableType = DIR_16x7_4x4;
+        break;
+    case GEOIP_COUNTRY_EDITION_V6:
+        walk = GeoIndexWalkIPv6;
+        tableType = DIR_8x16;
+        break;
+    default:
+        _dpd.logMsg("    Reputation GeoIP index: unsupported database edition, "
+                "using database lookups\n");
+        return;
+    }
+
+    memset(&build, 0, sizeof(build));
+    build.config = config;
+
+    if (walk(&build))
+    {
+        _dpd.logMsg("    Reputation GeoIP index: failed to walk %s, "
+                "using database lookups\n", config->geoip_db);
+        return;
+    }
+
+    /*Worst case 4 IPv4 sub tables per network, IPv6 as the IP lists*/
+    if (DIR_16x7_4x4 == tableType)
+        size = ((uint64_t)build.numNetworks << 9) + (2 << 20);
+    else
+        size = estimateSizeFromEntries(build.numNetworks, config->memcap);
+
+    if (size > ((uint64_t)config->memcap << 20))
+        size = (uint64_t)config->memcap << 20;
+
+    if ((segment = malloc(size)) == NULL)
+    {
+        DynamicPreprocessorFatalMessage(
+                "Failed to allocate memory for GeoIP index\n");
+    }
+    segment_meminit(segment, size);
+
+    build.table = sfrt_flat_new(tableType, IPv6, build.numNetworks + 1,
+            (uint32_t)((size + (1 << 20) - 1) >> 20));
+
+    if ((build.table == NULL) ||
+        !(build.info_ptr = segment_calloc(GeoIP_num_countries(), sizeof(GeoIPrepInfo))))
+    {
+        segment_meminit(NULL, 0);
+        free(segment);
+        _dpd.logMsg("    Reputation GeoIP index: not enough memory, "
+                "using database lookups\n");
+        return;
+    }
+
+    {
+        GeoIPrepInfo *info = (GeoIPrepInfo *)&segment[build.info_ptr];
+        int i;
+
+        for (i = 0; i < GeoIP_num_countries(); i++)
+            info[i].countryId = (uint16_t)i;
+    }
+
+    build.numNetworks = 0;
+
+    if (walk(&build))
+    {
+        segment_meminit(NULL, 0);
+        free(segment);
+        _dpd.logMsg("    Reputation GeoIP index: not enough memory, "
+                "using database lookups\n");
+        return;
+    }
+
+    /* the allocator must not keep pointing at the index, the IP list
+     * paths set their own segment before they allocate */
+    size -= segment_unusedmem();
+    segment_meminit(NULL, 0);
+
+    /* the table is addressed relative to its base, copy out what it uses */
+    if ((config->geoip_index = (table_flat_t *)malloc(size)) != NULL)
+    {
+        memcpy(config->geoip_index, segment, size);
+        free(segment);
+    }
+    else
+        config->geoip_index = (table_flat_t *)segment;
+
+    config->geoip_index_entries = build.numNetworks;
+
+    _dpd.logMsg("    Reputation GeoIP index: %u networks, %u bytes\n",
+            config->geoip_index_entries, (uint32_t)size);
+}
+
 void initGeoFilesWithManifiest(struct _SnortConfig * sc, void *conf)
 {
     FILE *fp;
@@ -2404,6 +3338,7 @@ void initGeoFilesWithManifiest(struct _SnortConfig * sc, void *conf)
 
     _dpd.logMsg("Reputation GeoIP files processed: \n");
     DisplayGeoIPStats(config);
+    GeoIndexInit(config);
 
 #ifdef DEBUG_MSGS
     GeoReputationPrintRepInfo(config);
@@ -122,6 +122,7 @@ typedef struct _reputationConfig
     uint32_t memsize;
     bool memCapReached;
     table_flat_t *iplist;
+    uint32_t generation;         /* changes whenever lookups may answer differently */
     ListInfo *listInfo;
     int ref_count;
     char *statusBuf;
@@ -134,6 +135,8 @@ typedef struct _reputationConfig
     char * geoip_path;           //redBorder -> GeoIP files location
     IPdecision * geoip_actions;  //redBorder -> Actions for each country. DECISION_NULL (no decission) should be the default action for each country
     int geoip_enabled;           //redBorder -> Enable GeoIP flag. If 1, geoip is enabled. To have it enabled it must have valid countries 
+    table_flat_t *geoip_index;   //redBorder -> Country id of every network with an action, NULL to look the address up in the GeoIP database
+    uint32_t geoip_index_entries;
 #endif
 
 
@@ -147,6 +150,12 @@ typedef struct _IPrepInfo{
     MEM_OFFSET    next;
 } IPrepInfo;
 
+#ifdef REPUTATION_GEOIP
+typedef struct _GeoIPrepInfo{
+    uint16_t countryId;
+} GeoIPrepInfo;
+#endif
+
 
 /********************************************************************
  * Public function prototypes
@@ -154,6 +163,7 @@ typedef struct _IPrepInfo{
 void  Reputation_FreeConfig(ReputationConfig *);
 void  ParseReputationArgs(ReputationConfig *, u_char*);
 void initShareMemory(struct _SnortConfig *sc, void *config);
+void compileShareMemoryImage(struct _SnortConfig *sc, void *config);
 void ReputationRepInfo(IPrepInfo *, uint8_t *, char *, int);
 DEBUG_WRAP(void ReputationPrintRepInfo(IPrepInfo * repInfo, uint8_t *base);)
 
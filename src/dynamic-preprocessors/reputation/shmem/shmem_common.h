@@ -38,6 +38,7 @@
 #define WHITE_LIST      3
 
 #define VERSION_FILENAME "IPRVersion.dat"
+#define IMAGE_FILENAME "IPRImage.dat"
 #define MANIFEST_FILENAME "zone.info"
 
 #endif
@@ -89,11 +89,13 @@ typedef struct shmemDataManagmentFunctions {
     int (*CreatePerProcessZeroSegment)(void*** data_ptr);
     uint32_t (*GetSegmentSize)(ShmemDataFileList** file_list, int file_count);
     int (*LoadShmemData)(void* data_ptr, ShmemDataFileList** file_list, int file_count);
+    int (*UpdateShmemData)(void* data_ptr, const void* active_ptr, uint32_t size, const char* filename);
 } ShmemDataMgmtFunctions;
 
 typedef int      (*CreateMallocZero)(void***);
 typedef uint32_t (*GetDataSize)(ShmemDataFileList**, int);
 typedef int      (*LoadData)(void*,ShmemDataFileList**,int);
+typedef int      (*UpdateData)(void*,const void*,uint32_t,const char*);
 
 extern ShmemDataMgmtFunctions *dmfunc_ptr; 
 extern ShmemUserInfo *shmusr_ptr;
@@ -105,7 +107,7 @@ int InitShmemUser(uint32_t instance_num, int instance_type, int dataset, int gro
 
 int InitShmemDataMgmtFunctions(
     CreateMallocZero create_malloc_zero, GetDataSize get_data_size,
-    LoadData load_data);
+    LoadData load_data, UpdateData update_data);
 
 void FreeShmemUser(void);
 void FreeShmemDataMgmtFunctions(void);
@@ -0,0 +1,216 @@
+/* $Id$ */
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+// @file    shmem_image.c
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "sf_types.h"
+#include "sf_dynamic_preprocessor.h"
+#include "snort_debug.h"
+
+#include "shmem_common.h"
+#include "shmem_datamgmt.h"
+#include "shmem_image.h"
+
+#define SHMEM_IMAGE_MAGIC    "SFIPRIMG"
+#define SHMEM_IMAGE_VERSION  1
+
+typedef struct _ShmemImageHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t size;          // payload bytes
+    uint64_t key;
+    uint64_t checksum;      // of the payload
+} ShmemImageHeader;
+
+static const char* const MODULE_NAME = "ShmemImage";
+
+// a word at a time, images and data files are hashed in full on load
+uint64_t ShmemImageHash(uint64_t key, const void *data, size_t size)
+{
+    const uint8_t *b = (const uint8_t *)data;
+
+    key ^= size;
+
+    while ( size >= 8 )
+    {
+        uint64_t w;
+        memcpy(&w, b, 8);
+        key = (key ^ w) * 0x9e3779b97f4a7c15ULL;
+        key ^= key >> 29;
+        b += 8;
+        size -= 8;
+    }
+    while ( size-- )
+    {
+        key = (key ^ *b++) * 0x9e3779b97f4a7c15ULL;
+        key ^= key >> 29;
+    }
+    return key;
+}
+
+int ShmemImageHashFile(uint64_t *key, const char *filename)
+{
+    uint8_t buf[65536];
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return SF_ENOENT;
+
+    while ((n = read(fd, buf, sizeof(buf))) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            return SF_EINVAL;
+        }
+        *key = ShmemImageHash(*key, buf, n);
+    }
+    close(fd);
+    return SF_SUCCESS;
+}
+
+int ShmemImageLoad(const char *filename, uint64_t key, void *data_ptr, uint32_t size)
+{
+    const ShmemImageHeader *hdr;
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return SF_ENOENT;
+
+    if (fstat(fd, &st) || ((size_t)st.st_size < sizeof(*hdr)))
+    {
+        close(fd);
+        return SF_EINVAL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return SF_EINVAL;
+
+    hdr = (const ShmemImageHeader *)map;
+
+    if (memcmp(hdr->magic, SHMEM_IMAGE_MAGIC, sizeof(hdr->magic)) ||
+        (hdr->version != SHMEM_IMAGE_VERSION) || (hdr->key != key) ||
+        ((size_t)hdr->size != st.st_size - sizeof(*hdr)) || (hdr->size > size))
+    {
+        // stale images are expected, the data files changed since
+        DEBUG_WRAP(DebugMessage(DEBUG_REPUTATION,
+            "Image %s doesn't match the data files\n", filename););
+        munmap(map, st.st_size);
+        return SF_EINVAL;
+    }
+
+    if (hdr->checksum != ShmemImageHash(SHMEM_IMAGE_KEY_INIT, hdr + 1, hdr->size))
+    {
+        _dpd.errMsg("%s: Ignoring corrupt image %s\n", MODULE_NAME, filename);
+        munmap(map, st.st_size);
+        return SF_EINVAL;
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    memcpy(data_ptr, hdr + 1, hdr->size);
+    munmap(map, st.st_size);
+
+    return SF_SUCCESS;
+}
+
+static int WriteAll(int fd, const void *data, size_t size)
+{
+    const uint8_t *b = (const uint8_t *)data;
+
+    while (size)
+    {
+        ssize_t n = write(fd, b, size);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        b += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int ShmemImageSave(const char *filename, uint64_t key, const void *data_ptr, uint32_t size)
+{
+    char tmp[PATH_MAX];
+    ShmemImageHeader hdr;
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.%u", filename, (unsigned)getpid());
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SHMEM_IMAGE_MAGIC, sizeof(hdr.magic));
+    hdr.version = SHMEM_IMAGE_VERSION;
+    hdr.size = size;
+    hdr.key = key;
+    hdr.checksum = ShmemImageHash(SHMEM_IMAGE_KEY_INIT, data_ptr, size);
+
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        _dpd.logMsg("%s: Unable to create image %s: %s\n",
+            MODULE_NAME, tmp, strerror(errno));
+        return SF_EINVAL;
+    }
+
+    if (WriteAll(fd, &hdr, sizeof(hdr)) || WriteAll(fd, data_ptr, size))
+    {
+        _dpd.logMsg("%s: Unable to write image %s: %s\n",
+            MODULE_NAME, tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return SF_EINVAL;
+    }
+    close(fd);
+
+    // readers of the directory only ever see a whole image
+    if (rename(tmp, filename))
+    {
+        _dpd.logMsg("%s: Unable to save image %s: %s\n",
+            MODULE_NAME, filename, strerror(errno));
+        unlink(tmp);
+        return SF_EINVAL;
+    }
+    return SF_SUCCESS;
+}
@@ -0,0 +1,45 @@
+/* $Id$ */
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+// @file    shmem_image.h
+
+// On disk images of shared memory data segments. A segment only holds
+// offsets, so a copy of it is valid anywhere; loading an image is one copy
+// into the new segment instead of parsing every data file.
+
+#ifndef _SHMEMIMAGE_H_
+#define _SHMEMIMAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHMEM_IMAGE_KEY_INIT  0xcbf29ce484222325ULL
+
+// key of everything the segment is built from, chained over each part
+uint64_t ShmemImageHash(uint64_t key, const void *data, size_t size);
+int      ShmemImageHashFile(uint64_t *key, const char *filename);
+
+// copies a valid image with this key into the segment, of at most size bytes
+int      ShmemImageLoad(const char *filename, uint64_t key, void *data_ptr, uint32_t size);
+int      ShmemImageSave(const char *filename, uint64_t key, const void *data_ptr, uint32_t size);
+
+#endif
@@ -470,6 +470,75 @@ exit:
    return segment_num;
 }
 
+// writer side, copy on write of the active segment. The update is applied
+// to a copy in the unused segment, which then becomes the active one the
+// same way a reload does; readers never see a partial update.
+int UpdateSharedMemDataSegmentForWriter(const char* filename)
+{
+    int segment_num, active_segment;
+    uint32_t size;
+    void* shmem_ptr;
+    char update_file[MAX_NAME];
+
+    if ( !mgmt_ptr || !dmfunc_ptr->UpdateShmemData )
+        return SHMEM_ERR;
+
+    active_segment = mgmt_ptr->activeSegment;
+
+    if ((active_segment < 0) ||
+        (mgmt_ptr->instance[shmusr_ptr->instance_num].activeSegment != active_segment))
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_REPUTATION,
+            "No active segment to update\n"););
+        return NO_DATASEG;
+    }
+
+    if ((segment_num = FindFirstUnusedShmemSegment()) < 0)
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_REPUTATION,
+            "No more segments available, all are in use\n"););
+        return NO_DATASEG;
+    }
+
+    if (filename[0] == '/')
+        snprintf(update_file, sizeof(update_file), "%s", filename);
+    else
+        snprintf(update_file, sizeof(update_file), "%s/%s", shmusr_ptr->path, filename);
+
+    size = mgmt_ptr->segment[active_segment].size;
+    mgmt_ptr->instance[shmusr_ptr->instance_num].shmemSegActiveFlag[segment_num] = TBMAP;
+
+    if ((shmem_ptr = ShmemMap(shmusr_ptr->dataSeg[segment_num],size,WRITE)) == NULL)
+    {
+        mgmt_ptr->instance[shmusr_ptr->instance_num].shmemSegActiveFlag[segment_num] = 0;
+        return SHMEM_ERR;
+    }
+    mgmt_ptr->instance[shmusr_ptr->instance_num].shmemSegmentPtr[segment_num] = shmem_ptr;
+    mgmt_ptr->segment[segment_num].size = size;
+
+    if (dmfunc_ptr->UpdateShmemData(shmem_ptr,
+        mgmt_ptr->instance[shmusr_ptr->instance_num].shmemSegmentPtr[active_segment],
+        size, update_file) != SF_SUCCESS)
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_REPUTATION,
+            "Updating shared memory from %s failed\n", update_file););
+        ShutdownSegment(segment_num);
+        return SHMEM_ERR;
+    }
+
+    // same data set on disk, so the version doesn't change; the next
+    // reload of a new version rebuilds (and compacts) the segment
+    mgmt_ptr->segment[segment_num].version = mgmt_ptr->segment[active_segment].version;
+    mgmt_ptr->segment[segment_num].active = 1;
+    mgmt_ptr->activeSegment = segment_num;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_REPUTATION,
+        "Active segment is %d\n",mgmt_ptr->activeSegment););
+
+    ManageUnusedSegments();
+    return segment_num;
+}
+
 int InitShmemWriter(
     uint32_t instance_num, int dataset, int group_id,
     int numa_node, const char* path, void*** data_ptr,
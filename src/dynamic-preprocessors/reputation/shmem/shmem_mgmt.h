@@ -69,6 +69,7 @@ int   InitShmemWriter(uint32_t instance_num, int dataset, int group_id, int numa
                       const char* path, void*** data_ptr, uint32_t instance_polltime,
                       unsigned int max_instances);
 int   LoadSharedMemDataSegmentForWriter(int startup);
+int   UpdateSharedMemDataSegmentForWriter(const char* filename);
 void  SwitchToActiveSegment(int segment_num,void*** data_ptr);
 void  UnmapInactiveSegments(void);
 void  ManageUnusedSegments(void);
@@ -79,7 +79,7 @@ const char *PREPROC_NAME = "SF_REPUTATION";
  */
 static void ReputationInit( struct _SnortConfig *, char* );
 static int ReputationCheckConfig(struct _SnortConfig *);
-static inline void ReputationProcess(SFSnortPacket *);
+static inline void ReputationProcess(SFSnortPacket *, ReputationFlowVerdict *);
 static void ReputationMain( void*, void* );
 static void ReputationFreeConfig(tSfPolicyUserContextId);
 static void ReputationPrintStats(int);
@@ -107,6 +107,17 @@ ReputationConfig *pDefaultPolicyConfig = NULL;
 Swith_State switch_state = NO_SWITCH;
 int available_segment = NO_DATASEG;
 #endif
+static uint32_t reputation_generation = 0;
+
+/* Lookups only change with the table, so a new table is a new generation */
+static inline void ReputationSetIPlist(ReputationConfig *config, table_flat_t *iplist)
+{
+    if (config->iplist != iplist)
+    {
+        config->iplist = iplist;
+        config->generation = ++reputation_generation;
+    }
+}
 
 #ifdef SNORT_RELOAD
 static void ReputationReload(struct _SnortConfig *, char *, void **);
@@ -266,7 +277,9 @@ static int Reputation_Lookup(uint16_t type, const uint8_t *data, uint32_t length
     return 0;
 }
 
-static int Reputation_PreControl(uint16_t type, const uint8_t *data, uint32_t length, void **new_config,
+/* Builds the next segment, from the IP list files or, given an update
+ * file, from the active segment */
+static int Reputation_LoadSegment(const char *update, void **new_config,
         char *statusBuf, int statusBufLen)
 {
     ReputationConfig *pDefaultPolicyConfig = NULL;
@@ -301,7 +314,12 @@ static int Reputation_PreControl(uint16_t type, const uint8_t *data, uint32_t le
     nextConfig->statusBuf_len = statusBufLen;
     reputation_shmem_config = nextConfig;
 
-    if ((available_segment = LoadSharedMemDataSegmentForWriter(RELOAD)) >= 0)
+    if (update)
+        available_segment = UpdateSharedMemDataSegmentForWriter(update);
+    else
+        available_segment = LoadSharedMemDataSegmentForWriter(RELOAD);
+
+    if (available_segment >= 0)
     {
         *new_config = nextConfig;
         nextConfig->segment_version = available_segment;
@@ -328,6 +346,56 @@ static int Reputation_PreControl(uint16_t type, const uint8_t *data, uint32_t le
     return -1;
 }
 
+static int Reputation_PreControl(uint16_t type, const uint8_t *data, uint32_t length, void **new_config,
+        char *statusBuf, int statusBufLen)
+{
+    return Reputation_LoadSegment(NULL, new_config, statusBuf, statusBufLen);
+}
+
+static int Reputation_PreControlUpdate(uint16_t type, const uint8_t *data, uint32_t length, void **new_config,
+        char *statusBuf, int statusBufLen)
+{
+    char *tokstr, *save, *data_copy;
+    CSMessageDataHeader *msg_hdr = (CSMessageDataHeader *)data;
+    int rval;
+
+    statusBuf[0] = 0;
+    *new_config = NULL;
+
+    if (length <= sizeof(*msg_hdr))
+    {
+        return -1;
+    }
+    length -= sizeof(*msg_hdr);
+    if (length != (uint32_t)ntohs(msg_hdr->length))
+    {
+        return -1;
+    }
+
+    data += sizeof(*msg_hdr);
+    data_copy = malloc(length + 1);
+    if (data_copy == NULL)
+    {
+        return -1;
+    }
+    memcpy(data_copy, data, length);
+    data_copy[length] = 0;
+
+    /* The update file, relative to the IP list directory */
+    tokstr = strtok_r(data_copy, " \t\n", &save);
+    if (tokstr == NULL)
+    {
+        snprintf(statusBuf, statusBufLen,
+            "Reputation Preprocessor: No update file given");
+        free(data_copy);
+        return -1;
+    }
+
+    rval = Reputation_LoadSegment(tokstr, new_config, statusBuf, statusBufLen);
+    free(data_copy);
+    return rval;
+}
+
 static int Reputation_Control(uint16_t type, void *new_config, void **old_config)
 {
     ReputationConfig *config = (ReputationConfig *) new_config;
@@ -364,7 +432,7 @@ static void Reputation_PostControl(uint16_t type, void *old_config, struct _THRE
     pDefaultPolicyConfig->segment_version = config->segment_version;
     pDefaultPolicyConfig->memsize = config->memsize;
     pDefaultPolicyConfig->numEntries = config->numEntries;
-    pDefaultPolicyConfig->iplist = config->iplist;
+    ReputationSetIPlist(pDefaultPolicyConfig, config->iplist);
     pDefaultPolicyConfig->statusBuf = NULL;
     reputation_shmem_config = pDefaultPolicyConfig;
     switch_state = SWITCHED;
@@ -419,7 +487,7 @@ static void ReputationShmemSwitch(void)
     reputation_eval_config = sfPolicyUserDataGetDefault(reputation_config);
 
     if (reputation_eval_config)
-        reputation_eval_config->iplist = (table_flat_t *)*IPtables;
+        ReputationSetIPlist(reputation_eval_config, (table_flat_t *)*IPtables);
 }
 
 void SetupReputationUpdate(uint32_t updateInterval)
@@ -435,6 +503,8 @@ void SetupReputationUpdate(uint32_t updateInterval)
                 &Reputation_Lookup, NULL, NULL);
         _dpd.controlSocketRegisterHandler(CS_TYPE_REPUTATION_SHAREMEM_MGMT_INFO,
                 &Reputation_MgmtInfo, NULL, NULL);
+        _dpd.controlSocketRegisterHandler(CS_TYPE_REPUTATION_SHAREMEM_UPDATE,
+                &Reputation_PreControlUpdate, &Reputation_Control, &Reputation_PostControl);
     }
 
 }
@@ -499,6 +569,7 @@ static void ReputationInit(struct _SnortConfig *sc, char *argp)
         DynamicPreprocessorFatalMessage("Could not allocate memory for "
                 "Reputation preprocessor configuration.\n");
     }
+    pPolicyConfig->generation = ++reputation_generation;
 
     sfPolicyUserDataSetCurrent(reputation_config, pPolicyConfig);
 
@@ -518,6 +589,8 @@ static void ReputationInit(struct _SnortConfig *sc, char *argp)
 #ifdef SHARED_REP
     if (pPolicyConfig->sharedMem.path && (!_dpd.isTestMode()))
         _dpd.addPostConfigFunc(sc, initShareMemory, pPolicyConfig);
+    else if (pPolicyConfig->sharedMem.path)
+        _dpd.addPostConfigFunc(sc, compileShareMemoryImage, pPolicyConfig);
 #endif
 
 #ifdef REPUTATION_GEOIP
@@ -775,26 +848,120 @@ static inline IPdecision ReputationDecision(SFSnortPacket *p)
     return (decision_final);
 }
 
+/*********************************************************************
+ * Find the verdict cached for the direction of this packet
+ *
+ * Arguments:
+ *  SFSnortPacket * - pointer to packet structure
+ *
+ * Returns:
+ *  ReputationFlowVerdict * - NULL if the session has none
+ *
+ *********************************************************************/
+static inline ReputationFlowVerdict *ReputationGetFlowVerdict(SFSnortPacket *p)
+{
+    ReputationFlowData *flowData;
+
+    if (!p->stream_session)
+        return NULL;
+
+    flowData = (ReputationFlowData *)_dpd.sessionAPI->get_application_data(
+            p->stream_session, PP_REPUTATION);
+
+    if (!flowData)
+        return NULL;
+
+    if (sfip_fast_eq6(&flowData->src, GET_INNER_SRC_IP(p)))
+        return &flowData->verdict[0];
+
+    return &flowData->verdict[1];
+}
+
+/*********************************************************************
+ * Keep the decision for later packets in the same direction of this
+ * session, until the generation changes
+ *
+ * Arguments:
+ *  SFSnortPacket * - pointer to packet structure
+ *  ReputationFlowVerdict * - the decision taken for this packet
+ *
+ * Returns:
+ *  None
+ *
+ *********************************************************************/
+static void ReputationSaveFlowVerdict(SFSnortPacket *p, ReputationFlowVerdict *verdict)
+{
+    ReputationFlowVerdict *cached = ReputationGetFlowVerdict(p);
+
+    if (!cached)
+    {
+        ReputationFlowData *flowData;
+
+        if (!p->stream_session)
+            return;
+
+        flowData = (ReputationFlowData *)calloc(1, sizeof(ReputationFlowData));
+
+        if (!flowData)
+            return;
+
+        sfip_set_ip(&flowData->src, GET_INNER_SRC_IP(p));
+        _dpd.sessionAPI->set_application_data(p->stream_session,
+                PP_REPUTATION, flowData, free);
+
+        cached = &flowData->verdict[0];
+    }
+
+    *cached = *verdict;
+}
+
 /*********************************************************************
  * Main entry point for Reputation processing.
  *
  * Arguments:
  *  SFSnortPacket * - pointer to packet structure
+ *  ReputationFlowVerdict * - filled in with the decision looked up,
+ *                            generation 0 if there was none
  *
  * Returns:
  *  None
  *
  *********************************************************************/
-static inline void ReputationProcess(SFSnortPacket *p)
+static inline void ReputationProcess(SFSnortPacket *p, ReputationFlowVerdict *verdict)
 {
 
     IPdecision decision;
+    ReputationFlowVerdict *cached;
+
+    verdict->generation = 0;
 
     if (!IPtables)
         return;
 
-    reputation_eval_config->iplist = (table_flat_t *)*IPtables;
-    decision = ReputationDecision(p);
+    ReputationSetIPlist(reputation_eval_config, (table_flat_t *)*IPtables);
+
+    cached = ReputationGetFlowVerdict(p);
+
+    if (cached && (cached->generation == reputation_eval_config->generation))
+    {
+        decision = (IPdecision)cached->decision;
+        p->iplist_id = cached->iplist_id;
+        p->iprep_layer = cached->layer;
+        if (cached->sourceTriggered)
+            p->flags |= FLAG_IPREP_SOURCE_TRIGGERED;
+        else
+            p->flags &= ~FLAG_IPREP_SOURCE_TRIGGERED;
+        reputation_stats.flowCacheHits++;
+    }
+    else
+    {
+        decision = ReputationDecision(p);
+        verdict->generation = reputation_eval_config->generation;
+        verdict->decision = (uint8_t)decision;
+        verdict->iplist_id = p->iplist_id;
+        verdict->layer = p->iprep_layer;
+        verdict->sourceTriggered = (p->flags & FLAG_IPREP_SOURCE_TRIGGERED) ? 1 : 0;
+    }
 
     //redBorder. If reputation_eval_config->whiteAction it will change WHITELISTED_UNBLACK for WHITELISTED_TRUST
     if (reputation_eval_config->whiteAction && WHITELISTED_UNBLACK==decision) {
@@ -853,6 +1020,7 @@ static inline void ReputationProcess(SFSnortPacket *p)
  */
 static void ReputationMain( void* ipacketp, void* contextp )
 {
+    ReputationFlowVerdict verdict;
     PROFILE_VARS;
     DEBUG_WRAP(DebugMessage(DEBUG_REPUTATION, "%s\n", REPUTATION_DEBUG__START_MSG));
 
@@ -870,7 +1038,7 @@ static void ReputationMain( void* ipacketp, void* contextp )
     reputation_eval_config = sfPolicyUserDataGetDefault(reputation_config);
 
     PREPROC_PROFILE_START(reputationPerfStats);
-    ReputationProcess((SFSnortPacket*) ipacketp);
+    ReputationProcess((SFSnortPacket*) ipacketp, &verdict);
 
     // Reputation has processed a packet for this session, no need to process
     // subsequent packets so we turn ourselves off for remainder of session if
@@ -878,6 +1046,10 @@ static void ReputationMain( void* ipacketp, void* contextp )
     if( ( _dpd.sessionAPI->get_session_flags( ( ( SFSnortPacket * ) ipacketp)->stream_session ) & SSNFLAG_DETECTION_DISABLED ) != SSNFLAG_DETECTION_DISABLED )
         _dpd.sessionAPI->disable_preproc_for_session( ( ( SFSnortPacket * ) ipacketp)->stream_session, PP_REPUTATION );
 
+    // Otherwise we keep seeing this session, remember the decision
+    else if (verdict.generation)
+        ReputationSaveFlowVerdict((SFSnortPacket*) ipacketp, &verdict);
+
     DEBUG_WRAP(DebugMessage(DEBUG_REPUTATION, "%s\n", REPUTATION_DEBUG__END_MSG));
 
     PREPROC_PROFILE_END(reputationPerfStats);
@@ -970,6 +1142,8 @@ static void ReputationPrintStats(int exiting)
         _dpd.logMsg("  Number of packets whitelisted: "STDu64"\n", reputation_stats.whitelisted);
     if (reputation_stats.monitored > 0)
         _dpd.logMsg("  Number of packets monitored: "STDu64"\n", reputation_stats.monitored);
+    if (reputation_stats.flowCacheHits > 0)
+        _dpd.logMsg("  Number of flow decisions reused: "STDu64"\n", reputation_stats.flowCacheHits);
 
 }
 
@@ -1016,6 +1190,7 @@ static void ReputationReload(struct _SnortConfig *sc, char *args, void **new_con
         DynamicPreprocessorFatalMessage("Could not allocate memory for "
                 "Reputation preprocessor configuration.\n");
     }
+    pPolicyConfig->generation = ++reputation_generation;
     sfPolicyUserDataSetCurrent(reputation_swap_config, pPolicyConfig);
 
     ParseReputationArgs(pPolicyConfig, (u_char *)args);
@@ -1155,7 +1330,23 @@ static inline IPdecision GetGeoReputation(sfaddr_t* ip, SFSnortPacket *p, uint32
     if (reputation_eval_config->geoip_actions && reputation_eval_config->geoip_enabled) {
         if (!sfip_is_private(ip)) {
             // Searching the country with the IP
-            int country_id = GeoIP_id_by_addr(reputation_eval_config->geoip, sfip_to_str(ip));
+            int country_id = 0;
+            table_flat_t *geoip_index = reputation_eval_config->geoip_index;
+
+            if (geoip_index) {
+                GeoIPrepInfo *info;
+
+                if (DIR_16x7_4x4 == geoip_index->table_flat_type)
+                    info = (GeoIPrepInfo *)sfrt_flat_dir16x7_lookup(ip, geoip_index);
+                else
+                    info = (GeoIPrepInfo *)sfrt_flat_dir8x_lookup(ip, geoip_index);
+
+                if (info)
+                    country_id = info->countryId;
+            } else {
+                country_id = GeoIP_id_by_addr(reputation_eval_config->geoip, sfip_to_str(ip));
+            }
+
             if (country_id>0) {
                 // GeoIP_id_by_addr(reputation_eval_config->geoip, 
                 decision = reputation_eval_config->geoip_actions[country_id];
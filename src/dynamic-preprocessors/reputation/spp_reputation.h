@@ -47,6 +47,7 @@
 #define CS_TYPE_REPUTATION_SHAREMEM             ((GENERATOR_SPP_REPUTATION *10) + 1)
 #define CS_TYPE_REPUTATION_SHAREMEM_LOOKUP      ((GENERATOR_SPP_REPUTATION *10) + 2)
 #define CS_TYPE_REPUTATION_SHAREMEM_MGMT_INFO   ((GENERATOR_SPP_REPUTATION *10) + 3)
+#define CS_TYPE_REPUTATION_SHAREMEM_UPDATE      ((GENERATOR_SPP_REPUTATION *10) + 4)
 
 /*These IDs are reserved for snort shared memory server (writer)*/
 #define SHMEM_SERVER_ID             0
@@ -68,9 +69,31 @@ typedef struct _Reputation_Stats
     uint64_t whitelisted;
     uint64_t monitored;
     uint64_t memoryAllocated;
+    uint64_t flowCacheHits;
 
 } Reputation_Stats;
 
+/* Decision taken for one direction of a session, valid while the
+ * generation matches the one of the evaluation config */
+typedef struct _ReputationFlowVerdict
+{
+    uint32_t generation;
+    uint32_t iplist_id;
+    uint8_t decision;
+    uint8_t layer;
+    uint8_t sourceTriggered;
+
+} ReputationFlowVerdict;
+
+/* Session application data.  Verdicts are kept for packets from the
+ * session source and for packets to it */
+typedef struct _ReputationFlowData
+{
+    sfaddr_t src;
+    ReputationFlowVerdict verdict[2];
+
+} ReputationFlowData;
+
 extern Reputation_Stats reputation_stats;
 extern int totalNumEntries;
 extern ReputationConfig *reputation_eval_config;
@@ -296,8 +296,10 @@ static void SMTPDetect(void *pkt, void *context)
     if (PROFILING_PREPROCS && smtpDetectCalled)
     {
         smtpPerfStats.ticks -= smtpDetectPerfStats.ticks;
+        PerfCountersSub(&smtpPerfStats.hw, &smtpDetectPerfStats.hw);
         /* And Reset ticks to 0 */
         smtpDetectPerfStats.ticks = 0;
+        memset(&smtpDetectPerfStats.hw, 0, sizeof(smtpDetectPerfStats.hw));
         smtpDetectCalled = 0;
     }
 #endif
@@ -60,6 +60,16 @@
 
 static uint8_t* dst_mac = NULL;
 Packet* encode_pkt = NULL;
+
+// the clone whose payload is one span inspected in place (Encode_SetSpans)
+static const Packet* ext_pkt = NULL;
+static const uint8_t* ext_data = NULL;
+
+// the clone whose payload is several spans not gathered yet
+const Packet* encode_span_pkt = NULL;
+const EncodeSpan* encode_span = NULL;
+unsigned encode_spans = 0;
+static uint8_t* span_buf = NULL;
 uint64_t total_rebuilt_pkts = 0;
 
 static inline int IsIcmp (int type)
@@ -256,6 +266,12 @@ int Encode_Format (EncodeFlags f, const Packet* p, Packet* c, PseudoPacketType t
 
     if ( next_layer < 1 ) return -1;
 
+    if ( c == ext_pkt )
+        ext_pkt = NULL;
+
+    if ( c == encode_span_pkt )
+        encode_span_pkt = NULL;
+
     memset(c, 0, PKT_ZERO_LEN);
     c->raw_ip6h = NULL;
 
@@ -412,6 +428,65 @@ void Encode_Update (Packet* p)
     p->packet_flags &= ~PKT_LOGGED;
 }
 
+void Encode_SetSpans (Packet* p, const EncodeSpan* span, unsigned n)
+{
+    if ( p == ext_pkt )
+        ext_pkt = NULL;
+
+    if ( p == encode_span_pkt )
+        encode_span_pkt = NULL;
+
+    if ( n == 1 )
+    {
+        ext_pkt = p;
+        ext_data = span->data;
+        p->data = span->data;
+    }
+    else if ( n > 1 )
+    {
+        encode_span_pkt = p;
+        encode_span = span;
+        encode_spans = n;
+        span_buf = (uint8_t*)p->data;
+    }
+}
+
+void Encode_GatherSpans (Packet* p)
+{
+    uint8_t* buf = span_buf;
+    unsigned i;
+
+    // the stream flush bounded the spans by the packet buffer
+    for ( i = 0; i < encode_spans; i++ )
+    {
+        memcpy(buf, encode_span[i].data, encode_span[i].len);
+        buf += encode_span[i].len;
+    }
+    encode_span_pkt = NULL;
+}
+
+void Encode_Flatten (Packet* p)
+{
+    Layer* lyr;
+    uint8_t* buf;
+
+    Encode_Gather(p);
+
+    if ( p != ext_pkt || p->data != ext_data || !p->next_layer )
+        return;
+
+    // Encode_Format() left the payload right behind the last layer
+    lyr = p->layers + p->next_layer - 1;
+    buf = (uint8_t*)lyr->start + lyr->length;
+
+    if ( p->dsize <= p->max_dsize )
+    {
+        memcpy(buf, p->data, p->dsize);
+        p->data = buf;
+    }
+    ext_pkt = NULL;
+}
+
 //-------------------------------------------------------------------------
 // internal packet support
 //-------------------------------------------------------------------------
@@ -102,6 +102,49 @@ int Encode_Format_With_DAQ_Info (
 // update length and checksum fields in layers and caplen, etc.
 void Encode_Update(Packet*);
 
+// a piece of a clone's payload held outside the packet buffer
+typedef struct
+{
+    const uint8_t* data;
+    uint32_t len;
+} EncodeSpan;
+
+extern const Packet* encode_span_pkt;
+extern const EncodeSpan* encode_span;
+extern unsigned encode_spans;
+
+// give a formatted clone a payload held elsewhere instead of copying it
+// into the packet buffer; one span is inspected where it is, several are
+// gathered where p->data points now once something needs the payload
+// contiguous (Encode_Gather), and none means p->data already holds it.
+// spans and their data must stay valid until the clone is formatted or
+// given another payload.
+void Encode_SetSpans(Packet*, const EncodeSpan*, unsigned n);
+
+// copy the spans of a payload set with Encode_SetSpans() into place
+void Encode_GatherSpans(Packet*);
+
+// copy a payload set with Encode_SetSpans() into the packet buffer
+// behind the headers, for consumers that need the whole frame (loggers)
+void Encode_Flatten(Packet*);
+
+// the spans of a payload that has not been gathered yet, or 0
+static inline unsigned Encode_GetSpans(const Packet* p, const EncodeSpan** span)
+{
+    if ( p != encode_span_pkt )
+        return 0;
+
+    *span = encode_span;
+    return encode_spans;
+}
+
+// make p->data contiguous before something reads it
+static inline void Encode_Gather(Packet* p)
+{
+    if ( p == encode_span_pkt )
+        Encode_GatherSpans(p);
+}
+
 // Set the destination MAC address
 void Encode_SetDstMAC(uint8_t* );
 
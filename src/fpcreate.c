@@ -34,6 +34,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -60,6 +61,8 @@
 #include "target-based/sftarget_reader.h"
 #include "mpse.h"
 #include "bitop_funcs.h"
+#include "sfutil/bnfa_prefilter.h"
+#include "sfutil/sfhugepage.h"
 
 #ifdef INTEL_SOFT_CPM
 #include "sfutil/intel-soft-cpm.h"
@@ -67,6 +70,8 @@
 
 #include "snort.h"
 #include "sp_clientserver.h"
+#include "sp_dsize_check.h"
+#include "sp_flowbits.h"
 #include "sfutil/sfportobject.h"
 #include "sfutil/sfrim.h"
 #include "detection_options.h"
@@ -841,6 +846,7 @@ void fpSetDefaults(FastPatternConfig *fp)
     fp->search_method = MPSE_AC_BNFA;
     fp->max_queue_events = 5;
     fp->bleedover_port_limit = 1024;
+    fp->compile_threads = 1;
 }
 
 void FastPatternConfigFree(FastPatternConfig *fp)
@@ -848,6 +854,9 @@ void FastPatternConfigFree(FastPatternConfig *fp)
     if (fp == NULL)
         return;
 
+    if (fp->search_image_dir != NULL)
+        free(fp->search_image_dir);
+
     free(fp);
 }
 
@@ -929,7 +938,7 @@ void fpSetDetectSearchOpt(FastPatternConfig *fp, int flag)
 
 /*
    Search method is set using:
-   config detect: search-method ac-bnfa | ac | ac-full | ac-sparsebands | ac-sparse | ac-banded | ac-std | verbose
+   config detect: search-method ac-bnfa | ac-bnfa-simd | ac | ac-full | ac-sparsebands | ac-sparse | ac-banded | ac-std | verbose
 */
 int fpSetDetectSearchMethod(FastPatternConfig *fp, char *method)
 {
@@ -951,6 +960,12 @@ int fpSetDetectSearchMethod(FastPatternConfig *fp, char *method)
        fp->search_method = MPSE_AC_BNFA;
        LogMessage("   Search-Method = AC-BNFA\n");
     }
+    else if( !strcasecmp(method,"ac-bnfa-simd") )
+    {
+       fp->search_method = MPSE_AC_BNFA_SIMD;
+       LogMessage("   Search-Method = AC-BNFA-Q with %s prefilter\n",
+           bnfaPrefilterEngine());
+    }
     else if( !strcasecmp(method,"ac-q") ||
              !strcasecmp(method,"ac") )
     {
@@ -1016,6 +1031,31 @@ int fpSetDetectSearchMethod(FastPatternConfig *fp, char *method)
     return 0;
 }
 
+void fpDetectSetSearchImageDir(FastPatternConfig *fp, const char *dir)
+{
+    if (fp->search_image_dir != NULL)
+        free(fp->search_image_dir);
+
+    fp->search_image_dir = SnortStrdup(dir);
+    LogMessage("    Search engine image directory = %s\n", dir);
+}
+
+void fpDetectSetCompileThreads(FastPatternConfig *fp, int n)
+{
+    fp->compile_threads = n;
+    LogMessage("    Compile threads = %d\n", n);
+}
+
+void fpDetectSetHugePages(FastPatternConfig *fp, int mode)
+{
+    fp->huge_pages = mode;
+
+    /* for the tables preprocessors create after the config is parsed;
+     * the state tables use the mode of the config being compiled */
+    sfhuge_set_mode((SfHugeMode)mode);
+    LogMessage("    Huge pages = %s\n", sfhuge_mode_name((SfHugeMode)mode));
+}
+
 void fpDetectSetSplitAnyAny(FastPatternConfig *fp, int enable)
 {
     if (enable)
@@ -1476,6 +1516,138 @@ static int UsePreprocOptFastPatterns(PatternMatchData *pmd, PatternMatchData *pr
     return 0;
 }
 
+static void fpAddPmMethod(PmPrecondition *pre, const char *s, unsigned len, int nocase)
+{
+    unsigned i;
+
+    for (i = 0; i < pre->num_methods; i++)
+    {
+        if ((pre->method_len[i] == len) && (pre->method_nocase[i] == nocase) &&
+            !memcmp(pre->methods[i], s, len))
+            return;
+    }
+
+    if (pre->num_methods == PM_PRE_MAX_METHODS)
+    {
+        pre->num_methods = 0;
+        return;
+    }
+
+    memcpy(pre->methods[i], s, len);
+    pre->method_len[i] = len;
+    pre->method_nocase[i] = nocase ? 1 : 0;
+    pre->num_methods++;
+}
+
+/* Works out what the rule needs from a packet, see PmPrecondition. */
+static void fpGetPmPrecondition(PmPrecondition *r, OptTreeNode *otn)
+{
+    ClientServerData *csd = (ClientServerData *)otn->ds_list[PLUGIN_CLIENTSERVER];
+    OptFpList *fpl;
+
+    memset(r, 0, sizeof(*r));
+    r->rules = 1;
+    r->flow = PM_PRE_FROM_CLIENT | PM_PRE_FROM_SERVER;
+
+    if (csd != NULL)
+    {
+        if (csd->from_client && !csd->from_server)
+            r->flow = PM_PRE_FROM_CLIENT;
+        else if (csd->from_server && !csd->from_client)
+            r->flow = PM_PRE_FROM_SERVER;
+
+        r->established = csd->established;
+    }
+
+    r->dsize = OtnDsizeRange(otn, &r->dsize_lo, &r->dsize_hi);
+    r->num_bits = FlowBitsOtnIsset(otn, r->bits, PM_PRE_MAX_BITS);
+
+    /* any positive http_method content needs the buffer; the first plain
+     * one must also be found in it */
+    for (fpl = otn->opt_func; fpl != NULL; fpl = fpl->next)
+    {
+        PatternMatchData *pmd = (PatternMatchData *)fpl->context;
+
+        if ((fpl->type != RULE_OPTION_TYPE_CONTENT_URI) || (pmd == NULL) ||
+            (pmd->http_buffer != HTTP_BUFFER_METHOD) || pmd->exception_flag)
+            continue;
+
+        r->method = 1;
+
+        if (!r->num_methods && !pmd->protected_pattern &&
+            pmd->pattern_size && (pmd->pattern_size <= PM_PRE_METHOD_LEN))
+        {
+            fpAddPmMethod(r, pmd->pattern_buf, pmd->pattern_size, pmd->nocase);
+        }
+    }
+}
+
+/* Widens the group's summary for pm_type to let the rule through. */
+static void fpAddPmPrecondition(PmPrecondition *pre, OptTreeNode *otn)
+{
+    PmPrecondition r;
+    unsigned i;
+
+    fpGetPmPrecondition(&r, otn);
+
+    if (!pre->rules)
+    {
+        *pre = r;
+    }
+    else
+    {
+        pre->rules++;
+        pre->flow |= r.flow;
+        pre->established &= r.established;
+
+        if (pre->dsize && r.dsize)
+        {
+            if (r.dsize_lo < pre->dsize_lo)
+                pre->dsize_lo = r.dsize_lo;
+            if (r.dsize_hi > pre->dsize_hi)
+                pre->dsize_hi = r.dsize_hi;
+        }
+        else
+            pre->dsize = 0;
+
+        if (pre->num_bits && r.num_bits)
+        {
+            for (i = 0; (i < r.num_bits) && pre->num_bits; i++)
+            {
+                unsigned j;
+
+                for (j = 0; j < pre->num_bits; j++)
+                {
+                    if (pre->bits[j] == r.bits[i])
+                        break;
+                }
+                if (j < pre->num_bits)
+                    continue;
+
+                if (pre->num_bits == PM_PRE_MAX_BITS)
+                    pre->num_bits = 0;
+                else
+                    pre->bits[pre->num_bits++] = r.bits[i];
+            }
+        }
+        else
+            pre->num_bits = 0;
+
+        pre->method &= r.method;
+
+        if (pre->num_methods && r.num_methods)
+        {
+            fpAddPmMethod(pre, r.methods[0], r.method_len[0], r.method_nocase[0]);
+        }
+        else
+            pre->num_methods = 0;
+    }
+
+    pre->active =
+        (pre->flow != (PM_PRE_FROM_CLIENT | PM_PRE_FROM_SERVER)) ||
+        pre->established || pre->dsize || pre->num_bits || pre->method;
+}
+
 static int fpFinishPortGroupRule(SnortConfig *sc, PORT_GROUP *pg, PmType pm_type,
         OptTreeNode *otn, PatternMatchData *pmd_list, FastPatternConfig *fp)
 {
@@ -1511,6 +1683,8 @@ static int fpFinishPortGroupRule(SnortConfig *sc, PORT_GROUP *pg, PmType pm_type
             return 0;  /* Not adding any content to pattern matcher */
     }
 
+    fpAddPmPrecondition(&pg->pgPre[pm_type], otn);
+
     for (pmd = pmd_list; pmd != NULL; pmd = pmd->next)
     {
         if (pmd->exception_flag)
@@ -1550,6 +1724,72 @@ static int fpFinishPortGroupRule(SnortConfig *sc, PORT_GROUP *pg, PmType pm_type
     return 0;
 }
 
+/*
+ *  With compile-threads > 1, finished port groups are queued instead of
+ *  compiled.  fpCompilePortGroups() then compiles the automata of all
+ *  queued groups on a pool of threads and afterwards builds the rule option
+ *  trees one group at a time in the order the groups were finished, which
+ *  is the only part that touches shared detection state.  The result is the
+ *  same as compiling each group as it is finished.
+ */
+static SF_LIST *pg_compile_list = NULL;
+
+static int fpCanDeferPortGroup(PORT_GROUP *pg, FastPatternConfig *fp)
+{
+    PmType i;
+
+    if (fp->compile_threads <= 1)
+        return 0;
+
+    for (i = PM_TYPE__CONTENT; i < PM_TYPE__MAX; i++)
+    {
+        if ((pg->pgPms[i] != NULL) && !mpseCompileThreadSafe(pg->pgPms[i]))
+            return 0;
+    }
+
+    return 1;
+}
+
+static void fpBuildPortGroupTrees(SnortConfig *sc, PORT_GROUP *pg, FastPatternConfig *fp,
+        int compiled)
+{
+    PmType i;
+
+    for (i = PM_TYPE__CONTENT; i < PM_TYPE__MAX; i++)
+    {
+        if (pg->pgPms[i] == NULL)
+            continue;
+
+        if (compiled)
+        {
+            mpseBuildTreesWithSnortConf(sc, pg->pgPms[i], pmx_create_tree,
+                    add_patrn_to_neg_list);
+        }
+        else if (mpsePrepPatternsWithSnortConf(sc, pg->pgPms[i], pmx_create_tree,
+                    add_patrn_to_neg_list) != 0)
+        {
+            FatalError("%s(%d) Failed to compile port group "
+                    "patterns.\n", __FILE__, __LINE__);
+        }
+
+        if (fp->debug)
+            mpsePrintInfo(pg->pgPms[i]);
+    }
+
+    if (pg->pgHeadNC != NULL)
+    {
+        RULE_NODE *ruleNode;
+
+        for (ruleNode = pg->pgHeadNC; ruleNode; ruleNode = ruleNode->rnNext)
+        {
+            OptTreeNode *otn = (OptTreeNode *)ruleNode->rnRuleData;
+            otn_create_tree(otn, &pg->pgNonContentTree);
+        }
+
+        finalize_detection_option_tree(sc, (detection_option_tree_root_t*)pg->pgNonContentTree);
+    }
+}
+
 static int fpFinishPortGroup(SnortConfig *sc, PORT_GROUP *pg, FastPatternConfig *fp)
 {
     PmType i;
@@ -1564,15 +1804,6 @@ static int fpFinishPortGroup(SnortConfig *sc, PORT_GROUP *pg, FastPatternConfig
         {
             if (mpseGetPatternCount(pg->pgPms[i]) != 0)
             {
-                if (mpsePrepPatternsWithSnortConf(sc, pg->pgPms[i], pmx_create_tree,
-                            add_patrn_to_neg_list) != 0)
-                {
-                    FatalError("%s(%d) Failed to compile port group "
-                            "patterns.\n", __FILE__, __LINE__);
-                }
-
-                if (fp->debug)
-                    mpsePrintInfo(pg->pgPms[i]);
                 rules = 1;
             }
             else
@@ -1584,18 +1815,7 @@ static int fpFinishPortGroup(SnortConfig *sc, PORT_GROUP *pg, FastPatternConfig
     }
 
     if (pg->pgHeadNC != NULL)
-    {
-        RULE_NODE *ruleNode;
-
-        for (ruleNode = pg->pgHeadNC; ruleNode; ruleNode = ruleNode->rnNext)
-        {
-            OptTreeNode *otn = (OptTreeNode *)ruleNode->rnRuleData;
-            otn_create_tree(otn, &pg->pgNonContentTree);
-        }
-
-        finalize_detection_option_tree(sc, (detection_option_tree_root_t*)pg->pgNonContentTree);
         rules = 1;
-    }
 
     if (!rules)
     {
@@ -1604,9 +1824,119 @@ static int fpFinishPortGroup(SnortConfig *sc, PORT_GROUP *pg, FastPatternConfig
         return -1;
     }
 
+    if (fpCanDeferPortGroup(pg, fp))
+    {
+        if (pg_compile_list == NULL)
+            pg_compile_list = sflist_new();
+
+        if ((pg_compile_list != NULL) && (sflist_add_tail(pg_compile_list, pg) == 0))
+            return 0;
+    }
+
+    fpBuildPortGroupTrees(sc, pg, fp, 0);
     return 0;
 }
 
+typedef struct _PmCompileJobs
+{
+    SnortConfig *sc;
+    void **pms;
+    int *status;
+    unsigned count;
+    unsigned next;
+
+} PmCompileJobs;
+
+static void * fpCompileThread(void *arg)
+{
+    PmCompileJobs *jobs = (PmCompileJobs *)arg;
+    unsigned i;
+
+    while ((i = __sync_fetch_and_add(&jobs->next, 1)) < jobs->count)
+        jobs->status[i] = mpsePrepPatternsWithSnortConf(jobs->sc, jobs->pms[i], NULL, NULL);
+
+    return NULL;
+}
+
+static int fpComparePmSize(const void *a, const void *b)
+{
+    int na = mpseGetPatternCount(*(void * const *)a);
+    int nb = mpseGetPatternCount(*(void * const *)b);
+
+    return (nb > na) - (nb < na);
+}
+
+/* Compiles and finishes the port groups queued by fpFinishPortGroup(). */
+static void fpCompilePortGroups(SnortConfig *sc, FastPatternConfig *fp)
+{
+    PmCompileJobs jobs;
+    pthread_t *threads;
+    PORT_GROUP *pg;
+    unsigned nthreads, i;
+    PmType t;
+
+    if ((pg_compile_list == NULL) || (sflist_count(pg_compile_list) == 0))
+        return;
+
+    memset(&jobs, 0, sizeof(jobs));
+    jobs.sc = sc;
+    jobs.pms = (void **)SnortAlloc(sizeof(void *) * PM_TYPE__MAX *
+            sflist_count(pg_compile_list));
+
+    for (pg = (PORT_GROUP *)sflist_first(pg_compile_list);
+            pg != NULL;
+            pg = (PORT_GROUP *)sflist_next(pg_compile_list))
+    {
+        for (t = PM_TYPE__CONTENT; t < PM_TYPE__MAX; t++)
+        {
+            if (pg->pgPms[t] != NULL)
+                jobs.pms[jobs.count++] = pg->pgPms[t];
+        }
+    }
+
+    /* largest first so a big group is not the last one started */
+    qsort(jobs.pms, jobs.count, sizeof(void *), fpComparePmSize);
+    jobs.status = (int *)SnortAlloc(sizeof(int) * (jobs.count + 1));
+
+    /* this thread makes one of them */
+    nthreads = fp->compile_threads - 1;
+    if (nthreads >= jobs.count)
+        nthreads = jobs.count ? jobs.count - 1 : 0;
+
+    threads = (pthread_t *)SnortAlloc(sizeof(pthread_t) * (nthreads + 1));
+
+    for (i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&threads[i], NULL, fpCompileThread, &jobs) != 0)
+            break;
+    }
+    nthreads = i;
+
+    fpCompileThread(&jobs);
+
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < jobs.count; i++)
+    {
+        if (jobs.status[i] != 0)
+        {
+            FatalError("%s(%d) Failed to compile port group "
+                    "patterns.\n", __FILE__, __LINE__);
+        }
+    }
+
+    while ((pg = (PORT_GROUP *)sflist_remove_head(pg_compile_list)) != NULL)
+        fpBuildPortGroupTrees(sc, pg, fp, 1);
+
+    sflist_free(pg_compile_list);
+    pg_compile_list = NULL;
+
+    free(threads);
+    free(jobs.status);
+    free(jobs.pms);
+}
+
 static int fpAllocPms(SnortConfig *sc, PORT_GROUP *pg, FastPatternConfig *fp)
 {
     PmType i;
@@ -2251,7 +2581,8 @@ static int fpGetFinalPattern(FastPatternConfig *fp, PatternMatchData *pmd,
          * since the next state is deterministic in state 0 and we won't move
          * beyond state 0 as long as the next input char is 0x00 */
         if ((fp->search_method == MPSE_AC_BNFA_Q)
-                || (fp->search_method == MPSE_AC_BNFA))
+                || (fp->search_method == MPSE_AC_BNFA)
+                || (fp->search_method == MPSE_AC_BNFA_SIMD))
         {
             bytes =
                 FLP_Trim(pmd->pattern_buf, pmd->pattern_size, &pattern);
@@ -3312,6 +3643,8 @@ int fpCreateFastPacketDetection(SnortConfig *sc)
     if ((port_tables == NULL) || (fp == NULL))
         return 0;
 
+    sfhuge_set_mode((SfHugeMode)fp->huge_pages);
+
 #ifdef INTEL_SOFT_CPM
     if (fp->search_method == MPSE_INTEL_CPM)
         IntelPmStartInstance();
@@ -3324,6 +3657,8 @@ int fpCreateFastPacketDetection(SnortConfig *sc)
     if (fpCreatePortGroups(sc, port_tables))
         FatalError("Could not create PortGroup objects for PortObjects\n");
 
+    fpCompilePortGroups(sc, fp);
+
     if (fpDetectGetDebugPrintRuleGroupBuildDetails(fp))
         LogMessage("Port Groups Done....\n");
 
@@ -3365,6 +3700,8 @@ int fpCreateFastPacketDetection(SnortConfig *sc)
         if (fpCreateServicePortGroups(sc))
             FatalError("Could not create service based port groups\n");
 
+        fpCompilePortGroups(sc, fp);
+
         if (fpDetectGetDebugPrintRuleGroupBuildDetails(fp))
             LogMessage("Service Based Rule Maps Done....\n");
 
@@ -101,6 +101,9 @@ typedef struct _FastPatternConfig
     int num_patterns_truncated;  /* due to max_pattern_len */
     int num_patterns_trimmed;    /* due to zero byte prefix */
     int debug_print_fast_pattern;
+    char *search_image_dir;      /* compiled search engine images */
+    int compile_threads;         /* rule group automata compiled in parallel */
+    int huge_pages;              /* SfHugeMode for the state tables */
 
 } FastPatternConfig;
 
@@ -182,6 +185,9 @@ void fpSetDebugMode(FastPatternConfig *);
 void fpSetStreamInsert(FastPatternConfig *);
 void fpSetMaxQueueEvents(FastPatternConfig *, unsigned int);
 void fpDetectSetSplitAnyAny(FastPatternConfig *, int);
+void fpDetectSetSearchImageDir(FastPatternConfig *, const char *);
+void fpDetectSetCompileThreads(FastPatternConfig *, int);
+void fpDetectSetHugePages(FastPatternConfig *, int);
 void fpSetMaxPatternLen(FastPatternConfig *, unsigned int);
 
 void fpDetectSetSingleRuleGroup(FastPatternConfig *);
@@ -64,6 +64,7 @@
 #include "sfPolicyData.h"
 
 #include "sp_pattern_match.h"
+#include "sp_flowbits.h"
 #include "spp_frag3.h"
 #include "stream_api.h"
 
@@ -1064,6 +1065,122 @@ void printRuleFmt1( SnortConfig *sc, OptTreeNode * otn )
 }
 #endif
 
+static inline int fpFindMethod(const HttpBuffer *hb, const char *s,
+        unsigned len, int nocase)
+{
+    unsigned i;
+
+    if ( hb->length < len )
+        return 0;
+
+    for ( i = 0; i <= hb->length - len; i++ )
+    {
+        if ( nocase ? !strncasecmp((const char *)hb->buf + i, s, len)
+                    : !memcmp(hb->buf + i, s, len) )
+            return 1;
+    }
+    return 0;
+}
+
+/*
+**  Checks the packet against what every rule in the group's pm_type
+**  matcher requires (see PmPrecondition) and returns 1 if none of them
+**  can match, in which case the search is skipped.  Each test mirrors
+**  the runtime check of the corresponding rule option.
+*/
+static inline int fpSkipPm(PORT_GROUP *pg, PmType pm_type, Packet *p)
+{
+    const PmPrecondition *pre = &pg->pgPre[pm_type];
+
+    if ( !pre->active )
+        return 0;
+
+    if ( ScStateful() )
+    {
+        if ( !(pre->flow & PM_PRE_FROM_CLIENT) &&
+            (p->packet_flags & PKT_FROM_CLIENT) &&
+            !(p->packet_flags & PKT_FROM_SERVER) )
+            return 1;
+
+        if ( !(pre->flow & PM_PRE_FROM_SERVER) &&
+            (p->packet_flags & PKT_FROM_SERVER) &&
+            !(p->packet_flags & PKT_FROM_CLIENT) )
+            return 1;
+
+        if ( pre->established && !(p->packet_flags & PKT_STREAM_EST) )
+            return 1;
+    }
+
+    /* rule_tree_match evaluates IP rules again on the inner payload of
+     * an encapsulated packet, with its own dsize */
+    if ( pre->dsize && !p->outer_ip_data )
+    {
+        if ( (p->packet_flags & PKT_REBUILT_STREAM) &&
+            !(p->packet_flags & PKT_PDU_HEAD) )
+            return 1;
+
+        if ( (p->dsize < pre->dsize_lo) || (p->dsize > pre->dsize_hi) )
+            return 1;
+    }
+
+    if ( pre->num_bits && !FlowBitsAnySet(p, pre->bits, pre->num_bits) )
+        return 1;
+
+    if ( pre->method )
+    {
+        const HttpBuffer *hb = GetHttpBuffer(HTTP_BUFFER_METHOD);
+        unsigned i;
+
+        if ( !hb )
+            return 1;
+
+        for ( i = 0; i < pre->num_methods; i++ )
+        {
+            if ( fpFindMethod(hb, pre->methods[i], pre->method_len[i],
+                    pre->method_nocase[i]) )
+                break;
+        }
+        if ( pre->num_methods && (i == pre->num_methods) )
+            return 1;
+    }
+    return 0;
+}
+
+/*
+**  Searches the payload of a rebuilt packet that is still held as stream
+**  segments (Encode_SetSpans) one segment at a time, carrying the
+**  automaton state across, so a packet without a fast pattern match is
+**  never gathered.  A match gathers it when its rule tree evaluates an
+**  option that reads the payload.  Returns 0 if the payload must be
+**  searched as one buffer at p->data instead.
+*/
+static inline int fpSearchSpans(void *so, Packet *p, uint16_t size,
+        OTNX_MATCH_DATA *omd)
+{
+    const EncodeSpan *span;
+    unsigned n = Encode_GetSpans(p, &span);
+    int start_state = 0;
+    unsigned i;
+
+    if ( !n )
+        return 0;
+
+    if ( !mpseCanResume(so) )
+    {
+        Encode_Gather(p);
+        return 0;
+    }
+
+    for ( i = 0; i < n && size; i++ )
+    {
+        uint16_t len = (span[i].len < size) ? span[i].len : size;
+
+        mpseSearch(so, span[i].data, len, rule_tree_match, omd, &start_state);
+        size -= len;
+    }
+    return 1;
+}
+
 /*
 **
 **  NAME
@@ -1102,6 +1219,9 @@ static inline int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p,
 
     if (ip_rule)
     {
+        /* the IP payload includes the TCP payload */
+        Encode_Gather(p);
+
         tmp_iph = (void *)p->iph;
         tmp_ip6h = (void *)p->ip6h;
         tmp_ip4h = (void *)p->ip4h;
@@ -1174,6 +1294,7 @@ static inline int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p,
                 if ( p->proto_bits & idx->proto_mask )
                     //IsDetectBitSet(p, idx->preproc_bit))
                 {
+                    Encode_Gather(p);
                     idx->func(p, idx->context);
                 }
             }
@@ -1189,11 +1310,18 @@ static inline int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p,
 
             if ( GetHttpBufferMask() )
             {
-                if ( (hb = GetHttpBuffer(HTTP_BUFFER_URI)) )
-                {
-                    so = (void *)port_group->pgPms[PM_TYPE__HTTP_URI_CONTENT];
+                /* only fetch the buffers this group searches since
+                 * fetching one may have to normalize it first */
+                so = (void *)port_group->pgPms[PM_TYPE__HTTP_URI_CONTENT];
 
-                    if ( so && mpseGetPatternCount(so) > 0 )
+                if ( so && mpseGetPatternCount(so) > 0 &&
+                     fpSkipPm(port_group, PM_TYPE__HTTP_URI_CONTENT, p) )
+                {
+                    pc.fp_skip_uri++;
+                }
+                else if ( so && mpseGetPatternCount(so) > 0 )
+                {
+                    if ( (hb = GetHttpBuffer(HTTP_BUFFER_URI)) )
                     {
                         start_state = 0;
 
@@ -1206,11 +1334,16 @@ static inline int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p,
 #endif
                     }
                 }
-                if ( (hb = GetHttpBuffer(HTTP_BUFFER_HEADER)) )
-                {
-                    so = (void *)port_group->pgPms[PM_TYPE__HTTP_HEADER_CONTENT];
+                so = (void *)port_group->pgPms[PM_TYPE__HTTP_HEADER_CONTENT];
 
-                    if ( so && mpseGetPatternCount(so) > 0 )
+                if ( so && mpseGetPatternCount(so) > 0 &&
+                     fpSkipPm(port_group, PM_TYPE__HTTP_HEADER_CONTENT, p) )
+                {
+                    pc.fp_skip_header++;
+                }
+                else if ( so && mpseGetPatternCount(so) > 0 )
+                {
+                    if ( (hb = GetHttpBuffer(HTTP_BUFFER_HEADER)) )
                     {
                         start_state = 0;
 
@@ -1223,11 +1356,16 @@ static inline int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p,
 #endif
                     }
                 }
-                if ( (hb = GetHttpBuffer(HTTP_BUFFER_CLIENT_BODY)) )
-                {
-                    so = (void *)port_group->pgPms[PM_TYPE__HTTP_CLIENT_BODY_CONTENT];
+                so = (void *)port_group->pgPms[PM_TYPE__HTTP_CLIENT_BODY_CONTENT];
 
-                    if ( so && mpseGetPatternCount(so) > 0 )
+                if ( so && mpseGetPatternCount(so) > 0 &&
+                     fpSkipPm(port_group, PM_TYPE__HTTP_CLIENT_BODY_CONTENT, p) )
+                {
+                    pc.fp_skip_body++;
+                }
+                else if ( so && mpseGetPatternCount(so) > 0 )
+                {
+                    if ( (hb = GetHttpBuffer(HTTP_BUFFER_CLIENT_BODY)) )
                     {
                         start_state = 0;
 
@@ -1252,7 +1390,13 @@ static inline int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p,
              **  'rawbytes' option.
              */
             so = (void *)port_group->pgPms[PM_TYPE__CONTENT];
-            if ((so != NULL) && (mpseGetPatternCount(so) > 0))
+
+            if ((so != NULL) && (mpseGetPatternCount(so) > 0) &&
+                fpSkipPm(port_group, PM_TYPE__CONTENT, p))
+            {
+                pc.fp_skip_content++;
+            }
+            else if ((so != NULL) && (mpseGetPatternCount(so) > 0))
             {
                 if (Is_DetectFlag(FLAG_ALT_DECODE) && DecodeBuffer.len)
                 {
@@ -1293,9 +1437,12 @@ static inline int fpEvalHeaderSW(PORT_GROUP *port_group, Packet *p,
                     if ( IsLimitedDetect(p) && (p->alt_dsize < p->dsize) )
                         pattern_match_size = p->alt_dsize;
 
-                    start_state = 0;
-                    mpseSearch(so, p->data, pattern_match_size,
-                            rule_tree_match, omd, &start_state);
+                    if ( !fpSearchSpans(so, p, pattern_match_size, omd) )
+                    {
+                        start_state = 0;
+                        mpseSearch(so, p->data, pattern_match_size,
+                                rule_tree_match, omd, &start_state);
+                    }
 #ifdef PPM_MGR
                     /* Bail if we spent too much time already */
                     if (PPM_PACKET_ABORT_FLAG())
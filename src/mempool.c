@@ -42,6 +42,9 @@
 #include "util.h"
 #include "snort_debug.h"
 #include "sf_types.h"
+#ifndef DYNAMIC_PREPROC_CONTEXT
+#include "sfnuma.h"
+#endif
 /*SharedObjectAddStarts
 #include "sf_dynamic_preprocessor.h"
 SharedObjectAddEnds */
@@ -99,10 +102,20 @@ int mempool_init(MemPool *mempool, PoolCount num_objects, size_t obj_size)
     mempool->obj_size = obj_size;
 
     /* this is the basis pool that represents all the *data pointers
-       in the list */
-    mempool->datapool = calloc(num_objects, obj_size);
-    if(mempool->datapool == NULL)
-        return 1;
+       in the list; it starts on a cache line so objects sized in whole
+       lines don't straddle them */
+    {
+        void *pool;
+
+        if(posix_memalign(&pool, 64, (size_t)num_objects * obj_size))
+            return 1;
+
+#ifndef DYNAMIC_PREPROC_CONTEXT
+        sfnuma_bind(pool, (size_t)num_objects * obj_size);
+#endif
+        memset(pool, 0, (size_t)num_objects * obj_size);
+        mempool->datapool = pool;
+    }
 
     mempool->listpool = calloc(num_objects, sizeof(SDListItem));
     if(mempool->listpool == NULL)
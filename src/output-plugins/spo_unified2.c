@@ -38,6 +38,11 @@
 #endif
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 #include "sfutil/Unified2_common.h"
 #include "spo_unified2.h"
@@ -68,6 +73,49 @@
 
 
 /* ------------------ Data structures --------------------------*/
+
+/* Records are copied into a single producer / single consumer ring by
+ * the packet thread and written out by the writer thread.  Positions are
+ * free running counters so the ring size must be a power of 2. */
+typedef struct _Unified2RingRec
+{
+    uint32_t len;
+    uint32_t type;
+
+} Unified2RingRec;
+
+#define U2_RING_DATA    0
+#define U2_RING_ROTATE  1
+#define U2_RING_PAD     2   /* rest of the ring is unused, wrap to 0 */
+
+#define U2_RING_ALIGN(n) (((n) + 7) & ~7)
+
+typedef struct _Unified2Writer
+{
+    uint8_t *ring;
+    uint32_t size;
+    volatile uint32_t head;     /* written by the packet thread */
+    volatile uint32_t tail;     /* written by the writer thread */
+
+    pthread_t thread_id;
+    pid_t owner;
+    volatile int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t unsignaled;
+
+    /* packet thread */
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t waits;             /* records delayed by a full ring */
+    uint64_t drops;             /* records dropped on a full ring */
+
+    /* writer thread */
+    uint64_t batches;
+    uint64_t rotations;
+
+} Unified2Writer;
+
 typedef struct _Unified2Config
 {
     char *base_filename;
@@ -91,6 +139,15 @@ typedef struct _Unified2Config
     // However, this will broke the limit implementation: spo_unified2 can
     // write beyond this limit, until it found an event to rotate on.
     int dont_rotate_on_packets;
+
+    // Hand the records to a writer thread instead of writing them on
+    // the packet thread.
+    int async;
+    int drop_on_full;
+    uint32_t queue_size;
+    uint32_t flush_size;
+    uint32_t flush_interval;
+    Unified2Writer *writer;
 } Unified2Config;
 
 typedef struct _Unified2LogCallbackData
@@ -167,6 +224,9 @@ static void _Unified2LogPacketAlert(Packet *, const char *, Unified2Config *, Ev
 static void _Unified2LogStreamAlert(Packet *, const char *, Unified2Config *, Event *);
 static int Unified2LogStreamCallback(DAQ_PktHdr_t *, uint8_t *, void *);
 static void Unified2Write(uint8_t *, uint32_t, Unified2Config *);
+static void Unified2WriterStart(Unified2Config *);
+static void Unified2WriterStop(Unified2Config *);
+static void Unified2WriterPut(Unified2Config *, uint32_t, const uint8_t *, uint32_t);
 
 static void _AlertIP4_v2(Packet *, const char *, Unified2Config *, Event *);
 static void _AlertIP6_v2(Packet *, const char *, Unified2Config *, Event *);
@@ -191,6 +251,13 @@ static void AlertExtraData(void *ssnptr, void *data, LogFunction *log_funcs, uin
 #define U2_BLOCKED_FLAG_WOULD 0x02
 #define U2_BLOCKED_FLAG_CANT  0x03
 
+#define U2_DEFAULT_QUEUE_SIZE     4096   /* KB */
+#define U2_DEFAULT_FLUSH_SIZE     64     /* KB */
+#define U2_DEFAULT_FLUSH_INTERVAL 100    /* ms */
+#define U2_MIN_QUEUE_SIZE         1024   /* KB */
+#define U2_MAX_QUEUE_SIZE         (1024 * 1024)
+#define U2_MAX_IOV                64
+
 /*
  * Function: SetupUnified2()
  *
@@ -279,6 +346,18 @@ static void Unified2PostConfig(struct _SnortConfig *sc, int unused, void *data)
 
     Unified2InitFile(config);
 
+    /* The thread itself is started with the first record so it runs in
+     * the process that does the logging (after daemonizing or forking
+     * the workers). */
+    if (config->async && (config->stream != NULL))
+    {
+        config->writer = (Unified2Writer *)SnortAlloc(sizeof(Unified2Writer));
+        config->writer->size = config->queue_size;
+        config->writer->ring = (uint8_t *)SnortAlloc(config->queue_size);
+        pthread_mutex_init(&config->writer->mutex, NULL);
+        pthread_cond_init(&config->writer->cond, NULL);
+    }
+
     if(stream_api)
     {
         stream_api->reg_xtra_data_log(AlertExtraData, (void *)config);
@@ -356,8 +435,15 @@ static void Unified2InitFile(Unified2Config *config)
 
 static inline void Unified2RotateFile(Unified2Config *config)
 {
-    fclose(config->stream);
     config->current = 0;
+
+    /* the writer thread owns the file */
+    if (config->writer != NULL)
+    {
+        Unified2WriterPut(config, U2_RING_ROTATE, NULL, 0);
+        return;
+    }
+    fclose(config->stream);
     Unified2InitFile(config);
 }
 
@@ -1334,6 +1420,38 @@ static Unified2Config * Unified2ParseArgs(char *args, char *default_filename)
             {
                 config->dont_rotate_on_packets = 1;
             }
+            else if(strcasecmp("async", stoks[0]) == 0)
+            {
+                config->async = 1;
+            }
+            else if(strcasecmp("drop_on_full", stoks[0]) == 0)
+            {
+                config->drop_on_full = 1;
+            }
+            else if((strcasecmp("queue_size", stoks[0]) == 0) ||
+                    (strcasecmp("flush_size", stoks[0]) == 0) ||
+                    (strcasecmp("flush_interval", stoks[0]) == 0))
+            {
+                char *end;
+                unsigned long value = 0;
+
+                if (num_stoks > 1)
+                    value = SnortStrtoul(stoks[1], &end, 10);
+
+                if ((num_stoks < 2) || (stoks[1] == end) || (*end != '\0') ||
+                    (errno == ERANGE) || (value == 0) || (value > U2_MAX_QUEUE_SIZE))
+                {
+                    FatalError("Argument Error in %s(%i): %s\n",
+                               file_name, file_line, index);
+                }
+
+                if (strcasecmp("queue_size", stoks[0]) == 0)
+                    config->queue_size = value;
+                else if (strcasecmp("flush_size", stoks[0]) == 0)
+                    config->flush_size = value;
+                else
+                    config->flush_interval = value;
+            }
             else
             {
                 FatalError("Argument Error in %s(%i): %s\n",
@@ -1362,6 +1480,36 @@ static Unified2Config * Unified2ParseArgs(char *args, char *default_filename)
     /* convert the limit to "MB" */
     config->limit <<= 20;
 
+    if (config->async)
+    {
+        uint32_t size = U2_MIN_QUEUE_SIZE;
+
+        if (config->queue_size == 0)
+            config->queue_size = U2_DEFAULT_QUEUE_SIZE;
+
+        if (config->flush_size == 0)
+            config->flush_size = U2_DEFAULT_FLUSH_SIZE;
+
+        if (config->flush_interval == 0)
+            config->flush_interval = U2_DEFAULT_FLUSH_INTERVAL;
+
+        /* the ring size is a power of 2 */
+        while (size < config->queue_size)
+            size <<= 1;
+
+        config->queue_size = size << 10;
+        config->flush_size <<= 10;
+
+        if (config->flush_size > config->queue_size / 2)
+            config->flush_size = config->queue_size / 2;
+    }
+    else if (config->queue_size || config->flush_size ||
+             config->flush_interval || config->drop_on_full)
+    {
+        FatalError("%s(%i) unified2: queue_size, flush_size, flush_interval "
+                   "and drop_on_full require async.\n", file_name, file_line);
+    }
+
     return config;
 }
 
@@ -1385,6 +1533,9 @@ static void Unified2CleanExit(int signal, void *arg)
     /* free up initialized memory */
     if (config != NULL)
     {
+        if (config->writer != NULL)
+            Unified2WriterStop(config);
+
         if (config->stream != NULL)
             fclose(config->stream);
 
@@ -1520,6 +1671,16 @@ static void Unified2Write(uint8_t *buf, uint32_t buf_len, Unified2Config *config
     size_t fwcount = 0;
     int ffstatus = 0;
 
+    if ((config != NULL) && (config->writer != NULL))
+    {
+        if (buf != NULL)
+        {
+            Unified2WriterPut(config, U2_RING_DATA, buf, buf_len);
+            config->current += buf_len;
+        }
+        return;
+    }
+
     /* Nothing to write or nothing to write to */
     if ((buf == NULL) || (config == NULL) || (config->stream == NULL))
         return;
@@ -1667,3 +1828,317 @@ static void Unified2Write(uint8_t *buf, uint32_t buf_len, Unified2Config *config
     config->current += buf_len;
 }
 
+
+/******************************************************************************
+ * Asynchronous writer
+ *
+ * With the async option the packet thread only copies each record into the
+ * ring (Unified2WriterPut).  The writer thread wakes up every flush_interval
+ * ms, or sooner once flush_size bytes are queued, and writes everything that
+ * is queued with writev() straight out of the ring.  File rotation is queued
+ * as a record so it happens in order with the data.  When the ring is full
+ * the packet thread waits for the writer, or drops the record if
+ * drop_on_full is set.
+ ******************************************************************************/
+static void Unified2WriterSignal(Unified2Writer *w)
+{
+    pthread_mutex_lock(&w->mutex);
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    w->unsignaled = 0;
+}
+
+static void Unified2WriterPut(Unified2Config *config, uint32_t type,
+        const uint8_t *buf, uint32_t len)
+{
+    Unified2Writer *w = config->writer;
+    Unified2RingRec *rec;
+    uint32_t need = sizeof(Unified2RingRec) + U2_RING_ALIGN(len);
+    uint32_t head = w->head;
+    uint32_t off = head & (w->size - 1);
+    uint32_t contig = w->size - off;
+    uint32_t total = (contig < need) ? (contig + need) : need;
+    int waited = 0;
+
+    if (w->owner != getpid())
+        Unified2WriterStart(config);
+
+    while ((w->size - (head - w->tail)) < total)
+    {
+        if (config->drop_on_full && (type == U2_RING_DATA))
+        {
+            w->drops++;
+            return;
+        }
+
+        if (!waited)
+        {
+            w->waits++;
+            waited = 1;
+        }
+        Unified2WriterSignal(w);
+
+        {
+            struct timespec ts = { 0, 100000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    /* don't touch the space before we've seen the writer release it */
+    __sync_synchronize();
+
+    if (contig < need)
+    {
+        rec = (Unified2RingRec *)(w->ring + off);
+        rec->type = U2_RING_PAD;
+        rec->len = contig - sizeof(Unified2RingRec);
+        head += contig;
+        off = 0;
+    }
+
+    rec = (Unified2RingRec *)(w->ring + off);
+    rec->type = type;
+    rec->len = len;
+
+    if (len != 0)
+        memcpy(rec + 1, buf, len);
+
+    __sync_synchronize();
+    w->head = head + need;
+
+    if (type == U2_RING_DATA)
+    {
+        w->records++;
+        w->bytes += len;
+    }
+
+    w->unsignaled += need;
+
+    if ((w->unsignaled >= config->flush_size) || (type != U2_RING_DATA))
+        Unified2WriterSignal(w);
+}
+
+static void Unified2WriterFileError(Unified2Config *config, int error)
+{
+    if (config->nostamp)
+    {
+        ErrorMessage("%s(%d) Failed to write to unified2 file (%s): %s\n",
+                     __FILE__, __LINE__, config->filepath, strerror(error));
+    }
+    else
+    {
+        ErrorMessage("%s(%d) Failed to write to unified2 file (%s.%u): %s\n",
+                     __FILE__, __LINE__, config->filepath,
+                     config->timestamp, strerror(error));
+    }
+}
+
+/* Same recovery as Unified2Write(): retry interrupts a few times and
+ * start a new file once on EIO.  A record that was partly written to
+ * the old file is not repeated in the new one. */
+static void Unified2WriterFlush(Unified2Config *config, struct iovec *iov, int iovcnt)
+{
+    int max_retries = 3;
+    int rotated = 0;
+    int partial = 0;
+
+    if (iovcnt == 0)
+        return;
+
+    config->writer->batches++;
+
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fileno(config->stream), iov, iovcnt);
+
+        if (n < 0)
+        {
+            int error = errno;
+
+            Unified2WriterFileError(config, error);
+
+            if ((error == EINTR) && (max_retries-- > 0))
+                continue;
+
+            if ((error == EIO) && !rotated)
+            {
+                ErrorMessage("%s(%d) Unified2 file is possibly corrupt. "
+                             "Closing this unified2 file and creating "
+                             "a new one.\n", __FILE__, __LINE__);
+
+                fclose(config->stream);
+                Unified2InitFile(config);
+                config->writer->rotations++;
+                rotated = 1;
+
+                if (partial)
+                {
+                    iov++;
+                    iovcnt--;
+                    partial = 0;
+                }
+                continue;
+            }
+
+            if (error == EINTR)
+            {
+                FatalError("%s(%d) Maximum number of interrupts exceeded. "
+                           "Cannot write to device.\n", __FILE__, __LINE__);
+            }
+            FatalError("%s(%d) Cannot write to device.\n", __FILE__, __LINE__);
+        }
+
+        while ((iovcnt > 0) && ((size_t)n >= iov->iov_len))
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        partial = (n > 0);
+
+        if (partial)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static void Unified2WriterDrain(Unified2Config *config)
+{
+    Unified2Writer *w = config->writer;
+    struct iovec iov[U2_MAX_IOV];
+    int iovcnt = 0;
+    uint32_t tail = w->tail;
+    uint32_t head = w->head;
+
+    __sync_synchronize();
+
+    while (tail != head)
+    {
+        Unified2RingRec *rec = (Unified2RingRec *)(w->ring + (tail & (w->size - 1)));
+
+        if (rec->type == U2_RING_DATA)
+        {
+            iov[iovcnt].iov_base = rec + 1;
+            iov[iovcnt].iov_len = rec->len;
+            iovcnt++;
+        }
+        else if (rec->type == U2_RING_ROTATE)
+        {
+            Unified2WriterFlush(config, iov, iovcnt);
+            iovcnt = 0;
+
+            fclose(config->stream);
+            Unified2InitFile(config);
+            w->rotations++;
+        }
+
+        tail += sizeof(Unified2RingRec) + U2_RING_ALIGN(rec->len);
+
+        if (iovcnt == U2_MAX_IOV)
+        {
+            Unified2WriterFlush(config, iov, iovcnt);
+            iovcnt = 0;
+
+            __sync_synchronize();
+            w->tail = tail;
+        }
+
+        if (tail == head)
+        {
+            head = w->head;
+            __sync_synchronize();
+        }
+    }
+
+    Unified2WriterFlush(config, iov, iovcnt);
+
+    __sync_synchronize();
+    w->tail = tail;
+}
+
+static void * Unified2WriterThread(void *arg)
+{
+    Unified2Config *config = (Unified2Config *)arg;
+    Unified2Writer *w = config->writer;
+    struct timespec ts;
+    struct timeval tv;
+
+    pthread_mutex_lock(&w->mutex);
+
+    while (!w->stop)
+    {
+        gettimeofday(&tv, NULL);
+        ts.tv_sec = tv.tv_sec + config->flush_interval / 1000;
+        ts.tv_nsec = tv.tv_usec * 1000 + (config->flush_interval % 1000) * 1000000;
+
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        pthread_cond_timedwait(&w->cond, &w->mutex, &ts);
+        pthread_mutex_unlock(&w->mutex);
+
+        Unified2WriterDrain(config);
+
+        pthread_mutex_lock(&w->mutex);
+    }
+
+    pthread_mutex_unlock(&w->mutex);
+
+    /* whatever was queued before we were stopped */
+    Unified2WriterDrain(config);
+
+    return NULL;
+}
+
+static void Unified2WriterStart(Unified2Config *config)
+{
+    Unified2Writer *w = config->writer;
+    int rval;
+
+    /* after a fork anything still queued belongs to the parent */
+    if (w->owner != 0)
+        w->tail = w->head;
+
+    w->owner = getpid();
+    w->stop = 0;
+
+    if ((rval = pthread_create(&w->thread_id, NULL, Unified2WriterThread, config)) != 0)
+    {
+        FatalError("%s(%d) Could not create unified2 writer thread: %s\n",
+                   __FILE__, __LINE__, strerror(rval));
+    }
+}
+
+static void Unified2WriterStop(Unified2Config *config)
+{
+    Unified2Writer *w = config->writer;
+
+    if (w->owner == getpid())
+    {
+        pthread_mutex_lock(&w->mutex);
+        w->stop = 1;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+
+        pthread_join(w->thread_id, NULL);
+
+        LogMessage("Unified2 %s: " STDu64 " records, " STDu64 " bytes in "
+                   STDu64 " writes, " STDu64 " rotations\n",
+                   config->base_filename, w->records, w->bytes,
+                   w->batches, w->rotations);
+        LogMessage("Unified2 %s: " STDu64 " records waited for queue space, "
+                   STDu64 " dropped\n", config->base_filename, w->waits, w->drops);
+    }
+
+    pthread_mutex_destroy(&w->mutex);
+    pthread_cond_destroy(&w->cond);
+    free(w->ring);
+    free(w);
+    config->writer = NULL;
+}
@@ -80,6 +80,7 @@
 #include "asn1.h"
 #include "sfutil/sfghash.h"
 #include "sp_preprocopt.h"
+#include "sp_pcre.h"
 #include "detection-plugins/sp_icmp_type_check.h"
 #include "detection-plugins/sp_ip_proto.h"
 #include "detection-plugins/sp_pattern_match.h"
@@ -99,6 +100,8 @@
 #include "active.h"
 #include "file_config.h"
 #include "file_service_config.h"
+#include "workers.h"
+#include "sfhugepage.h"
 #include "dynamic-plugins/sp_dynamic.h"
 #include "dynamic-output/plugins/output.h"
 
@@ -234,6 +237,9 @@
 #define DETECTION_OPT__NO_STREAM_INSERTS                     "no_stream_inserts"
 #define DETECTION_OPT__SEARCH_METHOD                         "search-method"
 #define DETECTION_OPT__SEARCH_OPTIMIZE                       "search-optimize"
+#define DETECTION_OPT__SEARCH_IMAGE_DIR                      "search-image-dir"
+#define DETECTION_OPT__COMPILE_THREADS                       "compile-threads"
+#define DETECTION_OPT__HUGE_PAGES                            "huge-pages"
 #define DETECTION_OPT__SPLIT_ANY_ANY                         "split-any-any"
 #define DETECTION_OPT__MAX_PATTERN_LEN                       "max-pattern-len"
 #define DETECTION_OPT__DEBUG_PRINT_FAST_PATTERN              "debug-print-fast-pattern"
@@ -273,6 +279,9 @@
 #define POLICY_MODE_INLINE      "inline"
 #define POLICY_MODE_INLINE_TEST "inline_test"
 
+#define WORKER_BALANCE_OPT__DAQ   "daq"
+#define WORKER_BALANCE_OPT__HASH  "hash"
+
 #ifdef PERF_PROFILING
 # define PROFILE_OPT__FILENAME                "filename"
 # define PROFILE_OPT__PRINT                   "print"
@@ -286,6 +295,10 @@
 # define PROFILE_OPT__AVG_TICKS_PER_MATCH     "avg_ticks_per_match"
 # define PROFILE_OPT__AVG_TICKS_PER_NO_MATCH  "avg_ticks_per_nomatch"
 # define PROFILE_OPT__APPEND                  "append"
+# define PROFILE_OPT__COUNTERS                "counters"
+# define PROFILE_OPT__DUMP                    "dump"
+# define PROFILE_OPT__JSON                    "json"
+# define PROFILE_OPT__CSV                     "csv"
 #endif
 
 #ifdef PPM_MGR
@@ -710,6 +723,9 @@ static const ConfigFunc config_opts[] =
     { CONFIG_OPT__PKT_SNAPLEN, 1, 1, 1, ConfigPacketSnaplen },
     { CONFIG_OPT__PCRE_MATCH_LIMIT, 1, 1, 1, ConfigPcreMatchLimit },
     { CONFIG_OPT__PCRE_MATCH_LIMIT_RECURSION, 1, 1, 1, ConfigPcreMatchLimitRecursion },
+    { CONFIG_OPT__PCRE_MATCH_LIMIT_POLICY, 1, 1, 1, ConfigPcreMatchLimitPolicy },
+    { CONFIG_OPT__PCRE_JIT, 1, 1, 1, ConfigPcreJit },
+    { CONFIG_OPT__PCRE_JIT_STACK, 1, 1, 1, ConfigPcreJitStack },
     /* XXX We can configure this on the command line - why not in config file ??? */
 #ifdef NOT_UNTIL_WE_DAEMONIZE_AFTER_READING_CONFFILE
     { CONFIG_OPT__PID_PATH, 1, 1, 1, ConfigPidPath },
@@ -752,6 +768,8 @@ static const ConfigFunc config_opts[] =
 #endif
     { CONFIG_OPT__MAX_IP6_EXTENSIONS, 1, 1, 1, ConfigMaxIP6Extensions },
     { CONFIG_OPT__DISABLE_REPLACE, 0, 1, 0, ConfigDisableReplace },
+    { CONFIG_OPT__WORKERS, 1, 1, 1, ConfigWorkers },
+    { CONFIG_OPT__WORKER_BALANCE, 1, 1, 1, ConfigWorkerBalance },
     { NULL, 0, 0, 0, NULL }   /* Marks end of array */
 };
 
@@ -6802,6 +6820,65 @@ void ConfigDetection(SnortConfig *sc, char *args)
         {
             fpDetectSetSplitAnyAny(fp, 1);
         }
+        else if (strcasecmp(toks[i], DETECTION_OPT__SEARCH_IMAGE_DIR) == 0)
+        {
+            struct stat st;
+
+            i++;
+            if (i >= num_toks)
+                ParseError("Missing argument to '%s'.", DETECTION_OPT__SEARCH_IMAGE_DIR);
+
+            if ((stat(toks[i], &st) != 0) || !S_ISDIR(st.st_mode))
+            {
+                ParseError("Invalid argument for %s: %s is not a directory.",
+                           DETECTION_OPT__SEARCH_IMAGE_DIR, toks[i]);
+            }
+
+            fpDetectSetSearchImageDir(fp, toks[i]);
+        }
+        else if (strcasecmp(toks[i], DETECTION_OPT__COMPILE_THREADS) == 0)
+        {
+            i++;
+            if (i < num_toks)
+            {
+                char *endptr;
+                int n = SnortStrtol(toks[i], &endptr, 0);
+
+                if ((errno == ERANGE) || (*endptr != '\0') || (n <= 0) || (n > 64))
+                {
+                    ParseError("Invalid argument for %s: %s.  Need an integer "
+                               "between 1 and 64.", DETECTION_OPT__COMPILE_THREADS, toks[i]);
+                }
+
+                fpDetectSetCompileThreads(fp, n);
+            }
+            else
+            {
+                ParseError("Missing argument to '%s'.", DETECTION_OPT__COMPILE_THREADS);
+            }
+        }
+        else if (strcasecmp(toks[i], DETECTION_OPT__HUGE_PAGES) == 0)
+        {
+            SfHugeMode mode;
+
+            i++;
+            if (i >= num_toks)
+                ParseError("Missing argument to '%s'.", DETECTION_OPT__HUGE_PAGES);
+
+            for (mode = SFHUGE__OFF; mode <= SFHUGE__1G; mode++)
+            {
+                if (strcasecmp(toks[i], sfhuge_mode_name(mode)) == 0)
+                    break;
+            }
+
+            if (mode > SFHUGE__1G)
+            {
+                ParseError("Invalid argument for %s: %s.  Need one of off, "
+                           "thp, 2m or 1g.", DETECTION_OPT__HUGE_PAGES, toks[i]);
+            }
+
+            fpDetectSetHugePages(fp, mode);
+        }
         else if (strcasecmp(toks[i], DETECTION_OPT__MAX_PATTERN_LEN) == 0)
         {
             i++;
@@ -8123,6 +8200,66 @@ void ConfigPcreMatchLimitRecursion(SnortConfig *sc, char *args)
                             sc->pcre_match_limit_recursion););
 }
 
+void ConfigPcreMatchLimitPolicy(SnortConfig *sc, char *args)
+{
+    if ((sc == NULL) || (args == NULL))
+        return;
+
+    if (strcasecmp(args, "nomatch") == 0)
+        sc->pcre_match_limit_policy = PCRE_MATCH_LIMIT_POLICY__NOMATCH;
+    else if (strcasecmp(args, "match") == 0)
+        sc->pcre_match_limit_policy = PCRE_MATCH_LIMIT_POLICY__MATCH;
+    else
+        ParseError("pcre_match_limit_policy: Invalid value '%s'.  Must be "
+                   "'match' or 'nomatch'.", args);
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "pcre_match_limit_policy: %d\n",
+                            sc->pcre_match_limit_policy););
+}
+
+void ConfigPcreJit(SnortConfig *sc, char *args)
+{
+    if ((sc == NULL) || (args == NULL))
+        return;
+
+    if (strcasecmp(args, "on") == 0)
+        sc->pcre_jit = 1;
+    else if (strcasecmp(args, "off") == 0)
+        sc->pcre_jit = 0;
+    else
+        ParseError("pcre_jit: Invalid value '%s'.  Must be 'on' or 'off'.", args);
+
+#ifndef PCRE_STUDY_JIT_COMPILE
+    if (sc->pcre_jit)
+        LogMessage("WARNING: pcre_jit: this libpcre has no JIT support, "
+                   "rules will be interpreted.\n");
+#endif
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "pcre_jit: %d\n", sc->pcre_jit););
+}
+
+void ConfigPcreJitStack(SnortConfig *sc, char *args)
+{
+    char *endp;
+    long val = 0;
+
+    if ((sc == NULL) || (args == NULL))
+        return;
+
+    /* KB; the JIT starts with 32K and grows the stack up to this */
+    val = strtol(args, &endp, 0);
+    if ((args == endp) || *endp || (val < 32) || (val > 1024 * 1024))
+    {
+        ParseError("pcre_jit_stack: Invalid value '%s'.  Must be between "
+                   "32 and 1048576 KB.", args);
+    }
+
+    sc->pcre_jit_stack_size = val;
+
+    DEBUG_WRAP(DebugMessage(DEBUG_INIT, "pcre_jit_stack: %ld\n",
+                            sc->pcre_jit_stack_size););
+}
+
 void ConfigPerfFile(SnortConfig *sc, char *args)
 {
     if ((sc == NULL) || (args == NULL))
@@ -8635,7 +8772,7 @@ void ConfigProfilePreprocs(SnortConfig *sc, char *args)
 
     toks = mSplit(args, ",", 0, &num_toks, 0);
 
-    if (num_toks > 3)
+    if (num_toks > 5)
     {
         ParseError("profile_preprocs speciified with invalid options (%s)", args);
     }
@@ -8645,15 +8782,19 @@ void ConfigProfilePreprocs(SnortConfig *sc, char *args)
         char **opts;
         int num_opts;
         int opt_filename = 0;
+        int opt_counters = 0;
         char *endptr;
 
         opts = mSplit(toks[i], " \t", 0, &num_opts, 0);
         if (num_opts > 0)
         {
-            opt_filename = strcasecmp(opts[0], PROFILE_OPT__FILENAME) == 0;
+            opt_filename = (strcasecmp(opts[0], PROFILE_OPT__FILENAME) == 0) ||
+                           (strcasecmp(opts[0], PROFILE_OPT__DUMP) == 0);
+            opt_counters = strcasecmp(opts[0], PROFILE_OPT__COUNTERS) == 0;
         }
 
-        if ((!opt_filename && (num_opts != 2)) ||
+        if ((opt_counters && (num_opts != 1)) ||
+            (!opt_filename && !opt_counters && (num_opts != 2)) ||
             (opt_filename && ((num_opts > 3) || (num_opts < 2))))
         {
             ParseError("profile_preprocs has an invalid option (%s)", toks[i]);
@@ -8706,6 +8847,26 @@ void ConfigProfilePreprocs(SnortConfig *sc, char *args)
                 sc->profile_preprocs.append = 0;
             }
         }
+        else if (strcasecmp(opts[0], PROFILE_OPT__COUNTERS) == 0)
+        {
+            sc->profile_preprocs.counters = 1;
+        }
+        else if (strcasecmp(opts[0], PROFILE_OPT__DUMP) == 0)
+        {
+            sc->profile_preprocs.dump_file = ProcessFileOption(sc, opts[1]);
+            if (!opts[2] || (strcasecmp(opts[2], PROFILE_OPT__JSON) == 0))
+            {
+                sc->profile_preprocs.dump_format = PROFILE_DUMP_JSON;
+            }
+            else if (strcasecmp(opts[2], PROFILE_OPT__CSV) == 0)
+            {
+                sc->profile_preprocs.dump_format = PROFILE_DUMP_CSV;
+            }
+            else
+            {
+                ParseError("profile_preprocs has an invalid dump format (%s)", toks[i]);
+            }
+        }
         else
         {
             ParseError("profile_preprocs has an invalid option (%s)", toks[i]);
@@ -8740,7 +8901,7 @@ void ConfigProfileRules(SnortConfig *sc, char *args)
 
     toks = mSplit(args, ",", 0, &num_toks, 0);
 
-    if (num_toks > 3)
+    if (num_toks > 5)
     {
         ParseError("profile_rules speciified with invalid options (%s)", args);
     }
@@ -8750,15 +8911,19 @@ void ConfigProfileRules(SnortConfig *sc, char *args)
         char **opts;
         int num_opts;
         int opt_filename = 0;
+        int opt_counters = 0;
         char *endptr;
 
         opts = mSplit(toks[i], " \t", 0, &num_opts, 0);
         if (num_opts > 0)
         {
-            opt_filename = strcasecmp(opts[0], PROFILE_OPT__FILENAME) == 0;
+            opt_filename = (strcasecmp(opts[0], PROFILE_OPT__FILENAME) == 0) ||
+                           (strcasecmp(opts[0], PROFILE_OPT__DUMP) == 0);
+            opt_counters = strcasecmp(opts[0], PROFILE_OPT__COUNTERS) == 0;
         }
 
-        if ((!opt_filename && (num_opts != 2)) ||
+        if ((opt_counters && (num_opts != 1)) ||
+            (!opt_filename && !opt_counters && (num_opts != 2)) ||
             (opt_filename && ((num_opts > 3) || (num_opts < 2))))
         {
             ParseError("profile_rules has an invalid option (%s)", toks[i]);
@@ -8827,6 +8992,26 @@ void ConfigProfileRules(SnortConfig *sc, char *args)
                 sc->profile_rules.append = 0;
             }
         }
+        else if (strcasecmp(opts[0], PROFILE_OPT__COUNTERS) == 0)
+        {
+            sc->profile_rules.counters = 1;
+        }
+        else if (strcasecmp(opts[0], PROFILE_OPT__DUMP) == 0)
+        {
+            sc->profile_rules.dump_file = ProcessFileOption(sc, opts[1]);
+            if (!opts[2] || (strcasecmp(opts[2], PROFILE_OPT__JSON) == 0))
+            {
+                sc->profile_rules.dump_format = PROFILE_DUMP_JSON;
+            }
+            else if (strcasecmp(opts[2], PROFILE_OPT__CSV) == 0)
+            {
+                sc->profile_rules.dump_format = PROFILE_DUMP_CSV;
+            }
+            else
+            {
+                ParseError("profile_rules has an invalid dump format (%s)", toks[i]);
+            }
+        }
         else
         {
             ParseError("profile_rules has an invalid option (%s)", toks[i]);
@@ -9291,6 +9476,43 @@ void ConfigDisableReplace(SnortConfig *sc, char *args)
         return;
     sc->disable_replace_opt = 1;
 }
+
+void ConfigWorkers(SnortConfig *sc, char *args)
+{
+    unsigned long value;
+    char *endptr;
+
+    if ((sc == NULL) || (args == NULL))
+        return;
+
+    value = SnortStrtoulRange(args, &endptr, 0, 0, WORKERS_MAX);
+
+    if ((errno == ERANGE) || (*endptr != '\0'))
+    {
+        ParseError("Invalid argument to '%s' configuration: %s.  "
+                   "Must be between 0 (off) and %u (max).",
+                   CONFIG_OPT__WORKERS, args, WORKERS_MAX);
+    }
+
+    sc->worker_count = (uint32_t)value;
+}
+
+void ConfigWorkerBalance(SnortConfig *sc, char *args)
+{
+    if ((sc == NULL) || (args == NULL))
+        return;
+
+    if (strcasecmp(args, WORKER_BALANCE_OPT__DAQ) == 0)
+        sc->worker_balance = WORKER_BALANCE__DAQ;
+    else if (strcasecmp(args, WORKER_BALANCE_OPT__HASH) == 0)
+        sc->worker_balance = WORKER_BALANCE__HASH;
+    else
+    {
+        ParseError("Invalid argument to '%s' configuration: %s.  "
+                   "Must be '%s' or '%s'.", CONFIG_OPT__WORKER_BALANCE, args,
+                   WORKER_BALANCE_OPT__DAQ, WORKER_BALANCE_OPT__HASH);
+    }
+}
 /****************************************************************************
  *
  * Function: ParseRule()
@@ -180,6 +180,9 @@
 #define CONFIG_OPT__PAF_MAX                         "paf_max"
 #define CONFIG_OPT__PCRE_MATCH_LIMIT                "pcre_match_limit"
 #define CONFIG_OPT__PCRE_MATCH_LIMIT_RECURSION      "pcre_match_limit_recursion"
+#define CONFIG_OPT__PCRE_MATCH_LIMIT_POLICY         "pcre_match_limit_policy"
+#define CONFIG_OPT__PCRE_JIT                        "pcre_jit"
+#define CONFIG_OPT__PCRE_JIT_STACK                  "pcre_jit_stack"
 #define CONFIG_OPT__PKT_COUNT                       "pkt_count"
 #define CONFIG_OPT__PKT_SNAPLEN                     "snaplen"
 #define CONFIG_OPT__PID_PATH                        "pidpath"
@@ -220,6 +223,8 @@
 #endif
 #define CONFIG_OPT__MAX_IP6_EXTENSIONS              "max_ip6_extensions"
 #define CONFIG_OPT__DISABLE_REPLACE                 "disable_replace"
+#define CONFIG_OPT__WORKERS                         "workers"
+#define CONFIG_OPT__WORKER_BALANCE                  "worker_balance"
 /* exported values */
 extern char *file_name;
 extern int file_line;
@@ -355,6 +360,9 @@ void ConfigPacketCount(SnortConfig *, char *);
 void ConfigPacketSnaplen(SnortConfig *, char *);
 void ConfigPcreMatchLimit(SnortConfig *, char *);
 void ConfigPcreMatchLimitRecursion(SnortConfig *, char *);
+void ConfigPcreMatchLimitPolicy(SnortConfig *, char *);
+void ConfigPcreJit(SnortConfig *, char *);
+void ConfigPcreJitStack(SnortConfig *, char *);
 void ConfigPerfFile(SnortConfig *sc, char *);
 void ConfigPidPath(SnortConfig *, char *);
 void ConfigPolicy(SnortConfig *, char *);
@@ -398,6 +406,8 @@ void ConfigFile(SnortConfig *, char *);
 void ConfigTunnelVerdicts(SnortConfig*, char*);
 void ConfigMaxIP6Extensions(SnortConfig *, char*);
 void ConfigDisableReplace(SnortConfig *, char*);
+void ConfigWorkers(SnortConfig *, char *);
+void ConfigWorkerBalance(SnortConfig *, char *);
 
 int addRtnToOtn(
         OptTreeNode *otn,
@@ -63,6 +63,41 @@ typedef enum _PmType
 
 } PmType;
 
+/*
+**  What every rule behind one of a group's pattern matchers needs from a
+**  packet before any of its options can pass, summarized when the group is
+**  built.  A matcher is not searched for a packet that fails its summary.
+*/
+#define PM_PRE_FROM_CLIENT  0x01
+#define PM_PRE_FROM_SERVER  0x02
+
+#define PM_PRE_MAX_BITS     8
+#define PM_PRE_MAX_METHODS  4
+#define PM_PRE_METHOD_LEN   16
+
+typedef struct _PmPrecondition
+{
+    unsigned rules;         /* rules summarized so far */
+    uint8_t active;         /* any of the below applies */
+
+    uint8_t flow;           /* PM_PRE_FROM_* some rule accepts */
+    uint8_t established;    /* every rule needs an established session */
+
+    uint8_t dsize;          /* every rule has dsize within dsize_lo..hi */
+    int dsize_lo;
+    int dsize_hi;
+
+    uint8_t num_bits;       /* every rule needs one of these flowbits */
+    uint16_t bits[PM_PRE_MAX_BITS];
+
+    uint8_t method;         /* every rule has an http_method content ... */
+    uint8_t num_methods;    /* ... and one of these must be in the buffer */
+    uint8_t method_len[PM_PRE_MAX_METHODS];
+    uint8_t method_nocase[PM_PRE_MAX_METHODS];
+    char methods[PM_PRE_MAX_METHODS][PM_PRE_METHOD_LEN];
+
+} PmPrecondition;
+
 typedef struct _not_rule_node_ {
 
   struct _not_rule_node_ * next;
@@ -98,6 +133,7 @@ typedef struct {
  
   /* Pattern Matching data structures (MPSE) */
   void *pgPms[PM_TYPE__MAX];
+  PmPrecondition pgPre[PM_TYPE__MAX];
 
   /* detection option tree */
   void *pgNonContentTree;
@@ -2832,6 +2832,37 @@ static inline const u_char *hi_client_extract_header(
     header_ptr->header.uri_end = p;
     return p;
 }
+
+/*
+**  hi_client_extract_header stops right after the blank line ending the
+**  header when it sees one.  In that case this returns where the body
+**  starts, which is what FindPipelineReq would find scanning the header
+**  again, or NULL if the header has to be rescanned.
+*/
+static inline const u_char *HeaderBodyStart(const HEADER_PTR *header_ptr,
+        const u_char *ptr, const u_char *start, const u_char *end)
+{
+    const u_char *eol;
+
+    if(!ptr || !header_ptr->header.uri || (ptr != header_ptr->header.uri_end) ||
+       ((ptr - start) < 3) || (ptr[-1] != '\n'))
+    {
+        return NULL;
+    }
+
+    eol = ptr - 2;
+
+    if(*eol == '\r')
+        eol--;
+
+    /* same limit as FindPipelineReq, there must be more than a few bytes
+     * after the header */
+    if((*eol != '\n') || (eol >= (end - 6)))
+        return NULL;
+
+    return ptr;
+}
+
 #define CLR_POST(Client) \
     do { \
                 Client->request.post_raw = NULL;\
@@ -3163,10 +3194,11 @@ int StatelessInspection(Packet *p, HI_SESSION *Session, HttpSessionData *hsd, in
         /* Got a Content-Length or it's a POST request which may be chunked */
         if (header_ptr.content_len.cont_len_start || header_ptr.is_chunked)
         {
-            /* Need to skip over header and get to the body.
-             * The unaptly named FindPipelineReq will do that. */
-            ptr = FindPipelineReq(Session, uri_ptr.delimiter, end);
-            //ptr = FindPipelineReq(Session, ptr, end);
+            /* Need to skip over header and get to the body.  Unless the
+             * header was cut short the header scan already got there;
+             * otherwise the unaptly named FindPipelineReq will do that. */
+            if(!(ptr = HeaderBodyStart(&header_ptr, ptr, start, end)))
+                ptr = FindPipelineReq(Session, uri_ptr.delimiter, end);
             if(ptr)
             {
                 post_ptr.uri = ptr;
@@ -57,6 +57,7 @@
 #endif
 
 #include "hi_norm.h"
+#include "hi_client_norm.h"
 #include "hi_util.h"
 #include "hi_return_codes.h"
 
@@ -192,25 +193,124 @@ int hi_split_header_cookie(HI_SESSION *Session, u_char *header, int *i_header_le
     return iRet;
 }
 
+static u_char HeaderBuf[MAX_URI];
+static u_char CookieBuf[MAX_URI];
+static u_char PostBuf[MAX_URI];
+
+/*
+**  Body normalization never alerts (HI_BODY) and header and cookie
+**  normalization only alert if one of the decoding or directory alerts is
+**  configured for the server.  When none are, the result only matters to
+**  detection and those fields are normalized on demand.
+*/
+static int hi_client_norm_quiet(HTTPINSPECT_CONF *ServerConf)
+{
+    int iCtr;
+
+    if(ServerConf->norm_quiet)
+        return ServerConf->norm_quiet > 0;
+
+    ServerConf->norm_quiet = 1;
+
+    if(!ServerConf->no_alerts)
+    {
+        if(ServerConf->ascii.alert || ServerConf->double_decoding.alert ||
+           ServerConf->u_encoding.alert || ServerConf->bare_byte.alert ||
+           ServerConf->utf_8.alert || ServerConf->iis_unicode.alert ||
+           ServerConf->multiple_slash.alert || ServerConf->iis_backslash.alert ||
+           ServerConf->directory.alert || ServerConf->webroot.alert ||
+           ServerConf->long_dir)
+        {
+            ServerConf->norm_quiet = -1;
+        }
+
+        for(iCtr = 0; iCtr < 256 && ServerConf->norm_quiet > 0; iCtr++)
+        {
+            if(ServerConf->non_rfc_chars[iCtr])
+                ServerConf->norm_quiet = -1;
+        }
+    }
+
+    return ServerConf->norm_quiet > 0;
+}
+
+/*
+**  Normalizes the field at *norm (still pointing at the raw data) into buf
+**  and points the field at the result, or clears it if there was a
+**  non-fatal problem normalizing.
+*/
+static void hi_client_norm_field(HI_SESSION *Session, u_char *buf,
+        const u_char **norm, u_int *norm_size, uint16_t *encode_type)
+{
+    int iBufSize = MAX_URI;
+    uint16_t encodeType = 0;
+    int iRet;
+
+    iRet = hi_norm_uri(Session, buf, &iBufSize, *norm, *norm_size, &encodeType);
+    if (iRet == HI_NONFATAL_ERR)
+    {
+        /* There was a non-fatal problem normalizing */
+        *norm = NULL;
+        *norm_size = 0;
+        *encode_type = 0;
+    }
+    else
+    {
+        /* Client code is expecting these to be set to non-NULL if
+         * normalization occurred. */
+        *norm = buf;
+        *norm_size = iBufSize;
+        *encode_type = encodeType;
+    }
+}
+
+void hi_client_norm_pending(HI_SESSION *Session, int iFields)
+{
+    HI_CLIENT_REQ *ClientReq = &Session->client.request;
+    uint32_t norm_flags = Session->norm_flags;
+
+    iFields &= ClientReq->norm_pending;
+    ClientReq->norm_pending &= ~iFields;
+
+    if(iFields & HI_NORM_HEADER)
+    {
+        Session->norm_flags &= ~HI_BODY;
+        hi_client_norm_field(Session, HeaderBuf, &ClientReq->header_norm,
+            &ClientReq->header_norm_size, &ClientReq->header_encode_type);
+    }
+
+    if(iFields & HI_NORM_COOKIE)
+    {
+        Session->norm_flags &= ~HI_BODY;
+        hi_client_norm_field(Session, CookieBuf, &ClientReq->cookie_norm,
+            &ClientReq->cookie_norm_size, &ClientReq->cookie_encode_type);
+    }
+
+    if(iFields & HI_NORM_POST)
+    {
+        Session->norm_flags |= HI_BODY;
+        hi_client_norm_field(Session, PostBuf, &ClientReq->post_norm,
+            &ClientReq->post_norm_size, &ClientReq->post_encode_type);
+    }
+
+    Session->norm_flags = norm_flags;
+}
+
 int hi_client_norm(HI_SESSION *Session)
 {
     static u_char UriBuf[MAX_URI];
-    static u_char HeaderBuf[MAX_URI];
-    static u_char CookieBuf[MAX_URI];
     static u_char RawHeaderBuf[MAX_URI];
     static u_char RawCookieBuf[MAX_URI];
-    static u_char PostBuf[MAX_URI];
     HI_CLIENT_REQ    *ClientReq;
     int iRet;
     int iUriBufSize = MAX_URI;
     int iRawHeaderBufSize = MAX_URI;
     int iRawCookieBufSize = MAX_URI;
-    int iHeaderBufSize = MAX_URI;
-    int iCookieBufSize = MAX_URI;
-    int iPostBufSize = MAX_URI;
+    const u_char *raw_header = RawHeaderBuf;
     uint16_t encodeType = 0;
     u_int updated_uri_size = 0;
     const u_char *updated_uri_start = NULL;
+    int iDefer;
 
     if(!Session || !Session->server_conf)
     {
@@ -222,6 +322,7 @@ int hi_client_norm(HI_SESSION *Session)
     ClientReq->header_encode_type = 0;
     ClientReq->cookie_encode_type = 0;
     ClientReq->post_encode_type = 0;
+    ClientReq->norm_pending = 0;
 
     /* Handle URI normalization */
     if(ClientReq->uri_norm)
@@ -289,41 +390,29 @@ int hi_client_norm(HI_SESSION *Session)
     }
     else
     {
-        if (ClientReq->header_raw_size)
+        /* Nothing to cut out of the header, so use it in place. */
+        if (ClientReq->header_raw_size > MAX_URI)
         {
-            if (ClientReq->header_raw_size > MAX_URI)
-            {
-                ClientReq->header_raw_size = MAX_URI;
-            }
-            /* Limiting to MAX_URI above should cause this to always return SAFEMEM_SUCCESS */
-            SafeMemcpy(RawHeaderBuf, ClientReq->header_raw, ClientReq->header_raw_size,
-                    &RawHeaderBuf[0], &RawHeaderBuf[0] + iRawHeaderBufSize);
+            ClientReq->header_raw_size = MAX_URI;
         }
+        raw_header = ClientReq->header_raw;
         iRawHeaderBufSize = ClientReq->header_raw_size;
         iRawCookieBufSize = 0;
     }
 
+    iDefer = hi_client_norm_quiet(Session->server_conf);
+
     if(ClientReq->header_norm && Session->server_conf->normalize_headers)
     {
         Session->norm_flags &= ~HI_BODY;
-        iRet = hi_norm_uri(Session, HeaderBuf, &iHeaderBufSize,
-                       RawHeaderBuf, iRawHeaderBufSize, &encodeType);
-        if (iRet == HI_NONFATAL_ERR)
-        {
-            /* There was a non-fatal problem normalizing */
-            ClientReq->header_norm = NULL;
-            ClientReq->header_norm_size = 0;
-            ClientReq->header_encode_type = 0;
-        }
+        ClientReq->header_norm = raw_header;
+        ClientReq->header_norm_size = iRawHeaderBufSize;
+
+        if(iDefer)
+            ClientReq->norm_pending |= HI_NORM_HEADER;
         else
-        {
-            /* Client code is expecting these to be set to non-NULL if
-             * normalization occurred. */
-            ClientReq->header_norm      = HeaderBuf;
-            ClientReq->header_norm_size = iHeaderBufSize;
-            ClientReq->header_encode_type = encodeType;
-        }
-        encodeType = 0;
+            hi_client_norm_field(Session, HeaderBuf, &ClientReq->header_norm,
+                &ClientReq->header_norm_size, &ClientReq->header_encode_type);
     }
     else
     {
@@ -331,7 +420,7 @@ int hi_client_norm(HI_SESSION *Session)
          * normalization occurred. */
         if (iRawHeaderBufSize)
         {
-            ClientReq->header_norm      = RawHeaderBuf;
+            ClientReq->header_norm      = raw_header;
             ClientReq->header_norm_size = iRawHeaderBufSize;
             ClientReq->header_encode_type = 0;
         }
@@ -340,24 +429,14 @@ int hi_client_norm(HI_SESSION *Session)
     if(ClientReq->cookie.cookie && Session->server_conf->normalize_cookies)
     {
         Session->norm_flags &= ~HI_BODY;
-        iRet = hi_norm_uri(Session, CookieBuf, &iCookieBufSize,
-                       RawCookieBuf, iRawCookieBufSize, &encodeType);
-        if (iRet == HI_NONFATAL_ERR)
-        {
-            /* There was a non-fatal problem normalizing */
-            ClientReq->cookie_norm = NULL;
-            ClientReq->cookie_norm_size = 0;
-            ClientReq->cookie_encode_type = 0;
-        }
+        ClientReq->cookie_norm = RawCookieBuf;
+        ClientReq->cookie_norm_size = iRawCookieBufSize;
+
+        if(iDefer)
+            ClientReq->norm_pending |= HI_NORM_COOKIE;
         else
-        {
-            /* Client code is expecting these to be set to non-NULL if
-             * normalization occurred. */
-            ClientReq->cookie_norm      = CookieBuf;
-            ClientReq->cookie_norm_size = iCookieBufSize;
-            ClientReq->cookie_encode_type = encodeType;
-        }
-        encodeType = 0;
+            hi_client_norm_field(Session, CookieBuf, &ClientReq->cookie_norm,
+                &ClientReq->cookie_norm_size, &ClientReq->cookie_encode_type);
     }
     else
     {
@@ -372,25 +451,14 @@ int hi_client_norm(HI_SESSION *Session)
     }
 
     /* Handle normalization of post methods.
-     * Note: posts go into a different buffer. */
+     * Note: posts go into a different buffer and are only normalized for
+     * the encoding type, so this is always left for detection to ask for. */
     if(ClientReq->post_norm)
     {
         Session->norm_flags |= HI_BODY;
-        iRet = hi_norm_uri(Session, PostBuf, &iPostBufSize,
-                           ClientReq->post_raw, ClientReq->post_raw_size, &encodeType);
-        if (iRet == HI_NONFATAL_ERR)
-        {
-            ClientReq->post_norm = NULL;
-            ClientReq->post_norm_size = 0;
-            ClientReq->post_encode_type = 0;
-        }
-        else
-        {
-            ClientReq->post_norm      = PostBuf;
-            ClientReq->post_norm_size = iPostBufSize;
-            ClientReq->post_encode_type = encodeType;
-        }
-        encodeType = 0;
+        ClientReq->post_norm = ClientReq->post_raw;
+        ClientReq->post_norm_size = ClientReq->post_raw_size;
+        ClientReq->norm_pending |= HI_NORM_POST;
     }
 
     /*
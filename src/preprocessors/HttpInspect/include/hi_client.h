@@ -173,6 +173,7 @@ typedef struct s_HI_CLIENT_REQ
 
     const u_char *pipeline_req;
     u_char method;
+    u_char norm_pending;    /* HI_NORM_* fields not normalized yet */
     uint16_t uri_encode_type;
     uint16_t header_encode_type;
     uint16_t cookie_encode_type;
@@ -38,6 +38,17 @@
 #include "hi_include.h"
 #include "hi_si.h"
 
+/*
+**  Header, cookie and body normalization is put off when it cannot raise
+**  an event.  The field is left pointing at the raw data with its bit set
+**  in HI_CLIENT_REQ.norm_pending until hi_client_norm_pending() is called
+**  for it, which happens when detection first looks at the buffer.
+*/
+#define HI_NORM_HEADER  0x01
+#define HI_NORM_COOKIE  0x02
+#define HI_NORM_POST    0x04
+
 int hi_client_norm(HI_SESSION *Session);
+void hi_client_norm_pending(HI_SESSION *Session, int iFields);
 
 #endif
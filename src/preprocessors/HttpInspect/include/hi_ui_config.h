@@ -146,6 +146,7 @@ typedef struct s_HTTPINSPECT_CONF
 
     char uri_only;
     char no_alerts;
+    char norm_quiet;    /* 0 unknown, 1 normalizing can't alert, -1 it can */
     char enable_cookie;
     char inspect_response;
     char enable_xff;
@@ -27,6 +27,7 @@
 #include "rules.h"
 #include "treenodes.h"
 #include "mempool.h"
+#include "sfoahash.h"
 
 #include "session_api.h"
 #include "session_common.h"
@@ -42,8 +43,7 @@ struct oneway_sessions
 
 typedef struct _SessionCache
 {
-    SFXHASH *hashTable;
-    SFXHASH_NODE *nextTimeoutEvalNode;
+    SFOAHASH *hashTable;
     uint32_t timeoutAggressive;
     uint32_t timeoutNominal;
     uint32_t max_sessions;
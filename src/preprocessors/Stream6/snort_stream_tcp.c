@@ -60,6 +60,7 @@
 #include "plugbase.h"
 #include "mstring.h"
 #include "sfxhash.h"
+#include "sfslab.h"
 #include "util.h"
 #include "sflsq.h"
 #include "snort_bounds.h"
@@ -168,6 +169,10 @@ extern PreprocStats preprocRuleOptionPerfStats;
 #define STREAM_UNALIGNED       0
 #define STREAM_ALIGNED         1
 
+/* segments a flush may pass to the rebuilt packet without copying;
+ * a full 64K flush of 1460 byte segments takes 45 */
+#define S5_MAX_FLUSH_SPANS    64
+
 /* actions */
 #define ACTION_NOTHING                  0x00000000
 #define ACTION_FLUSH_SENDER_STREAM      0x00000001
@@ -583,7 +588,7 @@ static uint32_t StreamGetMss(Packet *, uint16_t *);
 static uint32_t StreamGetTcpTimestamp(Packet *, uint32_t *, int strip);
 static int FlushStream(
         Packet*, StreamTracker *st, uint32_t toSeq, uint8_t *flushbuf,
-        const uint8_t *flushbuf_end);
+        const uint8_t *flushbuf_end, unsigned *spans);
 static void TcpSessionCleanup(SessionControlBlock *ssn, int freeApplicationData);
 static void TcpSessionCleanupWithFreeApplicationData(void *ssn);
 static void FlushQueuedSegs(SessionControlBlock *ssn, TcpSession *tcpssn);
@@ -602,9 +607,19 @@ static inline uint16_t GetTcpReassemblyPolicy(int os_policy);
 
 /*  G L O B A L S  **************************************************/
 void *tcp_lws_cache = NULL;
+
+/* Segment sizes include the StreamSegment header and are picked for the
+ * usual frame lengths: bare acks and small requests, 576, ethernet, jumbo
+ * and offloaded aggregates.  Bigger segments come from the heap. */
+static const size_t seg_pool_classes[] =
+    { 256, 640, 1664, 2304, 4224, 9344, 16512, 32896 };
+
+static SFSLAB *seg_pool = NULL;
+static SFSLAB_STATS seg_pool_final;
 static Packet *s5_pkt = NULL;
 static Packet *tcp_cleanup_pkt = NULL;
 static const uint8_t *s5_pkt_end = NULL;
+static EncodeSpan s5_flush_spans[S5_MAX_FLUSH_SPANS];
 static char midstream_allowed = 0;
 
 /* enum for policy names */
@@ -2508,6 +2523,28 @@ void StreamResetTcpPrunes(void)
     session_api->reset_session_prune_count( SESSION_PROTO_TCP );
 }
 
+void StreamPrintTcpSegmentStats(void)
+{
+    SFSLAB_STATS st;
+    uint64_t committed, requested;
+
+    if (seg_pool)
+        sfslab_get_stats(seg_pool, &st);
+    else
+        st = seg_pool_final;
+
+    committed = (uint64_t)st.slabs_in_use * st.slab_size;
+    requested = st.bytes_requested - st.bytes_fallback;
+
+    LogMessage("       TCP Segment Slabs: %u (peak %u of %u)\n",
+            st.slabs_in_use, st.slabs_peak, st.slabs_total);
+    LogMessage("   TCP Segments In Slabs: " STDu64 "\n",
+            st.objs_in_use);
+    LogMessage("TCP Segment Fragmentation: %.1f%%\n", committed ?
+            100.0 * (double)(committed - requested) / (double)committed : 0.0);
+    LogMessage("  TCP Segment Heap Allocs: " STDu64 "\n", st.fallback);
+}
+
 void StreamResetTcp(void)
 {
     if (snort_conf == NULL)
@@ -2551,6 +2588,15 @@ void StreamCleanTcp(void)
     session_api->delete_session_cache( SESSION_PROTO_TCP );
     tcp_lws_cache = NULL;
 
+    /* All segments are gone with the sessions; keep the pool stats for
+     * the exit summary which is printed after this. */
+    if (seg_pool)
+    {
+        sfslab_get_stats(seg_pool, &seg_pool_final);
+        sfslab_delete(seg_pool);
+        seg_pool = NULL;
+    }
+
     /* Cleanup the rebuilt packet */
     if (s5_pkt)
     {
@@ -3964,19 +4010,34 @@ static inline void SetupTcpDataBlock(TcpDataBlock *tdb, Packet *p)
     return;
 }
 
-static void SegmentFree (StreamSegment *seg)
+static inline unsigned SegmentSize (uint32_t caplen)
 {
-    unsigned dropped = sizeof(StreamSegment);
+    unsigned size = sizeof(StreamSegment);
+
+    if ( caplen > 0 )
+        size += caplen - 1;  // seg contains 1st byte
+
+    return size;
+}
+
+// returns the bytes released; caller does the accounting
+static inline unsigned SegmentRelease (StreamSegment *seg)
+{
+    unsigned dropped = SegmentSize(seg->caplen);
 
     STREAM_DEBUG_WRAP( DebugMessage(DEBUG_STREAM_STATE,
                 "Dumping segment at seq %X, size %d, caplen %d\n",
                 seg->seq, seg->size, seg->caplen););
 
-    if ( seg->caplen > 0 )
-        dropped += seg->caplen - 1;  // seg contains 1st byte
+    sfslab_free(seg_pool, seg, dropped);
+    return dropped;
+}
+
+static void SegmentFree (StreamSegment *seg)
+{
+    unsigned dropped = SegmentRelease(seg);
 
     session_mem_in_use -= dropped;
-    free(seg);
     s5stats.tcp_streamsegs_released++;
 
     STREAM_DEBUG_WRAP( DebugMessage(DEBUG_STREAM_STATE,
@@ -3987,6 +4048,7 @@ static void DeleteSeglist(StreamSegment *listhead)
 {
     StreamSegment *idx = listhead;
     StreamSegment *dump_me;
+    unsigned long dropped = 0;
     int i = 0;
 
     STREAM_DEBUG_WRAP( DebugMessage(DEBUG_STREAM_STATE,
@@ -3996,9 +4058,13 @@ static void DeleteSeglist(StreamSegment *listhead)
         i++;
         dump_me = idx;
         idx = idx->next;
-        SegmentFree(dump_me);
+        dropped += SegmentRelease(dump_me);
     }
 
+    // account for the whole list at once
+    session_mem_in_use -= dropped;
+    s5stats.tcp_streamsegs_released += i;
+
     STREAM_DEBUG_WRAP( DebugMessage(DEBUG_STREAM_STATE,
                 "Dropped %d segments\n", i););
 }
@@ -4274,6 +4340,8 @@ static inline int _flush_to_seq (
     uint32_t footprint = 0;
     uint32_t bytes_processed = 0;
     int32_t flushed_bytes;
+    uint8_t *flushbuf;
+    unsigned spans;
 
 #ifdef HAVE_DAQ_ADDRESS_SPACE_ID
     DAQ_PktHdr_t pkth;
@@ -4295,7 +4363,8 @@ static inline int _flush_to_seq (
     Encode_Format(enc_flags, p, s5_pkt, PSEUDO_PKT_TCP);
 #endif
 
-    s5_pkt_end = s5_pkt->data + s5_pkt->max_dsize;
+    flushbuf = (uint8_t *)s5_pkt->data;
+    s5_pkt_end = flushbuf + s5_pkt->max_dsize;
 
     // TBD in ips mode, these should be coming from current packet (tdb)
     ((TCPHdr *)s5_pkt->tcph)->th_ack = htonl(st->l_unackd);
@@ -4345,7 +4414,8 @@ static inline int _flush_to_seq (
         start_seq = htonl(st->seglist_next->seq);
 
         /* setup the pseudopacket payload */
-        flushed_bytes = FlushStream(p, st, stop_seq, (uint8_t *)s5_pkt->data, s5_pkt_end);
+        s5_pkt->data = flushbuf;
+        flushed_bytes = FlushStream(p, st, stop_seq, flushbuf, s5_pkt_end, &spans);
 
         if(flushed_bytes == -1)
         {
@@ -4377,6 +4447,17 @@ static inline int _flush_to_seq (
         s5_pkt->packet_flags |= (PKT_REBUILT_STREAM|PKT_STREAM_EST);
         s5_pkt->dsize = (uint16_t)flushed_bytes;
 
+        /* the payload stays in the segments until something needs it
+         * contiguous; see FlushSpans */
+        Encode_SetSpans(s5_pkt, s5_flush_spans, spans);
+
+        if ( spans == 1 )
+            s5stats.tcp_in_place_flushes++;
+        else if ( spans )
+            s5stats.tcp_span_flushes++;
+        else
+            s5stats.tcp_copied_flushes++;
+
         if ((p->packet_flags & PKT_PDU_TAIL))
             s5_pkt->packet_flags |= PKT_PDU_TAIL;
 
@@ -4411,6 +4492,7 @@ static inline int _flush_to_seq (
         PREPROC_PROFILE_TMPEND(s5TcpFlushPerfStats);
         {
             int tmp_do_detect, tmp_do_detect_content;
+            const EncodeSpan *span;
             PROFILE_VARS;
 
             PREPROC_PROFILE_START(s5TcpProcessRebuiltPerfStats);
@@ -4422,6 +4504,9 @@ static inline int _flush_to_seq (
             SnortEventqPop();
             DetectReset(s5_pkt->data, s5_pkt->dsize);
 
+            if ( spans > 1 && !Encode_GetSpans(s5_pkt, &span) )
+                s5stats.tcp_span_gathers++;
+
             do_detect = tmp_do_detect;
             do_detect_content = tmp_do_detect_content;
             PREPROC_PROFILE_END(s5TcpProcessRebuiltPerfStats);
@@ -4678,11 +4763,67 @@ static inline unsigned int getSegmentFlushSize(
     return flushSize;
 }
 
+/* The segment payload of a flush is only noted as spans and handed to
+ * the rebuilt packet that way (Encode_SetSpans).  One span is inspected
+ * in place; several are gathered into the flush buffer only when a
+ * preprocessor or rule option needs the payload contiguous.  A flush of
+ * more than S5_MAX_FLUSH_SPANS segments is copied as it is built. */
+typedef struct _FlushSpans
+{
+    uint8_t *start;
+    uint8_t *cur;
+    const uint8_t *end;
+    EncodeSpan *span;
+    unsigned spans;
+    int copied;
+
+} FlushSpans;
+
+static inline int AddFlushSpan(FlushSpans *fs, const uint8_t *data, unsigned len)
+{
+    unsigned i;
+    int ret;
+
+    if ( !len )
+        return SAFEMEM_SUCCESS;
+
+    ret = SafeMemCheck(fs->cur, len, fs->start, fs->end);
+
+    if ( ret != SAFEMEM_SUCCESS )
+        return ret;
+
+    if ( !fs->copied && fs->spans < S5_MAX_FLUSH_SPANS )
+    {
+        fs->span[fs->spans].data = data;
+        fs->span[fs->spans].len = len;
+        fs->spans++;
+        fs->cur += len;
+        return SAFEMEM_SUCCESS;
+    }
+
+    if ( !fs->copied )
+    {
+        uint8_t *buf = fs->start;
+
+        for ( i = 0; i < fs->spans; i++ )
+        {
+            memcpy(buf, fs->span[i].data, fs->span[i].len);
+            buf += fs->span[i].len;
+        }
+        fs->copied = 1;
+    }
+    memcpy(fs->cur, data, len);
+    fs->cur += len;
+    fs->spans++;
+    return SAFEMEM_SUCCESS;
+}
+
 static int FlushStream(
         Packet* p, StreamTracker *st, uint32_t toSeq, uint8_t *flushbuf,
-        const uint8_t *flushbuf_end)
+        const uint8_t *flushbuf_end, unsigned *spans)
 {
     StreamSegment *ss = NULL, *seglist, *sr;
+    FlushSpans fs;
     uint16_t bytes_flushed = 0;
     uint16_t bytes_skipped = 0;
     uint32_t bytes_queued = st->seg_bytes_logical;
@@ -4695,12 +4836,18 @@ static int FlushStream(
 
     PREPROC_PROFILE_START(s5TcpBuildPacketPerfStats);
 
+    fs.start = fs.cur = flushbuf;
+    fs.end = flushbuf_end;
+    fs.span = s5_flush_spans;
+    fs.spans = 0;
+    fs.copied = 0;
+
     // skip over previously flushed segments
     seglist = st->seglist_next;
 
     for(ss = seglist; ss && SEQ_LT(ss->seq,  toSeq); ss = ss->next)
     {
-        unsigned int flushbuf_size = flushbuf_end - flushbuf;
+        unsigned int flushbuf_size = flushbuf_end - fs.cur;
         unsigned int bytes_to_copy = getSegmentFlushSize(st, ss, toSeq, flushbuf_size);
 
         STREAM_DEBUG_WRAP(DebugMessage(DEBUG_STREAM_STATE,
@@ -4719,8 +4866,7 @@ static int FlushStream(
 
             if ( non_urgent_bytes )
             {
-                ret = SafeMemcpy(flushbuf, ss->payload+ss->urg_offset,
-                        non_urgent_bytes, flushbuf, flushbuf_end);
+                ret = AddFlushSpan(&fs, ss->payload+ss->urg_offset, non_urgent_bytes);
 
                 if (ret == SAFEMEM_ERROR)
                 {
@@ -4728,16 +4874,13 @@ static int FlushStream(
                                 "ERROR writing flushbuf attempting to "
                                 "write flushbuf out of range!\n"););
                 }
-                else
-                    flushbuf += non_urgent_bytes;
 
                 bytes_skipped += ss->urg_offset;
             }
         }
         else
         {
-            ret = SafeMemcpy(flushbuf, ss->payload,
-                    bytes_to_copy, flushbuf, flushbuf_end);
+            ret = AddFlushSpan(&fs, ss->payload, bytes_to_copy);
 
             if (ret == SAFEMEM_ERROR)
             {
@@ -4745,8 +4888,6 @@ static int FlushStream(
                             "ERROR writing flushbuf attempting to "
                             "write flushbuf out of range!\n"););
             }
-            else
-                flushbuf += bytes_to_copy;
         }
 
         if ( bytes_to_copy < ss->size &&
@@ -4762,7 +4903,7 @@ static int FlushStream(
         st->flush_count++;
         segs++;
 
-        if ( flushbuf >= flushbuf_end )
+        if ( fs.cur >= flushbuf_end )
             break;
 
         if ( SEQ_EQ(ss->seq + bytes_to_copy,  toSeq) )
@@ -4787,6 +4928,7 @@ static int FlushStream(
     }
 
     st->seglist_base_seq = toSeq;
+    *spans = fs.copied ? 0 : fs.spans;
 
     STREAM_DEBUG_WRAP(DebugMessage(DEBUG_STREAM_STATE,
                 "setting st->seglist_base_seq to 0x%X\n", st->seglist_base_seq););
@@ -5498,7 +5640,7 @@ int StreamProcessTcp(Packet *p, SessionControlBlock *scb, StreamTcpPolicy *s5Tcp
                 p->dp,
                 flagbuf,
                 ntohl(p->tcph->th_seq), ntohl(p->tcph->th_ack), p->dsize,
-                sfxhash_count(tcp_lws_cache->hashTable));
+                sfoahash_count(tcp_lws_cache->hashTable));
             );
 
     PREPROC_PROFILE_START(s5TcpPerfStats);
@@ -6152,10 +6294,7 @@ static inline StreamSegment* SegmentAlloc (
         Packet* p, const struct timeval* tv, uint32_t caplen, uint32_t pktlen, const uint8_t* pkt)
 {
     StreamSegment* ss;
-    unsigned size = sizeof(*ss);
-
-    if ( caplen > 0 )
-        size += caplen - 1;  // ss contains 1st byte
+    unsigned size = SegmentSize(caplen);
 
     session_mem_in_use += size;
 
@@ -6179,7 +6318,24 @@ static inline StreamSegment* SegmentAlloc (
         }
     }
 
-    ss = SnortAlloc(size);
+    if ( !seg_pool )
+    {
+        // the arena is sized to the memcap but only touched as it fills
+        seg_pool = sfslab_new(stream_session_config->memcap, seg_pool_classes,
+            sizeof(seg_pool_classes)/sizeof(seg_pool_classes[0]));
+
+        if ( !seg_pool )
+            FatalError("%s(%d) Unable to create stream segment pool.\n",
+                __FILE__, __LINE__);
+    }
+
+    ss = sfslab_alloc(seg_pool, size);
+
+    if ( !ss )
+        FatalError("%s(%d) Unable to allocate stream segment.\n",
+            __FILE__, __LINE__);
+
+    memset(ss, 0, offsetof(StreamSegment, pkt));
 
     ss->tv.tv_sec = tv->tv_sec;
     ss->tv.tv_usec = tv->tv_usec;
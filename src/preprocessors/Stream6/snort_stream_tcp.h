@@ -84,6 +84,7 @@ bool StreamIsSessionDecryptedTcp( SessionControlBlock *scb );
 
 uint32_t StreamGetTcpPrunes(void);
 void StreamResetTcpPrunes(void);
+void StreamPrintTcpSegmentStats(void);
 void enableRegisteredPortsForReassembly( struct _SnortConfig *sc );
 
 #ifdef NORMALIZER
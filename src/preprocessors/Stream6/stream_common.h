@@ -300,6 +300,10 @@ typedef struct _StreamStats
     uint32_t   tcp_streamsegs_released;
     uint32_t   tcp_rebuilt_packets;
     uint32_t   tcp_rebuilt_seqs_used;
+    uint32_t   tcp_in_place_flushes;      /* single segment, not copied */
+    uint32_t   tcp_span_flushes;          /* several segments, not copied */
+    uint32_t   tcp_span_gathers;          /* span flushes copied for inspection */
+    uint32_t   tcp_copied_flushes;        /* too many segments, copied */
     uint32_t   tcp_overlaps;
     uint32_t   tcp_discards;
     uint32_t   tcp_gaps;
@@ -66,18 +66,19 @@
 #include "stream_api.h"
 #include "sf_types.h"
 #include "snort_bounds.h"
+#include "sftwheel.h"
 
 
-static void GetPktDropStats(SFBASE *, SFBASE_STATS *);
+static void GetPktDropStats(SFBASE *, PKTSTATS *);
 static void DisplayBasePerfStatsConsole(SFBASE_STATS *, int);
-static int CalculateBasePerfStats(SFBASE *, SFBASE_STATS *, int);
+static void CalculateBasePerfStats(SFBASE *, const SFBASE_SAMPLE *, SFBASE_STATS *, int);
 static void LogBasePerfStats(SFBASE_STATS *, FILE *);
 static void GetPacketsPerSecond(SFBASE *, SFBASE_STATS *, SYSTIMES *, int);
 static void GetMbitsPerSecond(SFBASE *, SFBASE_STATS *, SYSTIMES *, int);
 static int GetProcessingTime(SYSTIMES *, SFBASE *);
 static void GetEventsPerSecond(SFBASE *, SFBASE_STATS *, SYSTIMES *);
 static void GetuSecondsPerPacket(SFBASE *, SFBASE_STATS *, SYSTIMES *);
-static void GetCPUTime(SFBASE *, SFBASE_STATS *, SYSTIMES *);
+static void GetCPUTime(SFBASE *, SFBASE_STATS *, SYSTIMES *, unsigned);
 
 
 //We should never output NaN or Infitity
@@ -540,26 +541,154 @@ int RemoveUDPSession(SFBASE *sfBase)
 **    Main function to process Base Stats.
 **
 **  FORMAL INPUTS
-**    SFBASE * - ptr to update.
+**    SFBASE *        - ptr to update.
+**    SFBASE_SAMPLE * - times and counts of the interval
 **
 **  FORMAL OUTPUTS
-**    int - 0 is successful
+**    void return
 */
-void ProcessBaseStats(SFBASE *sfBase, FILE *fh, int console, int max_stats)
+void ProcessBaseStats(SFBASE *sfBase, const SFBASE_SAMPLE *sample,
+        FILE *fh, int console, int max_stats)
 {
     SFBASE_STATS sfBaseStats;
 
-    if (fh  || console)
+    /* always, so the interval counters are reset the same way */
+    CalculateBasePerfStats(sfBase, sample, &sfBaseStats, max_stats);
+
+    if (console)
+        DisplayBasePerfStatsConsole(&sfBaseStats, max_stats);
+
+    if (fh)
+        LogBasePerfStats(&sfBaseStats, fh);
+}
+
+/*
+**  NAME
+**    GetBaseStatsSample
+**
+**  DESCRIPTION
+**    Takes the process times and the packet, alert and pattern
+**    match counts of the interval that is ending.
+**
+**  FORMAL INPUTS
+**    SFBASE *        - ptr to the interval's stats
+**    SFBASE_SAMPLE * - ptr to struct to fill in
+**
+**  FORMAL OUTPUTS
+**    int - 0 is successful
+*/
+int GetBaseStatsSample(SFBASE *sfBase, SFBASE_SAMPLE *sample)
+{
+    SF_TWHEEL_STATS tws;
+
+    memset(sample, 0, sizeof(*sample));
+
+    if (GetProcessingTime(&sample->times, sfBase))
+        return -1;
+
+    sample->procs = 1;
+
+    GetPktDropStats(sfBase, &sample->pkt_stats);
+
+    sample->alerts = pc.alert_pkts - sfBase->iAlerts;
+    sfBase->iAlerts = pc.alert_pkts;
+
+    sample->total_alerts = pc.total_alert_pkts - sfBase->total_iAlerts;
+    sfBase->total_iAlerts = pc.total_alert_pkts;
+
+    sample->patmatch_bytes = mpseGetPatByteCount();
+    mpseResetByteCount();
+
+    sftwheel_get_stats(&tws, 1);
+    sample->filter_trackers = tws.trackers;
+    sample->filter_expired = tws.expired;
+    sample->filter_evicted = tws.evicted;
+
+    return 0;
+}
+
+/* SFBASE is uint64_t counters apart from the times it starts from */
+#ifdef LINUX_SMP
+#define SFBASE_COUNTERS_END offsetof(SFBASE, sfProcPidStats)
+#else
+#define SFBASE_COUNTERS_END sizeof(SFBASE)
+#endif
+
+/*
+**  NAME
+**    AddBaseStats
+**
+**  DESCRIPTION
+**    Adds the interval of one worker process to the sum of all
+**    workers.  Counts and current values add up; the interval is
+**    the longest one.  If every worker reads the same packets the
+**    DAQ counts are the largest one instead of the sum.
+**
+**  FORMAL INPUTS
+**    SFBASE *        - ptr to the sum
+**    SFBASE_SAMPLE * - ptr to the sum of the samples
+**    SFBASE *        - ptr to the worker's interval
+**    SFBASE_SAMPLE * - ptr to the worker's sample
+**    int             - workers read the same packets
+**
+**  FORMAL OUTPUTS
+**    void return
+*/
+void AddBaseStats(SFBASE *sum, SFBASE_SAMPLE *sum_sample,
+        const SFBASE *sfBase, const SFBASE_SAMPLE *sample, int same_packets)
+{
+    static const size_t counters[][2] =
+    {
+        { 0, offsetof(SFBASE, usertime_sec) },
+        { offsetof(SFBASE, iAlerts), SFBASE_COUNTERS_END }
+    };
+    unsigned i;
+
+    for (i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+    {
+        uint64_t *dst = (uint64_t *)((uint8_t *)sum + counters[i][0]);
+        const uint64_t *src = (const uint64_t *)((const uint8_t *)sfBase + counters[i][0]);
+        const uint64_t *end = (const uint64_t *)((const uint8_t *)sfBase + counters[i][1]);
+
+        while (src < end)
+            *dst++ += *src++;
+    }
+
+    /* the attribute table is the same in every worker */
+    sum->iAttributeHosts = sfBase->iAttributeHosts;
+    sum->iAttributeReloads = sfBase->iAttributeReloads;
+
+    if (sfBase->time > sum->time)
+        sum->time = sfBase->time;
+
+    sum_sample->times.usertime += sample->times.usertime;
+    sum_sample->times.systemtime += sample->times.systemtime;
+    sum_sample->times.totaltime += sample->times.totaltime;
+
+    if (sample->times.realtime > sum_sample->times.realtime)
+        sum_sample->times.realtime = sample->times.realtime;
+
+    sum_sample->procs += sample->procs;
+
+    if (same_packets)
+    {
+        if (sample->pkt_stats.pkts_recv > sum_sample->pkt_stats.pkts_recv)
+            sum_sample->pkt_stats.pkts_recv = sample->pkt_stats.pkts_recv;
+        if (sample->pkt_stats.pkts_drop > sum_sample->pkt_stats.pkts_drop)
+            sum_sample->pkt_stats.pkts_drop = sample->pkt_stats.pkts_drop;
+    }
+    else
     {
-        if (CalculateBasePerfStats(sfBase, &sfBaseStats, max_stats))
-            return;
-
-        if (console)
-            DisplayBasePerfStatsConsole(&sfBaseStats, max_stats);
-    
-        if (fh)
-            LogBasePerfStats(&sfBaseStats, fh);
+        sum_sample->pkt_stats.pkts_recv += sample->pkt_stats.pkts_recv;
+        sum_sample->pkt_stats.pkts_drop += sample->pkt_stats.pkts_drop;
     }
+
+    sum_sample->alerts += sample->alerts;
+    sum_sample->total_alerts += sample->total_alerts;
+    sum_sample->patmatch_bytes += sample->patmatch_bytes;
+    sum_sample->filter_trackers += sample->filter_trackers;
+    sum_sample->filter_expired += sample->filter_expired;
+    sum_sample->filter_evicted += sample->filter_evicted;
 }
 
 static int GetProcessingTime(SYSTIMES *Systimes, SFBASE *sfBase)
@@ -611,16 +740,6 @@ static int GetProcessingTime(SYSTIMES *Systimes, SFBASE *sfBase)
 static void GetEventsPerSecond(SFBASE *sfBase, SFBASE_STATS *sfBaseStats,
         SYSTIMES *Systimes)
 {
-    sfBaseStats->alerts_per_second =
-        (double)(pc.alert_pkts - sfBase->iAlerts) / Systimes->realtime;
-
-    sfBase->iAlerts = pc.alert_pkts;
-
-    sfBaseStats->total_alerts_per_second =
-        (double)(pc.total_alert_pkts - sfBase->total_iAlerts) / Systimes->realtime;
-
-    sfBase->total_iAlerts = pc.total_alert_pkts;
-
     sfBaseStats->total_sessions = sfBase->iTotalSessions;
     sfBaseStats->max_sessions = sfBase->iMaxSessions;
 
@@ -896,17 +1015,20 @@ static void GetMbitsPerSecond(SFBASE *sfBase, SFBASE_STATS *sfBaseStats,
                                     Systimes->realtime;
 }
 
-static void GetCPUTime(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, SYSTIMES *Systimes)
+static void GetCPUTime(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, SYSTIMES *Systimes,
+        unsigned procs)
 {
 #ifndef LINUX_SMP
+    /* the times of several processes are an average per process */
+    double realtime = Systimes->realtime * procs;
     unsigned char needToNormalize = 0;
     sfBaseStats->user_cpu_time   = (Systimes->usertime   /
-                                   Systimes->realtime) * 100;
+                                   realtime) * 100;
     sfBaseStats->system_cpu_time = (Systimes->systemtime /
-                                   Systimes->realtime) * 100;
-    sfBaseStats->idle_cpu_time   = ((Systimes->realtime -
+                                   realtime) * 100;
+    sfBaseStats->idle_cpu_time   = ((realtime -
                                      Systimes->totaltime) /
-                                     Systimes->realtime) * 100;
+                                     realtime) * 100;
 
     /* percentages can be < 0 because of a small variance between
      * when the snapshot is taken of the CPU times and snapshot of
@@ -968,16 +1090,19 @@ static void GetCPUTime(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, SYSTIMES *Syst
 **    reading.
 **
 **  FORMAL INPUTS
-**    SFBASE *       - ptr to performance struct
-**    SFBASE_STATS * - ptr to struct to fill in performance stats
-**    int            - do max stats
+**    SFBASE *        - ptr to performance struct
+**    SFBASE_SAMPLE * - times and counts of the interval
+**    SFBASE_STATS *  - ptr to struct to fill in performance stats
+**    int             - do max stats
 **
 **  FORMAL OUTPUTS
-**    int - 0 is successful
+**    void return
 */
-static int CalculateBasePerfStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, int max_stats)
+static void CalculateBasePerfStats(SFBASE *sfBase, const SFBASE_SAMPLE *sample,
+        SFBASE_STATS *sfBaseStats, int max_stats)
 {
-    SYSTIMES       Systimes;
+    SYSTIMES       Systimes = sample->times;
+    uint64_t       sum;
     time_t   clock;
 
 #ifdef LINUX_SMP
@@ -990,8 +1115,6 @@ static int CalculateBasePerfStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, int
     sfBaseStats->sfProcPidStats = &(sfBase->sfProcPidStats);
 
 #endif
-    if(GetProcessingTime(&Systimes, sfBase))
-        return -1;
 
     sfBaseStats->total_blocked_packets = sfBase->total_blocked_packets;
     sfBaseStats->total_injected_packets = sfBase->total_injected_packets;
@@ -1062,12 +1185,22 @@ static int CalculateBasePerfStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, int
     /*
     **  CPU time
     */
-    GetCPUTime(sfBase, sfBaseStats, &Systimes);
+    GetCPUTime(sfBase, sfBaseStats, &Systimes, sample->procs);
 
     /*
-    **  Get Dropped Packets
+    **  Dropped Packets
     */
-    GetPktDropStats(sfBase, sfBaseStats);
+    sfBaseStats->pkt_stats = sample->pkt_stats;
+
+    sum = sfBaseStats->pkt_stats.pkts_recv
+        + sfBaseStats->pkt_stats.pkts_drop;
+
+    if ( !sum )
+        sfBaseStats->pkt_drop_percent = 0.0;
+
+    else
+        sfBaseStats->pkt_drop_percent = zeroFpException(
+            ((double)sfBaseStats->pkt_stats.pkts_drop / (double)sum) * 100.0);
 
     /*
     **  Total packets
@@ -1077,11 +1210,9 @@ static int CalculateBasePerfStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, int
     /*
     *   Pattern Matching Performance in Real and User time
     */
-    sfBaseStats->patmatch_percent = zeroFpException(100.0 * mpseGetPatByteCount() /
+    sfBaseStats->patmatch_percent = zeroFpException(100.0 * sample->patmatch_bytes /
                                     sfBase->total_wire_bytes);
 
-    mpseResetByteCount();
-
     if (max_stats)
     {
         /*
@@ -1099,9 +1230,13 @@ static int CalculateBasePerfStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, int
 
     /*
     **  EventsPerSecond
-    **  We get the information from the global variable
-    **  PacketCount.
     */
+    sfBaseStats->alerts_per_second =
+        (double)sample->alerts / Systimes.realtime;
+
+    sfBaseStats->total_alerts_per_second =
+        (double)sample->total_alerts / Systimes.realtime;
+
     GetEventsPerSecond(sfBase, sfBaseStats, &Systimes);
 
     /*
@@ -1120,6 +1255,10 @@ static int CalculateBasePerfStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, int
     sfBaseStats->frag3_mem_in_use = sfBase->frag3_mem_in_use;
     sfBaseStats->stream5_mem_in_use = sfBase->stream5_mem_in_use;
 
+    sfBaseStats->filter_trackers = sample->filter_trackers;
+    sfBaseStats->filter_expired = sample->filter_expired;
+    sfBaseStats->filter_evicted = sample->filter_evicted;
+
     /*
     **  Set the date string for print out
     */
@@ -1132,8 +1271,6 @@ static int CalculateBasePerfStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, int
         time(&clock);
     }
     sfBaseStats->time = clock;
-
-    return 0;
 }
 
 /*
@@ -1145,14 +1282,14 @@ static int CalculateBasePerfStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats, int
 **
 **  FORMAL INPUT
 **    SFBASE *       - ptr to struct
-**    SFBASE_STATS * - ptr to struct to fill in with perf stats
+**    PKTSTATS *     - ptr to struct to fill in with the interval's counts
 **
 **  FORMAL OUTPUT
 **    void return
 */
-static void GetPktDropStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats)
+static void GetPktDropStats(SFBASE *sfBase, PKTSTATS *pkt_stats)
 {
-    uint64_t recv, drop, sum;
+    uint64_t recv, drop;
 
     if (ScReadMode())
     {
@@ -1176,25 +1313,15 @@ static void GetPktDropStats(SFBASE *sfBase, SFBASE_STATS *sfBaseStats)
 
     if (perfmon_config->base_reset)
     {
-        sfBaseStats->pkt_stats.pkts_recv = recv - sfBase->pkt_stats.pkts_recv;
-        sfBaseStats->pkt_stats.pkts_drop = drop - sfBase->pkt_stats.pkts_drop;
+        pkt_stats->pkts_recv = recv - sfBase->pkt_stats.pkts_recv;
+        pkt_stats->pkts_drop = drop - sfBase->pkt_stats.pkts_drop;
     }
     else
     {
-        sfBaseStats->pkt_stats.pkts_recv = recv;
-        sfBaseStats->pkt_stats.pkts_drop = drop;
+        pkt_stats->pkts_recv = recv;
+        pkt_stats->pkts_drop = drop;
     }
 
-    sum = sfBaseStats->pkt_stats.pkts_recv
-        + sfBaseStats->pkt_stats.pkts_drop;
-
-    if ( !sum )
-        sfBaseStats->pkt_drop_percent = 0.0;
-
-    else
-        sfBaseStats->pkt_drop_percent = zeroFpException(
-            ((double)sfBaseStats->pkt_stats.pkts_drop / (double)sum) * 100.0);
-
     /*
     **  Reset sfBase stats for next go round.
     */
@@ -1452,6 +1579,13 @@ static void LogBasePerfStats(SFBASE_STATS *sfBaseStats,  FILE * fh )
     size += SafeSnprintf(buff + size, sizeof(buff) - size, 
         "%.3f", sfBaseStats->total_alerts_per_second);
 
+    size += SafeSnprintf(buff + size, sizeof(buff) - size, 
+        "," STDu64, sfBaseStats->filter_trackers);
+    size += SafeSnprintf(buff + size, sizeof(buff) - size, 
+        "," STDu64, sfBaseStats->filter_expired);
+    size += SafeSnprintf(buff + size, sizeof(buff) - size, 
+        "," STDu64, sfBaseStats->filter_evicted);
+
     size += SafeSnprintf(buff + size, sizeof(buff) - size, "\n");
 
     // Write to file. On error, reset the file position and inform the user.
@@ -1654,6 +1788,12 @@ void LogBasePerfHeader (FILE* fh)
     fprintf(fh, ",%s",
         "total_alerts_per_second");
 
+    fprintf(fh,
+        ",%s,%s,%s",
+        "filter_trackers",
+        "filter_expired",
+        "filter_evicted");
+
     fprintf(fh,"\n");
     fflush(fh);
 }
@@ -1810,6 +1950,10 @@ static void DisplayBasePerfStatsConsole(SFBASE_STATS *sfBaseStats, int max_stats
     LogMessage("Frag Timeouts          :  " STDu64 "\n", sfBaseStats->frag_timeouts);
     LogMessage("Frag Faults            :  " STDu64 "\n\n", sfBaseStats->frag_faults);
 
+    LogMessage("Filter Trackers        :  " STDu64 "\n", sfBaseStats->filter_trackers);
+    LogMessage("Filter Expired         :  " STDu64 "\n", sfBaseStats->filter_expired);
+    LogMessage("Filter Evicted         :  " STDu64 "\n\n", sfBaseStats->filter_evicted);
+
     LogMessage("New Cached UDP Ssns/Sec:  %.3f\n", sfBaseStats->new_udp_sessions_per_second);
     LogMessage("Cached UDP Ssns Del/Sec:  %.3f\n", sfBaseStats->deleted_udp_sessions_per_second);
 
@@ -188,6 +188,24 @@ typedef struct _SYSTIMES {
 
 }  SYSTIMES;
 
+/* What an interval needs besides SFBASE: the process times and the
+ * packet, alert and pattern match counts since the last interval.
+ * Workers publish it with their SFBASE so the supervisor can log the sum
+ * of all workers the same way one process logs its own. */
+typedef struct _SFBASE_SAMPLE {
+
+    SYSTIMES times;
+    unsigned procs;             /* processes the cpu times add up */
+    PKTSTATS pkt_stats;
+    uint64_t alerts;
+    uint64_t total_alerts;
+    uint64_t patmatch_bytes;
+    uint64_t filter_trackers;
+    uint64_t filter_expired;
+    uint64_t filter_evicted;
+
+}  SFBASE_SAMPLE;
+
 typedef struct _SFBASE_STATS {
 
     uint64_t   total_packets;
@@ -283,11 +301,18 @@ typedef struct _SFBASE_STATS {
     uint64_t   frag3_mem_in_use;
     uint64_t   stream5_mem_in_use;
     double     total_alerts_per_second;
+
+    /**Threshold, detection and rate filter trackers.*/
+    uint64_t   filter_trackers;
+    uint64_t   filter_expired;
+    uint64_t   filter_evicted;
 }  SFBASE_STATS;
 
 int InitBaseStats(SFBASE *sfBase);
 void UpdateBaseStats(SFBASE *, Packet *, bool);
-void ProcessBaseStats(SFBASE *, FILE *, int, int);
+int GetBaseStatsSample(SFBASE *, SFBASE_SAMPLE *);
+void ProcessBaseStats(SFBASE *, const SFBASE_SAMPLE *, FILE *, int, int);
+void AddBaseStats(SFBASE *, SFBASE_SAMPLE *, const SFBASE *, const SFBASE_SAMPLE *, int);
 int AddStreamSession(SFBASE *sfBase, uint32_t flags);
 #define SESSION_CLOSED_NORMALLY 0x01
 #define SESSION_CLOSED_TIMEDOUT 0x02
@@ -50,6 +50,7 @@
 #include "sf_types.h"
 #include "decode.h"
 #include "snort.h"
+#include "workers.h"
 
 SFBASE sfBase;
 SFFLOW sfFlow;
@@ -614,10 +615,53 @@ static inline bool sfCheckFileSize(FILE *fh, uint32_t max_file_size)
 
 static inline void sfProcessBaseStats(SFPERF *sfPerf)
 {
+    SFBASE_SAMPLE sample;
+
     if (!(sfPerf->perf_flags & SFPERF_BASE))
         return;
 
-    ProcessBaseStats(&sfBase, sfPerf->fh,
+    if (GetBaseStatsSample(&sfBase, &sample))
+        return;
+
+    // A worker hands the interval to the supervisor before it is reset
+    Workers_PublishPerf(&sfBase, &sample);
+
+    ProcessBaseStats(&sfBase, &sample, sfPerf->fh,
+            sfPerf->perf_flags & SFPERF_CONSOLE,
+            sfPerf->perf_flags & SFPERF_MAX_BASE_STATS);
+
+    if ((sfPerf->fh != NULL)
+            && sfCheckFileSize(sfPerf->fh, sfPerf->max_file_size))
+    {
+        sfRotateBaseStatsFile(sfPerf);
+    }
+}
+
+void sfProcessMergedBaseStats(SFPERF *sfPerf, SFBASE *sum, const SFBASE_SAMPLE *sample)
+{
+    static bool open_failed = false;
+
+    if (!(sfPerf->perf_flags & SFPERF_BASE))
+        return;
+
+    // The workers' files have a suffix, the sum goes to the configured one
+    if ((sfPerf->file != NULL) && (sfPerf->fh == NULL) && !open_failed)
+    {
+        if ((sfPerf->fh = sfOpenBaseStatsFile(sfPerf->file)) == NULL)
+        {
+            ErrorMessage("Perfmonitor: Cannot open base stats file \"%s\": %s.\n",
+                    sfPerf->file, strerror(errno));
+            open_failed = true;
+        }
+    }
+
+#ifdef LINUX_SMP
+    // CPU usage comes from /proc for the whole system
+    if (sfProcessProcPidStats(&(sfBase.sfProcPidStats)) == 0)
+        sum->sfProcPidStats = sfBase.sfProcPidStats;
+#endif
+
+    ProcessBaseStats(sum, sample, sfPerf->fh,
             sfPerf->perf_flags & SFPERF_CONSOLE,
             sfPerf->perf_flags & SFPERF_MAX_BASE_STATS);
 
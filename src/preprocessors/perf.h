@@ -117,6 +117,8 @@ int sfRotateFlowStatsFile(SFPERF *sfPerf);
 void sfPerformanceStats(SFPERF *, Packet *);
 void sfPerformanceStatsOOB(SFPERF *, time_t);
 void sfPerfStatsSummary(SFPERF *);
+/* Logs the sum of the workers' base stats intervals (supervisor only). */
+void sfProcessMergedBaseStats(SFPERF *, SFBASE *, const SFBASE_SAMPLE *);
 void SetSampleTime(SFPERF *, Packet *);
 void InitPerfStats(SFPERF *sfPerf);
 
@@ -167,10 +167,12 @@ typedef struct _StreamAppData
     StreamAppDataFree freeFunc;
 } StreamAppData;
 
+/* The flowbits follow the header in the same allocation, sized in whole
+ * 64 bit words by getFlowbitSizeInBytes(). */
 typedef struct _StreamFlowData
 {
     BITOP boFlowbits;
-    unsigned char flowb[1];
+    uint64_t flowb[1];
 } StreamFlowData;
 
 typedef struct _StreamSessionLimits
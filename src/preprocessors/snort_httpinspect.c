@@ -87,6 +87,7 @@
 #include "hi_mi.h"
 #include "hi_norm.h"
 #include "hi_client.h"
+#include "hi_client_norm.h"
 #include "snort_httpinspect.h"
 #include "detection_util.h"
 #include "profiler.h"
@@ -3889,6 +3890,133 @@ static inline int get_file_current_position(Packet *p,bool decomp_more,bool is_f
     return file_data_position;
 }
 
+/*
+**  Sets the client header and cookie buffers from the request fields.
+**  Returns non-zero if any were set.
+*/
+static int SetClientHeaderBuffers(HI_SESSION *Session)
+{
+    const HI_CLIENT_REQ *ClientReq = &Session->client.request;
+    const HttpBuffer* hb;
+    int iSet = 0;
+
+    if ( ClientReq->header_norm ||
+         ClientReq->header_raw )
+    {
+        if ( ClientReq->header_norm )
+        {
+            SetHttpBufferEncoding(
+                HTTP_BUFFER_HEADER,
+                ClientReq->header_norm,
+                ClientReq->header_norm_size,
+                ClientReq->header_encode_type);
+
+            SetHttpBuffer(
+                HTTP_BUFFER_RAW_HEADER,
+                ClientReq->header_raw,
+                ClientReq->header_raw_size);
+
+            iSet = 1;
+        }
+        else
+        {
+            SetHttpBufferEncoding(
+                HTTP_BUFFER_HEADER,
+                ClientReq->header_raw,
+                ClientReq->header_raw_size,
+                ClientReq->header_encode_type);
+
+            SetHttpBuffer(
+                HTTP_BUFFER_RAW_HEADER,
+                ClientReq->header_raw,
+                ClientReq->header_raw_size);
+
+            iSet = 1;
+        }
+    }
+
+    if ( ClientReq->cookie_norm ||
+         ClientReq->cookie.cookie )
+    {
+        if ( ClientReq->cookie_norm )
+        {
+            SetHttpBufferEncoding(
+                HTTP_BUFFER_COOKIE,
+                ClientReq->cookie_norm,
+                ClientReq->cookie_norm_size,
+                ClientReq->cookie_encode_type);
+
+            SetHttpBuffer(
+                HTTP_BUFFER_RAW_COOKIE,
+                ClientReq->cookie.cookie,
+                ClientReq->cookie.cookie_end -
+                    ClientReq->cookie.cookie);
+
+            iSet = 1;
+        }
+        else
+        {
+            SetHttpBufferEncoding(
+                HTTP_BUFFER_COOKIE,
+                ClientReq->cookie.cookie,
+                ClientReq->cookie.cookie_end -
+                    ClientReq->cookie.cookie,
+                ClientReq->cookie_encode_type);
+
+            SetHttpBuffer(
+                HTTP_BUFFER_RAW_COOKIE,
+                ClientReq->cookie.cookie,
+                ClientReq->cookie.cookie_end -
+                    ClientReq->cookie.cookie);
+
+            iSet = 1;
+        }
+    }
+    else if ( !Session->server_conf->enable_cookie &&
+        (hb = GetHttpBuffer(HTTP_BUFFER_HEADER)) )
+    {
+        SetHttpBufferEncoding(
+            HTTP_BUFFER_COOKIE, hb->buf, hb->length, hb->encode_type);
+
+        hb = GetHttpBuffer(HTTP_BUFFER_RAW_HEADER);
+        assert(hb);
+
+        SetHttpBuffer(HTTP_BUFFER_RAW_COOKIE, hb->buf, hb->length);
+
+        iSet = 1;
+    }
+
+    return iSet;
+}
+
+/* request whose put off fields ResolveClientBuffer normalizes */
+static HI_SESSION *hi_pending_session = NULL;
+
+/*
+**  Builds a pending client buffer once detection asks for it.  Header and
+**  cookie are done together since the cookie buffer may be the header.
+*/
+static void ResolveClientBuffer(HTTP_BUFFER b)
+{
+    HI_SESSION *Session = hi_pending_session;
+
+    if ( b == HTTP_BUFFER_CLIENT_BODY )
+    {
+        hi_client_norm_pending(Session, HI_NORM_POST);
+
+        SetHttpBufferEncoding(
+            HTTP_BUFFER_CLIENT_BODY,
+            Session->client.request.post_raw,
+            Session->client.request.post_raw_size,
+            Session->client.request.post_encode_type);
+    }
+    else
+    {
+        hi_client_norm_pending(Session, HI_NORM_HEADER | HI_NORM_COOKIE);
+        SetClientHeaderBuffers(Session);
+    }
+}
+
 /*
 **  NAME
 **    SnortHttpInspect::
@@ -4123,7 +4251,6 @@ int SnortHttpInspect(HTTPINSPECT_GLOBAL_CONF *GlobalConf, Packet *p)
         */
         if ( iInspectMode == HI_SI_CLIENT_MODE )
         {
-            const HttpBuffer* hb;
             ClearHttpBuffers();  // FIXTHIS needed here and right above??
 
             if ( Session->client.request.uri_norm )
@@ -4157,43 +4284,37 @@ int SnortHttpInspect(HTTPINSPECT_GLOBAL_CONF *GlobalConf, Packet *p)
                 p->packet_flags |= PKT_HTTP_DECODE;
             }
 
-            if ( Session->client.request.header_norm ||
-                 Session->client.request.header_raw )
+            if ( SetClientHeaderBuffers(Session) )
             {
-                if ( Session->client.request.header_norm )
-                {
-                    SetHttpBufferEncoding(
-                        HTTP_BUFFER_HEADER,
-                        Session->client.request.header_norm,
-                        Session->client.request.header_norm_size,
-                        Session->client.request.header_encode_type);
-
-                    SetHttpBuffer(
-                        HTTP_BUFFER_RAW_HEADER,
-                        Session->client.request.header_raw,
-                        Session->client.request.header_raw_size);
-
-                    p->packet_flags |= PKT_HTTP_DECODE;
+                p->packet_flags |= PKT_HTTP_DECODE;
 #ifdef DEBUG
+                if ( Session->client.request.header_norm )
                     hi_stats.req_header_len += Session->client.request.header_norm_size;
 #endif
-                }
-                else
+            }
+
+            /*
+            **  The raw buffers are final but normalizing the header and
+            **  cookie may have been put off; those are built if asked for.
+            */
+            if ( Session->client.request.norm_pending & HI_NORM_HEADER )
+            {
+                hi_pending_session = Session;
+                SetHttpBufferPending(HTTP_BUFFER_HEADER, ResolveClientBuffer);
+
+                /* without a cookie of its own the cookie buffer is the header */
+                if ( !Session->client.request.cookie_norm &&
+                     !Session->client.request.cookie.cookie &&
+                     (GetHttpBufferMask() & (1 << HTTP_BUFFER_COOKIE)) )
                 {
-                    SetHttpBufferEncoding(
-                        HTTP_BUFFER_HEADER,
-                        Session->client.request.header_raw,
-                        Session->client.request.header_raw_size,
-                        Session->client.request.header_encode_type);
-
-                    SetHttpBuffer(
-                        HTTP_BUFFER_RAW_HEADER,
-                        Session->client.request.header_raw,
-                        Session->client.request.header_raw_size);
-
-                    p->packet_flags |= PKT_HTTP_DECODE;
+                    SetHttpBufferPending(HTTP_BUFFER_COOKIE, ResolveClientBuffer);
                 }
             }
+            if ( Session->client.request.norm_pending & HI_NORM_COOKIE )
+            {
+                hi_pending_session = Session;
+                SetHttpBufferPending(HTTP_BUFFER_COOKIE, ResolveClientBuffer);
+            }
 
             if(Session->client.request.method & (HI_POST_METHOD | HI_GET_METHOD))
             {
@@ -4209,11 +4330,21 @@ int SnortHttpInspect(HTTPINSPECT_GLOBAL_CONF *GlobalConf, Packet *p)
                         {
                             Session->client.request.post_raw_size = Session->server_conf->post_depth;
                         }
-                        SetHttpBufferEncoding(
-                            HTTP_BUFFER_CLIENT_BODY,
-                            Session->client.request.post_raw,
-                            Session->client.request.post_raw_size,
-                            Session->client.request.post_encode_type);
+                        if ( Session->client.request.norm_pending & HI_NORM_POST )
+                        {
+                            /* only the encoding type is missing */
+                            hi_pending_session = Session;
+                            SetHttpBufferPending(
+                                HTTP_BUFFER_CLIENT_BODY, ResolveClientBuffer);
+                        }
+                        else
+                        {
+                            SetHttpBufferEncoding(
+                                HTTP_BUFFER_CLIENT_BODY,
+                                Session->client.request.post_raw,
+                                Session->client.request.post_raw_size,
+                                Session->client.request.post_encode_type);
+                        }
 
                         p->packet_flags |= PKT_HTTP_DECODE;
                     }
@@ -4235,57 +4366,6 @@ int SnortHttpInspect(HTTPINSPECT_GLOBAL_CONF *GlobalConf, Packet *p)
                 p->packet_flags |= PKT_HTTP_DECODE;
             }
 
-            if ( Session->client.request.cookie_norm ||
-                 Session->client.request.cookie.cookie )
-            {
-                if ( Session->client.request.cookie_norm )
-                {
-                    SetHttpBufferEncoding(
-                        HTTP_BUFFER_COOKIE,
-                        Session->client.request.cookie_norm,
-                        Session->client.request.cookie_norm_size,
-                        Session->client.request.cookie_encode_type);
-
-                    SetHttpBuffer(
-                        HTTP_BUFFER_RAW_COOKIE,
-                        Session->client.request.cookie.cookie,
-                        Session->client.request.cookie.cookie_end -
-                            Session->client.request.cookie.cookie);
-
-                    p->packet_flags |= PKT_HTTP_DECODE;
-                }
-                else
-                {
-                    SetHttpBufferEncoding(
-                        HTTP_BUFFER_COOKIE,
-                        Session->client.request.cookie.cookie,
-                        Session->client.request.cookie.cookie_end -
-                            Session->client.request.cookie.cookie,
-                        Session->client.request.cookie_encode_type);
-
-                    SetHttpBuffer(
-                        HTTP_BUFFER_RAW_COOKIE,
-                        Session->client.request.cookie.cookie,
-                        Session->client.request.cookie.cookie_end -
-                            Session->client.request.cookie.cookie);
-
-                    p->packet_flags |= PKT_HTTP_DECODE;
-                }
-            }
-            else if ( !Session->server_conf->enable_cookie &&
-                (hb = GetHttpBuffer(HTTP_BUFFER_HEADER)) )
-            {
-                SetHttpBufferEncoding(
-                    HTTP_BUFFER_COOKIE, hb->buf, hb->length, hb->encode_type);
-
-                hb = GetHttpBuffer(HTTP_BUFFER_RAW_HEADER);
-                assert(hb);
-
-                SetHttpBuffer(HTTP_BUFFER_RAW_COOKIE, hb->buf, hb->length);
-
-                p->packet_flags |= PKT_HTTP_DECODE;
-            }
-
             if ( IsLimitedDetect(p) )
             {
                 ApplyClientFlowDepth(p, Session->server_conf->client_flow_depth);
@@ -55,6 +55,16 @@
  *  pull out the splay trees I may as well solve some of the other problems
  *  we were seeing.
  *
+ *  Trackers now live in a fixed size open addressing table allocated up
+ *  front that evicts the least recently used tracker.  Each tracker
+ *  reassembles into a single buffer indexed by fragment offset, sized from
+ *  the datagram length once the last fragment shows up, so a fragment is
+ *  just an extent of that buffer.  The fraglist is mirrored by an array in
+ *  offset order that Frag3Insert() binary searches for the neighbors of a
+ *  new fragment.  When a datagram is complete its headers are encoded into
+ *  headroom kept in front of the buffer and the buffer itself is handed to
+ *  the decoder, so the payload is never copied again.
+ *
  *  Initial performance testing that I've done shows that frag3 can be as much
  *  as 250% faster than frag2, but we still need to do more testing and
  *  optimization, we may be able to squeeze out some more performance.
@@ -107,7 +117,8 @@
 #include "fpcreate.h"
 
 #include "sfutil/sflsq.h"
-#include "sfutil/sfxhash.h"
+#include "sfutil/sfoahash.h"
+#include "sfutil/sfhashfcn.h"
 
 #include "snort.h"
 #include "profiler.h"
@@ -121,6 +132,7 @@
 #include "sftarget_protocol_reference.h"
 #endif
 #include "sfPolicy.h"
+#include "workers.h"
 
 extern OptTreeNode *otn_tmp;
 
@@ -160,6 +172,15 @@ extern OptTreeNode *otn_tmp;
 /* max packet size */
 #define DATASIZE (ETHERNET_HEADER_LEN+IP_MAXPACKET)
 
+/* room left in front of a reassembly buffer for the encoded headers */
+#define FRAG3_HEADROOM      256
+
+/* smallest reassembly buffer, before the datagram length is known */
+#define FRAG3_BUF_MIN       2048
+
+/* datagram byte at offset off in a tracker's reassembly buffer */
+#define FRAG3_DATA(ft, off) ((ft)->buf + FRAG3_HEADROOM + (off))
+
 /* max frags in a single frag tracker */
 #define DEFAULT_MAX_FRAGS   8192
 
@@ -213,16 +234,13 @@ typedef struct _Frag3Context
 
 } Frag3Context;
 
-/* struct to manage an individual fragment */
+/* struct to manage an individual fragment, the data is the extent
+ * [offset, offset + size) of the tracker's reassembly buffer */
 typedef struct _Frag3Frag
 {
-    uint8_t   *data;     /* ptr to adjusted start position */
     uint16_t   size;     /* adjusted frag size */
     uint16_t   offset;   /* adjusted offset position */
 
-    uint8_t   *fptr;     /* free pointer */
-    uint16_t   flen;     /* free len, unneeded? */
-
     struct _Frag3Frag *prev;
     struct _Frag3Frag *next;
 
@@ -306,6 +324,12 @@ typedef struct _FragTracker
     Frag3Frag *fraglist_tail; /* tail ptr for easy appending */
     int fraglist_count;       /* handy dandy counter */
 
+    Frag3Frag **fragindex;    /* the fraglist as an array, for lookups */
+    uint32_t fragindex_size;  /* slots allocated in fragindex */
+
+    uint8_t *buf;             /* FRAG3_HEADROOM + buf_size bytes */
+    uint32_t buf_size;        /* datagram bytes that fit in buf */
+
     uint32_t alert_gid[MAX_FRAG_ALERTS]; /* flag alerts seen in a frag list  */
     uint32_t alert_sid[MAX_FRAG_ALERTS]; /* flag alerts seen in a frag list  */
     uint8_t  alert_count;                /* count alerts seen in a frag list */
@@ -364,7 +388,7 @@ static tSfPolicyUserContextId frag3_config = NULL;  /* current configuration */
  * which it was created will be used */
 static Frag3Config *frag3_eval_config = NULL;
 
-static SFXHASH *f_cache = NULL;                 /* fragment hash table */
+static SFOAHASH *f_cache = NULL;                /* fragment tracker table */
 static Frag3Frag *prealloc_frag_list = NULL;    /* head for prealloc queue */
 
 static unsigned long frag3_mem_in_use = 0;            /* memory in use, used for self pres */
@@ -378,6 +402,23 @@ static Packet* defrag_pkt = NULL;
 static Packet* encap_defrag_pkt = NULL;
 #endif
 
+/* A reassembly buffer goes along with the pseudo packet it was handed to
+ * and is kept until that packet is rebuilt again; the encoder may still
+ * refer to it for active responses after the tracker is gone. */
+typedef struct _Frag3Handoff
+{
+    Packet *pkt;          /* defrag_pkt or encap_defrag_pkt */
+    uint8_t *pkt_data;    /* the encoder's own buffer for pkt */
+    uint8_t *buf;         /* reassembly buffer pkt->pkt points into */
+    uint32_t buf_mem;     /* bytes of buf counted in frag3_mem_in_use */
+
+} Frag3Handoff;
+
+static Frag3Handoff defrag_handoff;
+#ifdef GRE
+static Frag3Handoff encap_defrag_handoff;
+#endif
+
 static uint32_t pkt_snaplen = 0;
 
 /* enum for policy names */
@@ -429,19 +470,26 @@ static void Frag3ReloadSwapFree(void *);
 static int Frag3Prune(FragTracker *);
 static struct timeval *pkttime;    /* packet timestamp */
 static void Frag3DeleteFrag(Frag3Frag *);
-static void Frag3RemoveTracker(void *, void *);
+static void Frag3RemoveTracker(FragTracker *);
 static void Frag3DeleteTracker(FragTracker *);
+static void Frag3PurgeTrackers(void);
 static int Frag3AutoFree(void *, void *);
 static int Frag3UserFree(void *, void *);
 
 /* fraglist handler funcs */
 static inline void Frag3FraglistAddNode(FragTracker *, Frag3Frag *, Frag3Frag *);
 static inline void Frag3FraglistDeleteNode(FragTracker *, Frag3Frag *);
+static inline int Frag3IndexFind(FragTracker *, uint16_t);
+static inline int Frag3IndexOf(FragTracker *, Frag3Frag *);
 
 /* prealloc queue handler funcs */
 static inline Frag3Frag *Frag3PreallocPop();
 static inline void Frag3PreallocPush(Frag3Frag *);
 
+/* reassembly buffer handling */
+static int Frag3BufferReserve(FragTracker *, uint32_t);
+static void Frag3HandoffRelease(Frag3Handoff *);
+
 /* main preprocessor functions */
 static void Frag3Defrag(Packet *, void *);
 static void Frag3CleanExit(int, void *);
@@ -533,11 +581,8 @@ static void PrintFrag3Frag(Frag3Frag *f)
 
     if(f)
     {
-        LogMessage("    data: %p\n", f->data);
         LogMessage("    size: %d\n", f->size);
         LogMessage("  offset: %d\n", f->offset);
-        LogMessage("    fptr: %p\n", f->fptr);
-        LogMessage("    flen: %d\n", f->flen);
         LogMessage("    prev: %p\n", f->prev);
         LogMessage("    next: %p\n", f->next);
     }
@@ -897,8 +942,9 @@ void SetupFrag3(void)
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG, "Preprocessor: frag3 is setup...\n"););
 }
 
-uint32_t Frag3KeyHashFunc(SFHASHFCN *p, unsigned char *d, int n)
+uint32_t Frag3KeyHashFunc(const void *key, size_t n)
 {
+    const unsigned char *d = (const unsigned char *)key;
     uint32_t a,b,c;
     uint32_t offset = 0;
 #ifdef MPLS
@@ -908,26 +954,26 @@ uint32_t Frag3KeyHashFunc(SFHASHFCN *p, unsigned char *d, int n)
     uint32_t tmp2 = 0;
 #endif
 
-    a = *(uint32_t *)d;        /* IPv6 sip[0] */
-    b = *(uint32_t *)(d+4);    /* IPv6 sip[1] */
-    c = *(uint32_t *)(d+8);    /* IPv6 sip[2] */
+    a = *(const uint32_t *)d;        /* IPv6 sip[0] */
+    b = *(const uint32_t *)(d+4);    /* IPv6 sip[1] */
+    c = *(const uint32_t *)(d+8);    /* IPv6 sip[2] */
     mix(a,b,c);
 
-    a += *(uint32_t *)(d+12);  /* IPv6 sip[3] */
-    b += *(uint32_t *)(d+16);  /* IPv6 dip[0] */
-    c += *(uint32_t *)(d+20);  /* IPv6 dip[1] */
+    a += *(const uint32_t *)(d+12);  /* IPv6 sip[3] */
+    b += *(const uint32_t *)(d+16);  /* IPv6 dip[0] */
+    c += *(const uint32_t *)(d+20);  /* IPv6 dip[1] */
     mix(a,b,c);
 
-    a += *(uint32_t *)(d+24);  /* IPv6 dip[2] */
-    b += *(uint32_t *)(d+28);  /* IPv6 dip[3] */
-    c += *(uint32_t *)(d+32);  /* IPv6 id */
+    a += *(const uint32_t *)(d+24);  /* IPv6 dip[2] */
+    b += *(const uint32_t *)(d+28);  /* IPv6 dip[3] */
+    c += *(const uint32_t *)(d+32);  /* IPv6 id */
     mix(a,b,c);
 
     offset = 36;
 
-    a += *(uint32_t *)(d+offset);  /* vlan, proto, ipver */
+    a += *(const uint32_t *)(d+offset);  /* vlan, proto, ipver */
 #ifdef MPLS
-    tmp = *(uint32_t*)(d+offset+4);
+    tmp = *(const uint32_t*)(d+offset+4);
     if( tmp )
     {
         b += tmp;   /* mpls label */
@@ -938,7 +984,7 @@ uint32_t Frag3KeyHashFunc(SFHASHFCN *p, unsigned char *d, int n)
 #endif
 
 #ifdef HAVE_DAQ_ADDRESS_SPACE_ID
-    tmp2 = *(uint32_t*)(d+offset); /* after offset that has been moved */
+    tmp2 = *(const uint32_t*)(d+offset); /* after offset that has been moved */
     c += tmp2; /* address space id and 16bits of zero'd pad */
 #endif
 
@@ -1082,8 +1128,12 @@ static void Frag3GlobalInit(struct _SnortConfig *sc, char *args)
         frag3_config = sfPolicyConfigCreate();
 
         defrag_pkt = Encode_New();
+        defrag_handoff.pkt = defrag_pkt;
+        defrag_handoff.pkt_data = (uint8_t *)defrag_pkt->pkt;
 #ifdef GRE
         encap_defrag_pkt = Encode_New();
+        encap_defrag_handoff.pkt = encap_defrag_pkt;
+        encap_defrag_handoff.pkt_data = (uint8_t *)encap_defrag_pkt->pkt;
 #endif
 
 #ifdef PERF_PROFILING
@@ -1098,6 +1148,7 @@ static void Frag3GlobalInit(struct _SnortConfig *sc, char *args)
         AddFuncToConfigCheckList(sc, Frag3VerifyConfig);
         AddFuncToPreprocPostConfigList(sc, Frag3PostConfigInit, NULL);
         RegisterPreprocStats("frag3", Frag3PrintStats);
+        Workers_RegisterCounters("frag3", &f3stats, sizeof(f3stats), sizeof(uint32_t), NULL);
     }
 
     sfPolicyUserPolicySet (frag3_config, policy_id);
@@ -1144,34 +1195,22 @@ static void Frag3GlobalInit(struct _SnortConfig *sc, char *args)
      */
     if(f_cache == NULL)
     {
-        /* we keep FragTrackers in the hash table.. */
-        unsigned long hashTableSize = (unsigned long) (pCurrentPolicyConfig->max_frags * 1.4);
-        unsigned long maxFragMem = pCurrentPolicyConfig->max_frags * (
-                            sizeof(FragTracker) +
-                            sizeof(SFXHASH_NODE) +
-                            sizeof (FRAGKEY) +
-                            sizeof(SFXHASH_NODE *));
-        unsigned long tableMem = (hashTableSize + 1) * sizeof(SFXHASH_NODE *);
-        unsigned long maxMem = maxFragMem + tableMem;
-        f_cache = sfxhash_new(
-                hashTableSize,       /* number of hash buckets */
+        /* we keep FragTrackers in the table, all max_frags of them are
+         * allocated here */
+        f_cache = sfoahash_new(
+                pCurrentPolicyConfig->max_frags, /* number of trackers */
                 sizeof(FRAGKEY),     /* size of the key we're going to use */
                 sizeof(FragTracker), /* size of the storage node */
-                maxMem,              /* memcap for frag trackers */
-                1,                   /* use auto node recovery */
-                Frag3AutoFree,       /* anr free function */
-                Frag3UserFree,       /* user free function */
-                1);                  /* recycle node flag */
+                Frag3KeyHashFunc,
+                Frag3KeyCmpFunc);
 
         /* can't proceed if we can't get a fragment cache */
         if(!f_cache)
         {
-            LogMessage("WARNING: Unable to generate new sfxhash for frag3, "
+            LogMessage("WARNING: Unable to generate new sfoahash for frag3, "
                        "defragmentation disabled.\n");
             return;
         }
-
-        sfxhash_set_keyops(f_cache, Frag3KeyHashFunc, Frag3KeyCmpFunc);
     }
 
     /* display the global config for the user */
@@ -1405,7 +1444,6 @@ static void Frag3PostConfigInit(struct _SnortConfig *sc, void *arg)
         for (i = 0; i < config->static_frags; i++)
         {
             tmp = (Frag3Frag *) SnortAlloc(sizeof(Frag3Frag));
-            tmp->fptr = (uint8_t *) SnortAlloc(sizeof(uint8_t) * pkt_snaplen);
             Frag3PreallocPush(tmp);
         }
 
@@ -1845,7 +1883,7 @@ static void Frag3Defrag(Packet *p, void *context)
                 "trackers: %d  p->pkt_flags: 0x%X "
                 "prealloc nodes in use: %lu/%lu)\n",
                 frag3_mem_in_use,
-                sfxhash_count(f_cache),
+                sfoahash_count(f_cache),
                 p->packet_flags, prealloc_nodes_in_use,
                 frag3_eval_config->static_frags););
 
@@ -1868,7 +1906,7 @@ static void Frag3Defrag(Packet *p, void *context)
                     "trackers: %d  prealloc "
                     "nodes in use: %lu/%lu\n",
                     frag3_mem_in_use,
-                    sfxhash_count(f_cache),
+                    sfoahash_count(f_cache),
                     prealloc_nodes_in_use,
                     frag3_eval_config->static_frags););
         /*
@@ -2013,13 +2051,13 @@ static void Frag3Defrag(Packet *p, void *context)
         }
         else
         {
-            Frag3RemoveTracker(&fkey, ft);
+            Frag3RemoveTracker(ft);
             p->fragtracker = NULL;
 
             DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
                         "[FRAG3] Dumped fragtracker (mem use: %ld frag "
                         "trackers: %d  prealloc nodes in use: %lu/%lu)\n",
-                        frag3_mem_in_use, sfxhash_count(f_cache),
+                        frag3_mem_in_use, sfoahash_count(f_cache),
                         prealloc_nodes_in_use, frag3_eval_config->static_frags););
         }
     }
@@ -2250,7 +2288,7 @@ static inline int Frag3CheckFirstLast(Packet *p, FragTracker *ft)
 }
 
 /**
- * Lookup a FragTracker in the f_cache sfxhash table based on an input key
+ * Lookup a FragTracker in the f_cache table based on an input key
  *
  * @param p The current packet to get the key info from
  * @param fkey Pointer to a container for the FragKey
@@ -2311,7 +2349,7 @@ static FragTracker *Frag3GetTracker(Packet *p, FRAGKEY *fkey)
     /*
      * if the hash table is empty we're done
      */
-    if(sfxhash_count(f_cache) == 0)
+    if(sfoahash_count(f_cache) == 0)
         return NULL;
 
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
@@ -2321,7 +2359,7 @@ static FragTracker *Frag3GetTracker(Packet *p, FRAGKEY *fkey)
     PrintFragKey(fkey);
 #endif
 
-    returned = (FragTracker *) sfxhash_find(f_cache, fkey);
+    returned = (FragTracker *) sfoahash_find(f_cache, fkey);
 
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
                 "Frag3GetTracker returning %p for\n", returned););
@@ -2438,7 +2476,7 @@ int FragGetPolicy(Packet *p, Frag3Context *f3context)
 }
 
 /**
- * Didn't find a FragTracker in the hash table, create a new one and put it
+ * Didn't find a FragTracker in the table, create a new one and put it
  * into the f_cache
  *
  * @param p Current packet to fill in FragTracker fields
@@ -2455,8 +2493,9 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
     //int ret = 0;
     const uint8_t *fragStart;
     uint16_t fragLength;
-    uint16_t frag_end;
-    SFXHASH_NODE *hnode;
+    uint16_t frag_offset;
+    uint32_t frag_end;
+    uint16_t frag_size;
     tSfPolicyId policy_id = getNapRuntimePolicy();
 
     fragStart = p->ip_frag_start;
@@ -2488,15 +2527,54 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
         return 0;
     }
 
+    frag_offset = p->frag_offset << 3;
+    frag_end = frag_offset + fragLength;
+
+    if (p->mf)
+    {
+        /*
+         * all non-last frags are supposed to end on 8-byte boundries
+         */
+        if(frag_end & 7)
+        {
+            /*
+             * bonk/boink/jolt/etc attack...
+             */
+            DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
+                        "[..] Short frag (Bonk, etc) attack!\n"););
+
+            EventAnomShortFrag(f3context);
+
+            /* don't return, might still be interesting... */
+        }
+
+        /* can't have non-full fragments... */
+        frag_end &= ~7;
+    }
+
+    /* Adjust len to take into account the jolting/non-full fragment. */
+    frag_size = (frag_end > frag_offset) ? frag_end - frag_offset : 0;
+
     // Try to get a new one
-    if (!(hnode = sfxhash_get_node(f_cache, fkey)) || !hnode->data)
+    if (!(tmp = (FragTracker *)sfoahash_get(f_cache, fkey)))
     {
-        DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                    "Frag3NewTracker: sfxhash_get_node() failed\n"););
-        return 0;
+        /* the table is full, recycle a tracker the clock finds idle */
+        FragTracker *victim = (FragTracker *)sfoahash_victim(f_cache);
+
+        if (victim)
+        {
+            Frag3AutoFree(NULL, victim);
+            sfoahash_remove(f_cache, victim);
+        }
+
+        if (!(tmp = (FragTracker *)sfoahash_get(f_cache, fkey)))
+        {
+            DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
+                        "Frag3NewTracker: sfoahash_get() failed\n"););
+            return 0;
+        }
     }
 
-    tmp = (FragTracker *)hnode->data;
     memset(tmp, 0, sizeof(FragTracker));
 
     /*
@@ -2541,6 +2619,20 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
     tmp->config = frag3_config;
     ((Frag3Config *)sfPolicyUserDataGet(tmp->config, tmp->policy_id))->ref_count++;
 
+    /*
+     * mark the FragTracker if this is the first/last frag, a last frag
+     * gives us the size of the reassembly buffer up front
+     */
+    Frag3CheckFirstLast(p, tmp);
+
+    if (Frag3BufferReserve(tmp, frag_end) != 0)
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
+            "Frag3NewTracker: no reassembly buffer\n"););
+
+        return 0;
+    }
+
     /*
      * get our first fragment storage struct
      */
@@ -2560,9 +2652,6 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
         f = (Frag3Frag *) SnortAlloc(sizeof(Frag3Frag));
         frag3_mem_in_use += sizeof(Frag3Frag);
 
-        f->fptr = (uint8_t *) SnortAlloc(fragLength);
-        frag3_mem_in_use += fragLength;
-
         sfBase.frag3_mem_in_use = frag3_mem_in_use;
     }
     else
@@ -2585,59 +2674,20 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
     if (sfBase.iCurrentFrags > sfBase.iMaxFrags)
         sfBase.iMaxFrags = sfBase.iCurrentFrags;
 
-    /* initialize the fragment list */
-    tmp->fraglist = NULL;
-
     /*
      * setup the Frag3Frag struct with the current packet's data
      */
-    memcpy(f->fptr, fragStart, fragLength);
+    memcpy(FRAG3_DATA(tmp, frag_offset), fragStart, frag_size);
 
-    f->size = f->flen = fragLength;
-    f->offset = p->frag_offset << 3;
-    frag_end = f->offset + fragLength;
+    f->size = frag_size;
+    f->offset = frag_offset;
     f->ord = tmp->ordinal++;
-    f->data = f->fptr;     /* ptr to adjusted start position */
-    if (!p->mf)
-    {
-        f->last = 1;
-    }
-    else
-    {
-        /*
-         * all non-last frags are supposed to end on 8-byte boundries
-         */
-        if(frag_end & 7)
-        {
-            /*
-             * bonk/boink/jolt/etc attack...
-             */
-            DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                        "[..] Short frag (Bonk, etc) attack!\n"););
-
-            EventAnomShortFrag(f3context);
-
-            /* don't return, might still be interesting... */
-        }
-
-        /* can't have non-full fragments... */
-        frag_end &= ~7;
-
-        /* Adjust len to take into account the jolting/non-full fragment. */
-        f->size = frag_end - f->offset;
-    }
+    f->last = !p->mf;
 
     /* insert the fragment into the frag list */
-    tmp->fraglist = f;
-    tmp->fraglist_tail = f;
-    tmp->fraglist_count = 1;  /* XXX: Are these duplciates? */
+    Frag3FraglistAddNode(tmp, NULL, f);
     tmp->frag_pkts = 1;
 
-    /*
-     * mark the FragTracker if this is the first/last frag
-     */
-    Frag3CheckFirstLast(p, tmp);
-
     tmp->frag_bytes += fragLength;
 
     Frag3HandleIPOptions(tmp, p);
@@ -2655,8 +2705,8 @@ static int Frag3NewTracker(Packet *p, FRAGKEY *fkey, Frag3Context *f3context)
 #endif
 
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                "Calling sfxhash(add), overhead at %lu\n",
-                f_cache->overhead_bytes););
+                "Added tracker, %u in the table\n",
+                sfoahash_count(f_cache)););
 
     f3stats.fragtrackers_created++;
     pc.frag_trackers++;
@@ -2699,6 +2749,7 @@ static int AddFragNode(FragTracker *ft,
 {
     Frag3Frag *newfrag = NULL;  /* new frag container */
     int16_t newSize = len - slide - trunc;
+    uint16_t copySize;
 
     if (newSize <= 0)
     {
@@ -2717,10 +2768,10 @@ static int AddFragNode(FragTracker *ft,
         while (newfrag)
         {
             DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                   "Size: %d, offset: %d, len %d, "
+                   "Size: %d, offset: %d, "
                    "Prev: 0x%x, Next: 0x%x, This: 0x%x, Ord: %d, %s\n",
                    newfrag->size, newfrag->offset,
-                   newfrag->flen, newfrag->prev,
+                   newfrag->prev,
                    newfrag->next, newfrag, newfrag->ord,
                    newfrag->last ? "Last":""););
             newfrag = newfrag->next;
@@ -2730,6 +2781,17 @@ static int AddFragNode(FragTracker *ft,
         return FRAG_INSERT_ANOMALY;
     }
 
+    /*
+     * make room for the data in the reassembly buffer
+     */
+    if (Frag3BufferReserve(ft, frag_offset + newSize) != 0)
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
+            "Frag3Insert: no reassembly buffer\n"););
+
+        return FRAG_INSERT_FAILED;
+    }
+
     /*
      * grab/generate a new frag node
      */
@@ -2752,12 +2814,6 @@ static int AddFragNode(FragTracker *ft,
         newfrag = (Frag3Frag *) SnortAlloc(sizeof(Frag3Frag));
         frag3_mem_in_use += sizeof(Frag3Frag);
 
-        /*
-         * allocate some space to hold the actual data
-         */
-        newfrag->fptr = (uint8_t*)SnortAlloc(fragLength);
-        frag3_mem_in_use += fragLength;
-
         sfBase.frag3_mem_in_use = frag3_mem_in_use;
     }
     else
@@ -2782,23 +2838,20 @@ static int AddFragNode(FragTracker *ft,
 
     f3stats.fragnodes_created++;
 
-    newfrag->flen = fragLength;
-    memcpy(newfrag->fptr, fragStart, fragLength);
     newfrag->ord = ft->ordinal++;
 
     /*
      * twiddle the frag values for overlaps
      */
-    newfrag->data = newfrag->fptr + slide;
     newfrag->size = newSize;
     newfrag->offset = frag_offset;
     newfrag->last = lastfrag;
 
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
                 "[+] Adding new frag, offset %d, size %d\n"
-                "   nf->data = nf->fptr(%p) + slide (%d)\n"
+                "   nf->data = fragStart + slide (%d)\n"
                 "   nf->size = len(%d) - slide(%d) - trunc(%d)\n",
-                newfrag->offset, newfrag->size, newfrag->fptr,
+                newfrag->offset, newfrag->size,
                 slide, fragLength, slide, trunc););
 
     /*
@@ -2806,9 +2859,23 @@ static int AddFragNode(FragTracker *ft,
      */
     Frag3FraglistAddNode(ft, left, newfrag);
 
+    /*
+     * copy the data into place.  Frags further down the list keep any
+     * bytes they still share with this one, the same as when the list
+     * was copied out in order at rebuild time.
+     */
+    copySize = newfrag->size;
+
+    if (newfrag->next && (newfrag->next->offset < frag_offset + copySize))
+    {
+        copySize = (newfrag->next->offset > frag_offset) ?
+            newfrag->next->offset - frag_offset : 0;
+    }
+    memcpy(FRAG3_DATA(ft, frag_offset), fragStart + slide, copySize);
+
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                "[*] Inserted new frag %d@%d ptr %p data %p prv %p nxt %p\n",
-                newfrag->size, newfrag->offset, newfrag, newfrag->data,
+                "[*] Inserted new frag %d@%d ptr %p prv %p nxt %p\n",
+                newfrag->size, newfrag->offset, newfrag,
                 newfrag->prev, newfrag->next););
 
     /*
@@ -2863,12 +2930,6 @@ static int DupFragNode(FragTracker *ft,
         newfrag = (Frag3Frag *) SnortAlloc(sizeof(Frag3Frag));
         frag3_mem_in_use += sizeof(Frag3Frag);
 
-        /*
-         * allocate some space to hold the actual data
-         */
-        newfrag->fptr = (uint8_t*)SnortAlloc(left->flen);
-        frag3_mem_in_use += left->flen;
-
         sfBase.frag3_mem_in_use = frag3_mem_in_use;
     }
     else
@@ -2895,11 +2956,9 @@ static int DupFragNode(FragTracker *ft,
 
     newfrag->ord = ft->ordinal++;
     /*
-     * twiddle the frag values for overlaps
+     * twiddle the frag values for overlaps, the data is already in the
+     * reassembly buffer
      */
-    newfrag->flen = left->flen;
-    memcpy(newfrag->fptr, left->fptr, newfrag->flen);
-    newfrag->data = newfrag->fptr + (left->data - left->fptr);
     newfrag->size = left->size;
     newfrag->offset = left->offset;
     newfrag->last = left->last;
@@ -2910,8 +2969,8 @@ static int DupFragNode(FragTracker *ft,
     Frag3FraglistAddNode(ft, left, newfrag);
 
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                "[*] Inserted new frag %d@%d ptr %p data %p prv %p nxt %p\n",
-                newfrag->size, newfrag->offset, newfrag, newfrag->data,
+                "[*] Inserted new frag %d@%d ptr %p prv %p nxt %p\n",
+                newfrag->size, newfrag->offset, newfrag,
                 newfrag->prev, newfrag->next););
 
     /*
@@ -3027,7 +3086,6 @@ static int Frag3Insert(Packet *p, FragTracker *ft, FRAGKEY *fkey,
     Frag3Frag *right = NULL; /* frag ptr for right-side overlap loop */
     Frag3Frag *newfrag = NULL;  /* new frag container */
     Frag3Frag *left = NULL;     /* left-side overlap fragment ptr */
-    Frag3Frag *idx = NULL;      /* indexing fragment pointer for loops */
     Frag3Frag *dump_me = NULL;  /* frag ptr for complete overlaps to dump */
     const uint8_t *fragStart;
     int16_t fragLength;
@@ -3187,30 +3245,16 @@ static int Frag3Insert(Packet *p, FragTracker *ft, FRAGKEY *fkey,
 
     /*
      * Need to figure out where in the frag list this frag should go
-     * and who its neighbors are
+     * and who its neighbors are: right is the first frag at or after
+     * this one's offset, left the one before it
      */
-    for(idx = ft->fraglist; idx; idx = idx->next)
-    {
-        i++;
-        right = idx;
-
-        DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                    "%d right o %d s %d ptr %p prv %p nxt %p\n",
-                    i, right->offset, right->size, right,
-                    right->prev, right->next););
-
-        if(right->offset >= frag_offset)
-        {
-            break;
-        }
+    i = Frag3IndexFind(ft, frag_offset);
 
-        left = right;
-    }
+    right = (i < ft->fraglist_count) ? ft->fragindex[i] : NULL;
+    left = (i > 0) ? ft->fragindex[i - 1] : NULL;
 
-    /*
-     * null things out if we walk to the end of the list
-     */
-    if(idx == NULL) right = NULL;
+    DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
+                "%d right %p left %p\n", i, right, left););
 
     /*
      * handle forward (left-side) overlaps...
@@ -3338,7 +3382,6 @@ static int Frag3Insert(Packet *p, FragTracker *ft, FRAGKEY *fkey,
 
                         right->offset = frag_offset + len;
                         right->size -= (frag_offset + len - left->offset);
-                        right->data += (frag_offset + len - left->offset);
                         ft->frag_bytes -= (frag_offset + len - left->offset);
                     }
                     else
@@ -3474,7 +3517,6 @@ left_overlap_last:
                     else
                     {
                         right->offset += (int16_t)overlap;
-                        right->data += (int16_t)overlap;
                         right->size -= (int16_t)overlap;
                         ft->frag_bytes -= (int16_t)overlap;
                     }
@@ -3826,9 +3868,9 @@ static inline int Frag3IsComplete(FragTracker *ft)
 static void Frag3Rebuild(FragTracker *ft, Packet *p)
 {
     uint8_t *rebuild_ptr = NULL;  /* ptr to the start of the reassembly buffer */
-    const uint8_t *rebuild_end;  /* ptr to the end of the reassembly buffer */
     Frag3Frag *frag;    /* frag pointer for managing fragments */
-    int ret = 0;
+    Frag3Handoff *handoff;
+    uint32_t hlen;
     Packet* dpkt;
     PROFILE_VARS;
 
@@ -3838,18 +3880,24 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
 
 #ifdef GRE
     if ( p->encapsulated )
-        dpkt = encap_defrag_pkt;
+        handoff = &encap_defrag_handoff;
     else
 #endif
-        dpkt = defrag_pkt;
+        handoff = &defrag_handoff;
+
+    dpkt = handoff->pkt;
+
+    /*
+     * the datagram last rebuilt in this packet is done with, give the
+     * packet its own buffer back before encoding into it
+     */
+    Frag3HandoffRelease(handoff);
 
     Encode_Format(ENC_FLAG_DEF|ENC_FLAG_FWD, p, dpkt, PSEUDO_PKT_IP);
     /*
-     * set the pointer to the end of the rebuild packet
+     * set the pointer to the end of the rebuild packet headers
      */
     rebuild_ptr = (uint8_t*)dpkt->data;
-    // the encoder ensures enough space for a maximum datagram
-    rebuild_end = (uint8_t*)dpkt->data + IP_MAXPACKET;
 
     if (IS_IP4(p))
     {
@@ -3867,15 +3915,7 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
                     new_ip_hlen););
             SET_IP_HLEN((IPHdr *)dpkt->iph, new_ip_hlen>>2);
 
-            ret = SafeMemcpy(rebuild_ptr, ft->ip_options_data,
-                ft->ip_options_len, rebuild_ptr, rebuild_end);
-
-            if (ret == SAFEMEM_ERROR)
-            {
-                /*XXX: Log message, failed to copy */
-                ft->frag_flags = ft->frag_flags | FRAG_REBUILT;
-                return;
-            }
+            memcpy(rebuild_ptr, ft->ip_options_data, ft->ip_options_len);
             rebuild_ptr += ft->ip_options_len;
         }
         else if (ft->copied_ip_options_len)
@@ -3891,59 +3931,10 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
         ((IPHdr *)dpkt->iph)->ip_off = 0x0000;
         dpkt->frag_flag = 0;
 
-        DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                    "[^^] Walking fraglist:\n"););
-    }
-
-    /*
-     * walk the fragment list and rebuild the packet
-     */
-    for(frag = ft->fraglist; frag; frag = frag->next)
-    {
-        DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                    "   frag: %p\n"
-                    "   frag->data: %p\n"
-                    "   frag->offset: %d\n"
-                    "   frag->size: %d\n"
-                    "   frag->prev: %p\n"
-                    "   frag->next: %p\n",
-                    frag, frag->data, frag->offset,
-                    frag->size, frag->prev, frag->next););
-
-        /*
-         * We somehow got a frag that had data beyond the calculated
-         * end. Don't want to include it.
-         */
-        if ((frag->offset + frag->size) > (uint16_t)ft->calculated_size)
-            continue;
-
-        /*
-         * try to avoid buffer overflows...
-         */
-        if (frag->size)
-        {
-            ret = SafeMemcpy(rebuild_ptr+frag->offset, frag->data, frag->size,
-                             rebuild_ptr, rebuild_end);
-
-            if (ret == SAFEMEM_ERROR)
-            {
-                /*XXX: Log message, failed to copy */
-                ft->frag_flags = ft->frag_flags | FRAG_REBUILT;
-                return;
-            }
-        }
-    }
-
-    if (IS_IP4(p))
-    {
         /*
          * tell the rest of the system that this is a rebuilt fragment
          */
         dpkt->packet_flags |= PKT_REBUILT_FRAG;
-        dpkt->frag_flag = 0;
-        dpkt->dsize = (uint16_t)ft->calculated_size;
-
-        Encode_Update(dpkt);
     }
     else /* Inner/only is IP6 */
     {
@@ -3971,10 +3962,89 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
         {
             rawHdr->ip6nxt = ft->protocol;
         }
-        dpkt->dsize = (uint16_t)ft->calculated_size;
-        Encode_Update(dpkt);
     }
 
+    /*
+     * try to avoid buffer overflows...
+     */
+    if (((rebuild_ptr - dpkt->data) + ft->calculated_size > IP_MAXPACKET) ||
+        (Frag3BufferReserve(ft, ft->calculated_size) != 0))
+    {
+        /*XXX: Log message, failed to copy */
+        ft->frag_flags = ft->frag_flags | FRAG_REBUILT;
+        return;
+    }
+
+    DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
+                "[^^] Walking fraglist:\n"););
+
+    /*
+     * the fragments are already in place, walk the list to drop the data
+     * of any that run past the calculated end
+     */
+    for(frag = ft->fraglist; frag; frag = frag->next)
+    {
+        DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
+                    "   frag: %p\n"
+                    "   frag->offset: %d\n"
+                    "   frag->size: %d\n"
+                    "   frag->prev: %p\n"
+                    "   frag->next: %p\n",
+                    frag, frag->offset,
+                    frag->size, frag->prev, frag->next););
+
+        /*
+         * We somehow got a frag that had data beyond the calculated
+         * end. Don't want to include it.
+         */
+        if (((frag->offset + frag->size) > (uint16_t)ft->calculated_size) &&
+            (frag->offset < ft->calculated_size))
+        {
+            memset(FRAG3_DATA(ft, frag->offset), 0,
+                ft->calculated_size - frag->offset);
+        }
+    }
+
+    hlen = rebuild_ptr - dpkt->pkt;
+
+    if (hlen <= FRAG3_HEADROOM)
+    {
+        /*
+         * put the headers right in front of the datagram and hand the
+         * whole buffer over to the pseudo packet, the tracker is done
+         * with it
+         */
+        uint8_t *hdr = ft->buf + FRAG3_HEADROOM - hlen;
+        int i;
+
+        memcpy(hdr, dpkt->pkt, hlen);
+
+        for (i = 0; i < dpkt->next_layer; i++)
+            dpkt->layers[i].start = hdr + (dpkt->layers[i].start - dpkt->pkt);
+
+        dpkt->pkt = hdr;
+        dpkt->data = hdr + hlen;
+
+        handoff->buf = ft->buf;
+        handoff->buf_mem = FRAG3_HEADROOM + ft->buf_size;
+
+        ft->buf = NULL;
+        ft->buf_size = 0;
+    }
+    else
+    {
+        /*
+         * more encapsulation than fits the headroom, copy the datagram
+         * in behind the headers the old fashioned way
+         */
+        memcpy(rebuild_ptr, FRAG3_DATA(ft, 0), ft->calculated_size);
+    }
+
+    dpkt->frag_flag = 0;
+    dpkt->dsize = (uint16_t)ft->calculated_size;
+
+    Encode_Update(dpkt);
+
     pc.rebuilt_frags++;
     sfBase.iFragFlushes++;
 
@@ -4015,6 +4085,99 @@ static void Frag3Rebuild(FragTracker *ft, Packet *p)
     ft->frag_flags = ft->frag_flags | FRAG_REBUILT;
 }
 
+/**
+ * Make sure a tracker's reassembly buffer reaches datagram offset end.
+ * Once the last fragment has told us the size of the datagram the buffer
+ * is sized to fit it exactly, until then it grows by doubling.  Growing
+ * the buffer moves it, so fragments only ever refer to it by offset.
+ *
+ * @param ft FragTracker that owns the buffer
+ * @param end Offset just past the data that needs to fit
+ *
+ * @return status
+ * @retval 0 the buffer is big enough
+ * @retval -1 the datagram is too big or we are out of memory
+ */
+static int Frag3BufferReserve(FragTracker *ft, uint32_t end)
+{
+    uint32_t size;
+    uint8_t *buf;
+
+    if (ft->buf && (end <= ft->buf_size))
+        return 0;
+
+    if (end > IP_MAXPACKET)
+        return -1;
+
+    if ((ft->frag_flags & FRAG_GOT_LAST) && (end <= ft->calculated_size))
+    {
+        size = ft->calculated_size;
+    }
+    else
+    {
+        size = ft->buf_size ? ft->buf_size << 1 : FRAG3_BUF_MIN;
+
+        if (size < end)
+            size = end;
+
+        if (size > IP_MAXPACKET)
+            size = IP_MAXPACKET;
+    }
+
+    if (frag3_mem_in_use > frag3_eval_config->memcap)
+    {
+        if (Frag3Prune(ft) == 0)
+        {
+            DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
+                "Frag3BufferReserve: Pruning failed\n"););
+
+            return -1;
+        }
+    }
+
+    buf = (uint8_t *)realloc(ft->buf, FRAG3_HEADROOM + size);
+
+    if (buf == NULL)
+        return -1;
+
+    /* holes in the datagram read back as zeros */
+    memset(buf + FRAG3_HEADROOM + ft->buf_size, 0, size - ft->buf_size);
+
+    if (ft->buf == NULL)
+        frag3_mem_in_use += FRAG3_HEADROOM;
+
+    frag3_mem_in_use += size - ft->buf_size;
+    sfBase.frag3_mem_in_use = frag3_mem_in_use;
+
+    ft->buf = buf;
+    ft->buf_size = size;
+
+    return 0;
+}
+
+/**
+ * Give a pseudo packet back its own buffer and free the reassembly buffer
+ * it was last handed.
+ *
+ * @param handoff Handoff record of the pseudo packet
+ *
+ * @return none
+ */
+static void Frag3HandoffRelease(Frag3Handoff *handoff)
+{
+    if (handoff->buf == NULL)
+        return;
+
+    handoff->pkt->pkt = handoff->pkt_data;
+
+    free(handoff->buf);
+    frag3_mem_in_use -= handoff->buf_mem;
+    sfBase.frag3_mem_in_use = frag3_mem_in_use;
+
+    handoff->buf = NULL;
+    handoff->buf_mem = 0;
+}
+
 /**
  * Delete a Frag3Frag struct
  *
@@ -4029,9 +4192,6 @@ static void Frag3DeleteFrag(Frag3Frag *frag)
      */
     if(!frag3_eval_config->use_prealloc)
     {
-        free(frag->fptr);
-        frag3_mem_in_use -= frag->flen;
-
         free(frag);
         frag3_mem_in_use -= sizeof(Frag3Frag);
 
@@ -4049,7 +4209,8 @@ static void Frag3DeleteFrag(Frag3Frag *frag)
 
 /**
  * Delete the contents of a FragTracker, in this instance that just means to
- * dump the fraglist.  The sfxhash system deletes the actual FragTracker mem.
+ * dump the fraglist and the reassembly buffer.  The FragTracker itself lives
+ * in the f_cache table.
  *
  * @param ft FragTracker to delete
  *
@@ -4073,6 +4234,26 @@ static void Frag3DeleteTracker(FragTracker *ft)
         Frag3DeleteFrag(dump_me);
     }
     ft->fraglist = NULL;
+    ft->fraglist_tail = NULL;
+    ft->fraglist_count = 0;
+
+    if (ft->fragindex)
+    {
+        free(ft->fragindex);
+        frag3_mem_in_use -= ft->fragindex_size * sizeof(*ft->fragindex);
+        ft->fragindex = NULL;
+        ft->fragindex_size = 0;
+    }
+
+    if (ft->buf)
+    {
+        free(ft->buf);
+        frag3_mem_in_use -= FRAG3_HEADROOM + ft->buf_size;
+        ft->buf = NULL;
+        ft->buf_size = 0;
+    }
+    sfBase.frag3_mem_in_use = frag3_mem_in_use;
+
     if (ft->ip_options_data)
     {
         free(ft->ip_options_data);
@@ -4083,29 +4264,27 @@ static void Frag3DeleteTracker(FragTracker *ft)
 }
 
 /**
- * Remove a FragTracker from the f_cache hash table
+ * Remove a FragTracker from the f_cache table
  *
- * @param key FragKey of the FragTracker to be removed
- * @param data unused in this function
+ * @param ft FragTracker to be removed
  *
  * @return none
  */
-static void Frag3RemoveTracker(void *key, void *data)
+static void Frag3RemoveTracker(FragTracker *ft)
 {
-    /*
-     * sfxhash maintains its own self preservation stuff/node freeing stuff
-     */
-    if(sfxhash_remove(f_cache, key) != SFXHASH_OK)
+    Frag3UserFree(NULL, ft);
+
+    if(sfoahash_remove(f_cache, ft) != SFOAHASH_OK)
     {
-        ErrorMessage("sfxhash_remove() failed in frag3!\n");
+        ErrorMessage("sfoahash_remove() failed in frag3!\n");
     }
 
     return;
 }
 
 /**
- * This is the auto-node-release function that gets handed to the sfxhash table
- * at initialization.  Handles deletion of sfxhash table data members.
+ * Release a FragTracker that is recycled because the f_cache table is full.
+ * Handles deletion of table data members.
  *
  * @param key FragKey of the element to be freed
  * @param data unused in this implementation
@@ -4155,8 +4334,8 @@ static int Frag3AutoFree(void *key, void *data)
 }
 
 /**
- * This is the user free function that gets handed to the sfxhash table
- * at initialization.  Handles deletion of sfxhash table data members.
+ * Release a FragTracker that is removed from the f_cache table.
+ * Handles deletion of table data members.
  *
  * @param key FragKey of the element to be freed
  * @param data unused in this implementation
@@ -4207,9 +4386,8 @@ static int Frag3UserFree(void *key, void *data)
 /**
  * This function gets called either when we run out of prealloc nodes or when
  * the memcap is exceeded.  Its job is to free memory up in frag3 by deleting
- * old/stale data.  Currently implemented using a simple LRU pruning
- * technique, could probably benefit from having some sort of tail selection
- * randomization added to it.  Additonally, right now when we hit the wall we
+ * old/stale data.  Trackers are taken from the LRU end of the f_cache
+ * table.  Additonally, right now when we hit the wall we
  * try to drop at least enough memory to satisfy the "ten_percent" value.
  * Hopefully that's not too aggressive, salt to taste!
  *
@@ -4219,14 +4397,13 @@ static int Frag3UserFree(void *key, void *data)
  */
 static int Frag3Prune(FragTracker *not_me)
 {
-    SFXHASH_NODE *hnode;
+    FragTracker *ft;
     int found_this = 0;
     int pruned = 0;
 #ifdef DEBUG
     /* Use these to print out whether the frag tracker has
      * expired or not.
      */
-    FragTracker *ft;
     struct timeval *fttime;     /* FragTracker timestamp */
 #endif
 
@@ -4239,15 +4416,15 @@ static int Frag3Prune(FragTracker *not_me)
         DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
                     "(spp_frag3) Frag3Prune: Pruning by memcap! "););
         while((frag3_mem_in_use > frag3_eval_config->memcap) ||
-              (f_cache->count > (frag3_eval_config->max_frags - 5)))
+              (sfoahash_count(f_cache) > (frag3_eval_config->max_frags - 5)))
         {
-            hnode = sfxhash_lru_node(f_cache);
-            if(!hnode)
+            ft = (FragTracker *)sfoahash_victim(f_cache);
+            if(!ft)
             {
                 break;
             }
 
-            if (hnode && hnode->data == not_me)
+            if (ft == not_me)
             {
                 if (found_this)
                 {
@@ -4256,12 +4433,10 @@ static int Frag3Prune(FragTracker *not_me)
                         "(spp_frag3) Frag3Prune: Pruning by memcap - empty list! "););
                     return pruned;
                 }
-                sfxhash_gmovetofront(f_cache, hnode);
                 found_this = 1;
                 continue;
             }
 #ifdef DEBUG
-            ft = hnode->data;
             fttime = &(ft->frag_time);
 
             if (CheckTimeout(pkttime,fttime,ft->context)==FRAG_TIMEOUT)
@@ -4283,7 +4458,7 @@ static int Frag3Prune(FragTracker *not_me)
                 free(src_str);
             }
 #endif
-            Frag3RemoveTracker(hnode->key, hnode->data);
+            Frag3RemoveTracker(ft);
             //sfBase.iFragDeletes++;
             //f3stats.fragtrackers_released++;
             pruned++;
@@ -4293,16 +4468,17 @@ static int Frag3Prune(FragTracker *not_me)
     {
         DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
                     "(spp_frag3) Frag3Prune: Pruning by prealloc! "););
-        while (prealloc_nodes_in_use >
-               (frag3_eval_config->static_frags - frag3_eval_config->ten_percent))
+        while ((prealloc_nodes_in_use >
+                (frag3_eval_config->static_frags - frag3_eval_config->ten_percent)) ||
+               (frag3_mem_in_use > frag3_eval_config->memcap))
         {
-            hnode = sfxhash_lru_node(f_cache);
-            if(!hnode)
+            ft = (FragTracker *)sfoahash_victim(f_cache);
+            if(!ft)
             {
                 break;
             }
 
-            if (hnode && hnode->data == not_me)
+            if (ft == not_me)
             {
                 if (found_this)
                 {
@@ -4311,13 +4487,11 @@ static int Frag3Prune(FragTracker *not_me)
                               "(spp_frag3) Frag3Prune: Pruning by prealloc - empty list! "););
                     return pruned;
                 }
-                sfxhash_gmovetofront(f_cache, hnode);
                 found_this = 1;
                 continue;
             }
 
 #ifdef DEBUG
-            ft = hnode->data;
             fttime = &(ft->frag_time);
 
             if (CheckTimeout(pkttime,fttime,ft->context)==FRAG_TIMEOUT)
@@ -4340,7 +4514,7 @@ static int Frag3Prune(FragTracker *not_me)
             }
 #endif
 
-            Frag3RemoveTracker(hnode->key, hnode->data);
+            Frag3RemoveTracker(ft);
             //sfBase.iFragDeletes++;
             //f3stats.fragtrackers_released++;
             pruned++;
@@ -4437,7 +4611,8 @@ static void Frag3CleanExit(int signal, void *foo)
     Frag3Frag *tmp;
     Frag3Config *pDefaultPolicyConfig = NULL;
 
-    sfxhash_delete(f_cache);
+    Frag3PurgeTrackers();
+    sfoahash_delete(f_cache);
     f_cache = NULL;
 
     pDefaultPolicyConfig = (Frag3Config *)sfPolicyUserDataGetDefault(frag3_config);
@@ -4448,7 +4623,6 @@ static void Frag3CleanExit(int signal, void *foo)
         tmp = Frag3PreallocPop();
         while (tmp)
         {
-            free(tmp->fptr);
             free(tmp);
             tmp = Frag3PreallocPop();
         }
@@ -4456,19 +4630,38 @@ static void Frag3CleanExit(int signal, void *foo)
 
     Frag3FreeConfigs(frag3_config);
 
+    Frag3HandoffRelease(&defrag_handoff);
     Encode_Delete(defrag_pkt);
     defrag_pkt = NULL;
 
 #ifdef GRE
+    Frag3HandoffRelease(&encap_defrag_handoff);
     Encode_Delete(encap_defrag_pkt);
     encap_defrag_pkt = NULL;
 #endif
 }
 
+/**
+ * Remove every FragTracker from the f_cache table
+ */
+static void Frag3PurgeTrackers(void)
+{
+    FragTracker *ft;
+    uint32_t cursor = 0;
+    unsigned remaining;
+
+    if (f_cache == NULL)
+        return;
+
+    remaining = sfoahash_count(f_cache);
+
+    while (remaining-- && (ft = (FragTracker *)sfoahash_sweep(f_cache, &cursor)))
+        Frag3RemoveTracker(ft);
+}
+
 static void Frag3Reset(int signal, void *foo)
 {
-    if (f_cache != NULL)
-        sfxhash_make_empty(f_cache);
+    Frag3PurgeTrackers();
 }
 
 static void Frag3ResetStats(int signal, void *foo)
@@ -4504,7 +4697,6 @@ static inline Frag3Frag *Frag3PreallocPop(void)
         node->prev = NULL;
         node->offset = 0;
         node->size = 0;
-        node->flen = 0;
         node->last = 0;
     }
     else
@@ -4512,12 +4704,6 @@ static inline Frag3Frag *Frag3PreallocPop(void)
         return NULL;
     }
 
-    if (!node->fptr)
-    {
-        DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                        "Frag3Frag fptr is NULL!\n"););
-    }
-
     prealloc_nodes_in_use++;
     return node;
 }
@@ -4544,17 +4730,68 @@ static inline void Frag3PreallocPush(Frag3Frag *node)
     }
 
     prealloc_frag_list = node;
-    node->data = NULL;
-    if (!node->fptr)
-    {
-        DEBUG_WRAP(DebugMessage(DEBUG_FRAG,
-                        "Frag3Frag fptr is NULL!\n"););
-    }
 
     prealloc_nodes_in_use--;
     return;
 }
 
+/**
+ * Find the first Frag3Frag at or after offset in a FragTracker's fraglist.
+ * The fraglist is kept in offset order, so this is a binary search of the
+ * fragindex.
+ *
+ * @param ft FragTracker to search
+ * @param offset datagram offset to look for
+ *
+ * @return position of that frag in the fragindex, or fraglist_count if
+ *         every frag starts before offset
+ */
+static inline int Frag3IndexFind(FragTracker *ft, uint16_t offset)
+{
+    int lo = 0;
+    int hi = ft->fraglist_count;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) >> 1;
+
+        if (ft->fragindex[mid]->offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * Find the position of a Frag3Frag in the fragindex
+ *
+ * @param ft FragTracker holding the frag
+ * @param node frag to look for
+ *
+ * @return position of node
+ */
+static inline int Frag3IndexOf(FragTracker *ft, Frag3Frag *node)
+{
+    int i = Frag3IndexFind(ft, node->offset);
+
+    /* a frag being split shares its offset with the copy */
+    while ((i < ft->fraglist_count) && (ft->fragindex[i] != node) &&
+           (ft->fragindex[i]->offset == node->offset))
+    {
+        i++;
+    }
+
+    if ((i < ft->fraglist_count) && (ft->fragindex[i] == node))
+        return i;
+
+    /* the list was out of order, fall back to walking it */
+    for (i = 0; ft->fragindex[i] != node; i++);
+
+    return i;
+}
+
 /**
  * Plug a Frag3Frag into the fraglist of a FragTracker
  *
@@ -4568,6 +4805,28 @@ static inline void Frag3PreallocPush(Frag3Frag *node)
 static inline void Frag3FraglistAddNode(FragTracker *ft, Frag3Frag *prev,
         Frag3Frag *node)
 {
+    int i = prev ? Frag3IndexOf(ft, prev) + 1 : 0;
+
+    if ((uint32_t)ft->fraglist_count == ft->fragindex_size)
+    {
+        uint32_t size = ft->fragindex_size ? ft->fragindex_size << 1 : 8;
+        Frag3Frag **index = (Frag3Frag **)realloc(ft->fragindex,
+            size * sizeof(*index));
+
+        if (index == NULL)
+            FatalError("frag3: unable to allocate a fragment index\n");
+
+        frag3_mem_in_use += (size - ft->fragindex_size) * sizeof(*index);
+        sfBase.frag3_mem_in_use = frag3_mem_in_use;
+
+        ft->fragindex = index;
+        ft->fragindex_size = size;
+    }
+
+    memmove(ft->fragindex + i + 1, ft->fragindex + i,
+        (ft->fraglist_count - i) * sizeof(*ft->fragindex));
+    ft->fragindex[i] = node;
+
     if(prev)
     {
         node->next = prev->next;
@@ -4602,9 +4861,14 @@ static inline void Frag3FraglistAddNode(FragTracker *ft, Frag3Frag *prev,
  */
 static inline void Frag3FraglistDeleteNode(FragTracker *ft, Frag3Frag *node)
 {
+    int i = Frag3IndexOf(ft, node);
+
     DEBUG_WRAP(DebugMessage(DEBUG_FRAG, "Deleting list node %p (p %p n %p)\n",
                 node, node->prev, node->next););
 
+    memmove(ft->fragindex + i, ft->fragindex + i + 1,
+        (ft->fraglist_count - i - 1) * sizeof(*ft->fragindex));
+
     if(node->prev)
     {
         node->prev->next = node->next;
@@ -83,6 +83,7 @@
 #include "mempool.h"
 #include "file_api.h"
 #include "sf_email_attach_decode.h"
+#include "workers.h"
 
 #if defined(FEAT_OPEN_APPID)
 #include "spp_stream6.h"
@@ -230,8 +231,10 @@ static void HttpInspect(Packet *p, void *context)
     if (hiDetectCalled)
     {
         hiPerfStats.ticks -= hiDetectPerfStats.ticks;
+        PerfCountersSub(&hiPerfStats.hw, &hiDetectPerfStats.hw);
         /* And Reset ticks to 0 */
         hiDetectPerfStats.ticks = 0;
+        memset(&hiDetectPerfStats.hw, 0, sizeof(hiDetectPerfStats.hw));
         hiDetectCalled = 0;
     }
 #endif
@@ -532,6 +535,8 @@ static void HttpInspectInit(struct _SnortConfig *sc, char *args)
         AddFuncToConfigCheckList(sc, HttpInspectCheckConfig);
 
         RegisterPreprocStats("http_inspect", HttpInspectDropStats);
+        Workers_RegisterCounters("http_inspect", &hi_stats, sizeof(hi_stats),
+                sizeof(uint64_t), NULL);
 
 #ifdef PERF_PROFILING
         RegisterPreprocessorProfile("httpinspect", &hiPerfStats, 0, &totalPerfStats, NULL);
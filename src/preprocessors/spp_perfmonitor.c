@@ -52,6 +52,7 @@
 #include "perf-base.h"
 #include "profiler.h"
 #include "session_api.h"
+#include "workers.h"
 
 // Performance statistic types
 //#define PERFMON_ARG__BASE          "base"
@@ -779,6 +780,10 @@ static void PerfMonitorOpenLogFiles(struct _SnortConfig *sc, void *data)
     if (perfmon_config == NULL)
         return;
 
+    Workers_FileName(&perfmon_config->file);
+    Workers_FileName(&perfmon_config->flow_file);
+    Workers_FileName(&perfmon_config->flowip_file);
+
     if ((perfmon_config->file != NULL)
             && ((perfmon_config->fh = sfOpenBaseStatsFile(perfmon_config->file)) == NULL))
     {
@@ -820,6 +825,10 @@ static void PerfMonitorReload(struct _SnortConfig *sc, char *args, void **new_co
 
     /* parse the argument list from the rules file */
     ParsePerfMonitorArgs(sc, perfmon_swap_config, args);
+
+    Workers_FileName(&perfmon_swap_config->file);
+    Workers_FileName(&perfmon_swap_config->flow_file);
+    Workers_FileName(&perfmon_swap_config->flowip_file);
 }
 
 static int PerfmonReloadVerify(struct _SnortConfig *sc, void *swap_config)
@@ -1003,19 +1003,11 @@ static int verifySessionConfig( struct _SnortConfig *sc )
     }
 
     /* Initialize the memory pool for Flowbits Data */
-    /* use giFlowbitSize - 1, since there is already 1 byte in the
-     * StreamFlowData structure */
-    obj_size = sizeof( StreamFlowData ) + getFlowbitSizeInBytes( ) - 1;
+    obj_size = offsetof( StreamFlowData, flowb ) + getFlowbitSizeInBytes( );
 
-    if( ( obj_size % sizeof( long ) ) != 0 )
-    {
-        /* Increase obj_size by sizeof(long) to force sizeof(long) byte
-         * alignment for each object in the mempool.  Without this,
-         * the mempool data buffer was not aligned. Overlaying the
-         * StreamFlowData structure caused problems on some Solaris
-         * platforms. */
-        obj_size += ( sizeof( long ) - ( obj_size % sizeof( long ) ) );
-    }
+    /* Round obj_size up to whole cache lines; the mempool is line aligned
+     * so no session's flowbits share a line with another's. */
+    obj_size = ( obj_size + 63 ) & ~63;
 
     if (total_sessions != 0)
     {
@@ -1440,7 +1432,7 @@ static int getActiveSessionCount(void *sessionCache)
     SessionCache *session_cache = (SessionCache *) sessionCache;
 
     if (session_cache &&session_cache->hashTable)
-        return session_cache->hashTable->count;
+        return sfoahash_count(session_cache->hashTable);
     else
         return 0;
 }
@@ -1719,23 +1711,11 @@ static void populateSessionKey( Packet *p, SessionKey *key )
 static void *getSessionControlBlockFromKey( void *sessionCache, const SessionKey *key )
 {
     SessionCache *session_cache = ( SessionCache * ) sessionCache;
-    SessionControlBlock *scb = NULL;
-    SFXHASH_NODE *hnode;
 
     if( !sessionCache )
         return NULL;
 
-    hnode = sfxhash_find_node( session_cache->hashTable, key );
-
-    if( hnode && hnode->data )
-    {
-        /* This is a unique hnode, since the sfxhash finds the
-         * same key before returning this node.
-         */
-        scb = ( SessionControlBlock * ) hnode->data;
-    }
-
-    return scb;
+    return ( SessionControlBlock * ) sfoahash_find( session_cache->hashTable, key );
 }
 
 static void freeSessionApplicationData(void *session)
@@ -1757,20 +1737,12 @@ static void freeSessionApplicationData(void *session)
 
 static int removeSession(SessionCache *session_cache, SessionControlBlock *scb )
 {
-    SFXHASH_NODE *hnode;
-
     decrementPolicySessionRefCount( scb );
 
     mempool_free(&sessionFlowMempool, scb->flowdata);
     scb->flowdata = NULL;
 
-    hnode = sfxhash_find_node(session_cache->hashTable, scb->key);
-    if (!hnode)
-        return SFXHASH_ERR;
-    if (session_cache->nextTimeoutEvalNode == hnode)
-        session_cache->nextTimeoutEvalNode = NULL;
-
-    return sfxhash_free_node(session_cache->hashTable, hnode);
+    return sfoahash_remove(session_cache->hashTable, scb);
 }
 
 static int deleteSessionByKey(void *session, char *delete_reason)
@@ -1896,7 +1868,7 @@ static int purgeSessionCache(void *sessionCache)
     SessionCache *session_cache = (SessionCache *) sessionCache;
     int retCount = 0;
     SessionControlBlock *idx;
-    SFXHASH_NODE *hnode;
+    uint32_t cursor = 0, remaining;
 
     if (!session_cache)
         return 0;
@@ -1904,20 +1876,11 @@ static int purgeSessionCache(void *sessionCache)
     session_cache->flags |= SESSION_CACHE_FLAG_PURGING;
 
     /* Remove all sessions from the hash table. */
-    hnode = sfxhash_mru_node(session_cache->hashTable);
-    while (hnode)
+    remaining = sfoahash_count(session_cache->hashTable);
+    while (remaining-- && (idx = sfoahash_sweep(session_cache->hashTable, &cursor)))
     {
-        idx = (SessionControlBlock *)hnode->data;
-        if (!idx)
-        {
-            sfxhash_free_node(session_cache->hashTable, hnode);
-        }
-        else
-        {
-            idx->ha_state.session_flags |= SSNFLAG_PRUNED;
-            deleteSession(session_cache, idx, "purge whole cache");
-        }
-        hnode = sfxhash_mru_node(session_cache->hashTable);
+        idx->ha_state.session_flags |= SSNFLAG_PRUNED;
+        deleteSession(session_cache, idx, "purge whole cache");
         retCount++;
     }
 
@@ -1942,7 +1905,7 @@ static int deleteSessionCache( uint32_t protocol )
         mempool_destroy( session_cache->protocol_session_pool );
         free( session_cache->protocol_session_pool );
 
-        sfxhash_delete( session_cache->hashTable );
+        sfoahash_delete( session_cache->hashTable );
         free( session_cache );
         proto_session_caches[ protocol ] = NULL;
     }
@@ -1986,7 +1949,7 @@ static int pruneOneWaySessions( SessionCache *session_cache )
 static bool prune_more_sessions( SessionCache *session_cache, uint32_t num_pruned,
         uint32_t prune_stop_threshold, int memCheck )
 {
-    unsigned int session_count = sfxhash_count(session_cache->hashTable);
+    unsigned int session_count = sfoahash_count(session_cache->hashTable);
 
     if( session_count < 1 )
         return false;
@@ -1997,13 +1960,6 @@ static bool prune_more_sessions( SessionCache *session_cache, uint32_t num_prune
         return session_mem_in_use > GetSessionMemCap();
 }
 
-static void moveHashNodeToFront( SessionCache *session_cache )
-{
-    SFXHASH_NODE *lastNode;
-
-    lastNode = sfxhash_lru_node(session_cache->hashTable);
-    sfxhash_gmovetofront(session_cache->hashTable, lastNode);
-}
 static ThrottleInfo error_throttleInfo = {0,60,0};
 
 static int pruneSessionCache( void *sessionCache, uint32_t thetime, void *save_me_session, int memCheck )
@@ -2017,64 +1973,29 @@ static int pruneSessionCache( void *sessionCache, uint32_t thetime, void *save_m
 
     if( thetime != 0 )
     {
-        /* Pruning, look for sessions that have time'd out */
-        bool got_one;
-        scb = ( SessionControlBlock * ) sfxhash_lru( session_cache->hashTable );
-
-        if( scb == NULL )
-            return 0;
+        /* Pruning, look for sessions that have time'd out among the ones the
+         * clock finds idle.  They come in no particular age order, so look
+         * at a bounded number rather than stopping at the first live one. */
+        uint32_t examined = 0;
 
-        do
+        while( examined++ < ( 2 * session_cache->cleanup_sessions ) )
         {
-            got_one = false;
-            if( scb == save_me )
-            {
-                SFXHASH_NODE *lastNode = sfxhash_lru_node( session_cache->hashTable );
-                sfxhash_gmovetofront( session_cache->hashTable, lastNode );
-                lastNode = sfxhash_lru_node( session_cache->hashTable );
-                if( ( lastNode ) && ( lastNode->data != scb ) )
-                {
-                    scb = ( SessionControlBlock * ) lastNode->data;
-                    got_one = true;
-                    continue;
-                }
-                else
-                {
-                    session_cache->prunes += pruned;
-                    Active_Resume();
-                    return pruned;
-                }
-            }
+            scb = ( SessionControlBlock * ) sfoahash_victim( session_cache->hashTable );
 
-            if((scb->last_data_seen + session_cache->timeoutAggressive) < thetime)
-            {
-                SessionControlBlock *savscb = scb;
+            if( scb == NULL )
+                break;
 
-                if(sfxhash_count(session_cache->hashTable) > 1)
-                {
-                    DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "pruning stale session\n"););
-                    savscb->ha_state.session_flags |= SSNFLAG_TIMEDOUT;
-                    deleteSession(session_cache, savscb, "stale/timeout");
+            if( scb == save_me )
+                continue;
 
-                    scb = (SessionControlBlock *) sfxhash_lru(session_cache->hashTable);
-                    pruned++;
-                    got_one = true;
-                }
-                else
-                {
-                    savscb->ha_state.session_flags |= SSNFLAG_TIMEDOUT;
-                    deleteSession(session_cache, savscb, "stale/timeout/last scb");
-                    pruned++;
-                    session_cache->prunes += pruned;
-                    Active_Resume();
-                    return pruned;
-                }
-            }
-            else
+            if((scb->last_data_seen + session_cache->timeoutAggressive) < thetime)
             {
-                session_cache->prunes += pruned;
-                Active_Resume();
-                return pruned;
+                DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "pruning stale session\n"););
+                scb->ha_state.session_flags |= SSNFLAG_TIMEDOUT;
+                deleteSession(session_cache, scb,
+                        (sfoahash_count(session_cache->hashTable) > 1) ?
+                        "stale/timeout" : "stale/timeout/last scb");
+                pruned++;
             }
 
             if (pruned > session_cache->cleanup_sessions)
@@ -2082,11 +2003,7 @@ static int pruneSessionCache( void *sessionCache, uint32_t thetime, void *save_m
                 /* Don't bother cleaning more than 'n' at a time */
                 break;
             }
-        } while( ( scb != NULL ) && got_one );
-
-        session_cache->prunes += pruned;
-        Active_Resume();
-        return pruned;
+        }
     }
     else
     {
@@ -2094,9 +2011,10 @@ static int pruneSessionCache( void *sessionCache, uint32_t thetime, void *save_m
          * enough sessions to be able to create new ones.
          */
         uint32_t prune_stop_threshold = session_cache->max_sessions - session_cache->cleanup_sessions;
+        unsigned int skipped = 0;
+
         while( prune_more_sessions( session_cache, pruned, prune_stop_threshold, memCheck ) )
         {
-            unsigned int blocks = 0;
             DEBUG_WRAP( DebugMessage(DEBUG_STREAM,
                         "S5: Pruning session cache by %d scbs for %s: %d/%d\n",
                         session_cache->cleanup_sessions,
@@ -2104,40 +2022,22 @@ static int pruneSessionCache( void *sessionCache, uint32_t thetime, void *save_m
                         session_mem_in_use,
                         GetSessionMemCap() ););
 
-            scb = (SessionControlBlock *) sfxhash_lru(session_cache->hashTable);
+            scb = (SessionControlBlock *) sfoahash_victim(session_cache->hashTable);
 
             if( scb == NULL )
                 break;
 
-            if( scb == save_me )
+            if( scb == save_me || ( memCheck && isSessionBlocked( scb ) ) )
             {
-                moveHashNodeToFront( session_cache );
+                if( ++skipped >= sfoahash_count( session_cache->hashTable ) )
+                    break;
+
                 continue;
             }
 
-            if( memCheck )
-            {
-                if ( isSessionBlocked( scb ) )
-                {
-                    if( ++blocks >= sfxhash_count( session_cache->hashTable ) )
-                        break;
-
-                    moveHashNodeToFront( session_cache );
-                    continue;
-                }
-                else
-                {
-                    scb->ha_state.session_flags |= SSNFLAG_PRUNED;
-                    deleteSession( session_cache, scb, "memcap/check" );
-                    pruned++;
-                }
-            }
-            else
-            {
-                scb->ha_state.session_flags |= SSNFLAG_PRUNED;
-                deleteSession( session_cache, scb, "memcap/stale" );
-                pruned++;
-            }
+            scb->ha_state.session_flags |= SSNFLAG_PRUNED;
+            deleteSession( session_cache, scb, memCheck ? "memcap/check" : "memcap/stale" );
+            pruned++;
 
             if ( pruned >= session_cache->cleanup_sessions )
                 break;
@@ -2147,10 +2047,10 @@ static int pruneSessionCache( void *sessionCache, uint32_t thetime, void *save_m
     if( memCheck && pruned )
     {
 	ErrorMessageThrottled(&error_throttleInfo,"S5: Pruned %d sessions from cache for memcap. %d scbs remain. memcap: %d/%d\n",
-                    pruned, sfxhash_count( session_cache->hashTable ),
+                    pruned, sfoahash_count( session_cache->hashTable ),
                     session_mem_in_use,
                     GetSessionMemCap() );
-        DEBUG_WRAP( if( sfxhash_count(session_cache->hashTable) == 1 )
+        DEBUG_WRAP( if( sfoahash_count(session_cache->hashTable) == 1 )
                     {
                         DebugMessage(DEBUG_STREAM, "S5: Pruned, one session remains\n");
                     } );
@@ -2189,15 +2089,14 @@ static void *createSession(void *sessionCache, Packet *p, const SessionKey *key
 {
     SessionCache *session_cache = (SessionCache *) sessionCache;
     SessionControlBlock *scb = NULL;
-    SFXHASH_NODE *hnode;
     StreamFlowData *flowdata;
     time_t timestamp = p ? p->pkth->ts.tv_sec : packet_time();
 
     if( sessionCache == NULL )
         return NULL;
 
-    hnode = sfxhash_get_node(session_cache->hashTable, key);
-    if (!hnode)
+    scb = sfoahash_get(session_cache->hashTable, key);
+    if (!scb)
     {
         DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "HashTable full, clean One Way Sessions.\n"););
         if( pruneOneWaySessions( session_cache ) == 0 )
@@ -2211,31 +2110,31 @@ static void *createSession(void *sessionCache, Packet *p, const SessionKey *key
         }
 
         /* Should have some freed nodes now */
-        hnode = sfxhash_get_node(session_cache->hashTable, key);
+        scb = sfoahash_get(session_cache->hashTable, key);
 #ifdef DEBUG_MSGS
-        if (!hnode)
+        if (!scb)
             LogMessage("%s(%d) Problem, no freed nodes\n", __FILE__, __LINE__);
 #endif
     }
 
-    if (hnode && hnode->data)
+    if (scb)
     {
-        scb = hnode->data;
-
         /* Zero everything out */
         memset(scb, 0, sizeof(SessionControlBlock));
 
         /* Save the session key for future use */
-        scb->key = hnode->key;
+        scb->key = sfoahash_key(session_cache->hashTable, scb);
         scb->session_state = STREAM_STATE_NONE;
         scb->session_established = false;
         scb->protocol = key->protocol;
         scb->last_data_seen = timestamp;
+        sfoahash_schedule(session_cache->hashTable, scb, timestamp + session_cache->timeoutNominal);
         scb->flowdata = mempool_alloc(&sessionFlowMempool);
         if( scb->flowdata )
         {
             flowdata = scb->flowdata->data;
-            boInitStaticBITOP(&(flowdata->boFlowbits), getFlowbitSizeInBytes(), flowdata->flowb);
+            boInitStaticBITOP(&(flowdata->boFlowbits), getFlowbitSizeInBytes(),
+                (unsigned char *)flowdata->flowb);
         }
 
         scb->stream_config = NULL;
@@ -2354,54 +2253,23 @@ static void *allocateProtocolSession( uint32_t protocol )
 }
 
 
-static uint32_t HashFunc(SFHASHFCN *p, unsigned char *d, int n)
+/* Every field of the session key is set (unused ones to zero) so the key is
+ * hashed as six 64 bit words; the tag and the first group of the session table
+ * come from opposite ends of the result so both need to be well mixed. */
+static uint32_t HashFunc(const void *key, size_t n)
 {
-    uint32_t a,b,c;
-    uint32_t offset = 0;
-#ifdef MPLS
-    uint32_t tmp = 0;
-#endif
-#ifdef HAVE_DAQ_ADDRESS_SPACE_ID
-    uint32_t tmp2 = 0;
-#endif
-
-    a = *(uint32_t*)d;         /* IPv6 lo[0] */
-    b = *(uint32_t*)(d+4);     /* IPv6 lo[1] */
-    c = *(uint32_t*)(d+8);     /* IPv6 lo[2] */
-
-    mix(a,b,c);
-
-    a += *(uint32_t*)(d+12);   /* IPv6 lo[3] */
-    b += *(uint32_t*)(d+16);   /* IPv6 hi[0] */
-    c += *(uint32_t*)(d+20);   /* IPv6 hi[1] */
-
-    mix(a,b,c);
+    const uint64_t *d = (const uint64_t *)key;
+    uint64_t h;
 
-    a += *(uint32_t*)(d+24);   /* IPv6 hi[2] */
-    b += *(uint32_t*)(d+28);   /* IPv6 hi[3] */
-    c += *(uint32_t*)(d+32);   /* port lo & port hi */
+    h = (d[0] ^ 0x9E3779B97F4A7C15ULL) * 0xFF51AFD7ED558CCDULL;   /* IPv6 lo[0,1] */
+    h = (h ^ (h >> 32) ^ d[1]) * 0xFF51AFD7ED558CCDULL;           /* IPv6 lo[2,3] */
+    h = (h ^ (h >> 32) ^ d[2]) * 0xFF51AFD7ED558CCDULL;           /* IPv6 hi[0,1] */
+    h = (h ^ (h >> 32) ^ d[3]) * 0xFF51AFD7ED558CCDULL;           /* IPv6 hi[2,3] */
+    h = (h ^ (h >> 32) ^ d[4]) * 0xFF51AFD7ED558CCDULL;           /* ports, vlan, protocol */
+    h = (h ^ (h >> 32) ^ d[5]) * 0xC4CEB9FE1A85EC53ULL;           /* mpls label, address space */
+    h ^= h >> 33;
 
-    mix(a,b,c);
-
-    offset=36;
-    a += *(uint32_t*)(d+offset);   /* vlan, protocol, & pad */
-#ifdef MPLS
-    tmp = *(uint32_t *)(d+offset+4);
-    if( tmp )
-    {
-        b += tmp;   /* mpls label */
-    }
-    offset += 8;    /* skip past vlan/proto/ipver & mpls label */
-#else
-    offset += 4;    /* skip past vlan/proto/ipver */
-#endif
-#ifdef HAVE_DAQ_ADDRESS_SPACE_ID
-    tmp2 = *(uint32_t*)(d+offset); /* after offset that has been moved */
-    c += tmp2; /* address space id and 16bits of zero'd pad */
-#endif
-    final(a,b,c);
-
-    return c;
+    return (uint32_t)h;
 }
 
 static int HashKeyCmp(const void *s1, const void *s2, size_t n)
@@ -2522,7 +2390,6 @@ static int HashKeyCmp(const void *s1, const void *s2, size_t n)
 
 static void *initSessionCache(uint32_t session_type, uint32_t protocol_scb_size, SessionCleanup cleanup_fcn)
 {
-    int hashTableSize;
     SessionCache *sessionCache = NULL;
     uint32_t max_sessions = 0, session_timeout_min = 0, session_timeout_max = 0;
     uint32_t cleanup_sessions = 5;
@@ -2574,9 +2441,7 @@ static void *initSessionCache(uint32_t session_type, uint32_t protocol_scb_size,
     // only create a case for session controls for this protocol if tracking is enabled
     if( max_sessions > 0 )
     {
-        // set hash table size to max sessions value...adjust up to avoid collisions????
-        hashTableSize = max_sessions;
-
+        // the session table sizes its index from max sessions
         sessionCache = SnortAlloc( sizeof( SessionCache ) );
         if( sessionCache )
         {
@@ -2603,12 +2468,13 @@ static void *initSessionCache(uint32_t session_type, uint32_t protocol_scb_size,
             sessionCache->ows_list.prune_max = sessionCache->ows_list.prune_threshold * 0.25;
 
             /* Okay, now create the table */
-            sessionCache->hashTable = sfxhash_new( hashTableSize, sizeof(SessionKey), sizeof(SessionControlBlock),
-                    //maxSessionMem + tableMem, 0, NULL, NULL, 1);
-                0, 0, NULL, NULL, 1 );
+            sessionCache->hashTable = sfoahash_new( max_sessions, sizeof(SessionKey), sizeof(SessionControlBlock),
+                    HashFunc, HashKeyCmp );
 
-            sfxhash_set_max_nodes( sessionCache->hashTable, max_sessions );
-            sfxhash_set_keyops( sessionCache->hashTable, HashFunc, HashKeyCmp );
+            if( !sessionCache->hashTable ||
+                sfoahash_wheel( sessionCache->hashTable, session_timeout_max + 1 ) != SFOAHASH_OK )
+                FatalError( "%s(%d) Unable to create the session table for %u sessions.\n",
+                        __FILE__, __LINE__, max_sessions );
 
             // now alloc and initial memory for protocol specific session blocks
             if( protocol_scb_size > 0 )
@@ -2640,41 +2506,53 @@ static void *initSessionCache(uint32_t session_type, uint32_t protocol_scb_size,
 static void printSessionCache(void *sessionCache)
 {
     DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "%lu sessions active\n",
-                sfxhash_count( ( ( SessionCache * ) sessionCache )->hashTable ) ););
+                sfoahash_count( ( ( SessionCache * ) sessionCache )->hashTable ) ););
 }
 
 static void checkCacheFlowTimeout(uint32_t flowCount, time_t cur_time, SessionCache *cache)
 {
     uint32_t flowRetiredCount = 0, flowExaminedCount = 0;
     SessionControlBlock *scb;
-    SFXHASH_NODE *hnode, *hnode_prev;
 
     if( !cache )
         return;
 
-    hnode_prev = cache->nextTimeoutEvalNode;
+    /* Sessions are only on the wheel at the time they were last scheduled
+     * for; packets just move last_data_seen, so one whose bucket comes up
+     * may still be live and is scheduled again for when it really expires.
+     * Whatever the limits leave on the due list waits for the next call. */
     while( flowRetiredCount < flowCount && flowExaminedCount < ( 2 * flowCount ) )
     {
-        if( !( hnode = hnode_prev ) && !( hnode = sfxhash_lru_node( cache->hashTable ) ) )
+        time_t expires;
+
+        if( !( scb = ( SessionControlBlock * ) sfoahash_expired( cache->hashTable, cur_time ) ) )
             break;
 
-        scb = ( SessionControlBlock * ) hnode->data;
-        if( ( time_t ) ( scb->last_data_seen + cache->timeoutNominal ) > cur_time )
+        flowExaminedCount++;
+        expires = ( time_t ) ( scb->last_data_seen + cache->timeoutNominal );
+
+        if( expires > cur_time )
         {
             uint64_t time_jiffies;
             /*  Give extra 1 second delay*/
             time_jiffies = ((uint64_t)cur_time - 1) * TCP_HZ;
 
             if( !( ( scb->expire_time != 0 )  && ( cur_time != 0 ) && ( scb->expire_time <= time_jiffies ) ) )
-                break;
-        }
+            {
+                if( scb->expire_time != 0 && ( time_t ) ( scb->expire_time / TCP_HZ + 2 ) < expires )
+                    expires = ( time_t ) ( scb->expire_time / TCP_HZ + 2 );
 
-        hnode_prev = hnode->gprev;
-        flowExaminedCount++;
+                sfoahash_schedule( cache->hashTable, scb, expires );
+                continue;
+            }
+        }
 
 #ifdef ENABLE_HA
         if( scb->ha_flags & HA_FLAG_STANDBY )
+        {
+            sfoahash_schedule( cache->hashTable, scb, cur_time + 1 );
             continue;
+        }
 #endif
 
         DEBUG_WRAP(DebugMessage(DEBUG_STREAM, "retiring stale session\n"););
@@ -2682,8 +2560,6 @@ static void checkCacheFlowTimeout(uint32_t flowCount, time_t cur_time, SessionCa
         deleteSession(cache, scb, "stale/timeout");
         flowRetiredCount++;
     }
-
-    cache->nextTimeoutEvalNode = hnode_prev;
 }
 
 /*get next flow from session cache. */
@@ -73,6 +73,7 @@
 #include "sfPolicy.h"
 #include "sp_flowbits.h"
 #include "stream5_ha.h"
+#include "workers.h"
 
 #ifdef TARGET_BASED
 #include "sftarget_protocol_reference.h"
@@ -129,6 +130,7 @@ static void StreamResetStats(int, void *);
 static int StreamVerifyConfig(struct _SnortConfig *);
 static void StreamPrintSessionConfig(SessionConfiguration *);
 static void StreamPrintStats(int);
+static void StreamUpdatePruneStats(void);
 static void StreamProcess(Packet *p, void *context);
 static inline int IsEligible(Packet *p);
 #ifdef TARGET_BASED
@@ -331,6 +333,8 @@ static StreamConfig *initStreamPolicyConfig( struct _SnortConfig *sc, bool reloa
             AddFuncToPreprocResetStatsList( StreamResetStats, NULL, PP_STREAM6_PRIORITY, PP_STREAM );
             AddFuncToConfigCheckList( sc, StreamVerifyConfig );
             RegisterPreprocStats( "stream5", StreamPrintStats );
+            Workers_RegisterCounters( "stream5", &s5stats, sizeof(s5stats),
+                    sizeof(uint32_t), StreamUpdatePruneStats );
         }
         else
             old_config_freed = false;
@@ -651,8 +655,22 @@ static void StreamCleanExit(int signal, void *foo)
     stream_online_config = NULL;
 }
 
+/* The session caches count the prunes when they are used; keep them with
+ * the other counters so workers publish them. */
+static void StreamUpdatePruneStats(void)
+{
+    s5stats.tcp_prunes = StreamGetTcpPrunes();
+    s5stats.udp_prunes = StreamGetUdpPrunes();
+    s5stats.icmp_prunes = StreamGetIcmpPrunes();
+    s5stats.ip_prunes = StreamGetIpPrunes();
+}
+
 static void StreamPrintStats(int exiting)
 {
+    /* the supervisor has the sum of the workers' counters */
+    if ( !Workers_IsSupervisor() )
+        StreamUpdatePruneStats();
+
     LogMessage("Stream statistics:\n");
     LogMessage("            Total sessions: %u\n", s5stats.total_tcp_sessions +
             s5stats.total_udp_sessions +
@@ -663,18 +681,27 @@ static void StreamPrintStats(int exiting)
     LogMessage("             ICMP sessions: %u\n", s5stats.total_icmp_sessions);
     LogMessage("               IP sessions: %u\n", s5stats.total_ip_sessions);
 
-    LogMessage("                TCP Prunes: %u\n", StreamGetTcpPrunes());
-    LogMessage("                UDP Prunes: %u\n", StreamGetUdpPrunes());
-    LogMessage("               ICMP Prunes: %u\n", StreamGetIcmpPrunes());
-    LogMessage("                 IP Prunes: %u\n", StreamGetIpPrunes());
+    LogMessage("                TCP Prunes: %u\n", s5stats.tcp_prunes);
+    LogMessage("                UDP Prunes: %u\n", s5stats.udp_prunes);
+    LogMessage("               ICMP Prunes: %u\n", s5stats.icmp_prunes);
+    LogMessage("                 IP Prunes: %u\n", s5stats.ip_prunes);
     LogMessage("TCP StreamTrackers Created: %u\n", s5stats.tcp_streamtrackers_created);
     LogMessage("TCP StreamTrackers Deleted: %u\n", s5stats.tcp_streamtrackers_released);
     LogMessage("              TCP Timeouts: %u\n", s5stats.tcp_timeouts);
     LogMessage("              TCP Overlaps: %u\n", s5stats.tcp_overlaps);
     LogMessage("       TCP Segments Queued: %u\n", s5stats.tcp_streamsegs_created);
     LogMessage("     TCP Segments Released: %u\n", s5stats.tcp_streamsegs_released);
+
+    /* segment memory is per worker */
+    if ( !Workers_IsSupervisor() )
+        StreamPrintTcpSegmentStats();
+
     LogMessage("       TCP Rebuilt Packets: %u\n", s5stats.tcp_rebuilt_packets);
     LogMessage("         TCP Segments Used: %u\n", s5stats.tcp_rebuilt_seqs_used);
+    LogMessage("   TCP Single Seg Rebuilds: %u\n", s5stats.tcp_in_place_flushes);
+    LogMessage("         TCP Span Rebuilds: %u\n", s5stats.tcp_span_flushes);
+    LogMessage("          TCP Span Gathers: %u\n", s5stats.tcp_span_gathers);
+    LogMessage("       TCP Copied Rebuilds: %u\n", s5stats.tcp_copied_flushes);
     LogMessage("              TCP Discards: %u\n", s5stats.tcp_discards);
     LogMessage("                  TCP Gaps: %u\n", s5stats.tcp_gaps);
     LogMessage("      UDP Sessions Created: %u\n", s5stats.udp_sessions_created);
@@ -694,7 +721,8 @@ static void StreamPrintStats(int exiting)
 
     // TBD-EDM move to session will need to fix reg tests?
 #ifdef ENABLE_HA
-    SessionPrintHAStats();
+    if ( !Workers_IsSupervisor() )
+        SessionPrintHAStats();
 #endif
 
 }
@@ -24,6 +24,7 @@
 **
 */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +34,13 @@
 #include "config.h"
 #endif
 
+#if defined(PERF_PROFILING) && defined(LINUX)
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 #include "snort.h"
 #include "rules.h"
 #include "treenodes.h"
@@ -47,6 +55,7 @@
 #include "sf_types.h"
 #include "sf_textlog.h"
 #include "detection_options.h"
+#include "sp_pcre.h"
 
 #ifdef PERF_PROFILING
 
@@ -97,6 +106,417 @@ void getTicksPerMicrosec(void)
     }
 }
 
+/* Hardware counters **********************************************************/
+int perf_counters_active = 0;
+
+#ifdef LINUX
+static const struct
+{
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+
+} perf_events[PERF_COUNTER_MAX] =
+{
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "LLC misses" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch misses" }
+};
+
+static int perf_fd[PERF_COUNTER_MAX] = { -1, -1, -1, -1 };
+static struct perf_event_mmap_page *perf_page[PERF_COUNTER_MAX];
+static size_t perf_page_size = 0;
+
+static void PerfCountersTerm(void)
+{
+    int i;
+
+    perf_counters_active = 0;
+
+    for (i = 0; i < PERF_COUNTER_MAX; i++)
+    {
+        if (perf_page[i] != NULL)
+            munmap(perf_page[i], perf_page_size);
+        perf_page[i] = NULL;
+
+        if (perf_fd[i] >= 0)
+            close(perf_fd[i]);
+        perf_fd[i] = -1;
+    }
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static inline uint64_t rdpmc(uint32_t counter)
+{
+    uint32_t low, high;
+    __asm__ __volatile__ ("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+    return low | ((uint64_t)high << 32);
+}
+
+/* Reads the counter from user space as described in linux/perf_event.h.
+ * Fails if the kernel does not allow it or the event is not on the PMU
+ * right now. */
+static inline int PerfCounterReadUser(struct perf_event_mmap_page *pc, uint64_t *val)
+{
+    uint32_t seq, idx, width;
+    uint64_t count;
+    int64_t pmc;
+
+    do
+    {
+        seq = pc->lock;
+        __asm__ __volatile__ ("" ::: "memory");
+
+        idx = pc->index;
+        if (!pc->cap_user_rdpmc || !idx)
+            return -1;
+
+        count = pc->offset;
+        width = pc->pmc_width;
+        pmc = rdpmc(idx - 1);
+        pmc <<= 64 - width;
+        pmc >>= 64 - width;
+        count += pmc;
+
+        __asm__ __volatile__ ("" ::: "memory");
+
+    } while (pc->lock != seq);
+
+    *val = count;
+    return 0;
+}
+#endif
+#endif
+
+void PerfCountersRead(PerfCounters *pc)
+{
+#ifdef LINUX
+    struct
+    {
+        uint64_t nr;
+        uint64_t values[PERF_COUNTER_MAX];
+    } group;
+    int i;
+
+#if defined(__i386__) || defined(__x86_64__)
+    for (i = 0; i < PERF_COUNTER_MAX; i++)
+    {
+        if (!perf_page[i] || PerfCounterReadUser(perf_page[i], &pc->v[i]))
+            break;
+    }
+    if (i == PERF_COUNTER_MAX)
+        return;
+#endif
+
+    /* the syscall returns the same running totals */
+    if ((read(perf_fd[0], &group, sizeof(group)) != sizeof(group)) ||
+        (group.nr != PERF_COUNTER_MAX))
+    {
+        memset(pc, 0, sizeof(*pc));
+        return;
+    }
+
+    for (i = 0; i < PERF_COUNTER_MAX; i++)
+        pc->v[i] = group.values[i];
+#else
+    memset(pc, 0, sizeof(*pc));
+#endif
+}
+
+void PerfCountersInit(void)
+{
+    SnortConfig *sc = snort_conf;
+#ifdef LINUX
+    struct perf_event_attr attr;
+    int user_read = 1;
+    int i;
+#endif
+
+    if ((sc == NULL) || perf_counters_active ||
+        (!sc->profile_rules.counters && !sc->profile_preprocs.counters))
+        return;
+
+#ifdef LINUX
+    perf_page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    /* one group so all four are scheduled on the PMU together */
+    for (i = 0; i < PERF_COUNTER_MAX; i++)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.disabled = (i == 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        perf_fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1,
+            (i == 0) ? -1 : perf_fd[0], 0);
+
+        if (perf_fd[i] < 0)
+        {
+            ErrorMessage("profiler: unable to open the %s counter (%s), "
+                "profiling without hardware counters.\n",
+                perf_events[i].name, strerror(errno));
+            PerfCountersTerm();
+            return;
+        }
+
+        perf_page[i] = mmap(NULL, perf_page_size, PROT_READ, MAP_SHARED,
+            perf_fd[i], 0);
+
+        if (perf_page[i] == MAP_FAILED)
+            perf_page[i] = NULL;
+
+        if ((perf_page[i] == NULL) || !perf_page[i]->cap_user_rdpmc)
+            user_read = 0;
+    }
+
+    ioctl(perf_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    perf_counters_active = 1;
+
+#if !defined(__i386__) && !defined(__x86_64__)
+    user_read = 0;
+#endif
+    LogMessage("profiler: hardware counters enabled (%s)\n",
+        user_read ? "rdpmc" : "read");
+#else
+    ErrorMessage("profiler: hardware counters are only supported on Linux, "
+        "profiling without them.\n");
+#endif
+}
+
+/* Table columns for the counters, empty unless they were collected. */
+typedef struct _CounterColumns
+{
+    int width[3];
+    char text[3][24];
+
+} CounterColumns;
+
+#define COUNTER_COLUMNS(c) \
+    (c).width[0], (c).text[0], (c).width[1], (c).text[1], (c).width[2], (c).text[2]
+
+static void CounterColumnsSet(CounterColumns *c, int on,
+    const char *ipc, const char *llc, const char *br)
+{
+    memset(c, 0, sizeof(*c));
+
+    if (!on)
+        return;
+
+    c->width[0] = 7;
+    c->width[1] = 11;
+    c->width[2] = 14;
+    SnortSnprintf(c->text[0], sizeof(c->text[0]), "%s", ipc);
+    SnortSnprintf(c->text[1], sizeof(c->text[1]), "%s", llc);
+    SnortSnprintf(c->text[2], sizeof(c->text[2]), "%s", br);
+}
+
+static double CounterIpc(const PerfCounters *hw)
+{
+    if (hw->v[PERF_COUNTER_CYCLES] == 0)
+        return 0.0;
+
+    return (double)hw->v[PERF_COUNTER_INSTRUCTIONS] /
+        (double)hw->v[PERF_COUNTER_CYCLES];
+}
+
+static double CounterPerCheck(const PerfCounters *hw, int counter, uint64_t checks)
+{
+    if (checks == 0)
+        return 0.0;
+
+    return (double)hw->v[counter] / (double)checks;
+}
+
+static void CounterColumnsValues(CounterColumns *c, int on,
+    const PerfCounters *hw, uint64_t checks)
+{
+    char ipc[24], llc[24], br[24];
+
+    if (!on)
+    {
+        CounterColumnsSet(c, 0, NULL, NULL, NULL);
+        return;
+    }
+
+    SnortSnprintf(ipc, sizeof(ipc), "%.2f", CounterIpc(hw));
+    SnortSnprintf(llc, sizeof(llc), "%.2f",
+        CounterPerCheck(hw, PERF_COUNTER_LLC_MISSES, checks));
+    SnortSnprintf(br, sizeof(br), "%.2f",
+        CounterPerCheck(hw, PERF_COUNTER_BRANCH_MISSES, checks));
+    CounterColumnsSet(c, 1, ipc, llc, br);
+}
+
+/* Machine readable dumps *****************************************************/
+static FILE *OpenProfileDump(const char *name, time_t cur_time)
+{
+    char fullname[STD_BUF];
+    FILE *fp;
+
+    if (SnortSnprintf(fullname, STD_BUF, "%s.%u", name, (uint32_t)cur_time)
+            != SNORT_SNPRINTF_SUCCESS)
+        FatalError("profiler: file path+name too long\n");
+
+    fp = fopen(fullname, "w");
+
+    if (fp == NULL)
+        ErrorMessage("profiler: unable to open %s: %s\n", fullname, strerror(errno));
+
+    return fp;
+}
+
+static void DumpCounters(FILE *fp, int format, const PerfCounters *hw, uint64_t checks)
+{
+    if (format == PROFILE_DUMP_CSV)
+    {
+        fprintf(fp, "," STDu64 "," STDu64 "," STDu64 "," STDu64 ",%.4f,%.4f,%.4f\n",
+            hw->v[PERF_COUNTER_CYCLES], hw->v[PERF_COUNTER_INSTRUCTIONS],
+            hw->v[PERF_COUNTER_LLC_MISSES], hw->v[PERF_COUNTER_BRANCH_MISSES],
+            CounterIpc(hw),
+            CounterPerCheck(hw, PERF_COUNTER_LLC_MISSES, checks),
+            CounterPerCheck(hw, PERF_COUNTER_BRANCH_MISSES, checks));
+    }
+    else
+    {
+        fprintf(fp, ", \"cycles\": " STDu64 ", \"instructions\": " STDu64
+            ", \"llc_misses\": " STDu64 ", \"branch_misses\": " STDu64
+            ", \"ipc\": %.4f, \"llc_misses_per_check\": %.4f"
+            ", \"branch_misses_per_check\": %.4f }",
+            hw->v[PERF_COUNTER_CYCLES], hw->v[PERF_COUNTER_INSTRUCTIONS],
+            hw->v[PERF_COUNTER_LLC_MISSES], hw->v[PERF_COUNTER_BRANCH_MISSES],
+            CounterIpc(hw),
+            CounterPerCheck(hw, PERF_COUNTER_LLC_MISSES, checks),
+            CounterPerCheck(hw, PERF_COUNTER_BRANCH_MISSES, checks));
+    }
+}
+
+/* Writes every profiled rule, in sort order. */
+static void DumpRuleProfiles(SnortConfig *sc)
+{
+    OTN_WorstPerformer *node;
+    OptTreeNode *otn;
+    int format = sc->profile_rules.dump_format;
+    FILE *fp = OpenProfileDump(sc->profile_rules.dump_file, time(NULL));
+
+    if (fp == NULL)
+        return;
+
+    getTicksPerMicrosec();
+
+    if (format == PROFILE_DUMP_CSV)
+        fprintf(fp, "gid,sid,rev,checks,matches,alerts,microsecs,avg_check,"
+            "avg_match,avg_nomatch,cycles,instructions,llc_misses,"
+            "branch_misses,ipc,llc_misses_per_check,branch_misses_per_check\n");
+    else
+        fprintf(fp, "{ \"rules\": [");
+
+    for (node = worstPerformers; node; node = node->next)
+    {
+        otn = node->otn;
+
+        if (format == PROFILE_DUMP_CSV)
+        {
+            fprintf(fp, "%u,%u,%u," STDu64 "," STDu64 "," STDu64 "," STDu64 ",%.2f,%.2f,%.2f",
+                otn->sigInfo.generator, otn->sigInfo.id, otn->sigInfo.rev,
+                otn->checks, otn->matches, otn->alerts,
+                (uint64_t)(otn->ticks/ticks_per_microsec),
+                node->ticks_per_check/ticks_per_microsec,
+                node->ticks_per_match/ticks_per_microsec,
+                node->ticks_per_nomatch/ticks_per_microsec);
+        }
+        else
+        {
+            fprintf(fp, "%s\n  { \"gid\": %u, \"sid\": %u, \"rev\": %u"
+                ", \"checks\": " STDu64 ", \"matches\": " STDu64
+                ", \"alerts\": " STDu64 ", \"microsecs\": " STDu64
+                ", \"avg_check\": %.2f, \"avg_match\": %.2f, \"avg_nomatch\": %.2f",
+                (node == worstPerformers) ? "" : ",",
+                otn->sigInfo.generator, otn->sigInfo.id, otn->sigInfo.rev,
+                otn->checks, otn->matches, otn->alerts,
+                (uint64_t)(otn->ticks/ticks_per_microsec),
+                node->ticks_per_check/ticks_per_microsec,
+                node->ticks_per_match/ticks_per_microsec,
+                node->ticks_per_nomatch/ticks_per_microsec);
+        }
+        DumpCounters(fp, format, &otn->hw, otn->checks);
+    }
+
+    if (format != PROFILE_DUMP_CSV)
+        fprintf(fp, "\n] }\n");
+
+    fclose(fp);
+}
+
+/* Writes every preprocessor that ran, with the name of its caller. */
+static void DumpPreprocProfiles(SnortConfig *sc)
+{
+    PreprocStatsNode *idx, *parent;
+    const char *parent_name;
+    int format = sc->profile_preprocs.dump_format;
+    int first = 1;
+    FILE *fp = OpenProfileDump(sc->profile_preprocs.dump_file, time(NULL));
+
+    if (fp == NULL)
+        return;
+
+    getTicksPerMicrosec();
+
+    if (format == PROFILE_DUMP_CSV)
+        fprintf(fp, "preprocessor,layer,caller,checks,exits,microsecs,avg_check,"
+            "cycles,instructions,llc_misses,branch_misses,ipc,"
+            "llc_misses_per_check,branch_misses_per_check\n");
+    else
+        fprintf(fp, "{ \"preprocessors\": [");
+
+    for (idx = PreprocStatsNodeList; idx; idx = idx->next)
+    {
+        if (idx->stats->checks == 0 || idx->stats->ticks == 0)
+            continue;
+
+        parent_name = "";
+        for (parent = PreprocStatsNodeList; idx->parent && parent; parent = parent->next)
+        {
+            if (parent->stats == idx->parent)
+            {
+                parent_name = parent->name;
+                break;
+            }
+        }
+
+        if (format == PROFILE_DUMP_CSV)
+        {
+            fprintf(fp, "%s,%d,%s," STDu64 "," STDu64 "," STDu64 ",%.2f",
+                idx->name, idx->layer, parent_name,
+                idx->stats->checks, idx->stats->exits,
+                (uint64_t)(idx->stats->ticks/ticks_per_microsec),
+                (double)idx->stats->ticks/idx->stats->checks/ticks_per_microsec);
+        }
+        else
+        {
+            fprintf(fp, "%s\n  { \"preprocessor\": \"%s\", \"layer\": %d"
+                ", \"caller\": \"%s\", \"checks\": " STDu64 ", \"exits\": " STDu64
+                ", \"microsecs\": " STDu64 ", \"avg_check\": %.2f",
+                first ? "" : ",", idx->name, idx->layer, parent_name,
+                idx->stats->checks, idx->stats->exits,
+                (uint64_t)(idx->stats->ticks/ticks_per_microsec),
+                (double)idx->stats->ticks/idx->stats->checks/ticks_per_microsec);
+        }
+        DumpCounters(fp, format, &idx->stats->hw, idx->stats->checks);
+        first = 0;
+    }
+
+    if (format != PROFILE_DUMP_CSV)
+        fprintf(fp, "\n] }\n");
+
+    fclose(fp);
+}
+
 void ResetRuleProfiling(void)
 {
     /* Cycle through all Rules, print ticks & check count for each */
@@ -133,6 +553,7 @@ void ResetRuleProfiling(void)
                 otn->matches = 0;
                 otn->alerts = 0;
                 otn->noalerts = 0;
+                memset(&otn->hw, 0, sizeof(otn->hw));
 #ifdef PPM_MGR
                 otn->ppm_disable_cnt = 0;
 #endif
@@ -150,6 +571,7 @@ void PrintWorstRules(int numToPrint)
     time_t cur_time;
     char fullname[STD_BUF];
     int ret;
+    CounterColumns cols;
     SnortConfig *sc = snort_conf;
 
     if (sc == NULL)
@@ -215,13 +637,16 @@ void PrintWorstRules(int numToPrint)
         return;
     }
 
+    CounterColumnsSet(&cols, ScProfileRuleCounters(),
+        "IPC", "LLC/Check", "BrMiss/Check");
+
     if(log)
     {
         TextLog_Print(log,
 #ifdef PPM_MGR
-            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
 #else
-            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
 #endif
              6, "Num",
              9, "SID", 4, "GID", 4, "Rev",
@@ -235,15 +660,17 @@ void PrintWorstRules(int numToPrint)
 #ifdef PPM_MGR
             , 11, "Disabled"
 #endif
+            , 9, "PCRE JIT"
+            , COUNTER_COLUMNS(cols)
             );
     }
     else
     {
         LogMessage(
 #ifdef PPM_MGR
-            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
 #else
-            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
 #endif
              6, "Num",
              9, "SID", 4, "GID", 4, "Rev",
@@ -257,16 +684,21 @@ void PrintWorstRules(int numToPrint)
 #ifdef PPM_MGR
             , 11, "Disabled"
 #endif
+            , 9, "PCRE JIT"
+            , COUNTER_COLUMNS(cols)
             );
     }
 
+    CounterColumnsSet(&cols, ScProfileRuleCounters(),
+        "===", "=========", "============");
+
     if(log)
     {
         TextLog_Print(log,
 #ifdef PPM_MGR
-            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
 #else
-            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
 #endif
             6, "===",
             9, "===", 4, "===", 4, "===",
@@ -280,15 +712,17 @@ void PrintWorstRules(int numToPrint)
 #ifdef PPM_MGR
             , 11, "========"
 #endif
+            , 9, "========"
+            , COUNTER_COLUMNS(cols)
             );
     }
     else
     {
         LogMessage(
 #ifdef PPM_MGR
-            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
 #else
-            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+            "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
 #endif
             6, "===",
             9, "===", 4, "===", 4, "===",
@@ -302,6 +736,8 @@ void PrintWorstRules(int numToPrint)
 #ifdef PPM_MGR
             , 11, "========"
 #endif
+            , 9, "========"
+            , COUNTER_COLUMNS(cols)
             );
     }
 
@@ -312,14 +748,15 @@ void PrintWorstRules(int numToPrint)
         //if (!node)
         //    break;
         otn = node->otn;
+        CounterColumnsValues(&cols, ScProfileRuleCounters(), &otn->hw, otn->checks);
 
         if(log)
         {
             TextLog_Print(log,
 #ifdef PPM_MGR
-                "%*d%*d%*d%*d" FMTu64("*") FMTu64("*") FMTu64("*") FMTu64("*") "%*.1f%*.1f%*.1f" FMTu64("*") "\n",
+                "%*d%*d%*d%*d" FMTu64("*") FMTu64("*") FMTu64("*") FMTu64("*") "%*.1f%*.1f%*.1f" FMTu64("*") "%*s%*s%*s%*s\n",
 #else
-                "%*d%*d%*d%*d" FMTu64("*") FMTu64("*") FMTu64("*") FMTu64("*") "%*.1f%*.1f%*.1f" "\n",
+                "%*d%*d%*d%*d" FMTu64("*") FMTu64("*") FMTu64("*") FMTu64("*") "%*.1f%*.1f%*.1f" "%*s%*s%*s%*s\n",
 #endif
                 6, num, 9, otn->sigInfo.id, 4, otn->sigInfo.generator, 4, otn->sigInfo.rev,
                 11, otn->checks,
@@ -332,15 +769,17 @@ void PrintWorstRules(int numToPrint)
 #ifdef PPM_MGR
                 , 11, otn->ppm_disable_cnt
 #endif
+                , 9, PcreJitStatus(otn)
+                , COUNTER_COLUMNS(cols)
                 );
         }
         else
         {
             LogMessage(
 #ifdef PPM_MGR
-                "%*d%*d%*d%*d" FMTu64("*") FMTu64("*") FMTu64("*") FMTu64("*") "%*.1f%*.1f%*.1f" FMTu64("*") "\n",
+                "%*d%*d%*d%*d" FMTu64("*") FMTu64("*") FMTu64("*") FMTu64("*") "%*.1f%*.1f%*.1f" FMTu64("*") "%*s%*s%*s%*s\n",
 #else
-                "%*d%*d%*d%*d" FMTu64("*") FMTu64("*") FMTu64("*") FMTu64("*") "%*.1f%*.1f%*.1f" "\n",
+                "%*d%*d%*d%*d" FMTu64("*") FMTu64("*") FMTu64("*") FMTu64("*") "%*.1f%*.1f%*.1f" "%*s%*s%*s%*s\n",
 #endif
                 6, num, 9, otn->sigInfo.id, 4, otn->sigInfo.generator, 4, otn->sigInfo.rev,
                 11, otn->checks,
@@ -353,6 +792,8 @@ void PrintWorstRules(int numToPrint)
 #ifdef PPM_MGR
                 , 11, otn->ppm_disable_cnt
 #endif
+                , 9, PcreJitStatus(otn)
+                , COUNTER_COLUMNS(cols)
                 );
         }
     }
@@ -513,6 +954,9 @@ void ShowRuleProfiles(void)
 
     CollectRTNProfile();
 
+    if (sc->profile_rules.dump_file != NULL)
+        DumpRuleProfiles(sc);
+
     /* Specifically call out a top xxx or something? */
     PrintWorstRules(sc->profile_rules.num);
     return;
@@ -586,15 +1030,19 @@ void PrintPreprocPerformance(TextLog *log, int num, Preproc_WorstPerformer *idx)
 {
     Preproc_WorstPerformer *child;
     int i;
+    CounterColumns cols;
     /* indent 'Num' based on the layer */
     unsigned int indent = 6 - (5 - idx->node->layer);
 
+    CounterColumnsValues(&cols, ScProfilePreprocCounters(),
+        &idx->node->stats->hw, idx->node->stats->checks);
+
     if (num != 0)
     {
         indent += 2;
         if(log)
         {
-            TextLog_Print(log, "%*d%*s%*d" FMTu64("*") FMTu64("*") FMTu64("*") "%*.2f%*.2f%*.2f\n",
+            TextLog_Print(log, "%*d%*s%*d" FMTu64("*") FMTu64("*") FMTu64("*") "%*.2f%*.2f%*.2f%*s%*s%*s\n",
                    indent, num,
                    28 - indent, idx->node->name, 6, idx->node->layer,
                    11, idx->node->stats->checks,
@@ -602,11 +1050,12 @@ void PrintPreprocPerformance(TextLog *log, int num, Preproc_WorstPerformer *idx)
                    20, (uint64_t)(idx->node->stats->ticks/ticks_per_microsec),
                    11, idx->ticks_per_check/ticks_per_microsec,
                    14, idx->pct_of_parent,
-                   13, idx->pct_of_total);
+                   13, idx->pct_of_total,
+                   COUNTER_COLUMNS(cols));
         }
         else
         {
-            LogMessage("%*d%*s%*d" FMTu64("*") FMTu64("*") FMTu64("*") "%*.2f%*.2f%*.2f\n",
+            LogMessage("%*d%*s%*d" FMTu64("*") FMTu64("*") FMTu64("*") "%*.2f%*.2f%*.2f%*s%*s%*s\n",
         	                   indent, num,
         	                   28 - indent, idx->node->name, 6, idx->node->layer,
         	                   11, idx->node->stats->checks,
@@ -614,7 +1063,8 @@ void PrintPreprocPerformance(TextLog *log, int num, Preproc_WorstPerformer *idx)
         	                   20, (uint64_t)(idx->node->stats->ticks/ticks_per_microsec),
         	                   11, idx->ticks_per_check/ticks_per_microsec,
         	                   14, idx->pct_of_parent,
-        	                   13, idx->pct_of_total);
+        	                   13, idx->pct_of_total,
+        	                   COUNTER_COLUMNS(cols));
         }
     }
     else
@@ -624,7 +1074,7 @@ void PrintPreprocPerformance(TextLog *log, int num, Preproc_WorstPerformer *idx)
 
         if(log)
         {
-            TextLog_Print(log, "%*s%*s%*d" FMTu64("*") FMTu64("*") FMTu64("*") "%*.2f%*.2f%*.2f\n",
+            TextLog_Print(log, "%*s%*s%*d" FMTu64("*") FMTu64("*") FMTu64("*") "%*.2f%*.2f%*.2f%*s%*s%*s\n",
                    indent, idx->node->name,
                    28 - indent, idx->node->name, 6, idx->node->layer,
                    11, idx->node->stats->checks,
@@ -632,11 +1082,12 @@ void PrintPreprocPerformance(TextLog *log, int num, Preproc_WorstPerformer *idx)
                    20, (uint64_t)(idx->node->stats->ticks/ticks_per_microsec),
                    11, idx->ticks_per_check/ticks_per_microsec,
                    14, idx->pct_of_parent,
-                   13, idx->pct_of_parent);
+                   13, idx->pct_of_parent,
+                   COUNTER_COLUMNS(cols));
         }
         else
         {
-            LogMessage("%*s%*s%*d" FMTu64("*") FMTu64("*") FMTu64("*") "%*.2f%*.2f%*.2f\n",
+            LogMessage("%*s%*s%*d" FMTu64("*") FMTu64("*") FMTu64("*") "%*.2f%*.2f%*.2f%*s%*s%*s\n",
         	                   indent, idx->node->name,
         	                   28 - indent, idx->node->name, 6, idx->node->layer,
         	                   11, idx->node->stats->checks,
@@ -644,7 +1095,8 @@ void PrintPreprocPerformance(TextLog *log, int num, Preproc_WorstPerformer *idx)
         	                   20, (uint64_t)(idx->node->stats->ticks/ticks_per_microsec),
         	                   11, idx->ticks_per_check/ticks_per_microsec,
         	                   14, idx->pct_of_parent,
-        	                   13, idx->pct_of_parent);
+        	                   13, idx->pct_of_parent,
+        	                   COUNTER_COLUMNS(cols));
         }
     }
 
@@ -700,6 +1152,7 @@ void PrintWorstPreprocs(int numToPrint)
     time_t cur_time;
     char fullname[STD_BUF];
     int ret;
+    CounterColumns cols;
     SnortConfig *sc = snort_conf;
 
     getTicksPerMicrosec();
@@ -771,9 +1224,12 @@ void PrintWorstPreprocs(int numToPrint)
         return;
     }
 
+    CounterColumnsSet(&cols, ScProfilePreprocCounters(),
+        "IPC", "LLC/Check", "BrMiss/Check");
+
     if(log)
     {
-        TextLog_Print(log, "%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+        TextLog_Print(log, "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
             4, "Num",
             24, "Preprocessor",
             6, "Layer",
@@ -782,11 +1238,12 @@ void PrintWorstPreprocs(int numToPrint)
             20, "Microsecs",
             11, "Avg/Check",
             14, "Pct of Caller",
-            13, "Pct of Total");
+            13, "Pct of Total",
+            COUNTER_COLUMNS(cols));
     }
     else
     {
-        LogMessage("%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+        LogMessage("%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
     	            4, "Num",
     	            24, "Preprocessor",
     	            6, "Layer",
@@ -795,12 +1252,16 @@ void PrintWorstPreprocs(int numToPrint)
     	            20, "Microsecs",
     	            11, "Avg/Check",
     	            14, "Pct of Caller",
-    	            13, "Pct of Total");
+    	            13, "Pct of Total",
+    	            COUNTER_COLUMNS(cols));
     }
 
+    CounterColumnsSet(&cols, ScProfilePreprocCounters(),
+        "===", "=========", "============");
+
     if(log)
     {
-        TextLog_Print(log, "%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+        TextLog_Print(log, "%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
             4, "===",
             24, "============",
             6, "=====",
@@ -809,11 +1270,12 @@ void PrintWorstPreprocs(int numToPrint)
             20, "=========",
             11, "=========",
             14, "=============",
-            13, "============");
+            13, "============",
+            COUNTER_COLUMNS(cols));
     }
     else
     {
-        LogMessage("%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
+        LogMessage("%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s%*s\n",
     	            4, "===",
     	            24, "============",
     	            6, "=====",
@@ -822,7 +1284,8 @@ void PrintWorstPreprocs(int numToPrint)
     	            20, "=========",
     	            11, "=========",
     	            14, "=============",
-    	            13, "============");
+    	            13, "============",
+    	            COUNTER_COLUMNS(cols));
     }
 
     for (idx = worstPreprocPerformers, num=1;
@@ -902,6 +1365,7 @@ void ResetPreprocProfiling(void)
         idx->stats->ticks_start = 0;
         idx->stats->checks = 0;
         idx->stats->exits = 0;
+        memset(&idx->stats->hw, 0, sizeof(idx->stats->hw));
     }
 }
 
@@ -924,6 +1388,12 @@ void ShowPreprocProfiles(void)
     /* And adjust the rules to include the NC rules */
     rulePerfStats.ticks += ncrulePerfStats.ticks;
 
+    PerfCountersSub(&mpsePerfStats.hw, &rulePerfStats.hw);
+    PerfCountersAdd(&rulePerfStats.hw, &ncrulePerfStats.hw);
+
+    if (sc->profile_preprocs.dump_file != NULL)
+        DumpPreprocProfiles(sc);
+
     for (layer=0;layer<=max_layers;layer++)
     {
 
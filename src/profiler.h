@@ -37,6 +37,53 @@
 #define PROFILE_SORT_AVG_TICKS_PER_NOMATCH 6
 #define PROFILE_SORT_TOTAL_TICKS 7
 
+/* Machine readable dump formats */
+#define PROFILE_DUMP_JSON 1
+#define PROFILE_DUMP_CSV 2
+
+/* Hardware event counts kept next to the tick counts when the profile
+ * configs ask for counters.  The events are opened with perf_event_open()
+ * by PerfCountersInit() in the packet processing thread and read in user
+ * space (rdpmc) where the kernel allows it. */
+enum
+{
+    PERF_COUNTER_CYCLES,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_LLC_MISSES,
+    PERF_COUNTER_BRANCH_MISSES,
+    PERF_COUNTER_MAX
+};
+
+typedef struct _PerfCounters
+{
+    uint64_t v[PERF_COUNTER_MAX];
+} PerfCounters;
+
+static inline void PerfCountersAccum(PerfCounters *sum,
+    const PerfCounters *start, const PerfCounters *end)
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTER_MAX; i++)
+        sum->v[i] += end->v[i] - start->v[i];
+}
+
+static inline void PerfCountersAdd(PerfCounters *sum, const PerfCounters *add)
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTER_MAX; i++)
+        sum->v[i] += add->v[i];
+}
+
+static inline void PerfCountersSub(PerfCounters *sum, const PerfCounters *sub)
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTER_MAX; i++)
+        sum->v[i] -= sub->v[i];
+}
+
 /* MACROS that handle profiling of rules and preprocessors */
 #define PROFILE_VARS_NAMED(name) uint64_t name##_ticks_start, name##_ticks_end
 #define PROFILE_VARS PROFILE_VARS_NAMED(snort)
@@ -55,17 +102,41 @@
 #define PROFILING_RULES ScProfileRules()
 #endif
 
-#define NODE_PROFILE_VARS uint64_t node_ticks_start, node_ticks_end, node_ticks_delta, node_deltas = 0
+#ifndef PROFILING_RULE_COUNTERS
+#define PROFILING_RULE_COUNTERS ScProfileRuleCounters()
+#endif
+
+#ifndef PERF_COUNTERS_READ
+#define PERF_COUNTERS_READ(pc) PerfCountersRead(pc)
+#endif
+
+/* Counters are added to the node at every (tmp)end rather than carried in
+ * a delta like the ticks; the sums come out the same. */
+#define NODE_COUNTERS_START \
+    if (PROFILING_RULE_COUNTERS) \
+        PERF_COUNTERS_READ(&node_hw_start)
+
+#define NODE_COUNTERS_END(node) \
+    if (PROFILING_RULE_COUNTERS) { \
+        PerfCounters node_hw_end; \
+        PERF_COUNTERS_READ(&node_hw_end); \
+        PerfCountersAccum(&node->hw, &node_hw_start, &node_hw_end); \
+    }
+
+#define NODE_PROFILE_VARS uint64_t node_ticks_start, node_ticks_end, node_ticks_delta, node_deltas = 0; \
+    PerfCounters node_hw_start
 
 #define NODE_PROFILE_START(node) \
     if (PROFILING_RULES) { \
         node->checks++; \
+        NODE_COUNTERS_START; \
         PROFILE_START_NAMED(node); \
     }
 
 #define NODE_PROFILE_END_MATCH(node) \
     if (PROFILING_RULES) { \
         NODE_PROFILE_END; \
+        NODE_COUNTERS_END(node); \
         node->ticks += node_ticks_delta + node_deltas; \
         node->ticks_match += node_ticks_delta + node_deltas; \
     }
@@ -73,18 +144,21 @@
 #define NODE_PROFILE_END_NOMATCH(node) \
     if (PROFILING_RULES) { \
         NODE_PROFILE_END; \
+        NODE_COUNTERS_END(node); \
         node->ticks += node_ticks_delta + node_deltas; \
         node->ticks_no_match += node_ticks_delta + node_deltas; \
     }
 
 #define NODE_PROFILE_TMPSTART(node) \
     if (PROFILING_RULES) { \
+        NODE_COUNTERS_START; \
         PROFILE_START_NAMED(node); \
     }
 
 #define NODE_PROFILE_TMPEND(node) \
     if (PROFILING_RULES) { \
         NODE_PROFILE_END; \
+        NODE_COUNTERS_END(node); \
         node_deltas += node_ticks_delta; \
     }
 
@@ -94,9 +168,25 @@
 #define PROFILING_PREPROCS ScProfilePreprocs()
 #endif
 
+#ifndef PROFILING_PREPROC_COUNTERS
+#define PROFILING_PREPROC_COUNTERS ScProfilePreprocCounters()
+#endif
+
+#define PREPROC_COUNTERS_START(ppstat) \
+    if (PROFILING_PREPROC_COUNTERS) \
+        PERF_COUNTERS_READ(&ppstat.hw_start)
+
+#define PREPROC_COUNTERS_END(ppstat) \
+    if (PROFILING_PREPROC_COUNTERS) { \
+        PerfCounters pp_hw_end; \
+        PERF_COUNTERS_READ(&pp_hw_end); \
+        PerfCountersAccum(&ppstat.hw, &ppstat.hw_start, &pp_hw_end); \
+    }
+
 #define PREPROC_PROFILE_START_NAMED(name, ppstat) \
     if (PROFILING_PREPROCS) { \
         ppstat.checks++; \
+        PREPROC_COUNTERS_START(ppstat); \
         PROFILE_START_NAMED(name); \
         ppstat.ticks_start = name##_ticks_start; \
     }
@@ -105,6 +195,7 @@
 #define PREPROC_PROFILE_START_NAMED_PI(name, ppstat) \
     { \
         ppstat.checks++; \
+        PREPROC_COUNTERS_START(ppstat); \
         PROFILE_START_NAMED(name); \
         ppstat.ticks_start = name##_ticks_start; \
     }
@@ -112,6 +203,7 @@
 
 #define PREPROC_PROFILE_REENTER_START_NAMED(name, ppstat) \
     if (PROFILING_PREPROCS) { \
+        PREPROC_COUNTERS_START(ppstat); \
         PROFILE_START_NAMED(name); \
         ppstat.ticks_start = name##_ticks_start; \
     }
@@ -119,6 +211,7 @@
 
 #define PREPROC_PROFILE_TMPSTART_NAMED(name, ppstat) \
     if (PROFILING_PREPROCS) { \
+        PREPROC_COUNTERS_START(ppstat); \
         PROFILE_START_NAMED(name); \
         ppstat.ticks_start = name##_ticks_start; \
     }
@@ -127,6 +220,7 @@
 #define PREPROC_PROFILE_END_NAMED(name, ppstat) \
     if (PROFILING_PREPROCS) { \
         PROFILE_END_NAMED(name); \
+        PREPROC_COUNTERS_END(ppstat); \
         ppstat.exits++; \
         ppstat.ticks += name##_ticks_end - ppstat.ticks_start; \
     }
@@ -135,6 +229,7 @@
 #define PREPROC_PROFILE_END_NAMED_PI(name, ppstat) \
     { \
         PROFILE_END_NAMED(name); \
+        PREPROC_COUNTERS_END(ppstat); \
         ppstat.exits++; \
         ppstat.ticks += name##_ticks_end - ppstat.ticks_start; \
     }
@@ -143,6 +238,7 @@
 #define PREPROC_PROFILE_REENTER_END_NAMED(name, ppstat) \
     if (PROFILING_PREPROCS) { \
         PROFILE_END_NAMED(name); \
+        PREPROC_COUNTERS_END(ppstat); \
         ppstat.ticks += name##_ticks_end - ppstat.ticks_start; \
     }
 #define PREPROC_PROFILE_REENTER_END(ppstat) PREPROC_PROFILE_REENTER_END_NAMED(snort, ppstat)
@@ -150,6 +246,7 @@
 #define PREPROC_PROFILE_TMPEND_NAMED(name, ppstat) \
     if (PROFILING_PREPROCS) { \
         PROFILE_END_NAMED(name); \
+        PREPROC_COUNTERS_END(ppstat); \
         ppstat.ticks += name##_ticks_end - ppstat.ticks_start; \
     }
 #define PREPROC_PROFILE_TMPEND(ppstat) PREPROC_PROFILE_TMPEND_NAMED(snort, ppstat)
@@ -163,6 +260,7 @@ typedef struct _PreprocStats
     uint64_t ticks, ticks_start;
     uint64_t checks;
     uint64_t exits;
+    PerfCounters hw, hw_start;
 } PreprocStats;
 
 typedef void (*FreeFunc)(PreprocStats *stats);
@@ -184,6 +282,9 @@ typedef struct _ProfileConfig
     int sort;
     int append;
     char *filename;
+    int counters;
+    int dump_format;
+    char *dump_file;
 
 } ProfileConfig;
 
@@ -194,6 +295,12 @@ void ResetRuleProfiling(void);
 void ResetPreprocProfiling(void);
 void CleanupPreprocStatsNodeList(void);
 extern PreprocStats totalPerfStats;
+
+/* Opens the hardware counters for the calling thread if either profile
+ * config asks for them; profiling continues without them on failure. */
+void PerfCountersInit(void);
+void PerfCountersRead(PerfCounters *);
+extern int perf_counters_active;
 #else
 #define PROFILE_VARS
 #define PROFILE_VARS_NAMED(name)
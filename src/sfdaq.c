@@ -715,6 +715,13 @@ const DAQ_Stats_t* DAQ_GetStats (void)
     return &daq_stats;
 }
 
+// used by the worker supervisor which has no daq instance of its own
+void DAQ_SetMergedStats (const DAQ_Stats_t* ps)
+{
+    tot_stats = *ps;
+    daq_stats = *ps;
+}
+
 //--------------------------------------------------------------------
 
 #ifdef HAVE_DAQ_EXT_MODFLOW
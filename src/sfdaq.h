@@ -105,6 +105,7 @@ static inline uint16_t DAQ_GetAddressSpaceID(const DAQ_PktHdr_t *h)
 // returns total stats if no daq else current stats
 // returns statically allocated stats - don't free
 const DAQ_Stats_t* DAQ_GetStats(void);
+void DAQ_SetMergedStats(const DAQ_Stats_t*);
 
 #endif // __DAQ_H__
 
@@ -130,6 +130,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -146,6 +147,7 @@
 #endif //DYNAMIC_PREPROC_CONTEXT
 
 #include "acsmx2.h"
+#include "sfhugepage.h"
 #include "util.h"
 #include "snort_debug.h"
 #ifdef DYNAMIC_PREPROC_CONTEXT
@@ -184,6 +186,11 @@ typedef struct acsm_summary_s
 
 static acsm_summary_t summary;
 
+/* Rule groups may be compiled on several threads (see fpcreate.c), so the
+ * memory counters and the summary are only updated atomically or under
+ * summary_lock. */
+static pthread_mutex_t summary_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void acsm_init_summary(void)
 {
     summary.num_states = 0;
@@ -293,16 +300,16 @@ AC_MALLOC(
         switch (type)
         {
             case ACSM2_MEMORY_TYPE__PATTERN:
-                acsm2_pattern_memory += n;
+                __sync_fetch_and_add(&acsm2_pattern_memory, n);
                 break;
             case ACSM2_MEMORY_TYPE__MATCHLIST:
-                acsm2_matchlist_memory += n;
+                __sync_fetch_and_add(&acsm2_matchlist_memory, n);
                 break;
             case ACSM2_MEMORY_TYPE__TRANSTABLE:
-                acsm2_transtable_memory += n;
+                __sync_fetch_and_add(&acsm2_transtable_memory, n);
                 break;
             case ACSM2_MEMORY_TYPE__FAILSTATE:
-                acsm2_failstate_memory += n;
+                __sync_fetch_and_add(&acsm2_failstate_memory, n);
                 break;
             case ACSM2_MEMORY_TYPE__NONE:
                 break;
@@ -311,7 +318,7 @@ AC_MALLOC(
                 break;
         }
 
-        acsm2_total_memory += n;
+        __sync_fetch_and_add(&acsm2_total_memory, n);
     }
 
     return p;
@@ -330,19 +337,19 @@ AC_MALLOC_DFA(
         switch (sizeofstate)
         {
             case 1:
-                acsm2_dfa1_memory += n;
+                __sync_fetch_and_add(&acsm2_dfa1_memory, n);
                 break;
             case 2:
-                acsm2_dfa2_memory += n;
+                __sync_fetch_and_add(&acsm2_dfa2_memory, n);
                 break;
             case 4:
             default:
-                acsm2_dfa4_memory += n;
+                __sync_fetch_and_add(&acsm2_dfa4_memory, n);
                 break;
         }
 
-        acsm2_dfa_memory += n;
-        acsm2_total_memory += n;
+        __sync_fetch_and_add(&acsm2_dfa_memory, n);
+        __sync_fetch_and_add(&acsm2_total_memory, n);
     }
 
     return p;
@@ -364,23 +371,23 @@ AC_FREE(
         switch (type)
         {
             case ACSM2_MEMORY_TYPE__PATTERN:
-                acsm2_pattern_memory -= n;
+                __sync_fetch_and_sub(&acsm2_pattern_memory, n);
                 break;
             case ACSM2_MEMORY_TYPE__MATCHLIST:
-                acsm2_matchlist_memory -= n;
+                __sync_fetch_and_sub(&acsm2_matchlist_memory, n);
                 break;
             case ACSM2_MEMORY_TYPE__TRANSTABLE:
-                acsm2_transtable_memory -= n;
+                __sync_fetch_and_sub(&acsm2_transtable_memory, n);
                 break;
             case ACSM2_MEMORY_TYPE__FAILSTATE:
-                acsm2_failstate_memory -= n;
+                __sync_fetch_and_sub(&acsm2_failstate_memory, n);
                 break;
             case ACSM2_MEMORY_TYPE__NONE:
             default:
                 break;
         }
 
-        acsm2_total_memory -= n;
+        __sync_fetch_and_sub(&acsm2_total_memory, n);
         free(p);
     }
 }
@@ -397,23 +404,87 @@ AC_FREE_DFA(
         switch (sizeofstate)
         {
             case 1:
-                acsm2_dfa1_memory -= n;
+                __sync_fetch_and_sub(&acsm2_dfa1_memory, n);
                 break;
             case 2:
-                acsm2_dfa2_memory -= n;
+                __sync_fetch_and_sub(&acsm2_dfa2_memory, n);
                 break;
             case 4:
             default:
-                acsm2_dfa4_memory -= n;
+                __sync_fetch_and_sub(&acsm2_dfa4_memory, n);
                 break;
         }
 
-        acsm2_dfa_memory -= n;
-        acsm2_total_memory -= n;
+        __sync_fetch_and_sub(&acsm2_dfa_memory, n);
+        __sync_fetch_and_sub(&acsm2_total_memory, n);
         free(p);
     }
 }
 
+/*
+*   Tables indexed by state on every input byte; these may come from
+*   huge pages.
+*/
+static void *
+AC_MALLOC_DFA_TABLE(
+        size_t n,
+        int sizeofstate
+        )
+{
+    void *p = sfhuge_alloc(n);
+
+    if (p != NULL)
+    {
+        switch (sizeofstate)
+        {
+            case 1:
+                __sync_fetch_and_add(&acsm2_dfa1_memory, n);
+                break;
+            case 2:
+                __sync_fetch_and_add(&acsm2_dfa2_memory, n);
+                break;
+            case 4:
+            default:
+                __sync_fetch_and_add(&acsm2_dfa4_memory, n);
+                break;
+        }
+
+        __sync_fetch_and_add(&acsm2_dfa_memory, n);
+        __sync_fetch_and_add(&acsm2_total_memory, n);
+    }
+
+    return p;
+}
+
+static void
+AC_FREE_DFA_TABLE(
+        void *p,
+        size_t n,
+        int sizeofstate
+        )
+{
+    if (p != NULL)
+    {
+        switch (sizeofstate)
+        {
+            case 1:
+                __sync_fetch_and_sub(&acsm2_dfa1_memory, n);
+                break;
+            case 2:
+                __sync_fetch_and_sub(&acsm2_dfa2_memory, n);
+                break;
+            case 4:
+            default:
+                __sync_fetch_and_sub(&acsm2_dfa4_memory, n);
+                break;
+        }
+
+        __sync_fetch_and_sub(&acsm2_dfa_memory, n);
+        __sync_fetch_and_sub(&acsm2_total_memory, n);
+        sfhuge_free(p);
+    }
+}
+
 
 /*
  *    Simple QUEUE NODE
@@ -1028,13 +1099,18 @@ Conv_List_To_Full(
     acstate_t k;
     acstate_t *p;
     acstate_t **NextState = acsm->acsmNextState;
+    size_t rowsize = acsm->sizeofstate * (acsm->acsmAlphabetSize + 2);
+
+    /* all rows in one table so they can share huge pages */
+    acsm->acsmDfaTable = (uint8_t *)AC_MALLOC_DFA_TABLE(
+        (size_t)acsm->acsmNumStates * rowsize, acsm->sizeofstate);
+
+    if (acsm->acsmDfaTable == NULL)
+        return -1;
 
     for (k = 0; k < (acstate_t)acsm->acsmNumStates; k++)
     {
-        p = AC_MALLOC_DFA(acsm->sizeofstate * (acsm->acsmAlphabetSize + 2),
-                acsm->sizeofstate);
-        if (p == NULL)
-            return -1;
+        p = (acstate_t *)(acsm->acsmDfaTable + (size_t)k * rowsize);
 
         switch (acsm->sizeofstate)
         {
@@ -1752,12 +1828,14 @@ int acsmAddKey2(ACSM_STRUCT2 * p, unsigned char *key, int klen, int nocase, void
 
 /*
 *  Copy a boolean match flag int NextState table, for caching purposes.
+*  Returns the number of match states.
 */
-static void
+static unsigned
 acsmUpdateMatchStates(
         ACSM_STRUCT2 *acsm
         )
 {
+    unsigned num_match_states = 0;
     acstate_t state;
     acstate_t **NextState = acsm->acsmNextState;
     ACSM_PATTERN2 **MatchList = acsm->acsmMatchList;
@@ -1781,9 +1859,11 @@ acsmUpdateMatchStates(
                     break;
             }
 
-            summary.num_match_states++;
+            num_match_states++;
         }
     }
+
+    return num_match_states;
 }
 
 static int acsmBuildMatchStateTrees2( ACSM_STRUCT2 * acsm,
@@ -1826,9 +1906,9 @@ static int acsmBuildMatchStateTrees2( ACSM_STRUCT2 * acsm,
     return cnt;
 }
 
-static int acsmBuildMatchStateTrees2WithSnortConf( struct _SnortConfig *sc, ACSM_STRUCT2 * acsm,
-                                                   int (*build_tree)(struct _SnortConfig *, void * id, void **existing_tree),
-                                                   int (*neg_list_func)(void *id, void **list) )
+int acsmBuildMatchStateTrees2WithSnortConf( struct _SnortConfig *sc, ACSM_STRUCT2 * acsm,
+                                            int (*build_tree)(struct _SnortConfig *, void * id, void **existing_tree),
+                                            int (*neg_list_func)(void *id, void **list) )
 {
     int i, cnt = 0;
     ACSM_PATTERN2  ** MatchList = acsm->acsmMatchList;
@@ -1876,6 +1956,16 @@ void acsmCompressStates(
     acsm->compress_states = flag;
 }
 
+void acsmSetImageDir2(
+        ACSM_STRUCT2 *acsm,
+        const char *dir
+        )
+{
+    if (acsm == NULL)
+        return;
+    acsm->acsmImageDir = dir;
+}
+
 /*
 *   Compile State Machine - NFA or DFA and Full or Banded or Sparse or SparseBands
 */
@@ -1885,6 +1975,7 @@ _acsmCompile2(
         )
 {
     ACSM_PATTERN2* plist;
+    unsigned num_patterns = 0, num_characters = 0, num_match_states;
 
     /* Count number of possible states */
     for (plist = acsm->acsmPatterns; plist != NULL; plist = plist->next)
@@ -1926,8 +2017,8 @@ _acsmCompile2(
     /* Add each Pattern to the State Table - This forms a keywords state table  */
     for (plist = acsm->acsmPatterns; plist != NULL; plist = plist->next)
     {
-        summary.num_patterns++;
-        summary.num_characters += plist->n;
+        num_patterns++;
+        num_characters += plist->n;
         AddPatternStates(acsm, plist);
     }
 
@@ -1939,17 +2030,17 @@ _acsmCompile2(
         if (acsm->acsmNumStates < UINT8_MAX)
         {
             acsm->sizeofstate = 1;
-            summary.num_1byte_instances++;
+            __sync_fetch_and_add(&summary.num_1byte_instances, 1);
         }
         else if (acsm->acsmNumStates < UINT16_MAX)
         {
             acsm->sizeofstate = 2;
-            summary.num_2byte_instances++;
+            __sync_fetch_and_add(&summary.num_2byte_instances, 1);
         }
         else
         {
             acsm->sizeofstate = 4;
-            summary.num_4byte_instances++;
+            __sync_fetch_and_add(&summary.num_4byte_instances, 1);
         }
     }
     else
@@ -1965,7 +2056,7 @@ _acsmCompile2(
 
     /* Alloc a separate state transition table == in state 's' due to event 'k', transition to 'next' state */
     acsm->acsmNextState =
-        (acstate_t**)AC_MALLOC_DFA(acsm->acsmNumStates * sizeof(acstate_t*),
+        (acstate_t**)AC_MALLOC_DFA_TABLE(acsm->acsmNumStates * sizeof(acstate_t*),
                 acsm->sizeofstate);
     MEMASSERT(acsm->acsmNextState, "acsmCompile-NextState");
 
@@ -2083,7 +2174,7 @@ _acsmCompile2(
     }
 
     /* load boolean match flags into state table */
-    acsmUpdateMatchStates(acsm);
+    num_match_states = acsmUpdateMatchStates(acsm);
 
     /* Free up the Table Of Transition Lists */
     List_FreeTransTable(acsm);
@@ -2099,12 +2190,275 @@ _acsmCompile2(
       acsmPrintInfo2(acsm);
 
     /* Accrue Summary State Stats */
+    pthread_mutex_lock(&summary_lock);
+
+    summary.num_patterns += num_patterns;
+    summary.num_characters += num_characters;
+    summary.num_match_states += num_match_states;
     summary.num_states += acsm->acsmNumStates;
     summary.num_transitions += acsm->acsmNumTrans;
     summary.num_instances++;
 
     memcpy(&summary.acsm, acsm, sizeof(ACSM_STRUCT2));
 
+    pthread_mutex_unlock(&summary_lock);
+
+    return 0;
+}
+
+/*
+*   Compiled images of full format DFAs - see mpse_image.h
+*
+*   payload: num states, sizeofstate, alphabet size, pattern count,
+*            match states, the rows back to back,
+*            then per match state: state, count, pattern indexes
+*/
+static uint64_t
+acsmImageKey(
+        ACSM_STRUCT2 *acsm,
+        int npats
+        )
+{
+    ACSM_PATTERN2 *plist;
+    uint64_t key = MPSE_IMAGE_KEY_INIT;
+    int cfg[5];
+
+    cfg[0] = acsm->acsmFSA;
+    cfg[1] = acsm->acsmFormat;
+    cfg[2] = acsm->acsmAlphabetSize;
+    cfg[3] = acsm->compress_states;
+    cfg[4] = npats;
+    key = mpseImageKey(key, cfg, sizeof(cfg));
+
+    for (plist = acsm->acsmPatterns; plist != NULL; plist = plist->next)
+    {
+        int pat[3];
+
+        pat[0] = plist->n;
+        pat[1] = plist->nocase;
+        pat[2] = plist->negative;
+        key = mpseImageKey(key, pat, sizeof(pat));
+        key = mpseImageKey(key, plist->casepatrn, plist->n);
+    }
+
+    return key;
+}
+
+static int
+acsmImageLoad(
+        ACSM_STRUCT2 *acsm,
+        int npats,
+        uint64_t key
+        )
+{
+    MpseImageReader r;
+    const uint32_t *hdr, *rec;
+    const uint8_t *rows;
+    ACSM_PATTERN2 **pats = NULL, *plist;
+    unsigned nstates, nmatch, rowsize, i, k;
+
+    if (mpseImageOpen(&acsm->acsmImage, acsm->acsmImageDir, MPSE_IMAGE_ACSM2, key))
+        return -1;
+
+    r.p = acsm->acsmImage.data;
+    r.end = r.p + acsm->acsmImage.size;
+
+    hdr = (const uint32_t *)mpseImageRead(&r, 5 * sizeof(uint32_t));
+
+    if ((hdr == NULL) || (hdr[0] == 0) ||
+        ((hdr[1] != 1) && (hdr[1] != 2) && (hdr[1] != 4)) ||
+        (hdr[2] != (uint32_t)acsm->acsmAlphabetSize) ||
+        (hdr[3] != (uint32_t)npats) || (hdr[4] > hdr[0]))
+    {
+        mpseImageClose(&acsm->acsmImage);
+        return -1;
+    }
+
+    nstates = hdr[0];
+    nmatch = hdr[4];
+    rowsize = hdr[1] * (hdr[2] + 2);
+
+    rows = (const uint8_t *)mpseImageRead(&r, (size_t)nstates * rowsize);
+
+    pats = (ACSM_PATTERN2 **)calloc(npats + 1, sizeof(*pats));
+    acsm->acsmNextState =
+        (acstate_t**)AC_MALLOC_DFA_TABLE(nstates * sizeof(acstate_t*), hdr[1]);
+    acsm->acsmMatchList =
+        (ACSM_PATTERN2 **)AC_MALLOC(sizeof(ACSM_PATTERN2*) * nstates,
+                ACSM2_MEMORY_TYPE__MATCHLIST);
+
+    if ((rows == NULL) || (pats == NULL) ||
+        (acsm->acsmNextState == NULL) || (acsm->acsmMatchList == NULL))
+    {
+        goto bail;
+    }
+
+    for (plist = acsm->acsmPatterns; plist != NULL; plist = plist->next)
+        pats[plist->index] = plist;
+
+    for (i = 0; i < nstates; i++)
+        acsm->acsmNextState[i] = (acstate_t *)(rows + (size_t)i * rowsize);
+
+    /* keep each list in the order it was saved in */
+    for (i = 0; i < nmatch; i++)
+    {
+        ACSM_PATTERN2 **tail;
+
+        rec = (const uint32_t *)mpseImageRead(&r, 2 * sizeof(uint32_t));
+
+        if ((rec == NULL) || (rec[0] >= nstates) || acsm->acsmMatchList[rec[0]])
+            goto bail;
+
+        tail = &acsm->acsmMatchList[rec[0]];
+        k = rec[1];
+
+        if (!k || !(rec = (const uint32_t *)mpseImageRead(&r, k * sizeof(uint32_t))))
+            goto bail;
+
+        while (k--)
+        {
+            if (*rec >= (uint32_t)npats)
+                goto bail;
+
+            *tail = CopyMatchListEntry(pats[*rec++]);
+            tail = &(*tail)->next;
+        }
+    }
+    free(pats);
+
+    acsm->acsmNumStates = nstates;
+    acsm->sizeofstate = hdr[1];
+
+    pthread_mutex_lock(&summary_lock);
+    summary.num_states += nstates;
+    summary.num_match_states += nmatch;
+    summary.num_instances++;
+    memcpy(&summary.acsm, acsm, sizeof(ACSM_STRUCT2));
+    pthread_mutex_unlock(&summary_lock);
+
+    return 0;
+
+bail:
+    if (acsm->acsmMatchList != NULL)
+    {
+        for (i = 0; i < nstates; i++)
+        {
+            ACSM_PATTERN2 *mlist = acsm->acsmMatchList[i];
+
+            while (mlist)
+            {
+                ACSM_PATTERN2 *ilist = mlist;
+                mlist = mlist->next;
+                AC_FREE(ilist, sizeof(ACSM_PATTERN2), ACSM2_MEMORY_TYPE__MATCHLIST);
+            }
+        }
+        AC_FREE(acsm->acsmMatchList, sizeof(ACSM_PATTERN2*) * nstates,
+                ACSM2_MEMORY_TYPE__MATCHLIST);
+        acsm->acsmMatchList = NULL;
+    }
+    AC_FREE_DFA_TABLE(acsm->acsmNextState, nstates * sizeof(acstate_t*), hdr[1]);
+    acsm->acsmNextState = NULL;
+    free(pats);
+    mpseImageClose(&acsm->acsmImage);
+    return -1;
+}
+
+static void
+acsmImageSave(
+        ACSM_STRUCT2 *acsm,
+        int npats,
+        uint64_t key
+        )
+{
+    unsigned rowsize = acsm->sizeofstate * (acsm->acsmAlphabetSize + 2);
+    size_t rowwords = ((size_t)acsm->acsmNumStates * rowsize + 3) / 4;
+    unsigned nmatch = 0;
+    size_t n;
+    uint32_t *buf, *w;
+    int i;
+
+    n = 5 + rowwords;
+
+    for (i = 0; i < acsm->acsmNumStates; i++)
+    {
+        ACSM_PATTERN2 *mlist;
+
+        if (acsm->acsmMatchList[i])
+        {
+            nmatch++;
+            n += 2;
+        }
+        for (mlist = acsm->acsmMatchList[i]; mlist; mlist = mlist->next)
+            n++;
+    }
+
+    buf = w = (uint32_t *)calloc(n, sizeof(uint32_t));
+    if (buf == NULL)
+        return;
+
+    *w++ = acsm->acsmNumStates;
+    *w++ = acsm->sizeofstate;
+    *w++ = acsm->acsmAlphabetSize;
+    *w++ = npats;
+    *w++ = nmatch;
+
+    for (i = 0; i < acsm->acsmNumStates; i++)
+        memcpy((uint8_t *)w + (size_t)i * rowsize, acsm->acsmNextState[i], rowsize);
+    w += rowwords;
+
+    for (i = 0; i < acsm->acsmNumStates; i++)
+    {
+        ACSM_PATTERN2 *mlist;
+        uint32_t *cnt;
+
+        if (!acsm->acsmMatchList[i])
+            continue;
+
+        *w++ = i;
+        cnt = w++;
+
+        for (mlist = acsm->acsmMatchList[i]; mlist; mlist = mlist->next)
+        {
+            *w++ = mlist->index;
+            (*cnt)++;
+        }
+    }
+
+    mpseImageSave(acsm->acsmImageDir, MPSE_IMAGE_ACSM2, key, buf, n * sizeof(uint32_t));
+    free(buf);
+}
+
+/*
+*   Compile, or load the compiled image when there is one
+*/
+static int
+_acsmCompileOrLoad2(
+        ACSM_STRUCT2* acsm
+        )
+{
+    ACSM_PATTERN2 *plist;
+    uint64_t key;
+    int npats = 0;
+
+    if ((acsm->acsmImageDir == NULL) || (acsm->acsmFSA != FSA_DFA) ||
+        ((acsm->acsmFormat != ACF_FULL) && (acsm->acsmFormat != ACF_FULLQ)))
+    {
+        return _acsmCompile2(acsm);
+    }
+
+    /* match list entries are copies of these so they carry the index */
+    for (plist = acsm->acsmPatterns; plist != NULL; plist = plist->next)
+        plist->index = npats++;
+
+    key = acsmImageKey(acsm, npats);
+
+    if (!acsmImageLoad(acsm, npats, key))
+        return 0;
+
+    if (_acsmCompile2(acsm))
+        return -1;
+
+    acsmImageSave(acsm, npats, key);
     return 0;
 }
 
@@ -2117,7 +2471,7 @@ acsmCompile2(
 {
     int rval;
 
-    if ((rval = _acsmCompile2(acsm)))
+    if ((rval = _acsmCompileOrLoad2(acsm)))
         return rval;
 
     if (build_tree && neg_list_func)
@@ -2138,7 +2492,7 @@ acsmCompile2WithSnortConf(
 {
     int rval;
 
-    if ((rval = _acsmCompile2(acsm)))
+    if ((rval = _acsmCompileOrLoad2(acsm)))
         return rval;
 
     if (build_tree && neg_list_func)
@@ -3195,9 +3549,13 @@ acsmFree2(
             AC_FREE(ilist, 0, ACSM2_MEMORY_TYPE__NONE);
         }
 
-        AC_FREE_DFA(acsm->acsmNextState[i], 0, 0);
+        if ((acsm->acsmImage.map == NULL) && (acsm->acsmDfaTable == NULL))
+            AC_FREE_DFA(acsm->acsmNextState[i], 0, 0);
     }
 
+    mpseImageClose(&acsm->acsmImage);
+    AC_FREE_DFA_TABLE(acsm->acsmDfaTable, 0, 0);
+
     for (plist = acsm->acsmPatterns; plist; )
     {
         ACSM_PATTERN2 *tmpPlist = plist->next;
@@ -3212,7 +3570,7 @@ acsmFree2(
         plist = tmpPlist;
     }
 
-    AC_FREE_DFA(acsm->acsmNextState, 0, 0);
+    AC_FREE_DFA_TABLE(acsm->acsmNextState, 0, 0);
     AC_FREE(acsm->acsmFailState, 0, ACSM2_MEMORY_TYPE__NONE);
     AC_FREE(acsm->acsmMatchList, 0, ACSM2_MEMORY_TYPE__NONE);
     AC_FREE(acsm, 0, ACSM2_MEMORY_TYPE__NONE);
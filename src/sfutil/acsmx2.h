@@ -32,6 +32,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "mpse_image.h"
+
 #ifndef ACSMX2S_H
 #define ACSMX2S_H
 
@@ -78,6 +80,7 @@ struct _acsm_pattern2
     int      negative;
     void *udata;
     int      iid;
+    int      index;       /* position in the pattern list, for images */
     void   * rule_option_tree;
     void   * neg_list;
 
@@ -163,6 +166,10 @@ typedef struct {
     int sizeofstate;
     int compress_states;
 
+    const char * acsmImageDir;  /* load/save compiled images here */
+    MpseImage acsmImage;        /* full format rows are mapped from this */
+    uint8_t * acsmDfaTable;     /* or allocated in one block here */
+
 }ACSM_STRUCT2;
 
 /*
@@ -180,6 +187,10 @@ struct _SnortConfig;
 int acsmCompile2WithSnortConf ( struct _SnortConfig *, ACSM_STRUCT2 * acsm,
                                 int (*build_tree)(struct _SnortConfig *, void * id, void **existing_tree),
                                 int (*neg_list_func)(void *id, void **list));
+/* Builds the rule option trees of an automaton compiled with no build_tree. */
+int acsmBuildMatchStateTrees2WithSnortConf ( struct _SnortConfig *, ACSM_STRUCT2 * acsm,
+                                int (*build_tree)(struct _SnortConfig *, void * id, void **existing_tree),
+                                int (*neg_list_func)(void *id, void **list));
 int acsmSearch2 ( ACSM_STRUCT2 * acsm,unsigned char * T, int n,
                   int (*Match)(void * id, void *tree, int index, void *data, void *neg_list),
                   void * data, int* current_state );
@@ -190,6 +201,7 @@ void acsmFree2 ( ACSM_STRUCT2 * acsm );
 int acsmPatternCount2 ( ACSM_STRUCT2 * acsm );
 
 void acsmCompressStates(ACSM_STRUCT2 *, int);
+void acsmSetImageDir2(ACSM_STRUCT2 *, const char *dir);
 
 int  acsmSelectFormat2( ACSM_STRUCT2 * acsm, int format );
 int  acsmSelectFSA2( ACSM_STRUCT2 * acsm, int fsa );
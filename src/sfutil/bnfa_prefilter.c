@@ -0,0 +1,241 @@
+/*
+** bnfa_prefilter.c
+**
+** Vectorized candidate prefilter for the ac-bnfa search engine.
+**
+** The automaton spends most of its time in state 0 stepping over bytes
+** that cannot start any pattern.  While the automaton is in state 0 the
+** search skips ahead with this prefilter and only runs the state machine
+** from the next candidate on, so matches are still confirmed against the
+** regular match lists.  The shuffle kernels are selected at run time
+** (avx2, ssse3) and fall back to table lookups on other cpus.
+**
+** Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+**
+** LICENSE (GPL)
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+** USA
+**
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bnfa_prefilter.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)) || defined(__clang__))
+#define BNFA_PREFILTER_X86
+#include <immintrin.h>
+#endif
+
+/* single byte patterns have no 2nd byte to check so they get a bucket of
+ * their own; everything else is spread over the others */
+#define PF_BUCKET_SINGLE  0x80
+#define PF_HASH_BUCKETS   7
+
+typedef const unsigned char * (*pf_scan_t)(const bnfa_prefilter_t *,
+                                           const unsigned char *, const unsigned char *);
+
+static const unsigned char * pf_scan_scalar(const bnfa_prefilter_t *pf,
+    const unsigned char *T, const unsigned char *Tend)
+{
+    for ( ; T < Tend; T++ )
+    {
+        if ( bnfaPrefilterHit(pf, T, Tend) )
+            break;
+    }
+    return T;
+}
+
+#ifdef BNFA_PREFILTER_X86
+__attribute__((target("ssse3")))
+static const unsigned char * pf_scan_ssse3(const bnfa_prefilter_t *pf,
+    const unsigned char *T, const unsigned char *Tend)
+{
+    const __m128i nib = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo0 = _mm_loadu_si128((const __m128i *)pf->lo0);
+    const __m128i hi0 = _mm_loadu_si128((const __m128i *)pf->hi0);
+    const __m128i lo1 = _mm_loadu_si128((const __m128i *)pf->lo1);
+    const __m128i hi1 = _mm_loadu_si128((const __m128i *)pf->hi1);
+
+    /* each step reads one byte past the block */
+    while ( Tend - T > 16 )
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)T);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(T + 1));
+
+        __m128i m0 = _mm_and_si128(
+            _mm_shuffle_epi8(lo0, _mm_and_si128(v0, nib)),
+            _mm_shuffle_epi8(hi0, _mm_and_si128(_mm_srli_epi16(v0, 4), nib)));
+
+        __m128i m1 = _mm_and_si128(
+            _mm_shuffle_epi8(lo1, _mm_and_si128(v1, nib)),
+            _mm_shuffle_epi8(hi1, _mm_and_si128(_mm_srli_epi16(v1, 4), nib)));
+
+        unsigned bits = ~_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_and_si128(m0, m1), zero)) & 0xffff;
+
+        if ( bits )
+            return T + __builtin_ctz(bits);
+
+        T += 16;
+    }
+    return pf_scan_scalar(pf, T, Tend);
+}
+
+__attribute__((target("avx2")))
+static const unsigned char * pf_scan_avx2(const bnfa_prefilter_t *pf,
+    const unsigned char *T, const unsigned char *Tend)
+{
+    const __m256i nib = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+
+    /* the shuffle works within 128 bit lanes so both get the tables */
+    const __m256i lo0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)pf->lo0));
+    const __m256i hi0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)pf->hi0));
+    const __m256i lo1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)pf->lo1));
+    const __m256i hi1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)pf->hi1));
+
+    while ( Tend - T > 32 )
+    {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)T);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(T + 1));
+
+        __m256i m0 = _mm256_and_si256(
+            _mm256_shuffle_epi8(lo0, _mm256_and_si256(v0, nib)),
+            _mm256_shuffle_epi8(hi0, _mm256_and_si256(_mm256_srli_epi16(v0, 4), nib)));
+
+        __m256i m1 = _mm256_and_si256(
+            _mm256_shuffle_epi8(lo1, _mm256_and_si256(v1, nib)),
+            _mm256_shuffle_epi8(hi1, _mm256_and_si256(_mm256_srli_epi16(v1, 4), nib)));
+
+        unsigned bits = ~(unsigned)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_and_si256(m0, m1), zero));
+
+        if ( bits )
+            return T + __builtin_ctz(bits);
+
+        T += 32;
+    }
+    return pf_scan_ssse3(pf, T, Tend);
+}
+#endif
+
+static pf_scan_t pf_scan = NULL;
+static const char *pf_engine = "scalar";
+
+static void pf_select(void)
+{
+    pf_scan_t scan = pf_scan_scalar;
+    const char *engine = "scalar";
+
+    /* compile threads may get here together */
+    if ( pf_scan )
+        return;
+
+#ifdef BNFA_PREFILTER_X86
+    __builtin_cpu_init();
+
+    if ( __builtin_cpu_supports("avx2") )
+    {
+        scan = pf_scan_avx2;
+        engine = "avx2";
+    }
+    else if ( __builtin_cpu_supports("ssse3") )
+    {
+        scan = pf_scan_ssse3;
+        engine = "ssse3";
+    }
+#endif
+    pf_engine = engine;
+    pf_scan = scan;
+}
+
+const char * bnfaPrefilterEngine(void)
+{
+    pf_select();
+    return pf_engine;
+}
+
+bnfa_prefilter_t * bnfaPrefilterNew(void)
+{
+    bnfa_prefilter_t *pf = (bnfa_prefilter_t *)calloc(1, sizeof(*pf));
+
+    if ( !pf )
+        return NULL;
+
+    pf_select();
+    pf->scan = pf_scan;
+
+    return pf;
+}
+
+void bnfaPrefilterFree(bnfa_prefilter_t *pf)
+{
+    free(pf);
+}
+
+static void pf_set(uint8_t *lo, uint8_t *hi, uint8_t *exact, unsigned c, uint8_t bit)
+{
+    unsigned u = toupper(c), l = tolower(c);
+
+    exact[u] |= bit;
+    lo[u & 0xf] |= bit;
+    hi[u >> 4] |= bit;
+
+    exact[l] |= bit;
+    lo[l & 0xf] |= bit;
+    hi[l >> 4] |= bit;
+}
+
+void bnfaPrefilterAddPattern(bnfa_prefilter_t *pf, const unsigned char *pat, int n)
+{
+    uint8_t bit;
+    int i;
+
+    if ( n <= 0 )
+        return;
+
+    if ( n == 1 )
+    {
+        bit = PF_BUCKET_SINGLE;
+        pf_set(pf->lo0, pf->hi0, pf->first, pat[0], bit);
+
+        /* any 2nd byte will do */
+        if ( !(pf->second[0] & PF_BUCKET_SINGLE) )
+        {
+            for ( i = 0; i < 16; i++ )
+                pf->lo1[i] |= bit, pf->hi1[i] |= bit;
+
+            for ( i = 0; i < 256; i++ )
+                pf->second[i] |= bit;
+        }
+        return;
+    }
+
+    bit = 1 << ((toupper(pat[0]) * 31 + toupper(pat[1])) % PF_HASH_BUCKETS);
+
+    pf_set(pf->lo0, pf->hi0, pf->first, pat[0], bit);
+    pf_set(pf->lo1, pf->hi1, pf->second, pat[1], bit);
+}
@@ -0,0 +1,79 @@
+/*
+** bnfa_prefilter.h
+**
+** Vectorized candidate prefilter for the ac-bnfa search engine.
+**
+** Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+**
+** LICENSE (GPL)
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+** USA
+**
+*/
+
+#ifndef BNFA_PREFILTER_H
+#define BNFA_PREFILTER_H
+
+#include <stdint.h>
+
+/*
+*  Each pattern is reduced to its first two bytes, case folded, and hashed
+*  into one of 8 buckets.  A text position is a candidate when the bucket
+*  masks of its byte and the following byte intersect.  The vector kernels
+*  look the masks up by nibble with a byte shuffle (16 or 32 positions per
+*  step), so they may report a few extra candidates but never miss one.
+*/
+typedef struct bnfa_prefilter_s
+{
+    uint8_t lo0[16], hi0[16];   /* 1st byte bucket masks by low/high nibble */
+    uint8_t lo1[16], hi1[16];   /* 2nd byte bucket masks by low/high nibble */
+
+    uint8_t first[256];         /* exact 1st byte bucket masks */
+    uint8_t second[256];        /* exact 2nd byte bucket masks */
+
+    const unsigned char * (*scan)(const struct bnfa_prefilter_s *,
+                                  const unsigned char *, const unsigned char *);
+
+} bnfa_prefilter_t;
+
+bnfa_prefilter_t * bnfaPrefilterNew(void);
+void bnfaPrefilterFree(bnfa_prefilter_t *);
+
+void bnfaPrefilterAddPattern(bnfa_prefilter_t *, const unsigned char *pat, int n);
+
+/* Returns the first position in [T, Tend) where a pattern may start, or
+ * Tend if there is none. */
+static inline const unsigned char * bnfaPrefilterScan(
+    const bnfa_prefilter_t *pf, const unsigned char *T, const unsigned char *Tend)
+{
+    return pf->scan(pf, T, Tend);
+}
+
+/* Exact test of a single position. */
+static inline int bnfaPrefilterHit(
+    const bnfa_prefilter_t *pf, const unsigned char *T, const unsigned char *Tend)
+{
+    if ( T + 1 < Tend )
+        return pf->first[T[0]] & pf->second[T[1]];
+
+    return pf->first[T[0]];
+}
+
+/* Name of the kernel selected for this cpu. */
+const char * bnfaPrefilterEngine(void);
+
+#endif
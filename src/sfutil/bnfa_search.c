@@ -147,6 +147,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -167,6 +168,8 @@
 #include "util.h"
 #include "sf_dynamic_preprocessor.h"
 
+#include "sfhugepage.h"
+
 /*
  * Used to initialize last state, states are limited to 0-16M
  * so this will not conflict.
@@ -228,9 +231,35 @@ void bnfa_free( void *p, int n, int * m )
 #define BNFA_MALLOC(n,memory) bnfa_alloc(n,&(memory))
 #define BNFA_FREE(p,n,memory) bnfa_free(p,n,&(memory))
 
+/*
+* The transition list is the one table every search walks; it may come
+* from huge pages.
+*/
+static
+void * bnfa_alloc_table( int n, int * m )
+{
+   void * p = sfhuge_alloc(n);
+   if( p && m )
+   {
+       m[0] += n;
+   }
+   return p;
+}
+static
+void bnfa_free_table( void *p, int n, int * m )
+{
+   if( p )
+   {
+       sfhuge_free(p);
+       if(m)
+       {
+          m[0] -= n;
+       }
+   }
+}
+#define BNFA_MALLOC_TABLE(n,memory) bnfa_alloc_table(n,&(memory))
+#define BNFA_FREE_TABLE(p,n,memory) bnfa_free_table(p,n,&(memory))
 
-/* queue memory traker */
-static int queue_memory=0;
 
 /*
 *    simple queue node
@@ -249,6 +278,7 @@ typedef struct _queue
   QNODE * head, *tail;
   int count;
   int maxcnt;
+  int memory;
 }
 QUEUE;
 /*
@@ -260,6 +290,7 @@ void queue_init (QUEUE * s)
   s->head = s->tail = 0;
   s->count= 0;
   s->maxcnt=0;
+  s->memory=0;
 }
 /*
 *  Add items to tail of queue (fifo)
@@ -270,14 +301,14 @@ int queue_add (QUEUE * s, int state)
   QNODE * q;
   if (!s->head)
   {
-      q = s->tail = s->head = (QNODE *) BNFA_MALLOC (sizeof(QNODE),queue_memory);
+      q = s->tail = s->head = (QNODE *) BNFA_MALLOC (sizeof(QNODE),s->memory);
       if(!q) return -1;
       q->state = state;
       q->next = 0;
   }
   else
   {
-      q = (QNODE *) BNFA_MALLOC (sizeof(QNODE),queue_memory);
+      q = (QNODE *) BNFA_MALLOC (sizeof(QNODE),s->memory);
       q->state = state;
       q->next = 0;
       s->tail->next = q;
@@ -310,7 +341,7 @@ int queue_remove (QUEUE * s)
         s->tail = 0;
         s->count = 0;
       }
-      BNFA_FREE (q,sizeof(QNODE),queue_memory);
+      BNFA_FREE (q,sizeof(QNODE),s->memory);
   }
   return state;
 }
@@ -518,7 +549,6 @@ int bnfaBuildMatchStateTrees(bnfa_struct_t *bnfa,
 }
 
 #ifndef DYNAMIC_PREPROCESSOR_CONTEXT
-static
 int bnfaBuildMatchStateTreesWithSnortConf(struct _SnortConfig *sc, bnfa_struct_t *bnfa,
                                           int (*build_tree)(struct _SnortConfig *, void *id, void **existing_tree),
                                           int (*neg_list_func)(void *id, void **list))
@@ -963,6 +993,7 @@ int _bnfa_build_nfa (bnfa_struct_t * bnfa)
 
     /* Clean up the queue */
     queue_free (queue);
+    bnfa->queue_memory = queue->memory;
 
     /* optimize the failure states */
     if( bnfa->bnfaOpt )
@@ -1074,13 +1105,14 @@ int _bnfa_conv_list_to_csparse_array(bnfa_struct_t * bnfa)
   /*
     Alloc The Transition List - we need an array of bnfa_state_t items of size 'nps'
   */
-  ps = BNFA_MALLOC( nps*sizeof(bnfa_state_t),bnfa->nextstate_memory);
+  ps = BNFA_MALLOC_TABLE( nps*sizeof(bnfa_state_t),bnfa->nextstate_memory);
   if( !ps )
   {
       /* Fatal */
       return -1;
   }
   bnfa->bnfaTransList = ps;
+  bnfa->bnfaTransListLen = nps;
 
   /*
      State Index list for pi - we need an array of bnfa_state_t items of size 'NumStates'
@@ -1395,7 +1427,6 @@ bnfa_struct_t * bnfaNew(void (*userfree)(void *p),
      p->neg_list_free          = neg_list_free;
   }
 
-  queue_memory = 0;
   return p;
 }
 
@@ -1411,6 +1442,11 @@ void bnfaSetCase(bnfa_struct_t  * p, int flag)
    if( flag == BNFA_NOCASE  ) p->bnfaCaseMode = flag;
 }
 
+void bnfaSetImageDir(bnfa_struct_t  * p, const char * dir)
+{
+   p->bnfaImageDir = dir;
+}
+
 /*
 *   Fee all memory
 */
@@ -1471,7 +1507,12 @@ void bnfaFree (bnfa_struct_t * bnfa)
   BNFA_FREE(bnfa->bnfaFailState,bnfa->bnfaNumStates*sizeof(bnfa_state_t),bnfa->failstate_memory);
   BNFA_FREE(bnfa->bnfaMatchList,bnfa->bnfaNumStates*sizeof(bnfa_pattern_t*),bnfa->matchlist_memory);
   BNFA_FREE(bnfa->bnfaNextState,bnfa->bnfaNumStates*sizeof(bnfa_state_t*),bnfa->nextstate_memory);
-  BNFA_FREE(bnfa->bnfaTransList,(2*bnfa->bnfaNumStates+bnfa->bnfaNumTrans)*sizeof(bnfa_state_t*),bnfa->nextstate_memory);
+  if( bnfa->bnfaImage.map )
+      mpseImageClose( &bnfa->bnfaImage );
+  else
+      BNFA_FREE_TABLE(bnfa->bnfaTransList,(2*bnfa->bnfaNumStates+bnfa->bnfaNumTrans)*sizeof(bnfa_state_t*),bnfa->nextstate_memory);
+  if( bnfa->bnfaPrefilter )
+      bnfaPrefilterFree( bnfa->bnfaPrefilter );
   free( bnfa ); /* cannot update memory tracker when deleting bnfa so just 'free' it !*/
 }
 
@@ -1503,6 +1544,7 @@ bnfaAddPattern (bnfa_struct_t * p,
   plist->n        = n;
   plist->nocase   = nocase;
   plist->negative = negative;
+  plist->index    = p->bnfaPatternCnt;
   plist->userdata = userdata;
 
   plist->next     = p->bnfaPatterns; /* insert at front of list */
@@ -1513,6 +1555,31 @@ bnfaAddPattern (bnfa_struct_t * p,
   return 0;
 }
 
+/*
+*   Build the state 0 skip filter from the same patterns
+*/
+static int
+_bnfa_build_prefilter (bnfa_struct_t * bnfa)
+{
+    bnfa_pattern_t * plist;
+
+    if( !bnfa->bnfaUsePrefilter )
+        return 0;
+
+    bnfa->bnfaPrefilter = bnfaPrefilterNew();
+    if( !bnfa->bnfaPrefilter )
+    {
+        return -1;
+    }
+    bnfa->bnfa_memory += sizeof(bnfa_prefilter_t);
+
+    for(plist = bnfa->bnfaPatterns; plist != NULL; plist = plist->next)
+    {
+        bnfaPrefilterAddPattern( bnfa->bnfaPrefilter, plist->casepatrn, plist->n );
+    }
+    return 0;
+}
+
 /*
 *   Compile the patterns into an nfa state machine
 */
@@ -1524,8 +1591,6 @@ _bnfaCompile (bnfa_struct_t * bnfa)
     unsigned          cntMatchStates;
     int               i;
 
-    queue_memory =0;
-
     /* Count number of states */
     for(plist = bnfa->bnfaPatterns; plist != NULL; plist = plist->next)
     {
@@ -1641,13 +1706,237 @@ _bnfaCompile (bnfa_struct_t * bnfa)
     }
 
     bnfa->bnfaMatchStates = cntMatchStates;
-    bnfa->queue_memory    = queue_memory;
+
+    if( _bnfa_build_prefilter( bnfa ) )
+    {
+        return -1;
+    }
 
     bnfaAccumInfo( bnfa  );
 
     return 0;
 }
 
+/*
+*   Compiled images - see mpse_image.h
+*
+*   payload: num states, trans list len, pattern count, match states,
+*            the sparse trans list,
+*            then per match state: state, count, pattern indexes
+*/
+static uint64_t
+_bnfa_image_key (bnfa_struct_t * bnfa)
+{
+    bnfa_pattern_t * plist;
+    uint64_t key = MPSE_IMAGE_KEY_INIT;
+    int cfg[5];
+
+    cfg[0] = bnfa->bnfaCaseMode;
+    cfg[1] = bnfa->bnfaFormat;
+    cfg[2] = bnfa->bnfaAlphabetSize;
+    cfg[3] = bnfa->bnfaForceFullZeroState;
+    cfg[4] = (int)bnfa->bnfaPatternCnt;
+    key = mpseImageKey(key, cfg, sizeof(cfg));
+
+    for(plist = bnfa->bnfaPatterns; plist != NULL; plist = plist->next)
+    {
+        int pat[4];
+
+        pat[0] = plist->index;
+        pat[1] = plist->n;
+        pat[2] = plist->nocase;
+        pat[3] = plist->negative;
+        key = mpseImageKey(key, pat, sizeof(pat));
+        key = mpseImageKey(key, plist->casepatrn, plist->n);
+    }
+    return key;
+}
+
+static void
+_bnfa_image_free_match_lists (bnfa_struct_t * bnfa, unsigned nstates)
+{
+    unsigned i;
+
+    for(i = 0; i < nstates; i++)
+    {
+        bnfa_match_node_t * mlist = bnfa->bnfaMatchList[i];
+
+        while( mlist )
+        {
+            bnfa_match_node_t * ilist = mlist;
+            mlist = mlist->next;
+            BNFA_FREE(ilist,sizeof(bnfa_match_node_t),bnfa->matchlist_memory);
+        }
+    }
+    BNFA_FREE(bnfa->bnfaMatchList,sizeof(void*)*nstates,bnfa->matchlist_memory);
+    bnfa->bnfaMatchList = NULL;
+}
+
+static int
+_bnfa_image_load (bnfa_struct_t * bnfa, uint64_t key)
+{
+    MpseImageReader r;
+    const uint32_t * hdr, * rec;
+    bnfa_pattern_t ** pats, * plist;
+    unsigned nstates, nmatch, i, k;
+
+    if( mpseImageOpen(&bnfa->bnfaImage, bnfa->bnfaImageDir, MPSE_IMAGE_BNFA, key) )
+        return -1;
+
+    r.p = bnfa->bnfaImage.data;
+    r.end = r.p + bnfa->bnfaImage.size;
+
+    hdr = (const uint32_t *)mpseImageRead(&r, 4 * sizeof(uint32_t));
+
+    if( !hdr || hdr[0] == 0 || hdr[0] > BNFA_SPARSE_MAX_STATE ||
+        hdr[2] != bnfa->bnfaPatternCnt || hdr[3] > hdr[0] )
+    {
+        mpseImageClose(&bnfa->bnfaImage);
+        return -1;
+    }
+    nstates = hdr[0];
+    nmatch = hdr[3];
+
+    bnfa->bnfaTransList = (bnfa_state_t *)mpseImageRead(&r, hdr[1] * sizeof(bnfa_state_t));
+
+    pats = (bnfa_pattern_t **)calloc(bnfa->bnfaPatternCnt + 1, sizeof(*pats));
+    bnfa->bnfaMatchList = (bnfa_match_node_t **)BNFA_MALLOC(sizeof(void*)*nstates,bnfa->matchlist_memory);
+
+    if( !bnfa->bnfaTransList || !pats || !bnfa->bnfaMatchList )
+        goto bail;
+
+    for(plist = bnfa->bnfaPatterns; plist != NULL; plist = plist->next)
+        pats[plist->index] = plist;
+
+    /* keep each list in the order it was saved in */
+    for(i = 0; i < nmatch; i++)
+    {
+        bnfa_match_node_t ** tail;
+
+        rec = (const uint32_t *)mpseImageRead(&r, 2 * sizeof(uint32_t));
+
+        if( !rec || rec[0] >= nstates || bnfa->bnfaMatchList[rec[0]] )
+            goto bail;
+
+        tail = &bnfa->bnfaMatchList[rec[0]];
+        k = rec[1];
+
+        if( !k || !(rec = (const uint32_t *)mpseImageRead(&r, k * sizeof(uint32_t))) )
+            goto bail;
+
+        while( k-- )
+        {
+            bnfa_match_node_t * pmn;
+
+            if( *rec >= bnfa->bnfaPatternCnt )
+                goto bail;
+
+            pmn = (bnfa_match_node_t*)BNFA_MALLOC(sizeof(bnfa_match_node_t),bnfa->matchlist_memory);
+            if( !pmn )
+                goto bail;
+
+            pmn->data = pats[*rec++];
+            *tail = pmn;
+            tail = &pmn->next;
+        }
+    }
+    free(pats);
+
+    bnfa->bnfaNumStates    = nstates;
+    bnfa->bnfaTransListLen = hdr[1];
+    bnfa->bnfaMatchStates  = nmatch;
+
+    if( _bnfa_build_prefilter( bnfa ) )
+        return -1;
+
+    bnfaAccumInfo( bnfa );
+    return 0;
+
+bail:
+    if( bnfa->bnfaMatchList )
+        _bnfa_image_free_match_lists(bnfa, nstates);
+    free(pats);
+    bnfa->bnfaTransList = NULL;
+    mpseImageClose(&bnfa->bnfaImage);
+    return -1;
+}
+
+static void
+_bnfa_image_save (bnfa_struct_t * bnfa, uint64_t key)
+{
+    uint32_t * buf, * w;
+    size_t n;
+    int i;
+
+    /* header + trans list + 2 words per match state + 1 per match */
+    n = 4 + bnfa->bnfaTransListLen + 2 * bnfa->bnfaMatchStates;
+
+    for(i = 0; i < bnfa->bnfaNumStates; i++)
+    {
+        bnfa_match_node_t * mlist;
+
+        for(mlist = bnfa->bnfaMatchList[i]; mlist; mlist = mlist->next)
+            n++;
+    }
+
+    buf = w = (uint32_t *)malloc(n * sizeof(uint32_t));
+    if( !buf )
+        return;
+
+    *w++ = bnfa->bnfaNumStates;
+    *w++ = bnfa->bnfaTransListLen;
+    *w++ = bnfa->bnfaPatternCnt;
+    *w++ = bnfa->bnfaMatchStates;
+
+    memcpy(w, bnfa->bnfaTransList, bnfa->bnfaTransListLen * sizeof(uint32_t));
+    w += bnfa->bnfaTransListLen;
+
+    for(i = 0; i < bnfa->bnfaNumStates; i++)
+    {
+        bnfa_match_node_t * mlist;
+        uint32_t * cnt;
+
+        if( !bnfa->bnfaMatchList[i] )
+            continue;
+
+        *w++ = i;
+        cnt = w++;
+        *cnt = 0;
+
+        for(mlist = bnfa->bnfaMatchList[i]; mlist; mlist = mlist->next)
+        {
+            *w++ = ((bnfa_pattern_t *)mlist->data)->index;
+            (*cnt)++;
+        }
+    }
+
+    mpseImageSave(bnfa->bnfaImageDir, MPSE_IMAGE_BNFA, key, buf, n * sizeof(uint32_t));
+    free(buf);
+}
+
+/*
+*   Compile, or load the compiled image when there is one
+*/
+static int
+_bnfaCompileOrLoad (bnfa_struct_t * bnfa)
+{
+    uint64_t key;
+
+    if( !bnfa->bnfaImageDir || bnfa->bnfaFormat != BNFA_SPARSE )
+        return _bnfaCompile (bnfa);
+
+    key = _bnfa_image_key (bnfa);
+
+    if( !_bnfa_image_load (bnfa, key) )
+        return 0;
+
+    if( _bnfaCompile (bnfa) )
+        return -1;
+
+    _bnfa_image_save (bnfa, key);
+    return 0;
+}
+
 int
 bnfaCompile (bnfa_struct_t * bnfa,
              int (*build_tree)(void * id, void **existing_tree),
@@ -1655,7 +1944,7 @@ bnfaCompile (bnfa_struct_t * bnfa,
 {
     int rval;
 
-    if ((rval = _bnfaCompile (bnfa)))
+    if ((rval = _bnfaCompileOrLoad (bnfa)))
         return rval;
 
     if (build_tree && neg_list_func)
@@ -1673,7 +1962,7 @@ bnfaCompileWithSnortConf (struct _SnortConfig *sc, bnfa_struct_t * bnfa,
 {
     int rval;
 
-    if ((rval = _bnfaCompile (bnfa)))
+    if ((rval = _bnfaCompileOrLoad (bnfa)))
         return rval;
 
     if (build_tree && neg_list_func)
@@ -2327,6 +2616,71 @@ _bnfa_search_csparse_nfa_q(   bnfa_struct_t * bnfa, unsigned char *T, int n,
     return _process_queue( bnfa, Match, data );
 }
 
+/*
+ *  Queued search that skips ahead with the prefilter whenever the
+ *  automaton is back in state 0.  From state 0 the automaton cannot
+ *  leave state 0 before a position where some pattern starts, and
+ *  the prefilter never misses such a position, so the matches and the
+ *  final state are the same as for _bnfa_search_csparse_nfa_q.
+ */
+static
+inline
+unsigned
+_bnfa_search_csparse_nfa_qp(  bnfa_struct_t * bnfa, unsigned char *T, int n,
+                 int (*Match)(bnfa_pattern_t * id, void *tree, int index, void *data, void *neg_list),
+                 void *data, unsigned sindex, int *current_state )
+{
+    bnfa_match_node_t  * mlist;
+    unsigned char      * Tend;
+    bnfa_match_node_t ** MatchList = bnfa->bnfaMatchList;
+    bnfa_state_t       * transList = bnfa->bnfaTransList;
+    bnfa_prefilter_t   * pf = bnfa->bnfaPrefilter;
+    unsigned             last_sindex;
+
+    Tend = T + n;
+
+    _init_queue(bnfa);
+
+    for(; T<Tend; T++)
+    {
+        if( !sindex && !bnfaPrefilterHit(pf, T, Tend) )
+        {
+            T = (unsigned char *)bnfaPrefilterScan(pf, T + 1, Tend);
+            if( T == Tend )
+                break;
+        }
+
+        last_sindex = sindex;
+
+        /* Transition to next state index */
+        sindex = _bnfa_get_next_state_csparse_nfa(transList,sindex,xlatcase[*T]);
+
+        /* Log matches in this state - if any */
+        if(sindex &&  (transList[sindex+1] & BNFA_SPARSE_MATCH_BIT) )
+        {
+            /* Test for same as last state */
+            if( sindex == last_sindex )
+                continue;
+
+            mlist = MatchList[ transList[sindex] ];
+            if( mlist )
+            {
+                if( _add_queue(bnfa,mlist) )
+                {
+                    if( _process_queue( bnfa, Match, data ) )
+                    {
+                        *current_state = sindex;
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+    *current_state = sindex;
+
+    return _process_queue( bnfa, Match, data );
+}
+
 /*
  *  Per Pattern case search, case is on per pattern basis
  *  standard snort search
@@ -2603,7 +2957,13 @@ bnfaSearch( bnfa_struct_t * bnfa, unsigned char *Tx, int n,
     {
         if( bnfa->bnfaCaseMode == BNFA_PER_PAT_CASE )
         {
-            if (bnfa->bnfaMethod)
+            if (bnfa->bnfaPrefilter)
+            {
+                ret = _bnfa_search_csparse_nfa_qp( bnfa, Tx, n,
+                    (int (*)(bnfa_pattern_t * id, void *tree, int index, void *data, void *neg_list))
+                    Match, data, sindex, current_state );
+            }
+            else if (bnfa->bnfaMethod)
             {
                 ret = _bnfa_search_csparse_nfa( bnfa, Tx, n,
                     (int (*)(bnfa_pattern_t * id, void *tree, int index, void *data, void *neg_list))
@@ -2653,7 +3013,13 @@ bnfaSearch( bnfa_struct_t * bnfa, unsigned char *Tx, int n,
 #else
     if( bnfa->bnfaCaseMode == BNFA_PER_PAT_CASE )
     {
-        if (bnfa->bnfaMethod)
+        if (bnfa->bnfaPrefilter)
+        {
+            ret = _bnfa_search_csparse_nfa_qp( bnfa, Tx, n,
+                (int (*)(bnfa_pattern_t * id, void *tree, int index, void *data, void *neg_list))
+                Match, data, sindex, current_state );
+        }
+        else if (bnfa->bnfaMethod)
         {
             ret = _bnfa_search_csparse_nfa( bnfa, Tx, n,
                 (int (*)(bnfa_pattern_t * id, void *tree, int index, void *data, void *neg_list))
@@ -2693,6 +3059,9 @@ int bnfaPatternCount( bnfa_struct_t * p)
 static bnfa_struct_t summary;
 static int summary_cnt=0;
 
+/* rule groups may be compiled on several threads */
+static pthread_mutex_t summary_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
 *  Info: Print info a particular state machine.
 */
@@ -2720,6 +3089,8 @@ void bnfaPrintInfoEx( bnfa_struct_t * p, char * text )
     LogMessage("| Pattern Chars    : %d\n",p->bnfaMaxStates);
     LogMessage("| Num States       : %d\n",p->bnfaNumStates);
     LogMessage("| Num Match States : %d\n",p->bnfaMatchStates);
+    if( p->bnfaUsePrefilter )
+    LogMessage("| Prefilter        : %s\n",bnfaPrefilterEngine());
     if( max_memory < 1024*1024 )
     {
         LogMessage("| Memory           :   %.2fKbytes\n", (double)max_memory/1024 );
@@ -2754,9 +3125,12 @@ void bnfaAccumInfo( bnfa_struct_t * p )
 {
     bnfa_struct_t * px = &summary;
 
+    pthread_mutex_lock(&summary_lock);
+
     summary_cnt++;
 
     px->bnfaAlphabetSize  = p->bnfaAlphabetSize;
+    px->bnfaUsePrefilter |= p->bnfaUsePrefilter;
     px->bnfaPatternCnt   += p->bnfaPatternCnt;
     px->bnfaMaxStates    += p->bnfaMaxStates;
     px->bnfaNumStates    += p->bnfaNumStates;
@@ -2768,6 +3142,8 @@ void bnfaAccumInfo( bnfa_struct_t * p )
     px->matchlist_memory += p->matchlist_memory;
     px->nextstate_memory += p->nextstate_memory;
     px->failstate_memory += p->failstate_memory;
+
+    pthread_mutex_unlock(&summary_lock);
 }
 
 #ifdef MATCH_LIST_CNT
@@ -38,6 +38,9 @@ k**
 #ifndef BNFA_SEARCH_H
 #define BNFA_SEARCH_H
 
+#include "bnfa_prefilter.h"
+#include "mpse_image.h"
+
 /* debugging - allow printing the trie and nfa in list format */
 /* #define ALLOW_LIST_PRINT */
 
@@ -75,6 +78,7 @@ typedef struct bnfa_pattern
     int                   n;           /* pattern len */
     int                   nocase;      /* nocase flag */
     int                   negative;    /* pattern is negated */
+    int                   index;       /* order added, for images */
     void                * userdata;    /* ptr to users pattern data/info  */
 
 } bnfa_pattern_t;
@@ -125,6 +129,7 @@ typedef struct {
 	int                bnfaFormat;
 	int                bnfaAlphabetSize;
 	int                bnfaOpt;
+	int                bnfaUsePrefilter;  /* skip state 0 with bnfa_prefilter */
 
 	unsigned           bnfaPatternCnt;
 	bnfa_pattern_t     * bnfaPatterns;
@@ -141,7 +146,12 @@ typedef struct {
 	bnfa_state_t       * bnfaFailState;
 
 	bnfa_state_t       * bnfaTransList;
+	unsigned           bnfaTransListLen;
    	int                bnfaForceFullZeroState;
+	bnfa_prefilter_t   * bnfaPrefilter;
+
+	const char         * bnfaImageDir;    /* load/save compiled images here */
+	MpseImage          bnfaImage;         /* bnfaTransList is mapped from this */
 
 	int 			   bnfa_memory;
 	int 			   pat_memory;
@@ -169,6 +179,7 @@ bnfa_struct_t * bnfaNew ( void (*userfree)(void *p),
                           void (*neg_list_free)(void **p));
 void bnfaSetOpt(bnfa_struct_t  * p, int flag);
 void bnfaSetCase(bnfa_struct_t  * p, int flag);
+void bnfaSetImageDir(bnfa_struct_t  * p, const char * dir);
 void bnfaFree( bnfa_struct_t  * pstruct );
 
 int bnfaAddPattern( bnfa_struct_t * pstruct,
@@ -183,6 +194,12 @@ int bnfaCompileWithSnortConf( struct _SnortConfig *, bnfa_struct_t * pstruct,
 			     int (*build_tree)(struct _SnortConfig *, void * id, void **existing_tree),
                  int (*neg_list_func)(void *id, void **list));
 
+/* Builds the rule option trees of a compiled machine, for a machine compiled
+ * with no build_tree. */
+int bnfaBuildMatchStateTreesWithSnortConf( struct _SnortConfig *, bnfa_struct_t * pstruct,
+                 int (*build_tree)(struct _SnortConfig *, void * id, void **existing_tree),
+                 int (*neg_list_func)(void *id, void **list));
+
 unsigned bnfaSearch( bnfa_struct_t * pstruct, unsigned char * t, int tlen,
         		    int (*match)(void * id, void *tree, int index, void *data, void *neg_list),
 					void * sdata,
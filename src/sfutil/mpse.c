@@ -39,6 +39,7 @@
 #include "acsmx2.h"
 #include "sfksearch.h"
 #include "mpse.h"
+#include "sfhugepage.h"
 #include "snort_debug.h"
 #include "sf_types.h"
 #include "util.h"
@@ -53,6 +54,9 @@
 
 #include "profiler.h"
 #include "snort.h"
+#ifndef DYNAMIC_PREPROC_CONTEXT
+#include "fpcreate.h"
+#endif
 #ifdef PERF_PROFILING
 PreprocStats mpsePerfStats;
 #endif
@@ -97,6 +101,14 @@ void * mpseNew( int method, int use_global_counter_flag,
             if(p->obj)
                ((bnfa_struct_t*)(p->obj))->bnfaMethod = 0;
             break;
+        case MPSE_AC_BNFA_SIMD:
+            p->obj=bnfaNew(userfree, optiontreefree, neg_list_free);
+            if(p->obj)
+            {
+               ((bnfa_struct_t*)(p->obj))->bnfaMethod = 0;
+               ((bnfa_struct_t*)(p->obj))->bnfaUsePrefilter = 1;
+            }
+            break;
         case MPSE_AC:
             p->obj = acsmNew(userfree, optiontreefree, neg_list_free);
             break;
@@ -170,6 +182,14 @@ void * mpseNewWithSnortConfig( struct _SnortConfig *sc,
             if(p->obj)
                ((bnfa_struct_t*)(p->obj))->bnfaMethod = 0;
             break;
+        case MPSE_AC_BNFA_SIMD:
+            p->obj=bnfaNew(userfree, optiontreefree, neg_list_free);
+            if(p->obj)
+            {
+               ((bnfa_struct_t*)(p->obj))->bnfaMethod = 0;
+               ((bnfa_struct_t*)(p->obj))->bnfaUsePrefilter = 1;
+            }
+            break;
         case MPSE_AC:
             p->obj = acsmNew(userfree, optiontreefree, neg_list_free);
             break;
@@ -214,6 +234,26 @@ void * mpseNewWithSnortConfig( struct _SnortConfig *sc,
         free(p);
         p = NULL;
     }
+    else if( sc && sc->fast_pattern_config &&
+             sc->fast_pattern_config->search_image_dir )
+    {
+        const char *dir = sc->fast_pattern_config->search_image_dir;
+
+        switch( method )
+        {
+            case MPSE_AC_BNFA:
+            case MPSE_AC_BNFA_Q:
+            case MPSE_AC_BNFA_SIMD:
+                bnfaSetImageDir((bnfa_struct_t*)p->obj, dir);
+                break;
+            case MPSE_ACF:
+            case MPSE_ACF_Q:
+                acsmSetImageDir2((ACSM_STRUCT2*)p->obj, dir);
+                break;
+            default:
+                break;
+        }
+    }
 
     return (void *)p;
 }
@@ -234,6 +274,7 @@ void   mpseSetOpt( void * pvoid, int flag )
     switch( p->method )
     {
         case MPSE_AC_BNFA_Q:
+        case MPSE_AC_BNFA_SIMD:
         case MPSE_AC_BNFA:
             if (p->obj)
                 bnfaSetOpt((bnfa_struct_t*)p->obj,flag);
@@ -259,6 +300,7 @@ void   mpseFree( void * pvoid )
     {
         case MPSE_AC_BNFA:
         case MPSE_AC_BNFA_Q:
+        case MPSE_AC_BNFA_SIMD:
             if (p->obj)
                 bnfaFree((bnfa_struct_t*)p->obj);
             free(p);
@@ -310,6 +352,7 @@ int  mpseAddPattern ( void * pvoid, void * P, int m,
    {
      case MPSE_AC_BNFA:
      case MPSE_AC_BNFA_Q:
+     case MPSE_AC_BNFA_SIMD:
        return bnfaAddPattern( (bnfa_struct_t*)p->obj, (unsigned char *)P, m,
               noCase, negative, ID );
 
@@ -345,6 +388,7 @@ int  mpseAddPatternWithSnortConfig ( SnortConfig *sc, void * pvoid, void * P, in
    {
      case MPSE_AC_BNFA:
      case MPSE_AC_BNFA_Q:
+     case MPSE_AC_BNFA_SIMD:
        return bnfaAddPattern( (bnfa_struct_t*)p->obj, (unsigned char *)P, m,
               noCase, negative, ID );
 
@@ -397,6 +441,7 @@ int  mpsePrepPatterns  ( void * pvoid,
    {
      case MPSE_AC_BNFA:
      case MPSE_AC_BNFA_Q:
+     case MPSE_AC_BNFA_SIMD:
        retv = bnfaCompile( (bnfa_struct_t*) p->obj, build_tree, neg_list_func );
      break;
 
@@ -436,6 +481,7 @@ int  mpsePrepPatternsWithSnortConf  ( struct _SnortConfig *sc, void * pvoid,
    {
      case MPSE_AC_BNFA:
      case MPSE_AC_BNFA_Q:
+     case MPSE_AC_BNFA_SIMD:
        retv = bnfaCompileWithSnortConf( sc, (bnfa_struct_t*) p->obj, build_tree, neg_list_func );
      break;
 
@@ -467,6 +513,61 @@ int  mpsePrepPatternsWithSnortConf  ( struct _SnortConfig *sc, void * pvoid,
 
   return retv;
 }
+
+/*
+*  The AC-BNFA and ACF engines keep all compile time state in the instance
+*  and update their shared counters atomically, so an instance of either
+*  may be compiled (with no build_tree) on a worker thread while others are
+*  being compiled.  The trees are then built on the main thread with
+*  mpseBuildTreesWithSnortConf().
+*/
+int mpseCompileThreadSafe( void * pvoid )
+{
+  MPSE * p = (MPSE*)pvoid;
+
+  switch( p->method )
+   {
+     case MPSE_AC_BNFA:
+     case MPSE_AC_BNFA_Q:
+     case MPSE_AC_BNFA_SIMD:
+     case MPSE_ACF:
+     case MPSE_ACF_Q:
+     case MPSE_ACS:
+     case MPSE_ACB:
+     case MPSE_ACSB:
+       return 1;
+
+     default:
+       return 0;
+   }
+}
+
+int mpseBuildTreesWithSnortConf ( struct _SnortConfig *sc, void * pvoid,
+                         int ( *build_tree )(struct _SnortConfig *, void *id, void **existing_tree),
+                         int ( *neg_list_func )(void *id, void **list) )
+{
+  MPSE * p = (MPSE*)pvoid;
+
+  switch( p->method )
+   {
+     case MPSE_AC_BNFA:
+     case MPSE_AC_BNFA_Q:
+     case MPSE_AC_BNFA_SIMD:
+       bnfaBuildMatchStateTreesWithSnortConf( sc, (bnfa_struct_t*) p->obj, build_tree, neg_list_func );
+       return 0;
+
+     case MPSE_ACF:
+     case MPSE_ACF_Q:
+     case MPSE_ACS:
+     case MPSE_ACB:
+     case MPSE_ACSB:
+       acsmBuildMatchStateTrees2WithSnortConf( sc, (ACSM_STRUCT2*) p->obj, build_tree, neg_list_func );
+       return 0;
+
+     default:
+       return 1;
+   }
+}
 #endif //DYNAMIC_PREPROC_CONTEXT
 
 void mpseSetRuleMask ( void *pvoid, BITOP * rm )
@@ -491,6 +592,7 @@ int mpsePrintInfo( void *pvoid )
    {
      case MPSE_AC_BNFA:
      case MPSE_AC_BNFA_Q:
+     case MPSE_AC_BNFA_SIMD:
       bnfaPrintInfo( (bnfa_struct_t*) p->obj );
      break;
      case MPSE_AC:
@@ -511,12 +613,41 @@ int mpsePrintInfo( void *pvoid )
  return 0;
 }
 
+static void mpseHugePagePrintSummary(void)
+{
+    SFHUGE_STATS hs;
+    double total;
+
+    if ( sfhuge_get_mode() == SFHUGE__OFF )
+        return;
+
+    sfhuge_get_stats(&hs);
+    total = (double)(hs.hugetlb + hs.thp + hs.heap);
+
+    if ( total == 0 )
+        return;
+
+    LogMessage("+-[Huge pages: %s]---------------------------------\n",
+        sfhuge_mode_name(sfhuge_get_mode()));
+    LogMessage("| State tables : %.2f MB\n", total / (1024 * 1024));
+    LogMessage("| Explicit     : %.2f MB (%.1f%%)\n",
+        hs.hugetlb / (1024.0 * 1024), 100.0 * hs.hugetlb / total);
+    LogMessage("| Transparent  : %.2f MB (%.1f%%)\n",
+        hs.thp / (1024.0 * 1024), 100.0 * hs.thp / total);
+    LogMessage("| Regular      : %.2f MB (%.1f%%)\n",
+        hs.heap / (1024.0 * 1024), 100.0 * hs.heap / total);
+    if ( hs.fallbacks )
+        LogMessage("| Fallbacks    : " STDu64 "\n", hs.fallbacks);
+    LogMessage("+-------------------------------------------------\n");
+}
+
 int mpsePrintSummary(int method)
 {
     switch (method)
     {
         case MPSE_AC_BNFA:
         case MPSE_AC_BNFA_Q:
+        case MPSE_AC_BNFA_SIMD:
             bnfaPrintSummary();
             break;
         case MPSE_AC:
@@ -545,6 +676,8 @@ int mpsePrintSummary(int method)
             break;
     }
 
+    mpseHugePagePrintSummary();
+
     return 0;
 }
 
@@ -555,6 +688,7 @@ int mpsePrintSummaryWithSnortConfig(SnortConfig *sc, int method)
     {
         case MPSE_AC_BNFA:
         case MPSE_AC_BNFA_Q:
+        case MPSE_AC_BNFA_SIMD:
             bnfaPrintSummary();
             break;
         case MPSE_AC:
@@ -587,6 +721,9 @@ int mpsePrintSummaryWithSnortConfig(SnortConfig *sc, int method)
     IntelPmPrintSummary(sc);
 #endif
 
+    mpseImagePrintSummary();
+    mpseHugePagePrintSummary();
+
     return 0;
 }
 #endif //DYNAMIC_PREPROC_CONTEXT
@@ -617,6 +754,7 @@ int mpseSearch( void *pvoid, const unsigned char * T, int n,
    {
      case MPSE_AC_BNFA:
      case MPSE_AC_BNFA_Q:
+     case MPSE_AC_BNFA_SIMD:
       /* return is actually the state */
       ret = bnfaSearch((bnfa_struct_t*) p->obj, (unsigned char *)T, n,
                        action, data, 0 /* start-state */, current_state );
@@ -688,6 +826,7 @@ int mpseSearchAll( void *pvoid, const unsigned char * T, int n,
 
      case MPSE_AC_BNFA:
      case MPSE_AC_BNFA_Q:
+     case MPSE_AC_BNFA_SIMD:
      case MPSE_AC:
      case MPSE_LOWMEM:
      case MPSE_LOWMEM_Q:
@@ -702,6 +841,29 @@ int mpseSearchAll( void *pvoid, const unsigned char * T, int n,
 
 }
 
+int mpseCanResume(void *pvoid)
+{
+    MPSE * p = (MPSE*)pvoid;
+
+    switch( p->method )
+    {
+        case MPSE_AC_BNFA:
+        case MPSE_AC_BNFA_Q:
+        case MPSE_AC_BNFA_SIMD:
+        case MPSE_AC:
+        case MPSE_ACF:
+        case MPSE_ACF_Q:
+        case MPSE_ACS:
+        case MPSE_ACB:
+        case MPSE_ACSB:
+            return 1;
+
+        default:
+            /* lowmem and intel cpm start over on each call */
+            return 0;
+    }
+}
+
 int mpseGetPatternCount(void *pvoid)
 {
     MPSE * p = (MPSE*)pvoid;
@@ -713,6 +875,7 @@ int mpseGetPatternCount(void *pvoid)
     {
         case MPSE_AC_BNFA:
         case MPSE_AC_BNFA_Q:
+        case MPSE_AC_BNFA_SIMD:
             return bnfaPatternCount((bnfa_struct_t *)p->obj);
         case MPSE_AC:
             return acsmPatternCount((ACSM_STRUCT*)p->obj);
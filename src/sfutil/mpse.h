@@ -87,6 +87,13 @@ int  mpsePrepPatternsWithSnortConf  ( struct _SnortConfig *, void * pvoid,
                                       int ( *build_tree )(struct _SnortConfig *, void *id, void **existing_tree),
                                       int ( *neg_list_func )(void *id, void **list) );
 
+/* Whether mpsePrepPatternsWithSnortConf with no build_tree may run on a
+ * worker thread; the trees are then built with mpseBuildTreesWithSnortConf. */
+int  mpseCompileThreadSafe( void * pvoid );
+int  mpseBuildTreesWithSnortConf  ( struct _SnortConfig *, void * pvoid,
+                                    int ( *build_tree )(struct _SnortConfig *, void *id, void **existing_tree),
+                                    int ( *neg_list_func )(void *id, void **list) );
+
 void mpseSetRuleMask   ( void *pv, BITOP * rm );
 
 int  mpseSearch( void *pv, const unsigned char * T, int n,
@@ -97,6 +104,10 @@ int  mpseSearchAll( void *pv, const unsigned char * T, int n,
                  int ( *action )(void* id, void * tree, int index, void *data, void *neg_list),
                  void * data, int* current_state );
 
+/* nonzero if the search method carries current_state from one call to
+ * the next, so a buffer held in pieces can be searched piece by piece */
+int mpseCanResume(void *pv);
+
 int mpseGetPatternCount(void *pv);
 
 uint64_t mpseGetPatByteCount(void);
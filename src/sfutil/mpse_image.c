@@ -0,0 +1,251 @@
+/*
+** mpse_image.c
+**
+** On disk images of compiled multi-pattern search engine state tables.
+**
+** Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+**
+** LICENSE (GPL)
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+** USA
+**
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "mpse_image.h"
+#include "sfhugepage.h"
+#include "util.h"
+
+#define MPSE_IMAGE_MAGIC    "SFMPSEIM"
+#define MPSE_IMAGE_VERSION  1
+
+typedef struct _MpseImageHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t engine;
+    uint64_t key;
+    uint64_t size;          /* payload bytes */
+    uint64_t checksum;      /* of the payload */
+
+} MpseImageHeader;
+
+/* updated atomically, images are opened and saved by compile threads */
+static unsigned s_loaded = 0;
+static unsigned s_saved = 0;
+static unsigned s_rejected = 0;
+static unsigned s_tmp_seq = 0;
+
+uint64_t mpseImageKey(uint64_t k, const void *p, size_t n)
+{
+    const uint8_t *b = (const uint8_t *)p;
+
+    while ( n-- )
+    {
+        k ^= *b++;
+        k *= 0x100000001b3ULL;
+    }
+    return k;
+}
+
+/* A word at a time; this runs over every byte of every image on load. */
+static uint64_t image_checksum(const void *p, size_t n)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    uint64_t h = MPSE_IMAGE_KEY_INIT ^ n;
+
+    while ( n >= 8 )
+    {
+        uint64_t w;
+        memcpy(&w, b, 8);
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+        b += 8;
+        n -= 8;
+    }
+    while ( n-- )
+    {
+        h = (h ^ *b++) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static void image_path(char *buf, size_t len, const char *dir, int engine, uint64_t key)
+{
+    snprintf(buf, len, "%s/%s-%016llx.img", dir,
+        (engine == MPSE_IMAGE_BNFA) ? "bnfa" : "acsm2", (unsigned long long)key);
+}
+
+int mpseImageOpen(MpseImage *img, const char *dir, int engine, uint64_t key)
+{
+    char path[PATH_MAX];
+    const MpseImageHeader *hdr;
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(img, 0, sizeof(*img));
+    image_path(path, sizeof(path), dir, engine, key);
+
+    fd = open(path, O_RDONLY);
+
+    if ( fd < 0 )
+        return -1;
+
+    if ( fstat(fd, &st) || ((size_t)st.st_size < sizeof(*hdr)) )
+    {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if ( map == MAP_FAILED )
+        return -1;
+
+    hdr = (const MpseImageHeader *)map;
+
+    if ( memcmp(hdr->magic, MPSE_IMAGE_MAGIC, sizeof(hdr->magic)) ||
+         (hdr->version != MPSE_IMAGE_VERSION) ||
+         (hdr->engine != (uint32_t)engine) || (hdr->key != key) ||
+         (hdr->size != st.st_size - sizeof(*hdr)) ||
+         (hdr->checksum != image_checksum(hdr + 1, hdr->size)) )
+    {
+        munmap(map, st.st_size);
+        LogMessage("WARNING: ignoring invalid search engine image %s\n", path);
+        __sync_fetch_and_add(&s_rejected, 1);
+        return -1;
+    }
+
+    /* read only file backed THP, where the kernel supports it */
+    sfhuge_advise(map, st.st_size);
+
+    img->map = map;
+    img->map_size = st.st_size;
+    img->data = (const uint8_t *)(hdr + 1);
+    img->size = hdr->size;
+
+    __sync_fetch_and_add(&s_loaded, 1);
+    return 0;
+}
+
+void mpseImageClose(MpseImage *img)
+{
+    if ( img->map )
+        munmap(img->map, img->map_size);
+
+    memset(img, 0, sizeof(*img));
+}
+
+static int write_all(int fd, const void *p, size_t n)
+{
+    const uint8_t *b = (const uint8_t *)p;
+
+    while ( n )
+    {
+        ssize_t w = write(fd, b, n);
+
+        if ( w < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        b += w;
+        n -= w;
+    }
+    return 0;
+}
+
+int mpseImageSave(const char *dir, int engine, uint64_t key,
+                  const void *payload, size_t size)
+{
+    char path[PATH_MAX], tmp[PATH_MAX];
+    MpseImageHeader hdr;
+    int fd;
+
+    image_path(path, sizeof(path), dir, engine, key);
+    snprintf(tmp, sizeof(tmp), "%s.%u.%u", path, (unsigned)getpid(),
+        __sync_fetch_and_add(&s_tmp_seq, 1));
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MPSE_IMAGE_MAGIC, sizeof(hdr.magic));
+    hdr.version = MPSE_IMAGE_VERSION;
+    hdr.engine = engine;
+    hdr.key = key;
+    hdr.size = size;
+    hdr.checksum = image_checksum(payload, size);
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if ( fd < 0 )
+    {
+        ErrorMessage("Unable to create search engine image %s: %s\n",
+            tmp, strerror(errno));
+        return -1;
+    }
+
+    if ( write_all(fd, &hdr, sizeof(hdr)) || write_all(fd, payload, size) )
+    {
+        ErrorMessage("Unable to write search engine image %s: %s\n",
+            tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+
+    /* concurrent instances (or compile threads) may race to save the same
+     * image; whichever rename lands last wins and both are identical */
+    if ( rename(tmp, path) )
+    {
+        unlink(tmp);
+        return -1;
+    }
+
+    __sync_fetch_and_add(&s_saved, 1);
+    return 0;
+}
+
+void mpseImagePrintSummary(void)
+{
+    if ( !s_loaded && !s_saved && !s_rejected )
+        return;
+
+    LogMessage("+-[Search engine images]-------------------------\n");
+    LogMessage("| Loaded   : %u\n", s_loaded);
+    LogMessage("| Compiled : %u\n", s_saved);
+    if ( s_rejected )
+        LogMessage("| Rejected : %u\n", s_rejected);
+    LogMessage("+-------------------------------------------------\n");
+}
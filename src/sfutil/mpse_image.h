@@ -0,0 +1,100 @@
+/*
+** mpse_image.h
+**
+** On disk images of compiled multi-pattern search engine state tables.
+**
+** Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+**
+** LICENSE (GPL)
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License Version 2 as
+** published by the Free Software Foundation.  You may not use, modify or
+** distribute this program under any other version of the GNU General
+** Public License.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+** USA
+**
+*/
+
+#ifndef MPSE_IMAGE_H
+#define MPSE_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+*  Compiling the automaton of a large rule group is by far the slowest
+*  part of building the detection engine.  An engine that is given an
+*  image directory hashes its patterns and compile settings into a key
+*  and looks for an image file with that key before compiling.  Images
+*  are mapped read only and the state tables are used in place, so all
+*  snort instances on a host share the same pages.  Pattern match lists
+*  refer to patterns by index and are rebuilt on load; the rule option
+*  trees hanging off them are always rebuilt.
+*
+*  Each file starts with a versioned header carrying the key and a
+*  checksum of the payload.  Anything that does not check out is ignored
+*  and the engine compiles (and saves) as usual.
+*/
+enum {
+    MPSE_IMAGE_BNFA  = 1,
+    MPSE_IMAGE_ACSM2 = 2
+};
+
+#define MPSE_IMAGE_KEY_INIT  0xcbf29ce484222325ULL
+
+typedef struct _MpseImage
+{
+    void *map;              /* whole file */
+    size_t map_size;
+
+    const uint8_t *data;    /* payload, 8 byte aligned */
+    size_t size;
+
+} MpseImage;
+
+/* Folds n bytes into the running key k. */
+uint64_t mpseImageKey(uint64_t k, const void *p, size_t n);
+
+/* Maps the image for engine/key from dir.  Returns 0 if a valid image was
+ * found, -1 otherwise. */
+int mpseImageOpen(MpseImage *, const char *dir, int engine, uint64_t key);
+void mpseImageClose(MpseImage *);
+
+/* Writes payload as the image for engine/key; the file appears atomically. */
+int mpseImageSave(const char *dir, int engine, uint64_t key,
+                  const void *payload, size_t size);
+
+/* Bounds checked payload reader for the loaders. */
+typedef struct _MpseImageReader
+{
+    const uint8_t *p, *end;
+
+} MpseImageReader;
+
+static inline const void * mpseImageRead(MpseImageReader *r, size_t n)
+{
+    const uint8_t *p = r->p;
+
+    /* keep every item 4 byte aligned */
+    n = (n + 3) & ~(size_t)3;
+
+    if ( (size_t)(r->end - p) < n )
+        return NULL;
+
+    r->p += n;
+    return p;
+}
+
+void mpseImagePrintSummary(void);
+
+#endif
@@ -0,0 +1,274 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+  sfhugepage.c
+
+  Every table starts with a header (one cache line) recording how it was
+  allocated so a single free works for all of them.  Tables smaller than
+  half a huge page stay on the heap; rounding them up would waste more
+  than the TLB entries they save.  Allocation happens on the compile
+  threads, so the counters are updated atomically.
+*/
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sfhugepage.h"
+#include "sfnuma.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* from linux/mman.h; older headers lack the page size selectors */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define HUGE_HDR_SIZE  64
+#define HUGE_2M        ((size_t)2 << 20)
+#define HUGE_1G        ((size_t)1 << 30)
+
+enum
+{
+    HUGE_KIND__HEAP = 0,
+    HUGE_KIND__HUGETLB,
+    HUGE_KIND__THP
+};
+
+typedef struct _HugeHdr
+{
+    void *base;
+    size_t map_size;    /* 0 for the heap */
+    size_t size;
+    int kind;
+
+} HugeHdr;
+
+static SfHugeMode s_mode = SFHUGE__OFF;
+
+static uint64_t s_hugetlb = 0;
+static uint64_t s_thp = 0;
+static uint64_t s_heap = 0;
+static uint64_t s_fallbacks = 0;
+
+static inline size_t round_up(size_t n, size_t a)
+{
+    return (n + a - 1) & ~(a - 1);
+}
+
+void sfhuge_set_mode(SfHugeMode mode)
+{
+    s_mode = mode;
+}
+
+SfHugeMode sfhuge_get_mode(void)
+{
+    return s_mode;
+}
+
+const char * sfhuge_mode_name(SfHugeMode mode)
+{
+    switch ( mode )
+    {
+        case SFHUGE__THP: return "thp";
+        case SFHUGE__2M:  return "2m";
+        case SFHUGE__1G:  return "1g";
+        default:          break;
+    }
+    return "off";
+}
+
+static void * map_hugetlb(size_t len, int page_flag)
+{
+#ifdef MAP_HUGETLB
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | page_flag, -1, 0);
+
+    return (p == MAP_FAILED) ? NULL : p;
+#else
+    (void)len;
+    (void)page_flag;
+    return NULL;
+#endif
+}
+
+/* A 2MB aligned anonymous mapping marked for transparent huge pages. */
+static void * map_thp(size_t len)
+{
+#ifdef MADV_HUGEPAGE
+    uint8_t *p, *a;
+
+    p = mmap(NULL, len + HUGE_2M, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if ( p == MAP_FAILED )
+        return NULL;
+
+    /* trim to alignment so the first and last pages can be huge too */
+    a = (uint8_t *)round_up((uintptr_t)p, HUGE_2M);
+
+    if ( a > p )
+        munmap(p, a - p);
+
+    munmap(a + len, (p + len + HUGE_2M) - (a + len));
+
+    if ( madvise(a, len, MADV_HUGEPAGE) )
+    {
+        /* THP is not available; the heap will do as well */
+        munmap(a, len);
+        return NULL;
+    }
+    return a;
+#else
+    (void)len;
+    return NULL;
+#endif
+}
+
+void * sfhuge_alloc(size_t n)
+{
+    size_t len = n + HUGE_HDR_SIZE;
+    size_t map_size = 0;
+    void *base = NULL;
+    int kind = HUGE_KIND__HEAP;
+    HugeHdr *hdr;
+
+    if ( (s_mode >= SFHUGE__1G) && (len >= HUGE_1G / 2) )
+    {
+        map_size = round_up(len, HUGE_1G);
+
+        if ( (base = map_hugetlb(map_size, MAP_HUGE_1GB)) )
+            kind = HUGE_KIND__HUGETLB;
+    }
+
+    if ( !base && (s_mode >= SFHUGE__2M) && (len >= HUGE_2M / 2) )
+    {
+        map_size = round_up(len, HUGE_2M);
+
+        if ( (base = map_hugetlb(map_size, MAP_HUGE_2MB)) )
+            kind = HUGE_KIND__HUGETLB;
+    }
+
+    if ( !base && (s_mode >= SFHUGE__THP) && (len >= HUGE_2M / 2) )
+    {
+        map_size = round_up(len, HUGE_2M);
+
+        if ( (base = map_thp(map_size)) )
+            kind = HUGE_KIND__THP;
+        else
+            __sync_fetch_and_add(&s_fallbacks, 1);
+    }
+
+    if ( base )
+    {
+        /* anonymous mappings are already zeroed and not yet touched */
+        sfnuma_bind(base, map_size);
+    }
+    else
+    {
+        map_size = 0;
+
+        if ( posix_memalign(&base, HUGE_HDR_SIZE, len) )
+            return NULL;
+
+        sfnuma_bind(base, len);
+        memset(base, 0, len);
+    }
+
+    hdr = (HugeHdr *)base;
+    hdr->base = base;
+    hdr->map_size = map_size;
+    hdr->size = n;
+    hdr->kind = kind;
+
+    switch ( kind )
+    {
+        case HUGE_KIND__HUGETLB: __sync_fetch_and_add(&s_hugetlb, n); break;
+        case HUGE_KIND__THP:     __sync_fetch_and_add(&s_thp, n);     break;
+        default:                 __sync_fetch_and_add(&s_heap, n);    break;
+    }
+
+    return (uint8_t *)base + HUGE_HDR_SIZE;
+}
+
+void sfhuge_free(void *p)
+{
+    HugeHdr *hdr;
+
+    if ( !p )
+        return;
+
+    hdr = (HugeHdr *)((uint8_t *)p - HUGE_HDR_SIZE);
+
+    switch ( hdr->kind )
+    {
+        case HUGE_KIND__HUGETLB: __sync_fetch_and_sub(&s_hugetlb, hdr->size); break;
+        case HUGE_KIND__THP:     __sync_fetch_and_sub(&s_thp, hdr->size);     break;
+        default:                 __sync_fetch_and_sub(&s_heap, hdr->size);    break;
+    }
+
+    if ( hdr->map_size )
+        munmap(hdr->base, hdr->map_size);
+    else
+        free(hdr->base);
+}
+
+void sfhuge_advise(void *p, size_t n)
+{
+#ifdef MADV_HUGEPAGE
+    uintptr_t start, end;
+
+    if ( (s_mode == SFHUGE__OFF) || !p )
+        return;
+
+    start = round_up((uintptr_t)p, HUGE_2M);
+    end = ((uintptr_t)p + n) & ~(uintptr_t)(HUGE_2M - 1);
+
+    /* nothing to gain below one whole huge page */
+    if ( start < end )
+        (void)madvise((void *)start, end - start, MADV_HUGEPAGE);
+#else
+    (void)p;
+    (void)n;
+#endif
+}
+
+void sfhuge_get_stats(SFHUGE_STATS *stats)
+{
+    stats->hugetlb = s_hugetlb;
+    stats->thp = s_thp;
+    stats->heap = s_heap;
+    stats->fallbacks = s_fallbacks;
+}
@@ -0,0 +1,77 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+**  sfhugepage.h
+**
+**  Huge page backed allocation for large tables that are read at random,
+**  mainly the pattern matcher state tables, where a lookup per payload
+**  byte makes TLB misses the dominant cost.
+**
+**  Large tables are mapped from explicit huge pages (MAP_HUGETLB, 2MB or
+**  1GB) or from ordinary anonymous memory marked MADV_HUGEPAGE so
+**  transparent huge pages can back it.  Each step falls back to the next
+**  one if the kernel refuses; small tables and the last resort come from
+**  the heap.  Tables are bound to the instance's NUMA node (sfnuma.h).
+*/
+#ifndef __SF_HUGEPAGE_H__
+#define __SF_HUGEPAGE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    SFHUGE__OFF = 0,    /* heap only */
+    SFHUGE__THP,        /* madvise(MADV_HUGEPAGE) */
+    SFHUGE__2M,         /* MAP_HUGETLB, then THP */
+    SFHUGE__1G          /* 1GB MAP_HUGETLB for very large tables, then 2M */
+
+} SfHugeMode;
+
+typedef struct
+{
+    /* live bytes requested, by where they ended up */
+    uint64_t hugetlb;
+    uint64_t thp;
+    uint64_t heap;
+
+    /* allocations that wanted huge pages and did not get them */
+    uint64_t fallbacks;
+
+} SFHUGE_STATS;
+
+/* Applies to tables allocated from now on. */
+void       sfhuge_set_mode(SfHugeMode);
+SfHugeMode sfhuge_get_mode(void);
+const char * sfhuge_mode_name(SfHugeMode);
+
+/* Returns n zeroed bytes, 64 byte aligned, or NULL. */
+void     * sfhuge_alloc(size_t n);
+void       sfhuge_free(void *);
+
+/* Asks for transparent huge pages on an existing mapping; a no op unless
+ * huge pages are enabled. */
+void       sfhuge_advise(void *p, size_t n);
+
+void       sfhuge_get_stats(SFHUGE_STATS *);
+
+#endif
@@ -0,0 +1,302 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+  sfnuma.c
+
+  Topology comes from sysfs and affinity and policies go through the raw
+  system calls so there is no dependency on libnuma (or _GNU_SOURCE).
+*/
+#include <sys/types.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef LINUX
+#include <sys/syscall.h>
+#endif
+
+#include "sfnuma.h"
+#include "util.h"
+
+#if defined(LINUX) && defined(SYS_mbind) && defined(SYS_set_mempolicy) && \
+    defined(SYS_sched_getaffinity)
+#define SFNUMA_LINUX
+#endif
+
+#define NUMA_SYSFS_NODE  "/sys/devices/system/node"
+#define NUMA_SYSFS_CPU   "/sys/devices/system/cpu"
+#define NUMA_SYSFS_NET   "/sys/class/net"
+
+/* from linux/mempolicy.h */
+#define NUMA_MPOL_PREFERRED  1
+#define NUMA_MPOL_MF_MOVE    (1 << 1)
+
+#define NUMA_MAX_NODES   1024
+#define NUMA_MAX_CPUS    4096
+#define NUMA_MASK_BITS   (8 * sizeof(unsigned long))
+
+static int s_node = -1;
+static int s_nodes = 0;
+static uint64_t s_bound = 0;
+static unsigned s_bind_failed = 0;
+
+/* node<N> entry in a sysfs directory */
+static int node_entry(const char *name)
+{
+    const char *s = name + 4;
+
+    if ( strncmp(name, "node", 4) || !isdigit((int)*s) )
+        return -1;
+
+    while ( isdigit((int)*s) )
+        s++;
+
+    return *s ? -1 : atoi(name + 4);
+}
+
+int sfnuma_num_nodes(void)
+{
+    struct dirent *de;
+    DIR *dir;
+    int num_nodes = 0;
+
+    if ( !(dir = opendir(NUMA_SYSFS_NODE)) )
+        return 0;
+
+    while ( (de = readdir(dir)) )
+    {
+        if ( node_entry(de->d_name) >= 0 )
+            num_nodes++;
+    }
+    closedir(dir);
+
+    return num_nodes;
+}
+
+int sfnuma_cpu_node(unsigned cpu)
+{
+    char path[256];
+    struct dirent *de;
+    DIR *dir;
+    int node = -1;
+
+    snprintf(path, sizeof(path), NUMA_SYSFS_CPU "/cpu%u", cpu);
+
+    if ( !(dir = opendir(path)) )
+        return -1;
+
+    while ( (de = readdir(dir)) )
+    {
+        if ( (node = node_entry(de->d_name)) >= 0 )
+            break;
+    }
+    closedir(dir);
+
+    return node;
+}
+
+int sfnuma_intf_node(const char *intf)
+{
+    char name[64], path[256];
+    FILE *fp;
+    size_t n;
+    int node = -1;
+
+    if ( !intf )
+        return -1;
+
+    /* inline pairs and lists: the first interface decides */
+    n = strcspn(intf, ":,");
+
+    if ( !n || (n >= sizeof(name)) )
+        return -1;
+
+    memcpy(name, intf, n);
+    name[n] = '\0';
+
+    snprintf(path, sizeof(path), NUMA_SYSFS_NET "/%s/device/numa_node", name);
+
+    if ( !(fp = fopen(path, "r")) )
+        return -1;
+
+    if ( fscanf(fp, "%d", &node) != 1 )
+        node = -1;
+
+    fclose(fp);
+
+    /* -1 is what the kernel reports for devices without affinity */
+    return (node < 0) ? -1 : node;
+}
+
+#ifdef SFNUMA_LINUX
+/* The node all allowed cpus are on, -1 if they span nodes. */
+static int affinity_node(void)
+{
+    unsigned long set[NUMA_MAX_CPUS / NUMA_MASK_BITS];
+    unsigned cpu, ncpus;
+    long len;
+    int node = -1;
+
+    /* returns the number of bytes of mask the kernel filled in */
+    len = syscall(SYS_sched_getaffinity, 0, sizeof(set), set);
+
+    if ( len <= 0 )
+        return -1;
+
+    ncpus = (unsigned)len * 8;
+
+    for ( cpu = 0; cpu < ncpus; cpu++ )
+    {
+        int n;
+
+        if ( !(set[cpu / NUMA_MASK_BITS] & (1UL << (cpu % NUMA_MASK_BITS))) )
+            continue;
+
+        n = sfnuma_cpu_node(cpu);
+
+        if ( (n < 0) || ((node >= 0) && (n != node)) )
+            return -1;
+
+        node = n;
+    }
+    return node;
+}
+
+static void node_mask(unsigned long *mask, size_t words, int node)
+{
+    memset(mask, 0, words * sizeof(*mask));
+    mask[node / NUMA_MASK_BITS] = 1UL << (node % NUMA_MASK_BITS);
+}
+#endif
+
+int sfnuma_init(const char *intf)
+{
+#ifdef SFNUMA_LINUX
+    unsigned long mask[NUMA_MAX_NODES / NUMA_MASK_BITS];
+    int cpu_node, intf_node, node;
+
+    s_node = -1;
+    s_nodes = sfnuma_num_nodes();
+
+    if ( s_nodes < 2 )
+        return -1;
+
+    cpu_node = affinity_node();
+    intf_node = sfnuma_intf_node(intf);
+    node = (cpu_node >= 0) ? cpu_node : intf_node;
+
+    if ( (cpu_node >= 0) && (intf_node >= 0) && (cpu_node != intf_node) )
+    {
+        LogMessage("WARNING: NUMA: interface %s is on node %d but this "
+            "instance is pinned to node %d.\n", intf, intf_node, cpu_node);
+    }
+
+    if ( (node < 0) || (node >= NUMA_MAX_NODES) )
+    {
+        LogMessage("NUMA: %d nodes, instance is not pinned to a node; "
+            "using the default memory placement\n", s_nodes);
+        return -1;
+    }
+
+    node_mask(mask, sizeof(mask) / sizeof(*mask), node);
+
+    if ( syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1) )
+    {
+        LogMessage("WARNING: NUMA: could not prefer node %d: %s\n",
+            node, strerror(errno));
+        return -1;
+    }
+    s_node = node;
+
+    if ( cpu_node >= 0 )
+        LogMessage("NUMA: placing instance memory on node %d of %d (cpu affinity)\n",
+            node, s_nodes);
+    else
+        LogMessage("NUMA: placing instance memory on node %d of %d (interface %s)\n",
+            node, s_nodes, intf);
+
+    return node;
+#else
+    (void)intf;
+    return -1;
+#endif
+}
+
+int sfnuma_node(void)
+{
+    return s_node;
+}
+
+void sfnuma_bind(void *p, size_t n)
+{
+#ifdef SFNUMA_LINUX
+    unsigned long mask[NUMA_MAX_NODES / NUMA_MASK_BITS];
+    uintptr_t page, start, end;
+
+    if ( (s_node < 0) || !p || !n )
+        return;
+
+    /* only pages wholly inside the region; the rest may be shared with
+     * other allocations */
+    page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    start = ((uintptr_t)p + page - 1) & ~(page - 1);
+    end = ((uintptr_t)p + n) & ~(page - 1);
+
+    if ( start >= end )
+        return;
+
+    node_mask(mask, sizeof(mask) / sizeof(*mask), s_node);
+
+    if ( syscall(SYS_mbind, (void *)start, (unsigned long)(end - start),
+            NUMA_MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1, NUMA_MPOL_MF_MOVE) )
+    {
+        s_bind_failed++;
+        return;
+    }
+    s_bound += end - start;
+#else
+    (void)p;
+    (void)n;
+#endif
+}
+
+void sfnuma_print_summary(void)
+{
+    if ( s_node < 0 )
+        return;
+
+    LogMessage("+-[NUMA placement]-------------------------------\n");
+    LogMessage("| Node     : %d of %d\n", s_node, s_nodes);
+    LogMessage("| Bound    : %.2f MB\n", s_bound / (1024.0 * 1024.0));
+    if ( s_bind_failed )
+        LogMessage("| Failed   : %u\n", s_bind_failed);
+    LogMessage("+-------------------------------------------------\n");
+}
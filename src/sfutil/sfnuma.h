@@ -0,0 +1,60 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+**  sfnuma.h
+**
+**  NUMA placement of per instance memory.  At startup the instance picks
+**  a home node: the node of the CPUs it is pinned to or, if it is not
+**  pinned to a single node, the node the capture interface is attached
+**  to.  The home node becomes the preferred node for everything the
+**  instance allocates from then on (threads and workers inherit it), and
+**  the large tables and pools are bound to it explicitly so pages that
+**  were already touched elsewhere are moved.  Binding is preferred, not
+**  strict; a full node falls back to the others instead of failing.
+**
+**  Everything is a no op on single node hosts and on other platforms.
+*/
+#ifndef __SF_NUMA_H__
+#define __SF_NUMA_H__
+
+#include <stddef.h>
+
+/* Number of nodes on the host, 0 if unknown. */
+int  sfnuma_num_nodes(void);
+
+/* Node of the given cpu or network interface, -1 if unknown. */
+int  sfnuma_cpu_node(unsigned cpu);
+int  sfnuma_intf_node(const char *intf);
+
+/* Picks and reports the home node; intf may be NULL.  Returns the node
+ * or -1 if memory is left to the default policy. */
+int  sfnuma_init(const char *intf);
+
+/* Home node or -1. */
+int  sfnuma_node(void);
+
+/* Binds the whole pages of [p, p+n) to the home node. */
+void sfnuma_bind(void *p, size_t n);
+
+void sfnuma_print_summary(void);
+
+#endif
@@ -0,0 +1,792 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+  sfoahash.c
+
+  The index has a power of 2 number of slots, at most 3/4 of which hold
+  nodes.  The low bits of the hash pick the first group of 16 slots and
+  the top 7 bits are the tag kept in the control byte; groups are probed
+  in triangular order so every group is visited.  A lookup stops at the
+  first group with an empty slot.  Removing a node leaves a tombstone
+  unless its group already has an empty slot, and the index is rebuilt
+  from the node array when tombstones use up the spare slots.
+
+  The node array is reserved with mmap and only touched as nodes are
+  handed out, so memory follows the peak number of nodes rather than
+  the configured maximum.
+
+  A lookup sets NODE_REF only if it is clear, so hot nodes are not even
+  written.  The clock hand walks the carved part of the node array; at
+  most two turns find a victim since the first clears every bit.
+
+  The wheel links nodes by index in the two words the header has left,
+  so it costs nothing per node and no pointers into the index, which is
+  rebuilt independently.  A head node's prev holds its list with the top
+  bit set, which is why the node count is limited to 2^31.  When the
+  wheel reaches a second the whole bucket is moved to a due list that
+  sfoahash_expired pops from, so a node rescheduled into the same bucket
+  a turn later is not returned again right away.
+*/
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sfoahash.h"
+#include "sfnuma.h"
+#include "sfhugepage.h"
+
+#if defined(__SSE2__)
+#define SFOAHASH_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define GROUP_SIZE    16
+
+#define CTRL_EMPTY    0x80
+#define CTRL_DELETED  0xFE    /* full slots are 0x00 - 0x7F */
+
+#define HASH_TAG(h)   ((uint8_t)((h) >> 25))
+
+#define NODE_USED     0x01
+#define NODE_REF      0x02    /* looked up since the clock hand passed */
+#define NODE_TIMED    0x04    /* on the wheel or the due list */
+
+#define NODE_ALIGN    16
+
+typedef struct
+{
+    uint32_t hash;      /* next free node while on the free list */
+    uint32_t flags;
+    uint32_t wprev;     /* wheel bucket or due list */
+    uint32_t wnext;
+    /* key follows, then data at data_offset */
+} SFOAHashNode;
+
+struct _SFOAHASH
+{
+    uint8_t *ctrl;
+    uint32_t *slots;          /* node index per slot */
+    uint32_t group_mask;
+    uint32_t num_slots;
+    uint32_t max_used;        /* count + tombstones before a rebuild */
+    uint32_t tombstones;
+
+    uint8_t *nodes;
+    size_t node_size;
+    size_t data_offset;
+    size_t map_size;          /* 0 if the nodes came from calloc */
+    uint32_t max_nodes;
+    uint32_t nodes_carved;    /* nodes taken from the untouched tail */
+    uint32_t free_list;
+    uint32_t count;
+    uint32_t hand;            /* clock */
+
+    uint32_t *wheel;          /* bucket heads, then the due list */
+    uint32_t wheel_mask;
+    time_t wheel_time;        /* last second moved to the due list */
+
+    size_t keysize;
+    size_t datasize;
+    SFOAHASH_HASH_FCN hash_fcn;
+    SFOAHASH_CMP_FCN cmp_fcn;
+};
+
+#define NO_NODE     UINT32_MAX
+#define WHEEL_LIST  0x80000000
+#define WHEEL_MAX   65536
+
+static inline SFOAHashNode * node_at(const SFOAHASH *t, uint32_t i)
+{
+    return (SFOAHashNode *)(t->nodes + (size_t)i * t->node_size);
+}
+
+static inline uint32_t node_index(const SFOAHASH *t, const SFOAHashNode *n)
+{
+    return (uint32_t)(((const uint8_t *)n - t->nodes) / t->node_size);
+}
+
+static inline void * node_key(SFOAHashNode *n)
+{
+    return (uint8_t *)n + sizeof(SFOAHashNode);
+}
+
+static inline void * node_data(const SFOAHASH *t, SFOAHashNode *n)
+{
+    return (uint8_t *)n + t->data_offset;
+}
+
+static inline SFOAHashNode * data_node(const SFOAHASH *t, const void *data)
+{
+    return (SFOAHashNode *)((const uint8_t *)data - t->data_offset);
+}
+
+static inline void node_ref(SFOAHashNode *n)
+{
+    if ( !(n->flags & NODE_REF) )
+        n->flags |= NODE_REF;
+}
+
+static void wheel_link(SFOAHASH *t, SFOAHashNode *n, uint32_t i, uint32_t list)
+{
+    uint32_t head = t->wheel[list];
+
+    n->wprev = WHEEL_LIST | list;
+    n->wnext = head;
+
+    if ( head != NO_NODE )
+        node_at(t, head)->wprev = i;
+
+    t->wheel[list] = i;
+    n->flags |= NODE_TIMED;
+}
+
+static void wheel_unlink(SFOAHASH *t, SFOAHashNode *n)
+{
+    if ( n->wprev & WHEEL_LIST )
+        t->wheel[n->wprev & ~WHEEL_LIST] = n->wnext;
+    else
+        node_at(t, n->wprev)->wnext = n->wnext;
+
+    if ( n->wnext != NO_NODE )
+        node_at(t, n->wnext)->wprev = n->wprev;
+
+    n->flags &= ~NODE_TIMED;
+}
+
+static inline unsigned first_bit(uint32_t m)
+{
+#ifdef __GNUC__
+    return __builtin_ctz(m);
+#else
+    unsigned i = 0;
+
+    while ( !(m & 1) )
+        m >>= 1, i++;
+
+    return i;
+#endif
+}
+
+/* bit i is set if control byte i of the group equals c */
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t c)
+{
+#ifdef SFOAHASH_SSE2
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)c)));
+#else
+    uint32_t m = 0;
+    unsigned i;
+
+    for ( i = 0; i < GROUP_SIZE; i++ )
+        if ( ctrl[i] == c )
+            m |= 1 << i;
+
+    return m;
+#endif
+}
+
+/* bit i is set if slot i of the group is empty or deleted */
+static inline uint32_t group_match_free(const uint8_t *ctrl)
+{
+#ifdef SFOAHASH_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    uint32_t m = 0;
+    unsigned i;
+
+    for ( i = 0; i < GROUP_SIZE; i++ )
+        if ( ctrl[i] & 0x80 )
+            m |= 1 << i;
+
+    return m;
+#endif
+}
+
+static uint32_t default_hash(const void *key, size_t n)
+{
+    const uint8_t *d = (const uint8_t *)key;
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+    uint64_t w;
+
+    while ( n >= 8 )
+    {
+        memcpy(&w, d, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+        d += 8;
+        n -= 8;
+    }
+    if ( n )
+    {
+        w = 0;
+        memcpy(&w, d, n);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+    }
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+
+    return (uint32_t)h;
+}
+
+static uint32_t find_free_slot(const SFOAHASH *t, uint32_t hash)
+{
+    uint32_t g = hash & t->group_mask;
+    uint32_t step = 0;
+    uint32_t m;
+
+    while ( !(m = group_match_free(t->ctrl + (size_t)g * GROUP_SIZE)) )
+        g = (g + ++step) & t->group_mask;
+
+    return g * GROUP_SIZE + first_bit(m);
+}
+
+static void set_slot(SFOAHASH *t, uint32_t slot, uint32_t hash, uint32_t node)
+{
+    t->ctrl[slot] = HASH_TAG(hash);
+    t->slots[slot] = node;
+}
+
+/* Find the slot holding node i, or the first node with a matching key
+ * when key is not NULL. */
+static uint32_t find_slot(const SFOAHASH *t, uint32_t hash, const void *key, uint32_t node)
+{
+    uint8_t tag = HASH_TAG(hash);
+    uint32_t g = hash & t->group_mask;
+    uint32_t step = 0;
+
+    for ( ;; )
+    {
+        const uint8_t *ctrl = t->ctrl + (size_t)g * GROUP_SIZE;
+        uint32_t m = group_match(ctrl, tag);
+
+        while ( m )
+        {
+            uint32_t slot = g * GROUP_SIZE + first_bit(m);
+            uint32_t i = t->slots[slot];
+
+            if ( key )
+            {
+                SFOAHashNode *n = node_at(t, i);
+
+                if ( (n->hash == hash) && !t->cmp_fcn(node_key(n), key, t->keysize) )
+                    return slot;
+            }
+            else if ( i == node )
+                return slot;
+
+            m &= m - 1;
+        }
+        if ( group_match(ctrl, CTRL_EMPTY) || (step == t->group_mask) )
+            return NO_NODE;
+
+        g = (g + ++step) & t->group_mask;
+    }
+}
+
+static void rebuild_index(SFOAHASH *t)
+{
+    uint32_t i;
+
+    memset(t->ctrl, CTRL_EMPTY, t->num_slots);
+    t->tombstones = 0;
+
+    for ( i = 0; i < t->nodes_carved; i++ )
+    {
+        SFOAHashNode *n = node_at(t, i);
+
+        if ( n->flags & NODE_USED )
+            set_slot(t, find_free_slot(t, n->hash), n->hash, i);
+    }
+}
+
+SFOAHASH * sfoahash_new(uint32_t max_nodes, size_t keysize, size_t datasize,
+                        SFOAHASH_HASH_FCN hash_fcn, SFOAHASH_CMP_FCN cmp_fcn)
+{
+    SFOAHASH *t;
+    uint64_t want;
+    uint32_t slots = GROUP_SIZE;
+
+    if ( !max_nodes || !keysize || (max_nodes >= WHEEL_LIST) )
+        return NULL;
+
+    /* keep the index at most 3/4 full */
+    want = (uint64_t)max_nodes + max_nodes / 3 + 1;
+
+    while ( slots < want )
+    {
+        if ( slots & 0x80000000 )
+            return NULL;
+        slots <<= 1;
+    }
+
+    t = (SFOAHASH *)calloc(1, sizeof(*t));
+
+    if ( !t )
+        return NULL;
+
+    t->num_slots = slots;
+    t->group_mask = slots / GROUP_SIZE - 1;
+    t->max_used = slots - slots / 8;
+
+    t->keysize = keysize;
+    t->datasize = datasize;
+    t->hash_fcn = hash_fcn ? hash_fcn : default_hash;
+    t->cmp_fcn = cmp_fcn ? cmp_fcn : memcmp;
+
+    t->data_offset = (sizeof(SFOAHashNode) + keysize + NODE_ALIGN - 1) & ~(size_t)(NODE_ALIGN - 1);
+    t->node_size = (t->data_offset + datasize + NODE_ALIGN - 1) & ~(size_t)(NODE_ALIGN - 1);
+    t->max_nodes = max_nodes;
+    t->free_list = NO_NODE;
+
+    t->ctrl = (uint8_t *)malloc(slots);
+    t->slots = (uint32_t *)malloc((size_t)slots * sizeof(*t->slots));
+
+    t->map_size = (size_t)max_nodes * t->node_size;
+    t->nodes = mmap(NULL, t->map_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if ( t->nodes == MAP_FAILED )
+    {
+        t->map_size = 0;
+        t->nodes = (uint8_t *)calloc(max_nodes, t->node_size);
+    }
+
+    if ( !t->ctrl || !t->slots || !t->nodes )
+    {
+        sfoahash_delete(t);
+        return NULL;
+    }
+    sfnuma_bind(t->ctrl, slots);
+    sfnuma_bind(t->slots, (size_t)slots * sizeof(*t->slots));
+    sfnuma_bind(t->nodes, (size_t)max_nodes * t->node_size);
+
+    sfhuge_advise(t->ctrl, slots);
+    sfhuge_advise(t->slots, (size_t)slots * sizeof(*t->slots));
+    sfhuge_advise(t->nodes, (size_t)max_nodes * t->node_size);
+
+    memset(t->ctrl, CTRL_EMPTY, slots);
+
+    return t;
+}
+
+void sfoahash_delete(SFOAHASH *t)
+{
+    if ( !t )
+        return;
+
+    if ( t->map_size )
+        munmap(t->nodes, t->map_size);
+    else
+        free(t->nodes);
+
+    free(t->wheel);
+    free(t->slots);
+    free(t->ctrl);
+    free(t);
+}
+
+void * sfoahash_find(SFOAHASH *t, const void *key)
+{
+    uint32_t slot = find_slot(t, t->hash_fcn(key, t->keysize), key, 0);
+    SFOAHashNode *n;
+
+    if ( slot == NO_NODE )
+        return NULL;
+
+    n = node_at(t, t->slots[slot]);
+    node_ref(n);
+
+    return node_data(t, n);
+}
+
+void * sfoahash_get(SFOAHASH *t, const void *key)
+{
+    uint32_t hash = t->hash_fcn(key, t->keysize);
+    uint32_t slot = find_slot(t, hash, key, 0);
+    SFOAHashNode *n;
+    uint32_t i;
+
+    if ( slot != NO_NODE )
+    {
+        n = node_at(t, t->slots[slot]);
+        node_ref(n);
+        return node_data(t, n);
+    }
+
+    if ( t->free_list != NO_NODE )
+    {
+        i = t->free_list;
+        t->free_list = node_at(t, i)->hash;
+    }
+    else if ( t->nodes_carved < t->max_nodes )
+        i = t->nodes_carved++;
+
+    else
+        return NULL;
+
+    if ( t->count + t->tombstones >= t->max_used )
+        rebuild_index(t);
+
+    slot = find_free_slot(t, hash);
+
+    if ( t->ctrl[slot] == CTRL_DELETED )
+        t->tombstones--;
+
+    set_slot(t, slot, hash, i);
+
+    n = node_at(t, i);
+    n->hash = hash;
+    n->flags = NODE_USED | NODE_REF;
+    memcpy(node_key(n), key, t->keysize);
+
+    t->count++;
+
+    return node_data(t, n);
+}
+
+int sfoahash_remove(SFOAHASH *t, void *data)
+{
+    SFOAHashNode *n = data_node(t, data);
+    uint32_t i = node_index(t, n);
+    uint32_t slot;
+
+    if ( (i >= t->nodes_carved) || !(n->flags & NODE_USED) )
+        return SFOAHASH_ERR;
+
+    slot = find_slot(t, n->hash, NULL, i);
+
+    if ( slot == NO_NODE )
+        return SFOAHASH_ERR;
+
+    /* a lookup that got past this group would have stopped at the empty slot */
+    if ( group_match(t->ctrl + (slot & ~(uint32_t)(GROUP_SIZE - 1)), CTRL_EMPTY) )
+        t->ctrl[slot] = CTRL_EMPTY;
+    else
+    {
+        t->ctrl[slot] = CTRL_DELETED;
+        t->tombstones++;
+    }
+
+    if ( n->flags & NODE_TIMED )
+        wheel_unlink(t, n);
+
+    n->flags = 0;
+    n->hash = t->free_list;
+    t->free_list = i;
+    t->count--;
+
+    return SFOAHASH_OK;
+}
+
+void * sfoahash_key(const SFOAHASH *t, const void *data)
+{
+    return node_key(data_node(t, data));
+}
+
+void sfoahash_touch(SFOAHASH *t, void *data)
+{
+    node_ref(data_node(t, data));
+}
+
+void * sfoahash_victim(SFOAHASH *t)
+{
+    uint64_t steps;
+
+    if ( !t->count )
+        return NULL;
+
+    for ( steps = 0; steps <= 2 * (uint64_t)t->nodes_carved; steps++ )
+    {
+        SFOAHashNode *n;
+
+        if ( t->hand >= t->nodes_carved )
+            t->hand = 0;
+
+        n = node_at(t, t->hand++);
+
+        if ( !(n->flags & NODE_USED) )
+            continue;
+
+        if ( n->flags & NODE_REF )
+        {
+            n->flags &= ~NODE_REF;
+            continue;
+        }
+        return node_data(t, n);
+    }
+    return NULL;
+}
+
+int sfoahash_wheel(SFOAHASH *t, unsigned slots)
+{
+    uint32_t n = 1, i;
+
+    if ( t->wheel )
+        return SFOAHASH_ERR;
+
+    while ( (n < slots) && (n < WHEEL_MAX) )
+        n <<= 1;
+
+    /* one more head for the due list */
+    t->wheel = (uint32_t *)malloc((n + 1) * sizeof(*t->wheel));
+
+    if ( !t->wheel )
+        return SFOAHASH_ERR;
+
+    for ( i = 0; i <= n; i++ )
+        t->wheel[i] = NO_NODE;
+
+    t->wheel_mask = n - 1;
+    return SFOAHASH_OK;
+}
+
+void sfoahash_schedule(SFOAHASH *t, void *data, time_t expires)
+{
+    SFOAHashNode *n = data_node(t, data);
+
+    if ( !t->wheel )
+        return;
+
+    if ( n->flags & NODE_TIMED )
+        wheel_unlink(t, n);
+
+    if ( expires <= t->wheel_time )
+        expires = t->wheel_time + 1;
+
+    wheel_link(t, n, node_index(t, n), (uint32_t)expires & t->wheel_mask);
+}
+
+void * sfoahash_expired(SFOAHASH *t, time_t now)
+{
+    uint32_t due = t->wheel_mask + 1;
+    SFOAHashNode *n;
+
+    if ( !t->wheel )
+        return NULL;
+
+    while ( t->wheel[due] == NO_NODE )
+    {
+        uint32_t b;
+
+        if ( now <= t->wheel_time )
+            return NULL;
+
+        if ( now - t->wheel_time > (time_t)due )
+            t->wheel_time = now - due;
+
+        b = (uint32_t)++t->wheel_time & t->wheel_mask;
+
+        if ( t->wheel[b] != NO_NODE )
+        {
+            t->wheel[due] = t->wheel[b];
+            t->wheel[b] = NO_NODE;
+            node_at(t, t->wheel[due])->wprev = WHEEL_LIST | due;
+        }
+    }
+    n = node_at(t, t->wheel[due]);
+    wheel_unlink(t, n);
+
+    return node_data(t, n);
+}
+
+void * sfoahash_sweep(SFOAHASH *t, uint32_t *cursor)
+{
+    uint32_t i = *cursor;
+    uint32_t steps;
+
+    for ( steps = 0; steps < t->nodes_carved; steps++, i++ )
+    {
+        SFOAHashNode *n;
+
+        if ( i >= t->nodes_carved )
+            i = 0;
+
+        n = node_at(t, i);
+
+        if ( n->flags & NODE_USED )
+        {
+            *cursor = i + 1;
+            return node_data(t, n);
+        }
+    }
+    return NULL;
+}
+
+unsigned sfoahash_count(const SFOAHASH *t)
+{
+    return t->count;
+}
+
+/*
+ * -----------------------------------------------------------------------------------------
+ *   Benchmark : use 'sfoahash 1000000 4000000 16000000' for the insert and lookup
+ *   rates with that many concurrent flows (48 byte keys like the session key)
+ * -----------------------------------------------------------------------------------------
+ */
+#ifdef SFOAHASH_MAIN
+
+#include <stdio.h>
+#include <time.h>
+
+typedef struct
+{
+    uint32_t w[12];
+} BenchKey;
+
+static void bench_key(BenchKey *k, uint64_t i)
+{
+    uint64_t x = (i + 1) * 0x9E3779B97F4A7C15ULL;
+
+    memset(k, 0, sizeof(*k));
+    k->w[0] = (uint32_t)(x >> 32);          /* ip_l */
+    k->w[4] = (uint32_t)x;                  /* ip_h */
+    k->w[8] = (uint32_t)(i & 0xffff) << 16 | 80;   /* ports */
+    k->w[9] = 6 << 16;                      /* protocol */
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, uint64_t n, double t)
+{
+    printf("  %-16s %10.2f Mops/s  %7.1f ns/op\n", what, n / t / 1e6, t * 1e9 / n);
+}
+
+static int bench(uint32_t flows, size_t datasize)
+{
+    SFOAHASH *t = sfoahash_new(flows, sizeof(BenchKey), datasize, NULL, NULL);
+    uint64_t i, found = 0, lookups = 4 * (uint64_t)flows;
+    uint64_t r = 88172645463325252ULL;
+    BenchKey k;
+    double start;
+
+    if ( !t )
+    {
+        printf("%u flows: unable to create the table\n", flows);
+        return -1;
+    }
+    printf("%u flows, %zu byte data:\n", flows, datasize);
+
+    start = now();
+    for ( i = 0; i < flows; i++ )
+    {
+        bench_key(&k, i);
+        if ( !sfoahash_get(t, &k) )
+            break;
+    }
+    report("insert", i, now() - start);
+
+    start = now();
+    for ( i = 0; i < lookups; i++ )
+    {
+        r ^= r << 13; r ^= r >> 7; r ^= r << 17;
+        bench_key(&k, r % flows);
+        if ( sfoahash_find(t, &k) )
+            found++;
+    }
+    report("lookup hit", lookups, now() - start);
+
+    start = now();
+    for ( i = 0; i < lookups; i++ )
+    {
+        bench_key(&k, flows + i);
+        if ( sfoahash_find(t, &k) )
+            found++;
+    }
+    report("lookup miss", lookups, now() - start);
+
+    /* replace flows as the session cache does when it is full */
+    start = now();
+    for ( i = 0; i < flows; i++ )
+    {
+        void *victim = sfoahash_victim(t);
+
+        sfoahash_remove(t, victim);
+        bench_key(&k, 2 * (uint64_t)flows + i);
+        sfoahash_get(t, &k);
+    }
+    report("evict + insert", flows, now() - start);
+
+    if ( found != lookups || sfoahash_count(t) != flows )
+        printf("  error: %llu found, %u in table\n", (unsigned long long)found, sfoahash_count(t));
+
+    /* time every flow out, spread over a minute */
+    if ( sfoahash_wheel(t, 64) == SFOAHASH_OK )
+    {
+        uint32_t cursor = 0;
+        void *data;
+
+        for ( i = 0; i < flows; i++ )
+            sfoahash_schedule(t, sfoahash_sweep(t, &cursor), 1 + i % 60);
+
+        start = now();
+        for ( i = 0; (data = sfoahash_expired(t, 61)); i++ )
+            sfoahash_remove(t, data);
+        report("expire", i, now() - start);
+
+        if ( sfoahash_count(t) )
+            printf("  error: %u left after expiring\n", sfoahash_count(t));
+    }
+
+    sfoahash_delete(t);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const uint32_t defaults[] = { 1000000, 4000000, 16000000 };
+    size_t datasize = 64;
+    int i;
+
+    if ( getenv("SFOAHASH_DATA_SIZE") )
+        datasize = strtoul(getenv("SFOAHASH_DATA_SIZE"), NULL, 0);
+
+    if ( argc < 2 )
+    {
+        for ( i = 0; i < 3; i++ )
+            bench(defaults[i], datasize);
+    }
+    for ( i = 1; i < argc; i++ )
+        bench(strtoul(argv[i], NULL, 0), datasize);
+
+    return 0;
+}
+
+#endif /* SFOAHASH_MAIN */
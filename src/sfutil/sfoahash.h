@@ -0,0 +1,105 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+**  sfoahash.h
+**
+**  Fixed capacity open addressing hash table for key + data pairs.
+**
+**  Nodes (key and data inline) live in one flat array and never move, so
+**  the data pointers handed out stay valid until the node is removed.
+**  The index is a separate array of slots grouped by 16, with one control
+**  byte per slot holding 7 bits of the hash; a probe compares a whole
+**  group of control bytes at once and only touches a node when its tag
+**  matches.
+**
+**  Lookups only set a reference bit in the node header, which the key
+**  compare already brought into cache; eviction runs a clock over the
+**  node array that gives referenced nodes a second chance.  Tables that
+**  time out their nodes can add a wheel of one second buckets, linked
+**  through the node array by index, so expiring them only visits nodes
+**  whose bucket came up.
+*/
+#ifndef __SF_OAHASH_H__
+#define __SF_OAHASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define SFOAHASH_ERR      -1
+#define SFOAHASH_OK        0
+
+typedef struct _SFOAHASH SFOAHASH;
+
+typedef uint32_t (*SFOAHASH_HASH_FCN)(const void *key, size_t n);
+typedef int (*SFOAHASH_CMP_FCN)(const void *key1, const void *key2, size_t n);
+
+/* hash_fcn and cmp_fcn may be NULL for the defaults (any key, memcmp).
+ * max_nodes must be below 2^31. */
+SFOAHASH * sfoahash_new(uint32_t max_nodes, size_t keysize, size_t datasize,
+                        SFOAHASH_HASH_FCN hash_fcn, SFOAHASH_CMP_FCN cmp_fcn);
+void       sfoahash_delete(SFOAHASH *);
+
+/* Returns the data for key or NULL and marks the node referenced. */
+void     * sfoahash_find(SFOAHASH *, const void *key);
+
+/* Returns the data for key, adding a node if it is not in the table.  The
+ * data of a new node is not cleared.  Returns NULL when the table is full. */
+void     * sfoahash_get(SFOAHASH *, const void *key);
+
+/* Removes the node owning data, as returned by find or get. */
+int        sfoahash_remove(SFOAHASH *, void *data);
+
+/* The table's copy of the key for data. */
+void     * sfoahash_key(const SFOAHASH *, const void *data);
+
+/* Marks the node referenced, as a lookup does. */
+void       sfoahash_touch(SFOAHASH *, void *data);
+
+/* Advances the clock to the next node not referenced since the hand last
+ * passed it, clearing the reference bits on the way, and returns it.
+ * Successive calls return different nodes, so a caller that wants to keep
+ * one just asks again.  NULL if the table is empty. */
+void     * sfoahash_victim(SFOAHASH *);
+
+/* Adds a wheel of slots one second buckets (rounded up to a power of 2,
+ * at most 65536).  It should cover the usual timeout; later expiries
+ * come up a turn early and are simply rescheduled. */
+int        sfoahash_wheel(SFOAHASH *, unsigned slots);
+
+/* (Re)schedules the node on the wheel for expires.  Expiries already
+ * passed go to the next bucket. */
+void       sfoahash_schedule(SFOAHASH *, void *data, time_t expires);
+
+/* Returns a node whose bucket came up by now and takes it off the wheel,
+ * or NULL when there are none.  The caller checks the node's own timeout
+ * and either removes it or schedules it again.  A time jump of more than
+ * one turn only visits each bucket once. */
+void     * sfoahash_expired(SFOAHASH *, time_t now);
+
+/* Returns the next node in array order from *cursor on, wrapping around,
+ * and moves the cursor past it.  The returned node may be removed. */
+void     * sfoahash_sweep(SFOAHASH *, uint32_t *cursor);
+
+unsigned   sfoahash_count(const SFOAHASH *);
+
+#endif
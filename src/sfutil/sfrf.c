@@ -49,6 +49,7 @@
 #include "rules.h"
 #include "treenodes.h"
 #include "sfrf.h"
+#include "sftwheel.h"
 #include "util.h"
 #include "sfPolicyData.h"
 #include "sfPolicyUserData.h"
@@ -88,7 +89,9 @@ typedef struct
  */
 typedef struct
 {
-    // automatically initialized to FS_NEW when allocated
+    SF_TWHEEL_NODE tw;  // must be first
+
+    // initialized to FS_NEW when allocated
     FilterState filterState;
 
 #ifdef SFRF_OVER_RATE
@@ -112,6 +115,10 @@ typedef struct
 
 SFXHASH *rf_hash = NULL;
 
+/* Nodes are scheduled to expire once they act as a new one would. */
+#define SFRF_WHEEL_SLOTS 1024
+static SF_TWHEEL *rf_wheel = NULL;
+
 // private methods ...
 static int _checkThreshold(
     tSFRFConfigNode*,
@@ -131,6 +138,11 @@ static tSFRFTrackingNode *_getSFRFTrackingNode(
     time_t curTime
 );
 
+static time_t _getExpiryTime(
+    tSFRFConfigNode*,
+    tSFRFTrackingNode*
+);
+
 static void _updateDependentThresholds(
     RateFilterConfig *config,
     unsigned gid,
@@ -169,9 +181,12 @@ static void SFRF_New( unsigned nbytes )
         sizeof(tSFRFTrackingNode),     /* data size */
         nbytes,                  /* memcap **/
         1,         /* ANR flag - true ?- Automatic Node Recovery=ANR */
-        0,         /* ANR callback - none */
-        0,         /* user freemem callback - none */
+        sftwheel_release,  /* ANR callback - off the wheel */
+        sftwheel_release,  /* user freemem callback - off the wheel */
         1) ;      /* Recycle nodes ?*/
+
+    if ( rf_hash )
+        rf_wheel = sftwheel_new(rf_hash, SFRF_WHEEL_SLOTS);
 }
 
 void SFRF_Delete (void)
@@ -181,6 +196,9 @@ void SFRF_Delete (void)
 
     sfxhash_delete(rf_hash);
     rf_hash = NULL;
+
+    sftwheel_free(rf_wheel);
+    rf_wheel = NULL;
 }
 
 void SFRF_Flush (void)
@@ -434,6 +452,8 @@ static int SFRF_TestObject(
 
     retValue = _checkThreshold(cfgNode, dynNode, curTime);
 
+    sftwheel_schedule(rf_wheel, &dynNode->tw, _getExpiryTime(cfgNode, dynNode));
+
     // we drop after the session count has been incremented
     // but the decrement will never come so we "fix" it here
     // if the count were not incremented in such cases, the
@@ -806,20 +826,28 @@ static tSFRFTrackingNode* _getSFRFTrackingNode(
 ) {
     tSFRFTrackingNode* dynNode = NULL;
     tSFRFTrackingNodeKey key;
-    SFXHASH_NODE * hnode = NULL;
+    void *data = NULL;
+    int status;
 
     /* Setup key */
     sfaddr_copy_to_raw(&key.ip, ip);
     key.tid = tid;
     key.policyId = getNapRuntimePolicy();  // TBD-EDM should this be NAP or IPS?
 
+    sftwheel_expire(rf_wheel, curTime);
+
     /*
      * Check for any Permanent sid objects for this gid or add this one ...
      */
-    hnode = sfxhash_get_node(rf_hash, (void*)&key);
-    if ( hnode && hnode->data )
+    status = sfxhash_add_return_data_ptr(rf_hash, (void*)&key, &data);
+
+    // nodes are recycled so a new one may hold an old node's state
+    if ( status == SFXHASH_OK )
+        memset(data, 0, sizeof(tSFRFTrackingNode));
+
+    if ( data )
     {
-        dynNode = (tSFRFTrackingNode*)hnode->data;
+        dynNode = (tSFRFTrackingNode*)data;
 
         if ( dynNode->filterState == FS_NEW )
         {
@@ -833,5 +861,35 @@ static tSFRFTrackingNode* _getSFRFTrackingNode(
     }
     return dynNode;
 }
+
+/* Once the sampling period is over and any new action has timed out the
+ * node acts as a new one would, so it can go.  Total counts (no seconds)
+ * and actions that never revert are kept.
+ */
+static time_t _getExpiryTime(
+    tSFRFConfigNode* cfgNode,
+    tSFRFTrackingNode* dynNode
+) {
+    time_t expires;
+
+    if ( !cfgNode->seconds )
+        return 0;
+
+    expires = dynNode->tstart + cfgNode->seconds;
+
+    if ( dynNode->filterState == FS_ON )
+    {
+        if ( !cfgNode->timeout )
+            return 0;
+
+        if ( dynNode->revertTime + (time_t)cfgNode->timeout > expires )
+            expires = dynNode->revertTime + cfgNode->timeout;
+    }
+#ifdef SFRF_OVER_RATE
+    if ( dynNode->tlast + (time_t)cfgNode->seconds + 1 > expires )
+        expires = dynNode->tlast + cfgNode->seconds + 1;
+#endif
+    return expires;
+}
 /*@}*/
 
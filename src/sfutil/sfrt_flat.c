@@ -367,6 +367,51 @@ int sfrt_flat_insert(sfcidr_t *ip, unsigned char len, INFO ptr,
     return res;
 }
 
+/* Check whether an entry that applies to some address in the range "ip"
+ * matches, without changing the table */
+int sfrt_flat_range_match(sfcidr_t *ip, unsigned char len, table_flat_t *table,
+        matchEntryInfoFunc matchEntry)
+{
+    uint32_t* adr;
+    int numAdrDwords;
+    TABLE_PTR rt;
+    INFO *data;
+    uint8_t *base;
+
+    if(!ip || !table || !table->data || !matchEntry)
+    {
+        return 0;
+    }
+
+    if((len == 0) || (len > 128))
+    {
+        return 0;
+    }
+
+    if (sfaddr_family(&ip->addr) == AF_INET)
+    {
+        if (len < 96)
+        {
+            return 0;
+        }
+        len -= 96;
+        adr = sfip_get_ip4_ptr(ip);
+        numAdrDwords = 1;
+        rt = table->rt;
+    }
+    else
+    {
+        adr = sfip_get_ip6_ptr(ip);
+        numAdrDwords = 4;
+        rt = table->rt6;
+    }
+
+    base = (uint8_t *)segment_basePtr();
+    data = (INFO *)(&base[table->data]);
+
+    return sfrt_dir_flat_range_match(adr, numAdrDwords, len, rt, matchEntry, data);
+}
+
 uint32_t sfrt_flat_num_entries(table_flat_t* table)
 {
     if(!table)
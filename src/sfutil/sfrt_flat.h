@@ -48,6 +48,7 @@ typedef enum
 
 typedef int64_t (*updateEntryInfoFunc)(INFO *entryInfo, INFO newInfo,
         SaveDest saveDest, uint8_t *base);
+typedef int (*matchEntryInfoFunc)(INFO entryInfo, uint8_t *base);
 typedef struct {
     FLAT_INDEX index;
     int length;
@@ -70,6 +71,8 @@ typedef struct {
     TABLE_PTR rt; /* Actual "routing" table */
     TABLE_PTR rt6; /* Actual "routing" table */
     TABLE_PTR list_info; /* List file information table (entry information)*/
+    uint32_t list_count; /* Number of entries in list_info */
+    MEM_OFFSET mem_used; /* End of the segment memory in use, updates allocate after it */
 
 } table_flat_t;
 /*******************************************************************/
@@ -81,6 +84,8 @@ void sfrt_flat_free(TABLE_PTR table);
 GENERIC sfrt_flat_lookup(sfaddr_t *ip, table_flat_t *table);
 int sfrt_flat_insert(sfcidr_t *ip, unsigned char len, INFO ptr, int behavior,
         table_flat_t *table, updateEntryInfoFunc updateEntry);
+int sfrt_flat_range_match(sfcidr_t *ip, unsigned char len, table_flat_t *table,
+        matchEntryInfoFunc matchEntry);
 uint32_t sfrt_flat_usage(table_flat_t *table);
 uint32_t sfrt_flat_num_entries(table_flat_t *table);
 
@@ -214,5 +219,58 @@ static inline GENERIC sfrt_flat_dir8x_lookup(sfaddr_t *ip, table_flat_t* table)
 
     return NULL;
 }
+
+/* Perform a lookup on value contained in "ip", relative to the table base
+ * like sfrt_flat_dir8x_lookup
+ * Note: this only applied to table setting: DIR_16x7_4x4 (DIR_16_4x4 for IPV4)*/
+static inline GENERIC sfrt_flat_dir16x7_lookup(sfaddr_t *ip, table_flat_t* table) {
+    dir_sub_table_flat_t *subtable;
+    Entry_Value *entries_value;
+    Entry_Len *entries_length;
+    uint8_t *base = (uint8_t *) table;
+    int i;
+    dir_table_flat_t *rt = NULL;
+    int index;
+    INFO *data = (INFO *) (&base[table->data]);
+
+    /* IPv4 starts at the 16 bits of the mapped address,
+     * both share the 4x4 tail */
+    if (sfaddr_family(ip) == AF_INET)
+    {
+        rt = (dir_table_flat_t *)(&base[table->rt]);
+        i = 6;
+    }
+    else
+    {
+        rt = (dir_table_flat_t *)(&base[table->rt6]);
+        i = 0;
+    }
+    subtable = (dir_sub_table_flat_t *)(&base[rt->sub_table]);
+
+    for (; i < 11; i++)
+    {
+        /* 16 bits */
+        if (i < 7)
+            index = ntohs(ip->ia16[i]);
+        /* 4 bits */
+        else if (i & 1)
+            index = ip->ia8[14 + ((i - 7) >> 1)] >> 4;
+        else
+            index = ip->ia8[14 + ((i - 7) >> 1)] & 0xF;
+
+        entries_value = (Entry_Value *)(&base[subtable->entries_value]);
+        entries_length = (Entry_Len *)(&base[subtable->entries_length]);
+        if( !entries_value[index] || entries_length[index] )
+        {
+            if ( data[entries_value[index]] )
+                return (GENERIC) &base[data[entries_value[index]]];
+            else
+                return NULL;
+        }
+        subtable = (dir_sub_table_flat_t *)(&base[entries_value[index]]);
+    }
+
+    return NULL;
+}
 #endif
 
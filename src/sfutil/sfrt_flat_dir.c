@@ -623,6 +623,133 @@ tuple_flat_t sfrt_dir_flat_lookup(uint32_t* adr, int numAdrDwords, TABLE_PTR tab
     return _dir_sub_flat_lookup(&iplu, root->sub_table);
 }
 
+/* Check entries [index, fill) of a sub table and everything below them */
+static int _dir_range_match(int index, int fill, SUB_TABLE_PTR sub_ptr,
+        matchEntryInfoFunc matchEntry, INFO *data)
+{
+    dir_sub_table_flat_t *subtable;
+    uint8_t *base;
+
+    base = (uint8_t *)segment_basePtr();
+    subtable = (dir_sub_table_flat_t *)(&base[sub_ptr]);
+
+    for(; index < fill; index++)
+    {
+        Entry_Value *entries_value = (Entry_Value *)(&base[subtable->entries_value]);
+        Entry_Len *entries_length = (Entry_Len *)(&base[subtable->entries_length]);
+
+        if( entries_value[index] && !entries_length[index] )
+        {
+            dir_sub_table_flat_t *next = (dir_sub_table_flat_t*)(&base[entries_value[index]]);
+            if (_dir_range_match(0, 1 << next->width, entries_value[index],
+                    matchEntry, data))
+                return 1;
+        }
+        else if( entries_value[index] && data[entries_value[index]] &&
+                matchEntry(data[entries_value[index]], base) )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Find the sub table that houses the range, as _dir_sub_insert does */
+static int _dir_sub_range_match(IPLOOKUP *ip, int cur_len, SUB_TABLE_PTR sub_ptr,
+        matchEntryInfoFunc matchEntry, INFO *data)
+{
+    word index;
+    uint32_t fill;
+    uint8_t *base = (uint8_t *)segment_basePtr();
+    dir_sub_table_flat_t *sub_table = (dir_sub_table_flat_t *)(&base[sub_ptr]);
+    Entry_Value *entries_value;
+    Entry_Len *entries_length;
+
+    {
+        uint32_t local_index, i;
+        /* need to handle bits usage across multiple 32bit vals within IPv6. */
+        if (ip->bits < 32 )
+        {
+            i=0;
+        }
+        else if (ip->bits < 64)
+        {
+            i=1;
+        }
+        else if (ip->bits < 96)
+        {
+            i=2;
+        }
+        else
+        {
+            i=3;
+        }
+        local_index = ip->adr[i] << (ip->bits %32);
+        index = local_index >> (sizeof(local_index)*8 - sub_table->width);
+    }
+
+    if(sub_table->width >= cur_len)
+    {
+        fill = 1 << (sub_table->width - cur_len);
+
+        index = (index >> (sub_table->width - cur_len)) <<
+                (sub_table->width - cur_len);
+
+        fill += index;
+
+        return _dir_range_match(index, fill, sub_ptr, matchEntry, data);
+    }
+
+    entries_value = (Entry_Value *)(&base[sub_table->entries_value]);
+    entries_length = (Entry_Len *)(&base[sub_table->entries_length]);
+
+    /* A single less specific entry covers the whole range */
+    if( !entries_value[index] || entries_length[index] )
+    {
+        return entries_value[index] && data[entries_value[index]] &&
+                matchEntry(data[entries_value[index]], base);
+    }
+
+    ip->bits += sub_table->width;
+    return _dir_sub_range_match(ip, cur_len - sub_table->width,
+            entries_value[index], matchEntry, data);
+}
+
+/* Check whether any entry that applies to some address in a range matches
+ * @param adr       IP address of the range
+ * @param len       Number of bits of the IP used to specify this CIDR
+ * @return 1 if an entry matches, 0 otherwise */
+int sfrt_dir_flat_range_match(uint32_t* adr, int numAdrDwords, int len,
+        TABLE_PTR table_ptr, matchEntryInfoFunc matchEntry, INFO *data)
+{
+    dir_table_flat_t *root;
+    uint8_t *base = (uint8_t *)segment_basePtr();
+    uint32_t h_adr[4];
+    int i;
+    IPLOOKUP iplu;
+    iplu.adr = h_adr;
+    iplu.bits = 0;
+
+    if(!table_ptr)
+    {
+        return 0;
+    }
+
+    root = (dir_table_flat_t *)(&base[table_ptr]);
+
+    if(!root->sub_table)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < numAdrDwords; i++)
+    {
+        h_adr[i] = ntohl(adr[i]);
+    }
+
+    return _dir_sub_range_match(&iplu, len, root->sub_table, matchEntry, data);
+}
 
 uint32_t sfrt_dir_flat_usage(TABLE_PTR table_ptr)
 {
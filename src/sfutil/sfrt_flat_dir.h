@@ -68,6 +68,8 @@ void         sfrt_dir_flat_free(TABLE_PTR);
 tuple_flat_t  sfrt_dir_flat_lookup(uint32_t* adr, int numAdrDwords, TABLE_PTR table);
 int           sfrt_dir_flat_insert(uint32_t* adr, int numAdrDwords, int len, word data_index,
                                int behavior, TABLE_PTR, updateEntryInfoFunc updateEntry, INFO *data);
+int           sfrt_dir_flat_range_match(uint32_t* adr, int numAdrDwords, int len,
+                               TABLE_PTR, matchEntryInfoFunc matchEntry, INFO *data);
 uint32_t      sfrt_dir_flat_usage(TABLE_PTR);
 
 #endif /* SFRT_DIR_FLAT_H_ */
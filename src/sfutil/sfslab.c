@@ -0,0 +1,326 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+  sfslab.c
+
+  Slabs are SFSLAB_SLAB_SIZE aligned so the slab owning an object is found
+  by masking the object address.  The arena is reserved with mmap and only
+  touched as slabs are carved out of it, so a large arena costs address
+  space rather than memory until it is used.  Within a slab objects are
+  handed out from the slab free list first, then from the untouched tail.
+*/
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sfslab.h"
+#include "sfnuma.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#define SFSLAB_SLAB_SIZE  (128 * 1024)
+#define SFSLAB_ALIGN      16
+
+typedef struct _SFSlab
+{
+    struct _SFSlab *next;
+    struct _SFSlab *prev;
+
+    void *free_list;
+
+    uint32_t in_use;
+    uint32_t carved;      /* objects taken from the untouched tail */
+    uint32_t cls;
+
+} SFSlab;
+
+typedef struct
+{
+    size_t size;
+    uint32_t per_slab;
+    SFSlab *partial;      /* slabs with at least one free object */
+
+} SFSlabClass;
+
+struct _SFSLAB
+{
+    void *map;
+    size_t map_size;
+
+    uint8_t *arena;
+    uint8_t *arena_end;
+
+    uint32_t slabs_carved;
+    SFSlab *free_slabs;
+
+    SFSlabClass classes[SFSLAB_MAX_CLASSES];
+    unsigned num_classes;
+
+    SFSLAB_STATS stats;
+};
+
+#define SLAB_HDR_SIZE \
+    ((sizeof(SFSlab) + SFSLAB_ALIGN - 1) & ~(size_t)(SFSLAB_ALIGN - 1))
+
+static inline void slab_link(SFSlab **head, SFSlab *s)
+{
+    s->prev = NULL;
+    s->next = *head;
+
+    if (*head)
+        (*head)->prev = s;
+
+    *head = s;
+}
+
+static inline void slab_unlink(SFSlab **head, SFSlab *s)
+{
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        *head = s->next;
+
+    if (s->next)
+        s->next->prev = s->prev;
+
+    s->next = s->prev = NULL;
+}
+
+static SFSlab * slab_get(SFSLAB *sl, uint32_t cls)
+{
+    SFSlab *s = sl->free_slabs;
+
+    if (s)
+        sl->free_slabs = s->next;
+
+    else if (sl->slabs_carved < sl->stats.slabs_total)
+        s = (SFSlab *)(sl->arena + (size_t)sl->slabs_carved++ * SFSLAB_SLAB_SIZE);
+
+    else
+        return NULL;
+
+    memset(s, 0, sizeof(*s));
+    s->cls = cls;
+
+    if (++sl->stats.slabs_in_use > sl->stats.slabs_peak)
+        sl->stats.slabs_peak = sl->stats.slabs_in_use;
+
+    return s;
+}
+
+static void slab_put(SFSLAB *sl, SFSlab *s)
+{
+    s->next = sl->free_slabs;
+    sl->free_slabs = s;
+    sl->stats.slabs_in_use--;
+}
+
+SFSLAB * sfslab_new(size_t arena_size, const size_t *class_sizes, unsigned num_classes)
+{
+    SFSLAB *sl;
+    unsigned i;
+    size_t nslabs;
+
+    if (!class_sizes || !num_classes || (num_classes > SFSLAB_MAX_CLASSES))
+        return NULL;
+
+    sl = (SFSLAB *)calloc(1, sizeof(*sl));
+
+    if (!sl)
+        return NULL;
+
+    for (i = 0; i < num_classes; i++)
+    {
+        size_t size = (class_sizes[i] + SFSLAB_ALIGN - 1) & ~(size_t)(SFSLAB_ALIGN - 1);
+
+        if ((size < sizeof(void *)) || (size > SFSLAB_SLAB_SIZE - SLAB_HDR_SIZE) ||
+            (i && (size <= sl->classes[i-1].size)))
+        {
+            free(sl);
+            return NULL;
+        }
+        sl->classes[i].size = size;
+        sl->classes[i].per_slab = (SFSLAB_SLAB_SIZE - SLAB_HDR_SIZE) / size;
+    }
+    sl->num_classes = num_classes;
+    sl->stats.slab_size = SFSLAB_SLAB_SIZE;
+
+    nslabs = (arena_size + SFSLAB_SLAB_SIZE - 1) / SFSLAB_SLAB_SIZE;
+
+    if (nslabs > UINT32_MAX)
+        nslabs = UINT32_MAX;
+
+    if (nslabs)
+    {
+        /* one extra slab so the arena can be aligned */
+        sl->map_size = (nslabs + 1) * SFSLAB_SLAB_SIZE;
+        sl->map = mmap(NULL, sl->map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (sl->map == MAP_FAILED)
+        {
+            /* everything goes to malloc */
+            sl->map = NULL;
+            nslabs = 0;
+        }
+        else
+        {
+            uintptr_t a = ((uintptr_t)sl->map + SFSLAB_SLAB_SIZE - 1) &
+                ~(uintptr_t)(SFSLAB_SLAB_SIZE - 1);
+
+            sl->arena = (uint8_t *)a;
+            sl->arena_end = sl->arena + nslabs * SFSLAB_SLAB_SIZE;
+
+            sfnuma_bind(sl->arena, nslabs * SFSLAB_SLAB_SIZE);
+        }
+    }
+    sl->stats.slabs_total = (uint32_t)nslabs;
+
+    return sl;
+}
+
+void sfslab_delete(SFSLAB *sl)
+{
+    if (!sl)
+        return;
+
+    if (sl->map)
+        munmap(sl->map, sl->map_size);
+
+    free(sl);
+}
+
+void * sfslab_alloc(SFSLAB *sl, size_t size)
+{
+    SFSlabClass *c = NULL;
+    SFSlab *s;
+    void *obj;
+    unsigned i;
+
+    for (i = 0; i < sl->num_classes; i++)
+    {
+        if (size <= sl->classes[i].size)
+        {
+            c = &sl->classes[i];
+            break;
+        }
+    }
+
+    if (c)
+    {
+        s = c->partial;
+
+        if (!s && (s = slab_get(sl, i)))
+            slab_link(&c->partial, s);
+    }
+    else
+        s = NULL;
+
+    if (!s)
+    {
+        obj = malloc(size);
+
+        if (obj)
+        {
+            sl->stats.allocs++;
+            sl->stats.fallback++;
+            sl->stats.objs_in_use++;
+            sl->stats.bytes_requested += size;
+            sl->stats.bytes_fallback += size;
+        }
+        return obj;
+    }
+
+    if (s->free_list)
+    {
+        obj = s->free_list;
+        s->free_list = *(void **)obj;
+    }
+    else
+    {
+        obj = (uint8_t *)s + SLAB_HDR_SIZE + (size_t)s->carved++ * c->size;
+    }
+
+    if (++s->in_use == c->per_slab)
+        slab_unlink(&c->partial, s);
+
+    sl->stats.allocs++;
+    sl->stats.objs_in_use++;
+    sl->stats.bytes_requested += size;
+    sl->stats.bytes_used += c->size;
+
+    return obj;
+}
+
+void sfslab_free(SFSLAB *sl, void *obj, size_t size)
+{
+    SFSlabClass *c;
+    SFSlab *s;
+
+    if (!obj)
+        return;
+
+    sl->stats.frees++;
+    sl->stats.objs_in_use--;
+    sl->stats.bytes_requested -= size;
+
+    if (((uint8_t *)obj < sl->arena) || ((uint8_t *)obj >= sl->arena_end))
+    {
+        sl->stats.bytes_fallback -= size;
+        free(obj);
+        return;
+    }
+
+    s = (SFSlab *)((uintptr_t)obj & ~(uintptr_t)(SFSLAB_SLAB_SIZE - 1));
+    c = &sl->classes[s->cls];
+
+    sl->stats.bytes_used -= c->size;
+
+    if (s->in_use == c->per_slab)
+        slab_link(&c->partial, s);
+
+    *(void **)obj = s->free_list;
+    s->free_list = obj;
+
+    /* keep one slab per class so a single flow doesn't thrash the arena */
+    if (!--s->in_use && (s->prev || s->next))
+    {
+        slab_unlink(&c->partial, s);
+        slab_put(sl, s);
+    }
+}
+
+void sfslab_get_stats(const SFSLAB *sl, SFSLAB_STATS *stats)
+{
+    *stats = sl->stats;
+}
@@ -0,0 +1,71 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+**  sfslab.h
+**
+**  Size classed slab allocator.  An arena of address space is reserved
+**  up front and carved into fixed size slabs on demand; each slab holds
+**  objects of one size class and keeps its own free list.  Slabs that
+**  become empty go back to the arena and can be reused by any class.
+**  Requests larger than the biggest class, or made after the arena is
+**  used up, fall back to malloc.
+*/
+#ifndef __SF_SLAB_H__
+#define __SF_SLAB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SFSLAB_MAX_CLASSES 16
+
+typedef struct _SFSLAB SFSLAB;
+
+typedef struct
+{
+    uint64_t allocs;          /* total allocations */
+    uint64_t frees;           /* total frees */
+    uint64_t fallback;        /* allocations that went to malloc */
+
+    uint64_t objs_in_use;     /* live objects */
+    uint64_t bytes_requested; /* sum of requested sizes of live objects */
+    uint64_t bytes_used;      /* sum of class sizes of live slab objects */
+    uint64_t bytes_fallback;  /* live bytes that went to malloc */
+
+    uint32_t slabs_total;     /* slabs the arena can hold */
+    uint32_t slabs_in_use;    /* slabs assigned to a class */
+    uint32_t slabs_peak;
+
+    size_t slab_size;
+
+} SFSLAB_STATS;
+
+/* class_sizes must be ascending; arena_size is rounded up to whole slabs.
+ * sfslab_free must be given the size that was passed to sfslab_alloc. */
+SFSLAB * sfslab_new(size_t arena_size, const size_t *class_sizes, unsigned num_classes);
+void     sfslab_delete(SFSLAB *);
+
+void   * sfslab_alloc(SFSLAB *, size_t size);
+void     sfslab_free(SFSLAB *, void *, size_t size);
+
+void     sfslab_get_stats(const SFSLAB *, SFSLAB_STATS *);
+
+#endif
@@ -79,11 +79,20 @@ SFXHASH * sfthd_new_hash(unsigned nbytes, size_t key, size_t data)
         data,   /* data size */
         nbytes, /* memcap **/
         1,      /* ANR flag - true ?- Automatic Node Recovery=ANR */
-        0,      /* ANR callback - none */
-        0,      /* user freemem callback - none */
+        sftwheel_release,   /* ANR callback - off the wheel */
+        sftwheel_release,   /* user freemem callback - off the wheel */
         1 ) ;   /* Recycle nodes ?*/
 }
 
+/* Trackers are scheduled to expire when their window is over; the slots
+ * cover the common event_filter and detection_filter periods. */
+#define THD_WHEEL_SLOTS 1024
+
+SF_TWHEEL * sfthd_new_wheel(SFXHASH *hash)
+{
+    return sftwheel_new(hash, THD_WHEEL_SLOTS);
+}
+
 /*!
   Create a threshold table, initialize the threshold system,
   and optionally limit it's memory usage.
@@ -143,6 +152,7 @@ THD_STRUCT * sfthd_new(unsigned lbytes, unsigned gbytes)
         free(thd);
         return NULL;
     }
+    thd->ip_wheel = sfthd_new_wheel(thd->ip_nodes);
 
     if ( gbytes == 0 )
         return thd;
@@ -155,9 +165,11 @@ THD_STRUCT * sfthd_new(unsigned lbytes, unsigned gbytes)
         printf("Could not allocate the sfxhash table\n");
 #endif
         sfxhash_delete(thd->ip_nodes);
+        sftwheel_free(thd->ip_wheel);
         free(thd);
         return NULL;
     }
+    thd->ip_gwheel = sfthd_new_wheel(thd->ip_gnodes);
 #endif
 
     return thd;
@@ -252,11 +264,15 @@ void sfthd_free(THD_STRUCT *thd)
         return;
 
 #ifndef CRIPPLE
+    /* the tables take their nodes off the wheels as they go */
     if (thd->ip_nodes != NULL)
         sfxhash_delete(thd->ip_nodes);
 
     if (thd->ip_gnodes != NULL)
         sfxhash_delete(thd->ip_gnodes);
+
+    sftwheel_free(thd->ip_wheel);
+    sftwheel_free(thd->ip_gwheel);
 #endif
 
     free(thd);
@@ -689,7 +705,7 @@ static char * printIP(unsigned u )
 }
 #endif
 
-int sfthd_test_rule(SFXHASH *rule_hash, THD_NODE *sfthd_node,
+int sfthd_test_rule(SFXHASH *rule_hash, SF_TWHEEL *rule_wheel, THD_NODE *sfthd_node,
                     sfaddr_t* sip, sfaddr_t* dip, long curtime)
 {
     int status;
@@ -697,7 +713,7 @@ int sfthd_test_rule(SFXHASH *rule_hash, THD_NODE *sfthd_node,
     if ((rule_hash == NULL) || (sfthd_node == NULL))
         return 0;
 
-    status = sfthd_test_local(rule_hash, sfthd_node, sip, dip, curtime );
+    status = sfthd_test_local(rule_hash, rule_wheel, sfthd_node, sip, dip, curtime );
 
     return (status < -1) ? 1 : status;
 }
@@ -738,6 +754,31 @@ static inline int sfthd_test_suppress (
     return 1; /* Keep looking for other suppressors */
 }
 
+/*
+ *  When the tracker will act just as a new one would on the next event:
+ *  its window is over and, for detection_filter, no event fell in the
+ *  last one either.  threshold type both with a count of 1 logs the first
+ *  event of a new tracker but not the one after a window is over, so it
+ *  is kept.
+ */
+static inline time_t sfthd_expires(THD_NODE* sfthd_node, THD_IP_NODE* sfthd_ip_node)
+{
+    switch ( sfthd_node->type )
+    {
+    case THD_TYPE_DETECT:
+        return sfthd_ip_node->tlast + sfthd_node->seconds + 1;
+
+    case THD_TYPE_BOTH:
+        if ( sfthd_node->count <= 1 )
+            return 0;
+        break;
+
+    default:
+        break;
+    }
+    return sfthd_ip_node->tstart + sfthd_node->seconds;
+}
+
 /*
  *  Do the appropriate test for the Threshold Object Type
  */
@@ -888,6 +929,32 @@ static inline int sfthd_test_non_suppress(
     return 0;  /* should not get here, so log it just to be safe */
 }
 
+/*
+ *  Finds the tracker for key, adding a new one for this event if there is
+ *  none, or counts the event against it.
+ */
+static inline int sfthd_get_ip_node(
+    SFXHASH *hash, void *key, time_t curtime, THD_IP_NODE **ip_node)
+{
+    void *data;
+    int status = sfxhash_add_return_data_ptr(hash, key, &data);
+
+    if (status == SFXHASH_INTABLE)
+    {
+        /* Already in the table - increment the event count */
+        *ip_node = (THD_IP_NODE *)data;
+        (*ip_node)->count++;
+    }
+    else if (status == SFXHASH_OK)
+    {
+        *ip_node = (THD_IP_NODE *)data;
+        memset(*ip_node, 0, sizeof(**ip_node));
+        (*ip_node)->count  = 1;
+        (*ip_node)->tstart = (*ip_node)->tlast = curtime; /* Event time */
+    }
+    return status;
+}
+
 /*!
  *
  *  Find/Test/Add an event against a single threshold object.
@@ -907,13 +974,14 @@ static inline int sfthd_test_non_suppress(
  */
 int sfthd_test_local(
     SFXHASH *local_hash,
+    SF_TWHEEL *local_wheel,
     THD_NODE   * sfthd_node,
     sfaddr_t*    sip,
     sfaddr_t*    dip,
     time_t       curtime )
 {
     THD_IP_NODE_KEY key;
-    THD_IP_NODE     data,*sfthd_ip_node;
+    THD_IP_NODE     *sfthd_ip_node;
     int             status=0;
     sfaddr_t*       ip;
     tSfPolicyId policy_id = getIpsRuntimePolicy();
@@ -965,35 +1033,25 @@ int sfthd_test_local(
     sfaddr_copy_to_raw(&key.ip, ip);
     key.thd_id = sfthd_node->thd_id;
 
-    /* Set up a new data element */
-    data.count  = 1;
-    data.prev   = 0;
-    data.tstart = data.tlast = curtime; /* Event time */
+    sftwheel_expire(local_wheel, curtime);
 
     /*
      * Check for any Permanent sig_id objects for this gen_id  or add this one ...
      */
-    status = sfxhash_add(local_hash, (void*)&key, &data);
-    if (status == SFXHASH_INTABLE)
-    {
-        /* Already in the table */
-        sfthd_ip_node = local_hash->cnode->data;
+    status = sfthd_get_ip_node(local_hash, &key, curtime, &sfthd_ip_node);
 
-        /* Increment the event count */
-        sfthd_ip_node->count++;
-    }
-    else if (status != SFXHASH_OK)
+    if (status != SFXHASH_OK && status != SFXHASH_INTABLE)
     {
         /* hash error */
         return 1; /*  check the next threshold object */
     }
-    else
-    {
-        /* Was not in the table - it was added - work with our copy of the data */
-        sfthd_ip_node = &data;
-    }
 
-    return sfthd_test_non_suppress(sfthd_node, sfthd_ip_node, curtime);
+    status = sfthd_test_non_suppress(sfthd_node, sfthd_ip_node, curtime);
+
+    sftwheel_schedule(local_wheel, &sfthd_ip_node->tw,
+        sfthd_expires(sfthd_node, sfthd_ip_node));
+
+    return status;
 }
 
 /*
@@ -1001,6 +1059,7 @@ int sfthd_test_local(
  */
 static inline int sfthd_test_global(
     SFXHASH *global_hash,
+    SF_TWHEEL *global_wheel,
     THD_NODE   * sfthd_node,
     unsigned     gen_id,     /* from current event */
     unsigned     sig_id,     /* from current event */
@@ -1009,7 +1068,7 @@ static inline int sfthd_test_global(
     time_t       curtime )
 {
     THD_IP_GNODE_KEY key;
-    THD_IP_NODE      data, *sfthd_ip_node;
+    THD_IP_NODE      *sfthd_ip_node;
     int              status=0;
     sfaddr_t*        ip;
     tSfPolicyId policy_id = getIpsRuntimePolicy();
@@ -1067,33 +1126,23 @@ static inline int sfthd_test_global(
     key.sig_id = sig_id;
     key.policyId = policy_id;
 
-    /* Set up a new data element */
-    data.count  = 1;
-    data.prev  = 0;
-    data.tstart = data.tlast = curtime; /* Event time */
+    sftwheel_expire(global_wheel, curtime);
 
     /* Check for any Permanent sig_id objects for this gen_id  or add this one ...  */
-    status = sfxhash_add(global_hash, (void*)&key, &data);
-    if (status == SFXHASH_INTABLE)
-    {
-        /* Already in the table */
-        sfthd_ip_node = global_hash->cnode->data;
+    status = sfthd_get_ip_node(global_hash, &key, curtime, &sfthd_ip_node);
 
-        /* Increment the event count */
-        sfthd_ip_node->count++;
-    }
-    else if (status != SFXHASH_OK)
+    if (status != SFXHASH_OK && status != SFXHASH_INTABLE)
     {
         /* hash error */
         return 1; /*  check the next threshold object */
     }
-    else
-    {
-        /* Was not in the table - it was added - work with our copy of the data */
-        sfthd_ip_node = &data;
-    }
 
-    return sfthd_test_non_suppress(sfthd_node, sfthd_ip_node, curtime);
+    status = sfthd_test_non_suppress(sfthd_node, sfthd_ip_node, curtime);
+
+    sftwheel_schedule(global_wheel, &sfthd_ip_node->tw,
+        sfthd_expires(sfthd_node, sfthd_ip_node));
+
+    return status;
 }
 
 
@@ -1211,7 +1260,7 @@ int sfthd_test_threshold(
         /*
          *   Test SUPPRESSION and THRESHOLDING
          */
-        status = sfthd_test_local(thd->ip_nodes, sfthd_node, sip, dip, curtime );
+        status = sfthd_test_local(thd->ip_nodes, thd->ip_wheel, sfthd_node, sip, dip, curtime );
 
         if( status < 0 ) /* -1 == Don't log and stop looking */
         {
@@ -1254,7 +1303,7 @@ global_test:
      if( g_thd_node )
      {
          status = sfthd_test_global(
-             thd->ip_gnodes, g_thd_node, gen_id, sig_id, sip, dip, curtime );
+             thd->ip_gnodes, thd->ip_gwheel, g_thd_node, gen_id, sig_id, sip, dip, curtime );
 
          if( status < 0 ) /* -1 == Don't log and stop looking */
          {
@@ -32,6 +32,7 @@
 #include "sflsq.h"
 #include "sfghash.h"
 #include "sfxhash.h"
+#include "sftwheel.h"
 #include "sfPolicy.h"
 #include "sfPolicyUserData.h"
 
@@ -87,6 +88,8 @@ enum
 */
 typedef struct {
 
+    SF_TWHEEL_NODE tw;  /* must be first */
+
     unsigned count;
     unsigned prev;
     time_t tstart;
@@ -203,6 +206,9 @@ typedef struct _THD_STRUCT
     SFXHASH *ip_nodes;   /* Global hash of active IP's key=THD_IP_NODE_KEY, data=THD_IP_NODE */
     SFXHASH *ip_gnodes;  /* Global hash of active IP's key=THD_IP_GNODE_KEY, data=THD_IP_GNODE */
 
+    SF_TWHEEL *ip_wheel;   /* expiry of ip_nodes */
+    SF_TWHEEL *ip_gwheel;  /* expiry of ip_gnodes */
+
 } THD_STRUCT;
 
 typedef struct _ThresholdObjects
@@ -235,7 +241,7 @@ void sfthd_free(THD_STRUCT *);
 ThresholdObjects * sfthd_objs_new(void);
 void sfthd_objs_free(ThresholdObjects *);
 
-int sfthd_test_rule(SFXHASH *rule_hash, THD_NODE *sfthd_node,
+int sfthd_test_rule(SFXHASH *rule_hash, SF_TWHEEL *rule_wheel, THD_NODE *sfthd_node,
                     sfaddr_t* sip, sfaddr_t* dip, long curtime);
 
 void * sfthd_create_rule_threshold(
@@ -275,9 +281,11 @@ int sfthd_test_threshold(
 
 
 SFXHASH * sfthd_new_hash(unsigned, size_t, size_t);
+SF_TWHEEL * sfthd_new_wheel(SFXHASH *);
 
 int sfthd_test_local(
     SFXHASH *local_hash,
+    SF_TWHEEL *local_wheel,
     THD_NODE   * sfthd_node,
     sfaddr_t*    sip,
     sfaddr_t*    dip,
@@ -0,0 +1,195 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+  sftwheel.c
+
+  Each slot is a circular list with a sentinel head.  Nodes go in the slot
+  for their expiry second and the wheel walks the slots from the last time
+  it was advanced to now, freeing what has expired and leaving nodes due
+  on a later turn.  A node is visited once per turn it stays on the wheel,
+  so with enough slots for the usual timeout each node costs O(1).
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sftwheel.h"
+#include "util.h"
+
+struct _SF_TWHEEL
+{
+    SFXHASH *table;
+    SF_TWHEEL_NODE *slots;
+    unsigned mask;
+    time_t now;
+
+    uint64_t expired;       /* since the last reset */
+    unsigned anr_base;      /* table's anr_count at the last reset */
+
+    struct _SF_TWHEEL *next;
+};
+
+/* all wheels, for the stats */
+static SF_TWHEEL *s_wheels = NULL;
+
+SF_TWHEEL * sftwheel_new(SFXHASH *table, unsigned slots)
+{
+    SF_TWHEEL *w;
+    unsigned n = 1, i;
+
+    while ( n < slots )
+        n <<= 1;
+
+    w = (SF_TWHEEL *)SnortAlloc(sizeof(*w));
+    w->slots = (SF_TWHEEL_NODE *)SnortAlloc(n * sizeof(*w->slots));
+    w->mask = n - 1;
+    w->table = table;
+
+    for ( i = 0; i < n; i++ )
+        w->slots[i].next = w->slots[i].prev = &w->slots[i];
+
+    w->next = s_wheels;
+    s_wheels = w;
+
+    return w;
+}
+
+void sftwheel_free(SF_TWHEEL *w)
+{
+    SF_TWHEEL **pw;
+
+    if ( w == NULL )
+        return;
+
+    for ( pw = &s_wheels; *pw; pw = &(*pw)->next )
+    {
+        if ( *pw == w )
+        {
+            *pw = w->next;
+            break;
+        }
+    }
+    free(w->slots);
+    free(w);
+}
+
+static inline void tw_unlink(SF_TWHEEL_NODE *n)
+{
+    if ( n->next == NULL )
+        return;
+
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->next = n->prev = NULL;
+}
+
+int sftwheel_release(void *key, void *data)
+{
+    tw_unlink((SF_TWHEEL_NODE *)data);
+    return 0;
+}
+
+void sftwheel_schedule(SF_TWHEEL *w, SF_TWHEEL_NODE *n, time_t expires)
+{
+    SF_TWHEEL_NODE *head;
+
+    tw_unlink(n);
+    n->expires = expires;
+
+    if ( !expires )
+        return;
+
+    head = &w->slots[expires & w->mask];
+    n->next = head;
+    n->prev = head->prev;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+static inline SFXHASH_NODE * tw_hash_node(SFXHASH *t, SF_TWHEEL_NODE *n)
+{
+    return (SFXHASH_NODE *)
+        ((char *)n - t->pad - t->keysize - sizeof(SFXHASH_NODE));
+}
+
+void sftwheel_expire(SF_TWHEEL *w, time_t now)
+{
+    time_t t;
+
+    if ( now <= w->now )
+        return;
+
+    /* no need to go around more than once */
+    if ( !w->now || ((now - w->now) > (time_t)w->mask) )
+        t = now - w->mask;
+    else
+        t = w->now + 1;
+
+    for ( ; t <= now; t++ )
+    {
+        SF_TWHEEL_NODE *head = &w->slots[t & w->mask];
+        SF_TWHEEL_NODE *n = head->next;
+
+        while ( n != head )
+        {
+            SF_TWHEEL_NODE *next = n->next;
+
+            if ( n->expires <= now )
+            {
+                /* the table's free callback takes it off the wheel */
+                sfxhash_free_node(w->table, tw_hash_node(w->table, n));
+                w->expired++;
+            }
+            n = next;
+        }
+    }
+    w->now = now;
+}
+
+void sftwheel_get_stats(SF_TWHEEL_STATS *s, int reset)
+{
+    SF_TWHEEL *w;
+
+    memset(s, 0, sizeof(*s));
+
+    for ( w = s_wheels; w; w = w->next )
+    {
+        unsigned anr = sfxhash_anr_count(w->table);
+
+        /* emptying the table clears its count */
+        if ( anr < w->anr_base )
+            w->anr_base = 0;
+
+        s->trackers += sfxhash_count(w->table);
+        s->expired += w->expired;
+        s->evicted += anr - w->anr_base;
+
+        if ( reset )
+        {
+            w->expired = 0;
+            w->anr_base = anr;
+        }
+    }
+}
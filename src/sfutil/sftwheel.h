@@ -0,0 +1,85 @@
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/*
+**  sftwheel.h
+**
+**  Timing wheel expiring the nodes of an SFXHASH.
+**
+**  The threshold, detection_filter and rate_filter trackers only matter
+**  until their window (or revert timeout) runs out; after that a tracker
+**  behaves exactly as a new one would.  Each tracker is scheduled on a
+**  wheel of one second slots at the time it stops mattering and is freed
+**  when the wheel gets there, so the tables only fill up with live state
+**  and the memcap LRU only has to step in when that alone exceeds it.
+**
+**  The node is embedded at the start of the hash data.  The table must be
+**  created with sftwheel_release as both its ANR and user free callbacks
+**  so nodes leaving the table any other way are taken off the wheel.
+*/
+#ifndef __SF_TWHEEL_H__
+#define __SF_TWHEEL_H__
+
+#include <time.h>
+#include <stdint.h>
+
+#include "sfxhash.h"
+
+typedef struct _SF_TWHEEL_NODE
+{
+    struct _SF_TWHEEL_NODE *next;
+    struct _SF_TWHEEL_NODE *prev;
+    time_t expires;
+
+} SF_TWHEEL_NODE;
+
+typedef struct _SF_TWHEEL SF_TWHEEL;
+
+typedef struct _SF_TWHEEL_STATS
+{
+    uint64_t trackers;      /* nodes in the tables */
+    uint64_t expired;       /* freed by the wheels */
+    uint64_t evicted;       /* recycled by the tables for lack of memory */
+
+} SF_TWHEEL_STATS;
+
+/* slots is rounded up to a power of 2 and should cover the usual timeout
+ * in seconds; longer ones just stay on the wheel for more turns. */
+SF_TWHEEL * sftwheel_new(SFXHASH *table, unsigned slots);
+
+/* Must be called after the table is deleted. */
+void        sftwheel_free(SF_TWHEEL *);
+
+/* SFXHASH_FREE_FCN for the table. */
+int         sftwheel_release(void *key, void *data);
+
+/* (Re)schedules the node; 0 means it never expires. */
+void        sftwheel_schedule(SF_TWHEEL *, SF_TWHEEL_NODE *, time_t expires);
+
+/* Frees every node that expired by now.  Cheap when now has not moved
+ * since the last call. */
+void        sftwheel_expire(SF_TWHEEL *, time_t now);
+
+/* Adds up all wheels; the expired and evicted counts are since the last
+ * call with reset set. */
+void        sftwheel_get_stats(SF_TWHEEL_STATS *, int reset);
+
+#endif
@@ -31,6 +31,16 @@
 
 #ifndef SC_USE_DMQ
 
+/*
+ * The queue needs no locking with one producer (reserve, commit, discard)
+ * and one consumer (read, ack).  Each side only moves its own indices and
+ * offsets; a message changes hands through its state, which is published
+ * with release stores and checked with acquire loads.
+ */
+#define RBMQ_LOAD_ACQUIRE(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RBMQ_STORE_RELEASE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define RBMQ_STORE_RELAXED(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
 #define RBMQ_MSG_FLAG_EXTERNAL  0x01
 
 enum {
@@ -80,6 +90,7 @@ typedef struct _rbmq
 {
     RBMQ_MsgRing msg_ring;
     RBMQ_DataRing data_ring;
+    uint64_t full;
 } RBMQ;
 
 static inline uint32_t IncrementMessageIndex(RBMQ *mq, uint32_t index)
@@ -149,32 +160,46 @@ int RBMQ_ReserveMsg(RBMQ *mq, uint32_t length, void **hdr_ptr, uint8_t **msg_ptr
 {
     RBMQ_InternalDataHdr *idh;
     RBMQ_Msg *msg_info;
-    uint32_t msg_index, msg_len, start_offset;
+    uint32_t msg_index, msg_len, start_offset, read_offset;
 
     /* Find the next entry in the message ring to reserve. */
     msg_index = IncrementMessageIndex(mq, mq->msg_ring.last_reserved);
     msg_info = &mq->msg_ring.msgs[msg_index];
 
     /* Bail if the entry is in use. */
-    if (msg_info->state != RBMQ_MSG_STATE_UNUSED)
+    if (RBMQ_LOAD_ACQUIRE(&msg_info->state) != RBMQ_MSG_STATE_UNUSED)
+    {
+        mq->full++;
         return -ENOMEM;
+    }
 
-    /* Make sure that we can reserve the requested space in the data ring. */
+    /* Make sure that we can reserve the requested space in the data ring.  The write offset
+        never catches up with the read offset, equal offsets mean the ring is empty. */
+    read_offset = RBMQ_LOAD_ACQUIRE(&mq->data_ring.read_offset);
     msg_len = length + sizeof(RBMQ_InternalDataHdr);
-    if (mq->data_ring.write_offset < mq->data_ring.read_offset)
+    if (mq->data_ring.write_offset < read_offset)
     {
-        if ((mq->data_ring.read_offset - mq->data_ring.write_offset) < msg_len)
+        if ((read_offset - mq->data_ring.write_offset) <= msg_len)
+        {
+            mq->full++;
             return -ENOMEM;
+        }
         start_offset = mq->data_ring.write_offset;
     }
-    else if ((mq->data_ring.size - mq->data_ring.write_offset) < msg_len)
+    else if ((mq->data_ring.size - mq->data_ring.write_offset) > msg_len ||
+             ((mq->data_ring.size - mq->data_ring.write_offset) == msg_len && read_offset != 0))
+    {
+        start_offset = mq->data_ring.write_offset;
+    }
+    else
     {
-        if (mq->data_ring.read_offset < msg_len)
+        if (read_offset <= msg_len)
+        {
+            mq->full++;
             return -ENOMEM;
+        }
         start_offset = 0;
     }
-    else
-        start_offset = mq->data_ring.write_offset;
 
     idh = (RBMQ_InternalDataHdr *) (mq->data_ring.data + start_offset);
     idh->msg_index = msg_index;
@@ -188,7 +213,7 @@ int RBMQ_ReserveMsg(RBMQ *mq, uint32_t length, void **hdr_ptr, uint8_t **msg_ptr
     msg_info->length = length;
     /* Type is filled in during the commit. */
     msg_info->flags = 0;
-    msg_info->state = RBMQ_MSG_STATE_RESERVED;
+    RBMQ_STORE_RELAXED(&msg_info->state, RBMQ_MSG_STATE_RESERVED);
     msg_info->data = (uint8_t *) idh + sizeof(RBMQ_InternalDataHdr);
     msg_info->msgFreeFunc = NULL;
 
@@ -238,8 +263,8 @@ int RBMQ_CommitReservedMsg(RBMQ *mq, void *msg_handle, uint32_t length, SCMQMsgF
         msg_info->length = length;
     }
 
-    msg_info->state = RBMQ_MSG_STATE_COMMITTED;
     msg_info->msgFreeFunc = msgFreeFunc;
+    RBMQ_STORE_RELEASE(&msg_info->state, RBMQ_MSG_STATE_COMMITTED);
 
     return 0;
 }
@@ -262,27 +287,26 @@ int RBMQ_DiscardReservedMsg(RBMQ *mq, void *msg_handle)
         return -EINVAL;
     }
 
-    msg_info->state = RBMQ_MSG_STATE_DISCARDED;
-
-    /* Working backward from the last entry reserved (in order), release discarded messages as allowed. 
-        Any discarded messages that we can't release here will have to wait until something gets ACK'd. */
+    /* The reader never gets past a reserved message, so the last one reserved can be released
+        right away.  Anything before it is handed over as discarded since the reader may already be
+        looking at it; it will be released when something after it gets ACK'd. */
     idx = mq->msg_ring.last_reserved;
-    msg_info = &mq->msg_ring.msgs[idx];
-    while (msg_info->state == RBMQ_MSG_STATE_DISCARDED)
+    if (msg_info != &mq->msg_ring.msgs[idx])
     {
-        /* Clean up the data ring state if this was internally allocated.  Only internally allocated
-            messages can be discarded, so this should be safe. */
-        idh = (RBMQ_InternalDataHdr *) (msg_info->data - sizeof(RBMQ_InternalDataHdr));
-        mq->data_ring.write_offset = idh->prev_offset;
+        RBMQ_STORE_RELEASE(&msg_info->state, RBMQ_MSG_STATE_DISCARDED);
+        return 0;
+    }
 
-        /* Reset the state to unused so that it can be reserved again. */
-        msg_info->state = RBMQ_MSG_STATE_UNUSED;
+    /* Clean up the data ring state if this was internally allocated.  Only internally allocated
+        messages can be discarded, so this should be safe. */
+    idh = (RBMQ_InternalDataHdr *) (msg_info->data - sizeof(RBMQ_InternalDataHdr));
+    mq->data_ring.write_offset = idh->prev_offset;
 
-        /* Finally, update the last reserved index. */
-        idx = DecrementMessageIndex(mq, idx);
-        mq->msg_ring.last_reserved = idx;
-        msg_info = &mq->msg_ring.msgs[idx];
-    }
+    /* Reset the state to unused so that it can be reserved again. */
+    RBMQ_STORE_RELAXED(&msg_info->state, RBMQ_MSG_STATE_UNUSED);
+
+    /* Finally, update the last reserved index. */
+    mq->msg_ring.last_reserved = DecrementMessageIndex(mq, idx);
 
     return 0;
 }
@@ -299,8 +323,11 @@ int RBMQ_CommitExternalMsg(RBMQ *mq, const void *hdr, uint8_t *msg, uint32_t len
     msg_info = &mq->msg_ring.msgs[idx];
 
     /* Bail if the entry is in use. */
-    if (msg_info->state != RBMQ_MSG_STATE_UNUSED)
+    if (RBMQ_LOAD_ACQUIRE(&msg_info->state) != RBMQ_MSG_STATE_UNUSED)
+    {
+        mq->full++;
         return -ENOMEM;
+    }
 
     /* Require a header if there is a header size specified for the control ring and copy it over. */
     if (mq->msg_ring.header_size)
@@ -312,13 +339,14 @@ int RBMQ_CommitExternalMsg(RBMQ *mq, const void *hdr, uint8_t *msg, uint32_t len
 
     msg_info->length = length;
     msg_info->flags = RBMQ_MSG_FLAG_EXTERNAL;
-    msg_info->state = RBMQ_MSG_STATE_COMMITTED;
     msg_info->data = msg;
     msg_info->msgFreeFunc = msgFreeFunc;
 
     /* Update the last reservation index in the control ring. */
     mq->msg_ring.last_reserved = idx;
 
+    RBMQ_STORE_RELEASE(&msg_info->state, RBMQ_MSG_STATE_COMMITTED);
+
     return 0;
 }
 
@@ -326,21 +354,24 @@ int RBMQ_ReadMsg(RBMQ *mq, const void **hdr_ptr, const uint8_t **msg_ptr, uint32
 {
     RBMQ_Msg *msg_info;
     uint32_t idx;
+    uint8_t state;
 
     /* Find the next entry in the message ring to read. */
     idx = IncrementMessageIndex(mq, mq->msg_ring.last_read);
     msg_info = &mq->msg_ring.msgs[idx];
+    state = RBMQ_LOAD_ACQUIRE(&msg_info->state);
 
     /* Skip over discarded messages -- the next ACK should clear them out. */
-    while (msg_info->state == RBMQ_MSG_STATE_DISCARDED)
+    while (state == RBMQ_MSG_STATE_DISCARDED)
     {
         mq->msg_ring.last_read = idx;
         idx = IncrementMessageIndex(mq, idx);
         msg_info = &mq->msg_ring.msgs[idx];
+        state = RBMQ_LOAD_ACQUIRE(&msg_info->state);
     }
 
     /* Return an error if there is not a committed entry ready to be read. */
-    if (msg_info->state != RBMQ_MSG_STATE_COMMITTED)
+    if (state != RBMQ_MSG_STATE_COMMITTED)
         return -ENOENT;
 
     if (mq->msg_ring.header_size)
@@ -351,7 +382,7 @@ int RBMQ_ReadMsg(RBMQ *mq, const void **hdr_ptr, const uint8_t **msg_ptr, uint32
     *length = msg_info->length;
     *msg_handle = msg_info;
 
-    msg_info->state = RBMQ_MSG_STATE_READ;
+    RBMQ_STORE_RELAXED(&msg_info->state, RBMQ_MSG_STATE_READ);
     mq->msg_ring.last_read = idx;
 
     return 0;
@@ -377,22 +408,31 @@ int RBMQ_AckMsg(RBMQ *mq, void *msg_handle)
     if (msg_info->data && msg_info->msgFreeFunc)
         msg_info->msgFreeFunc(msg_info->data);
 
-    msg_info->state = RBMQ_MSG_STATE_ACKED;
+    RBMQ_STORE_RELAXED(&msg_info->state, RBMQ_MSG_STATE_ACKED);
 
     /* Working forward from the last entry ACK'd (in order), release ACK'd and discarded messages as allowed. */
     do {
+        uint8_t state;
+
         idx = IncrementMessageIndex(mq, mq->msg_ring.last_acked);
         msg_info = &mq->msg_ring.msgs[idx];
-        if (msg_info->state != RBMQ_MSG_STATE_ACKED && msg_info->state != RBMQ_MSG_STATE_DISCARDED)
+        state = RBMQ_LOAD_ACQUIRE(&msg_info->state);
+        if (state != RBMQ_MSG_STATE_ACKED && state != RBMQ_MSG_STATE_DISCARDED)
             break;
 
         /* Clean up the data ring state if this was internally allocated.  We are guaranteed that internal
             allocations will be sequential in relation to sequential control entries.*/
         if (!(msg_info->flags & RBMQ_MSG_FLAG_EXTERNAL))
-            mq->data_ring.read_offset = msg_info->data + msg_info->length - mq->data_ring.data;
+        {
+            uint32_t read_offset = msg_info->data + msg_info->length - mq->data_ring.data;
+
+            if (read_offset == mq->data_ring.size)
+                read_offset = 0;
+            RBMQ_STORE_RELEASE(&mq->data_ring.read_offset, read_offset);
+        }
 
         /* Reset the state to unused so it can be reserved again. */
-        msg_info->state = RBMQ_MSG_STATE_UNUSED;
+        RBMQ_STORE_RELEASE(&msg_info->state, RBMQ_MSG_STATE_UNUSED);
 
         /* Finally, update the last ACK'd index to accurately represent how far processing has gotten. */
         mq->msg_ring.last_acked = idx;
@@ -403,18 +443,36 @@ int RBMQ_AckMsg(RBMQ *mq, void *msg_handle)
 
 int RBMQ_IsEmpty(RBMQ *mq)
 {
-    RBMQ_Msg *msg_info;
     uint32_t idx;
+    uint8_t state;
 
-    /* Find the next entry in the message ring to read and return true if it's not committed. */
-    idx = IncrementMessageIndex(mq, mq->msg_ring.last_read);
-    msg_info = &mq->msg_ring.msgs[idx];
+    /* Find the next entry in the message ring to read, past any discarded ones, and return true
+        if it's not committed. */
+    idx = mq->msg_ring.last_read;
+    do {
+        idx = IncrementMessageIndex(mq, idx);
+        state = RBMQ_LOAD_ACQUIRE(&mq->msg_ring.msgs[idx].state);
+    } while (state == RBMQ_MSG_STATE_DISCARDED && idx != mq->msg_ring.last_read);
 
-    return (msg_info->state != RBMQ_MSG_STATE_COMMITTED);
+    return (state != RBMQ_MSG_STATE_COMMITTED);
 }
 
 void RBMQ_Stats(RBMQ_Ptr mq, const char *indent)
 {
+    uint32_t length, used;
+    uint32_t read_offset = RBMQ_LOAD_ACQUIRE(&mq->data_ring.read_offset);
+    uint32_t write_offset = mq->data_ring.write_offset;
+
+    length = (mq->msg_ring.last_reserved + mq->msg_ring.entries - mq->msg_ring.last_acked) % mq->msg_ring.entries;
+
+    if (write_offset >= read_offset)
+        used = write_offset - read_offset;
+    else
+        used = mq->data_ring.size - read_offset + write_offset;
+
+    LogMessage("%s  Length: %u (%u max)\n", indent, length, mq->msg_ring.entries);
+    LogMessage("%s  Size: %u internal (%u max)\n", indent, used, mq->data_ring.size);
+    LogMessage("%s  Full: %"PRIu64"\n", indent, mq->full);
 }
 
 #endif /* !SC_USE_DMQ */
@@ -28,6 +28,12 @@
 #endif
 
 #include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef LINUX
+#include <sys/eventfd.h>
+#endif
 
 #include "dmq.h"
 #include "rbmq.h"
@@ -46,6 +52,8 @@
 #define CONF_TX_QUEUE_DEPTH     "tx-queue-depth"
 #define CONF_DISABLE_TX_THREAD  "disable-tx-thread"
 
+#define TX_THREAD_IDLE_TIMEOUT  10000   /* ms */
+
 #ifdef SC_USE_DMQ
 #define RBMQ_Ptr DMQ_Ptr
 #define RBMQ_Alloc DMQ_Alloc
@@ -101,6 +109,9 @@ typedef struct _SC_MESSAGE_QUEUE
     pthread_cond_t cond;
     uint32_t max_data_size;
     uint32_t max_depth;
+    bool lockless;              /* one producer and one consumer on a ring, no mutex */
+    volatile int sleeping;      /* the consumer is waiting for wakeup_fd */
+    int wakeup_fd[2];           /* read and write ends, the same eventfd on Linux */
 } SCMessageQueue;
 
 static struct {
@@ -114,6 +125,9 @@ static struct {
 static volatile int stop_processing = 0;
 static volatile int tx_thread_running = 0;
 
+/* Dynamic side channel plugins may queue TX messages from their own threads. */
+static int tx_shared_producers = 0;
+
 static pid_t tx_thread_pid;
 static pthread_t tx_thread_id;
 static pthread_t *p_tx_thread_id;
@@ -131,6 +145,97 @@ static SCHandler *tx_handlers;
 PreprocStats sideChannelRxPerfStats;
 #endif
 
+static inline void SCLockQueue(SCMessageQueue *mq)
+{
+    if (!mq->lockless)
+        pthread_mutex_lock(&mq->mutex);
+}
+
+static inline void SCUnlockQueue(SCMessageQueue *mq)
+{
+    if (!mq->lockless)
+        pthread_mutex_unlock(&mq->mutex);
+}
+
+static void SCWakeupInit(SCMessageQueue *mq)
+{
+#ifdef LINUX
+    mq->wakeup_fd[0] = mq->wakeup_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mq->wakeup_fd[0] < 0)
+        FatalError("Side Channel: Unable to create eventfd: %s\n", strerror(errno));
+#else
+    if (pipe(mq->wakeup_fd) != 0)
+        FatalError("Side Channel: Unable to create pipe: %s\n", strerror(errno));
+    fcntl(mq->wakeup_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(mq->wakeup_fd[1], F_SETFL, O_NONBLOCK);
+#endif
+}
+
+static void SCWakeupCleanup(SCMessageQueue *mq)
+{
+    if (mq->wakeup_fd[0] >= 0)
+        close(mq->wakeup_fd[0]);
+    if (mq->wakeup_fd[1] != mq->wakeup_fd[0] && mq->wakeup_fd[1] >= 0)
+        close(mq->wakeup_fd[1]);
+    mq->wakeup_fd[0] = mq->wakeup_fd[1] = -1;
+}
+
+static inline void SCWakeupSignal(SCMessageQueue *mq)
+{
+#ifdef LINUX
+    uint64_t one = 1;
+#else
+    uint8_t one = 1;
+#endif
+    /* A full queue of wakeups is as good as another one, so the result is not checked. */
+    if (write(mq->wakeup_fd[1], &one, sizeof(one)) < 0)
+        return;
+}
+
+/* Called by the producer after committing: only make the system call when the consumer has gone
+    to sleep.  The barrier pairs with the one in SCWakeupWait so that either the producer sees the
+    consumer sleeping or the consumer sees the new message. */
+static inline void SCWakeupConsumer(SCMessageQueue *mq)
+{
+    __sync_synchronize();
+    if (mq->sleeping)
+        SCWakeupSignal(mq);
+}
+
+/* Returns 0 on timeout. */
+static int SCWakeupWait(SCMessageQueue *mq, int timeout)
+{
+    struct pollfd pfd;
+    uint64_t buf[8];
+    int empty, rval;
+
+    mq->sleeping = 1;
+    __sync_synchronize();
+
+    SCLockQueue(mq);
+    empty = RBMQ_IsEmpty(mq->queue);
+    SCUnlockQueue(mq);
+
+    if (!empty || stop_processing)
+    {
+        mq->sleeping = 0;
+        return 1;
+    }
+
+    pfd.fd = mq->wakeup_fd[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    rval = poll(&pfd, 1, timeout);
+
+    while (read(mq->wakeup_fd[0], buf, sizeof(buf)) > 0)
+        ;
+
+    mq->sleeping = 0;
+
+    return (rval < 0 && errno == EINTR) ? 1 : rval;
+}
+
 void RegisterSideChannelModules(void)
 {
     if (!ScSideChannelEnabled())
@@ -261,9 +366,9 @@ static int SCPreallocMessage(SCMessageQueue *mq, uint32_t length, SCMsgHdr **hdr
 {
     int rval;
 
-    pthread_mutex_lock(&mq->mutex);
+    SCLockQueue(mq);
     rval = RBMQ_ReserveMsg(mq->queue, length, (void **) hdr_ptr, msg_ptr, msg_handle);
-    pthread_mutex_unlock(&mq->mutex);
+    SCUnlockQueue(mq);
 
     return rval;
 }
@@ -282,9 +387,9 @@ static int SCDiscardMessage(SCMessageQueue *mq, void *msg_handle)
 {
     int rval;
 
-    pthread_mutex_lock(&mq->mutex);
+    SCLockQueue(mq);
     rval = RBMQ_DiscardReservedMsg(mq->queue, msg_handle);
-    pthread_mutex_unlock(&mq->mutex);
+    SCUnlockQueue(mq);
 
     return rval;
 }
@@ -349,9 +454,9 @@ static int SCDrainAndProcess(SCMessageQueue *mq, SCHandler *handlers)
     int rval;
 
     /* Read a message from the queue. */
-    pthread_mutex_lock(&mq->mutex);
+    SCLockQueue(mq);
     rval = RBMQ_ReadMsg(mq->queue, (const void **) &hdr, &msg, &length, &msg_handle);
-    pthread_mutex_unlock(&mq->mutex);
+    SCUnlockQueue(mq);
     if (rval != 0)
         return 1;
 
@@ -359,9 +464,9 @@ static int SCDrainAndProcess(SCMessageQueue *mq, SCHandler *handlers)
     SCProcessMessage(handlers, hdr, msg, length);
 
     /* And, finally, acknowledge it. */
-    pthread_mutex_lock(&mq->mutex);
+    SCLockQueue(mq);
     rval = RBMQ_AckMsg(mq->queue, msg_handle);
-    pthread_mutex_unlock(&mq->mutex);
+    SCUnlockQueue(mq);
     if (rval != 0)
         WarningMessage("Error ACK'ing message %p!\n", msg_handle);
 
@@ -419,20 +524,18 @@ int SideChannelEnqueueMessageRX(SCMsgHdr *hdr, const uint8_t *msg, uint32_t leng
 /* Called in the Snort main thread. */
 int SideChannelEnqueueMessageTX(SCMsgHdr *hdr, const uint8_t *msg, uint32_t length, void *msg_handle, SCMQMsgFreeFunc msgFreeFunc)
 {
-    int rval, empty;
+    int rval;
 
     /* Only bother queuing if the TX thread is running, otherwise just immediately process. */
     if (tx_thread_running)
     {
-        pthread_mutex_lock(&tx_queue.mutex);
-        empty = RBMQ_IsEmpty(tx_queue.queue);
+        SCLockQueue(&tx_queue);
         rval = SCEnqueueMessage(&tx_queue, hdr, msg, length, msg_handle, msgFreeFunc);
         /* TODO: Error check the above call. */
         Side_Channel_Stats.tx_messages_total++;
-        /* If the queue was empty, signal any waiters. */
-        if (empty)
-            pthread_cond_signal(&tx_queue.cond);
-        pthread_mutex_unlock(&tx_queue.mutex);
+        SCUnlockQueue(&tx_queue);
+        /* If the TX thread is waiting for messages, wake it up. */
+        SCWakeupConsumer(&tx_queue);
     }
     else
     {
@@ -443,9 +546,9 @@ int SideChannelEnqueueMessageTX(SCMsgHdr *hdr, const uint8_t *msg, uint32_t leng
             msgFreeFunc((uint8_t *) msg);
         if (msg_handle)
         {
-            pthread_mutex_lock(&tx_queue.mutex);
+            SCLockQueue(&tx_queue);
             RBMQ_DiscardReservedMsg(tx_queue.queue, msg_handle);
-            pthread_mutex_unlock(&tx_queue.mutex);
+            SCUnlockQueue(&tx_queue);
         }
         rval = 0;
     }
@@ -475,20 +578,18 @@ int SideChannelEnqueueDataRX(SCMsgHdr *hdr, uint8_t *msg, uint32_t length, SCMQM
 /* Called in the Snort main thread. */
 int SideChannelEnqueueDataTX(SCMsgHdr *hdr, uint8_t *msg, uint32_t length, SCMQMsgFreeFunc msgFreeFunc)
 {
-    int rval, empty;
+    int rval;
 
     /* Only bother queuing if the TX thread is running, otherwise just immediately process. */
     if (tx_thread_running)
     {
-        pthread_mutex_lock(&tx_queue.mutex);
-        empty = RBMQ_IsEmpty(tx_queue.queue);
+        SCLockQueue(&tx_queue);
         rval = SCEnqueueData(&tx_queue, hdr, msg, length, msgFreeFunc);
         /* TODO: Error check the above call. */
         Side_Channel_Stats.tx_messages_total++;
-        /* If the queue was empty, signal any waiters. */
-        if (empty)
-            pthread_cond_signal(&tx_queue.cond);
-        pthread_mutex_unlock(&tx_queue.mutex);
+        SCUnlockQueue(&tx_queue);
+        /* If the TX thread is waiting for messages, wake it up. */
+        SCWakeupConsumer(&tx_queue);
     }
     else
     {
@@ -527,8 +628,6 @@ uint32_t SideChannelDrainRX(unsigned max_msgs)
 
 static void *SideChannelThread(void *arg)
 {
-    struct timespec ts;
-    struct timeval tv;
     SCHandler *handler;
     SCModule *module;
     SCMsgHdr *hdr;
@@ -540,41 +639,38 @@ static void *SideChannelThread(void *arg)
     tx_thread_pid = gettid();
     tx_thread_running = 1;
 
-    pthread_mutex_lock(&tx_queue.mutex);
-    while (!stop_processing)
+    while (1)
     {
-        /* If the message queue is empty, we will stop without unlocking it so we can immediately start a timed wait. */
-        while ((rval = RBMQ_ReadMsg(tx_queue.queue, (const void **) &hdr, &msg, &length, &msg_handle)) == 0)
-        {
-            pthread_mutex_unlock(&tx_queue.mutex);
+        SCLockQueue(&tx_queue);
+        rval = RBMQ_ReadMsg(tx_queue.queue, (const void **) &hdr, &msg, &length, &msg_handle);
+        SCUnlockQueue(&tx_queue);
 
+        if (rval == 0)
+        {
             for (handler = tx_handlers; handler; handler = handler->next)
             {
                 if (hdr->type == handler->type || handler->type == SC_MSG_TYPE_ANY)
                     handler->processMsgFunc(hdr, msg, length);
             }
 
-            pthread_mutex_lock(&tx_queue.mutex);
+            SCLockQueue(&tx_queue);
             rval = RBMQ_AckMsg(tx_queue.queue, msg_handle);
+            SCUnlockQueue(&tx_queue);
             if (rval != 0)
                 WarningMessage("Error ACK'ing message %p!\n", msg_handle);
-            /* Again, not unlocking so that we're already locked for the three places we can go
-                from here, which are all expecting it (dequeue, timed wait, or done). */
 
             Side_Channel_Stats.tx_messages_processed++;
 #ifndef REG_TEST
             if (stop_processing)
-                goto done;
+                break;
 #endif
+            continue;
         }
         if (stop_processing)
-            goto done;
-        gettimeofday(&tv, NULL);
-        ts.tv_sec = tv.tv_sec + 10;
-        ts.tv_nsec = tv.tv_usec * 1000;
-        rval = pthread_cond_timedwait(&tx_queue.cond, &tx_queue.mutex, &ts);
+            break;
+
         /* If we timed out waiting for new output messages to process, run the registered idle routines. */
-        if (rval == ETIMEDOUT && !stop_processing)
+        if (SCWakeupWait(&tx_queue, TX_THREAD_IDLE_TIMEOUT) == 0 && !stop_processing)
         {
             for (module = modules; module; module = module->next)
             {
@@ -583,8 +679,6 @@ static void *SideChannelThread(void *arg)
             }
         }
     }
-done:
-    pthread_mutex_unlock(&tx_queue.mutex);
 
     LogMessage("Side Channel thread exiting...\n");
 
@@ -709,6 +803,12 @@ void SideChannelInit(void)
     pthread_cond_init(&tx_queue.cond, NULL);
     pthread_mutex_init(&tx_queue.mutex, NULL);
     tx_queue.queue = RBMQ_Alloc(tx_queue.max_depth, sizeof(SCMsgHdr), tx_queue.max_data_size);
+#ifndef SC_USE_DMQ
+    /* Without plugins queuing from other threads, only the Snort main thread queues TX messages
+        and only the TX thread reads them. */
+    tx_queue.lockless = !tx_shared_producers;
+#endif
+    SCWakeupInit(&tx_queue);
 
     for (module = modules; module; module = module->next)
     {
@@ -717,6 +817,12 @@ void SideChannelInit(void)
     }
 }
 
+/* Called before SideChannelInit() for every dynamic side channel plugin handed the TX functions. */
+void SideChannelAddSharedTXProducer(void)
+{
+    tx_shared_producers++;
+}
+
 void SideChannelStartTXThread(void)
 {
     const struct timespec thread_sleep = { 0, 100 };
@@ -789,9 +895,7 @@ void SideChannelStopTXThread(void)
     if (p_tx_thread_id != NULL)
     {
         stop_processing = 1;
-        pthread_mutex_lock(&tx_queue.mutex);
-        pthread_cond_signal(&tx_queue.cond);
-        pthread_mutex_unlock(&tx_queue.mutex);
+        SCWakeupSignal(&tx_queue);
         if ((rval = pthread_join(*p_tx_thread_id, NULL)) != 0)
             WarningMessage("Side channel TX thread termination returned an error: %s\n", strerror(rval));
     }
@@ -865,6 +969,7 @@ void SideChannelCleanUp(void)
         free(module->keyword);
         free(module);
     }
+    SCWakeupCleanup(&tx_queue);
     pthread_cond_destroy(&tx_queue.cond);
     pthread_mutex_destroy(&tx_queue.mutex);
     pthread_cond_destroy(&rx_queue.cond);
@@ -29,6 +29,7 @@
 
 void SideChannelConfigure(SnortConfig *sc);
 void SideChannelInit(void);
+void SideChannelAddSharedTXProducer(void);
 void SideChannelStartTXThread(void);
 void SideChannelStopTXThread(void);
 void SideChannelCleanUp(void);
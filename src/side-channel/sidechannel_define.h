@@ -26,7 +26,11 @@
 
 #include <stdint.h>
 
-#define SC_USE_DMQ 1
+/* Both queues are ring buffers.  The TX queue is lock-free while only the packet
+   thread and the TX thread use it, i.e. no dynamic side channel plugins are
+   loaded; the RX queue always uses its mutex.  Define SC_USE_DMQ to go back to
+   the mutex protected lists for both. */
+/* #define SC_USE_DMQ 1 */
 
 /* You get 16 bits worth of types.  Use them wisely. */
 enum
@@ -116,6 +116,7 @@
 #include "strlcpyu.h"
 #include "sflsq.h"
 #include "sp_replace.h"
+#include "sp_pcre.h"
 #include "output-plugins/spo_log_tcpdump.h"
 #include "event_queue.h"
 #include "asn1.h"
@@ -130,6 +131,7 @@
 #include "detection_util.h"
 #include "sfcontrol_funcs.h"
 #include "idle_processing_funcs.h"
+#include "workers.h"
 #include "file_service.h"
 #include "session_expect.h"
 #ifdef SIDE_CHANNEL
@@ -153,6 +155,7 @@
 # include "cpuclock.h"
 #endif
 #include "sfActionQueue.h"
+#include "sfnuma.h"
 
 #ifdef INTEL_SOFT_CPM
 #include "sfutil/intel-soft-cpm.h"
@@ -482,6 +485,8 @@ static struct option long_options[] =
 
    {"suppress-config-log", LONGOPT_ARG_NONE, NULL, SUPPRESS_CONFIG_LOG},
 
+   {"workers", LONGOPT_ARG_REQUIRED, NULL, ARG_WORKERS},
+
    {0, 0, 0, 0}
 };
 
@@ -543,7 +548,9 @@ static void LoadDynamicPlugins(SnortConfig *);
 static void SnortIdle(void);
 #ifndef WIN32
 static void SnortStartThreads(void);
+static void SuperviseWorkers(const char *);
 #endif
+static void PrintStatistics(void);
 
 /* Signal handler declarations ************************************************/
 static void SigDumpStatsHandler(int);
@@ -872,17 +879,37 @@ int SnortMain(int argc, char *argv[])
     if ( daqInit )
     {
         DAQ_Init(snort_conf);
-        DAQ_New(snort_conf, intf);
-        DAQ_UpdateTunnelBypass(snort_conf);
+
+        // workers open their own daq instance after the fork
+        if ( !ScWorkerCount() || ScTestMode() )
+        {
+            DAQ_New(snort_conf, intf);
+            DAQ_UpdateTunnelBypass(snort_conf);
+        }
     }
-    if ( tmp_ptr )
-        free(tmp_ptr);
 
     if ( ScDaemonMode() )
     {
         GoDaemon();
     }
 
+#ifndef WIN32
+    if ( ScWorkerCount() && !ScTestMode() )
+    {
+        if ( !daqInit )
+            FatalError("Workers require a packet source.\n");
+
+        // the supervisor doesn't return from here
+        if ( Workers_Spawn(snort_conf, intf) < 0 )
+            SuperviseWorkers(intf);
+
+        DAQ_New(snort_conf, intf);
+        DAQ_UpdateTunnelBypass(snort_conf);
+    }
+#endif
+    if ( tmp_ptr )
+        free(tmp_ptr);
+
     // this must follow daemonization
     snort_main_thread_pid = gettid();
 #ifndef WIN32
@@ -949,6 +976,11 @@ int SnortMain(int argc, char *argv[])
         }
     }
 
+#ifdef PERF_PROFILING
+    /* counters count for the opening thread only, so after any fork */
+    PerfCountersInit();
+#endif
+
     PacketLoop();
 
     // DAQ is shutdown in CleanExit() since we don't always return here
@@ -992,6 +1024,110 @@ static void SnortStartThreads(void)
     SFAT_StartReloadThread();
 # endif
 }
+
+/* Signals caught by the supervisor are passed on to the workers. */
+static int WorkerPendingSignal(void)
+{
+#if defined(SNORT_RELOAD)
+    static snort_reload_t reload_forwarded = 0;
+#endif
+
+    if (exit_signal)
+    {
+        int sig = exit_signal;
+
+        if (!exit_logged)
+        {
+            ErrorMessage("*** Caught %s, stopping workers\n",
+                (sig == SIGINT) ? "Int-Signal" :
+                (sig == SIGQUIT) ? "Quit-Signal" : "Term-Signal");
+            exit_logged = 1;
+            return sig;
+        }
+        return 0;
+    }
+
+    if (dump_stats_signal)
+    {
+        dump_stats_signal = false;
+        return SIGNAL_SNORT_DUMP_STATS;
+    }
+
+    if (rotate_stats_signal)
+    {
+        /* the supervisor rotates the merged perfmonitor file */
+        rotate_stats_signal = false;
+        SetRotatePerfFileFlag();
+        return SIGNAL_SNORT_ROTATE_STATS;
+    }
+
+#if defined(SNORT_RELOAD)
+    if (reload_signal != reload_forwarded)
+    {
+        reload_forwarded = reload_signal;
+        return SIGNAL_SNORT_RELOAD;
+    }
+#else
+    if (reload_signal)
+    {
+        reload_signal = false;
+        return SIGNAL_SNORT_RELOAD;
+    }
+#endif
+
+    return 0;
+}
+
+/* The supervisor keeps the startup state, so a worker that has to be
+ * replaced is forked from here and continues where the first ones did. */
+static void SuperviseWorkers(const char *intf)
+{
+    snort_initializing = false;
+    snort_main_thread_pid = gettid();
+
+    if ( !ScReadMode() &&
+       (ScDaemonMode() || *snort_conf->pidfile_suffix || ScCreatePidFile()))
+    {
+        CreatePidFile(intf ? intf : "", snort_main_thread_pid, snort_conf->parent_pid);
+    }
+
+    TimeStart();
+
+    if ( Workers_Supervise(WorkerPendingSignal) >= 0 )
+    {
+#if defined(SNORT_RELOAD)
+        /* the replacement has the startup config; one reload brings it to
+         * the config the other workers were reloaded with */
+        if ( reload_signal )
+        {
+            LogMessage("Reloading the configuration of the restarted worker\n");
+            reload_total = reload_signal - 1;
+        }
+#endif
+        snort_initializing = true;
+        return;
+    }
+
+    Workers_MergeStats();
+    TimeStop();
+    PrintStatistics();
+    Workers_Cleanup();
+
+    ClosePidFile();
+
+    if (SnortStrnlen(snort_conf->pid_filename, sizeof(snort_conf->pid_filename)) > 0)
+    {
+        if (unlink(snort_conf->pid_filename) != 0)
+        {
+            ErrorMessage("Could not remove pid file %s: %s\n",
+                         snort_conf->pid_filename, strerror(errno));
+        }
+    }
+
+    LogMessage("Snort exiting\n");
+    closelog();
+    exit(0);
+}
 #else   /* WIN32 */
 //------------------------------------------------------------------------------
 // interface stuff
@@ -1700,6 +1836,15 @@ static DAQ_Verdict PacketCallback(
 #endif
     }
 
+    if ( !Workers_OwnsPacket(pkthdr, pkt) )
+    {
+        /* another worker handles this flow */
+        CheckForReload();
+        packet_time_update(&pkthdr->ts);
+        PREPROC_PROFILE_END_PI(totalPerfStats);
+        return DAQ_VERDICT_PASS;
+    }
+
     pc.total_from_daq++;
 
     /* Increment counter that we're evaling rules for caching results */
@@ -1836,6 +1981,8 @@ static DAQ_Verdict PacketCallback(
 
     s_packet.pkth = NULL;  // no longer avail on segv
 
+    Workers_PublishStats(false);
+
     PREPROC_PROFILE_END_PI(totalPerfStats);
     return verdict;
 }
@@ -2124,6 +2271,7 @@ static int ShowUsage(char *program_name)
     FPUTS_BOTH ("   --ha-out <file>                 Write high-availability events to this file.\n");
     FPUTS_BOTH ("   --ha-in <file>                  Read high-availability events from this file on startup (warm-start).\n");
     FPUTS_BOTH ("   --suppress-config-log           Suppress configuration information output.\n");
+    FPUTS_UNIX ("   --workers <count>               Fork <count> packet processing worker processes.\n");
 #undef FPUTS_WIN32
 #undef FPUTS_UNIX
 #undef FPUTS_BOTH
@@ -2942,6 +3090,10 @@ static void ParseCmdLine(int argc, char **argv)
                 sc->suppress_config_log = 1;
                 break;
 
+            case ARG_WORKERS:
+                ConfigWorkers(sc, optarg);
+                break;
+
             case '?':  /* show help and exit with 1 */
                 PrintVersion();
                 ShowUsage(argv[0]);
@@ -3274,6 +3426,7 @@ static void SnortIdle(void)
 
     if( session_api )
         session_api->check_session_timeout(16384, time(NULL));
+    Workers_PublishStats(false);
     ControlSocketDoWork(1);
 #ifdef SIDE_CHANNEL
     SideChannelDrainRX(0);
@@ -3567,6 +3720,14 @@ static void PrintStatistics (void)
     if ( ScTestMode() || ScVersionMode() || ScRuleDumpMode() )
         return;
 
+    if ( Workers_IsSupervisor() )
+    {
+        // detection stats are reported by each worker; preprocessor
+        // stats only for the counters the workers publish
+        DropStats(2);
+        return;
+    }
+
     fpShowEventStats(snort_conf);
 
 #ifdef PERF_PROFILING
@@ -3583,6 +3744,7 @@ static void PrintStatistics (void)
 
     DropStats(2);
     print_thresholding(snort_conf->threshold_config, 1);
+    Workers_PublishStats(true);
 }
 
 /****************************************************************************
@@ -4086,6 +4248,7 @@ int SignalCheck(void)
     {
         ErrorMessage("*** Caught Dump Stats-Signal\n");
         DropStats(0);
+        Workers_PublishStats(true);
     }
 
     dump_stats_signal = false;
@@ -4161,6 +4324,9 @@ SnortConfig * SnortConfNew(void)
     sc->default_rule_state = RULE_STATE_ENABLED;
     sc->pcre_match_limit = 1500;
     sc->pcre_match_limit_recursion = 1500;
+    sc->pcre_match_limit_policy = PCRE_MATCH_LIMIT_POLICY__NOMATCH;
+    sc->pcre_jit = 1;
+    sc->pcre_jit_stack_size = 1024;
     sc->ipv6_max_frag_sessions = 10000;
     sc->ipv6_frag_timeout = 60;  /* This is the default timeout on BSD */
 
@@ -4245,6 +4411,12 @@ void SnortConfFree(SnortConfig *sc)
 
     if (sc->profile_preprocs.filename != NULL)
         free(sc->profile_preprocs.filename);
+
+    if (sc->profile_rules.dump_file != NULL)
+        free(sc->profile_rules.dump_file);
+
+    if (sc->profile_preprocs.dump_file != NULL)
+        free(sc->profile_preprocs.dump_file);
 #endif
 
     FreeDynamicLibInfos(sc);
@@ -4291,6 +4463,8 @@ void SnortConfFree(SnortConfig *sc)
     if (sc->pcre_ovector != NULL)
         free(sc->pcre_ovector);
 
+    PcreFreeJitStack(sc);
+
     if ( sc->event_queue_config )
         EventQueueConfigFree(sc->event_queue_config);
 
@@ -4737,6 +4911,9 @@ static SnortConfig * MergeSnortConfs(SnortConfig *cmd_line, SnortConfig *config_
                      sizeof(config_file->pidfile_suffix));
     }
 
+    if (cmd_line->worker_count != 0)
+        config_file->worker_count = cmd_line->worker_count;
+
     if (cmd_line->chroot_dir != NULL)
     {
         if (config_file->chroot_dir != NULL)
@@ -4863,6 +5040,9 @@ static SnortConfig * MergeSnortConfs(SnortConfig *cmd_line, SnortConfig *config_
 
 #endif
 
+    /* a reload in a worker keeps the per worker paths */
+    Workers_ConfigureWorker(config_file);
+
     return config_file;
 }
 
@@ -5072,6 +5252,10 @@ void SnortInit(int argc, char **argv)
          * Set the global snort_conf that will be used during run time */
         snort_conf = MergeSnortConfs(snort_cmd_line_conf, sc);
 
+        /* before the preprocessors and the detection engine allocate
+         * their tables */
+        sfnuma_init(ScReadMode() ? NULL : snort_conf->interface);
+
         InitSynToMulticastDstIp(snort_conf);
         InitMulticastReservedIp(snort_conf);
 
@@ -5295,6 +5479,8 @@ void SnortInit(int argc, char **argv)
     SideChannelInit();
 #endif
 
+    sfnuma_print_summary();
+
     // If we suppressed output at the beginning of SnortInit(),
     // then restore it now.
     ScRestoreInternalLogLevel();
@@ -6043,6 +6229,13 @@ static int VerifyReload(SnortConfig *sc)
         return -1;
     }
 
+    if (snort_conf->worker_count != sc->worker_count)
+    {
+        ErrorMessage("Snort Reload: Changing the number of workers "
+                     "requires a restart.\n");
+        return -1;
+    }
+
 #ifdef TARGET_BASED
     if (snort_conf->max_attribute_hosts != sc->max_attribute_hosts)
     {
@@ -6086,10 +6279,11 @@ static int VerifyReload(SnortConfig *sc)
 #ifdef PERF_PROFILING
     if ((snort_conf->profile_rules.num != sc->profile_rules.num) ||
         (snort_conf->profile_rules.sort != sc->profile_rules.sort) ||
-        (snort_conf->profile_rules.append != sc->profile_rules.append))
+        (snort_conf->profile_rules.append != sc->profile_rules.append) ||
+        (snort_conf->profile_rules.counters != sc->profile_rules.counters))
     {
-        ErrorMessage("Snort Reload: Changing rule profiling number, sort "
-                     "or append configuration requires a restart.\n");
+        ErrorMessage("Snort Reload: Changing rule profiling number, sort, "
+                     "append or counters configuration requires a restart.\n");
         return -1;
     }
 
@@ -6114,10 +6308,11 @@ static int VerifyReload(SnortConfig *sc)
 
     if ((snort_conf->profile_preprocs.num !=  sc->profile_preprocs.num) ||
         (snort_conf->profile_preprocs.sort != sc->profile_preprocs.sort) ||
-        (snort_conf->profile_preprocs.append != sc->profile_preprocs.append))
+        (snort_conf->profile_preprocs.append != sc->profile_preprocs.append) ||
+        (snort_conf->profile_preprocs.counters != sc->profile_preprocs.counters))
     {
         ErrorMessage("Snort Reload: Changing preprocessor profiling number, "
-                     "sort or append configuration requires a restart.\n");
+                     "sort, append or counters configuration requires a restart.\n");
         return -1;
     }
 
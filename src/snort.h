@@ -303,6 +303,8 @@ typedef enum _GetOptLongIds
 
     SUPPRESS_CONFIG_LOG,
 
+    ARG_WORKERS,
+
     GET_OPT_LONG_IDS_MAX
 
 } GetOptLongIds;
@@ -546,6 +548,15 @@ typedef enum _ChecksumFlag
 
 } ChecksumFlag;
 
+/* config pcre_match_limit_policy
+ * what a pcre option evaluates to when the search hits a limit */
+typedef enum _PcreMatchLimitPolicy
+{
+    PCRE_MATCH_LIMIT_POLICY__NOMATCH,
+    PCRE_MATCH_LIMIT_POLICY__MATCH
+
+} PcreMatchLimitPolicy;
+
 typedef enum
 {
     /* config autogenerate_preprocessor_decoder_rules */
@@ -791,6 +802,10 @@ typedef struct _SnortConfig
     long int tagged_packet_limit;            /* config tagged_packet_limit */
     long int pcre_match_limit;               /* config pcre_match_limit */
     long int pcre_match_limit_recursion;     /* config pcre_match_limit_recursion */
+    int pcre_match_limit_policy;             /* config pcre_match_limit_policy */
+    int pcre_jit;                            /* config pcre_jit */
+    long int pcre_jit_stack_size;            /* config pcre_jit_stack, in KB */
+    void *pcre_jit_stack;
     int *pcre_ovector;
     int pcre_ovector_size;
 
@@ -973,6 +988,9 @@ typedef struct _SnortConfig
 
     struct _MandatoryEarlySessionCreator* mandatoryESCreators;
     bool normalizer_set;
+
+    uint32_t worker_count;      /* config workers, --workers */
+    int worker_balance;         /* config worker_balance */
 } SnortConfig;
 
 /* struct to collect packet statistics */
@@ -1047,6 +1065,13 @@ typedef struct _PacketCount
     uint64_t log_limit;
     uint64_t event_limit;
     uint64_t alert_limit;
+    uint64_t pcre_limit;      /* pcre searches given up at a match limit */
+
+    /* fast pattern searches skipped because no rule could match */
+    uint64_t fp_skip_content;
+    uint64_t fp_skip_uri;
+    uint64_t fp_skip_header;
+    uint64_t fp_skip_body;
 
     uint64_t frags;           /* number of frags that have come in */
     uint64_t frag_trackers;   /* number of tracking structures generated */
@@ -1198,6 +1223,11 @@ static inline int ScDaemonMode(void)
     return snort_conf->run_flags & RUN_FLAG__DAEMON;
 }
 
+static inline uint32_t ScWorkerCount(void)
+{
+    return snort_conf->worker_count;
+}
+
 static inline int ScDaemonRestart(void)
 {
     return snort_conf->run_flags & RUN_FLAG__DAEMON_RESTART;
@@ -1472,6 +1502,16 @@ static inline long int ScPcreMatchLimitRecursion(void)
     return snort_conf->pcre_match_limit_recursion;
 }
 
+static inline int ScPcreMatchLimitPolicy(void)
+{
+    return snort_conf->pcre_match_limit_policy;
+}
+
+static inline int ScPcreJit(void)
+{
+    return snort_conf->pcre_jit;
+}
+
 #ifdef PERF_PROFILING
 static inline int ScProfilePreprocs(void)
 {
@@ -1482,6 +1522,16 @@ static inline int ScProfileRules(void)
 {
     return snort_conf->profile_rules.num;
 }
+
+static inline int ScProfilePreprocCounters(void)
+{
+    return perf_counters_active && snort_conf->profile_preprocs.counters;
+}
+
+static inline int ScProfileRuleCounters(void)
+{
+    return perf_counters_active && snort_conf->profile_rules.counters;
+}
 #endif
 
 static inline int ScStaticHash(void)
@@ -28,6 +28,7 @@
 #include "rules.h"
 #include "plugin_enum.h"
 #include "rule_option_types.h"
+#include "profiler.h"
 
 struct _OptTreeNode;      /* forward declaration of OTN data struct */
 struct _RuleTreeNode;     /* forward declaration of RTN data struct */
@@ -118,6 +119,7 @@ typedef struct _OptTreeNode
     uint64_t matches;
     uint64_t alerts;
     uint8_t noalerts;
+    PerfCounters hw;
 #endif
 
     int pcre_flag; /* PPM */
@@ -83,6 +83,7 @@ static struct mallinfo mi;
 #include "ppm.h"
 #include "active.h"
 #include "packet_time.h"
+#include "workers.h"
 
 #ifdef TARGET_BASED
 #include "sftarget_reader.h"
@@ -1191,7 +1192,8 @@ void DropStats(int exiting)
 #endif
 
 #ifdef PPM_MGR
-    PPM_PRINT_SUMMARY(&snort_conf->ppm_cfg);
+    if ( !Workers_IsSupervisor() )
+        PPM_PRINT_SUMMARY(&snort_conf->ppm_cfg);
 #endif
 
     {
@@ -1228,6 +1230,12 @@ void DropStats(int exiting)
 #endif
     }
 
+    if ( Workers_IsSupervisor() )
+    {
+        LogMessage("%s\n", STATS_SEPARATOR);
+        Workers_PrintStats();
+    }
+
     LogMessage("%s\n", STATS_SEPARATOR);
     LogMessage("Breakdown by protocol (includes rebuilt packets):\n");
 
@@ -1318,7 +1326,18 @@ void DropStats(int exiting)
         LogCount("Log", pc.log_limit);
         LogCount("Event", pc.event_limit);
         LogCount("Alert", pc.alert_limit);
+        LogCount("PCRE", pc.pcre_limit);
 
+        if ( pc.fp_skip_content || pc.fp_skip_uri ||
+             pc.fp_skip_header || pc.fp_skip_body )
+        {
+            LogMessage("Searches Skipped:\n");
+
+            LogCount("Content", pc.fp_skip_content);
+            LogCount("Http Uri", pc.fp_skip_uri);
+            LogCount("Http Header", pc.fp_skip_header);
+            LogCount("Http Body", pc.fp_skip_body);
+        }
 
         LogMessage("Verdicts:\n");
 
@@ -1363,12 +1382,17 @@ void DropStats(int exiting)
 
     for (idx = preproc_stats_funcs; idx != NULL; idx = idx->next)
     {
+        /* the supervisor only has the merged counts */
+        if ( Workers_IsSupervisor() && !Workers_MergedCounters(idx->keyword) )
+            continue;
+
         LogMessage("%s\n", STATS_SEPARATOR);
         idx->func(exiting ? 1 : 0);
     }
 
 #ifdef SIDE_CHANNEL
-    SideChannelStats(exiting, STATS_SEPARATOR);
+    if ( !Workers_IsSupervisor() )
+        SideChannelStats(exiting, STATS_SEPARATOR);
 #endif /* SIDE_CHANNEL */
 
     LogMessage("%s\n", STATS_SEPARATOR);
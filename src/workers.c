@@ -0,0 +1,1077 @@
+/* $Id$ */
+/*
+ ** Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ **
+ ** This program is free software; you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License Version 2 as
+ ** published by the Free Software Foundation.  You may not use, modify or
+ ** distribute this program under any other version of the GNU General
+ ** Public License.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program; if not, write to the Free Software
+ ** Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+/**
+ * @file   workers.c
+ *
+ * @brief  Multi-process packet workers.
+ *
+ * Snort keeps its detection, session and preprocessor state in process
+ * globals, so workers are processes rather than threads.  The supervisor
+ * forks the workers once configuration is complete so the compiled
+ * detection engine is shared copy-on-write.  Each worker publishes its
+ * counters into a shared anonymous mapping protected by a per slot
+ * sequence count; the supervisor merges them for the exit statistics
+ * and logs the sum of the workers' perfmonitor intervals.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef LINUX
+#include <sys/prctl.h>
+#endif
+
+#include "workers.h"
+#include "snort.h"
+#include "sfdaq.h"
+#include "util.h"
+#include "sfcontrol_funcs.h"
+#include "preprocessors/perf.h"
+
+/* a worker that dies sooner than this after starting is not restarted */
+#define WORKER_MIN_UPTIME  5
+
+/* limit the rate of stats updates from the packet path */
+#define WORKER_PUBLISH_INTERVAL  1
+
+/* how long the supervisor waits for all workers to end a perfmonitor
+ * interval before it logs the ones it has */
+#define WORKER_PERF_GRACE  3
+
+#define ETHERNET_TYPE_IP     0x0800
+#define ETHERNET_TYPE_IPV6   0x86dd
+#define ETHERNET_TYPE_8021Q  0x8100
+#define ETHERNET_TYPE_8021AD 0x88a8
+#define ETHERNET_TYPE_QINQ   0x9100
+#define ETHERNET_TYPE_MPLS   0x8847
+
+#define WORKER_MAX_VLAN   4
+#define WORKER_MAX_MPLS   8
+#define WORKER_MAX_IP6EXT 4
+
+typedef struct _WorkerSlot
+{
+    volatile uint32_t seq;    /* odd while the worker is updating */
+    volatile pid_t pid;       /* 0 once the worker is gone */
+    time_t started;
+    uint32_t restarts;
+    uint64_t skipped;         /* packets left to other workers */
+    PacketCount pc;
+    DAQ_Stats_t daq;
+
+    volatile uint32_t perf_seq;   /* perfmonitor intervals published */
+    SFBASE perf_base;
+    SFBASE_SAMPLE perf_sample;
+
+    uint64_t counters[];      /* registered preprocessor counters */
+
+} WorkerSlot;
+
+typedef struct _WorkerTotals
+{
+    uint64_t skipped;
+    PacketCount pc;
+    DAQ_Stats_t daq;
+
+} WorkerTotals;
+
+typedef struct _WorkerCounters
+{
+    char *keyword;
+    void *counters;
+    size_t size;
+    size_t width;
+    size_t offset;            /* in the slot's counters */
+    WorkerCountersFunc update;
+    struct _WorkerCounters *next;
+
+} WorkerCounters;
+
+static WorkerSlot *worker_slots = NULL;
+static size_t worker_slots_size = 0;
+static size_t worker_slot_size = sizeof(WorkerSlot);
+static WorkerSlot *worker_snap = NULL;
+static unsigned worker_count = 0;
+static WorkerBalance worker_balance = WORKER_BALANCE__DAQ;
+static int worker_id = -1;
+
+static WorkerCounters *worker_counters = NULL;
+static size_t worker_counters_size = 0;
+
+/* counts of workers that were replaced after a crash */
+static WorkerTotals worker_retired;
+static uint8_t *worker_retired_counters = NULL;
+
+/* perfmonitor intervals of each worker the supervisor has logged */
+static uint32_t worker_perf_logged[WORKERS_MAX];
+static time_t worker_perf_wait = 0;
+
+static uint64_t worker_skipped = 0;
+static time_t worker_last_publish = 0;
+
+static const struct timespec supervise_sleep = { 0, 100000000 };
+
+//--------------------------------------------------------------------
+// shared stats
+//--------------------------------------------------------------------
+
+static inline WorkerSlot * WorkerSlotAt(unsigned id)
+{
+    return (WorkerSlot *)((uint8_t *)worker_slots + id * worker_slot_size);
+}
+
+static void WorkerWriteSlot(WorkerSlot *slot)
+{
+    const DAQ_Stats_t *ps = DAQ_GetStats();
+    WorkerCounters *wc;
+
+    for (wc = worker_counters; wc != NULL; wc = wc->next)
+        if (wc->update != NULL)
+            wc->update();
+
+    slot->seq++;
+    __sync_synchronize();
+
+    slot->pc = pc;
+    slot->daq = *ps;
+    slot->skipped = worker_skipped;
+
+    for (wc = worker_counters; wc != NULL; wc = wc->next)
+        memcpy((uint8_t *)slot->counters + wc->offset, wc->counters, wc->size);
+
+    __sync_synchronize();
+    slot->seq++;
+}
+
+/* Returns a copy of the slot that stays valid until the next read. */
+static const WorkerSlot * WorkerReadSlot(const WorkerSlot *slot)
+{
+    uint32_t seq;
+    unsigned tries = 0;
+
+    do
+    {
+        /* a worker that died mid update leaves seq odd; take what is there */
+        while (((seq = slot->seq) & 1) && (++tries < 1000))
+            sched_yield();
+
+        __sync_synchronize();
+
+        memcpy(worker_snap, (const void *)slot, worker_slot_size);
+
+        __sync_synchronize();
+
+    } while ((seq != slot->seq) && (tries < 1000));
+
+    return worker_snap;
+}
+
+static void WorkerAddCounters(
+    const WorkerCounters *wc, uint8_t *dst, const WorkerSlot *wt)
+{
+    const uint8_t *src = (const uint8_t *)wt->counters + wc->offset;
+    size_t i, n = wc->size / wc->width;
+
+    if (wc->width == sizeof(uint64_t))
+    {
+        for (i = 0; i < n; i++)
+            ((uint64_t *)dst)[i] += ((const uint64_t *)src)[i];
+    }
+    else
+    {
+        for (i = 0; i < n; i++)
+            ((uint32_t *)dst)[i] += ((const uint32_t *)src)[i];
+    }
+}
+
+static void WorkerAddTotals(WorkerTotals *sum, const WorkerSlot *wt)
+{
+    /* PacketCount is all uint64_t counters */
+    uint64_t *dst = (uint64_t *)&sum->pc;
+    const uint64_t *src = (const uint64_t *)&wt->pc;
+    unsigned i;
+
+    for (i = 0; i < sizeof(PacketCount) / sizeof(uint64_t); i++)
+        dst[i] += src[i];
+
+    sum->skipped += wt->skipped;
+
+    if (worker_balance == WORKER_BALANCE__HASH)
+    {
+        /* all workers read the same packets */
+        if (wt->daq.hw_packets_received > sum->daq.hw_packets_received)
+            sum->daq.hw_packets_received = wt->daq.hw_packets_received;
+        if (wt->daq.hw_packets_dropped > sum->daq.hw_packets_dropped)
+            sum->daq.hw_packets_dropped = wt->daq.hw_packets_dropped;
+        if (wt->daq.packets_received > sum->daq.packets_received)
+            sum->daq.packets_received = wt->daq.packets_received;
+        if (wt->daq.packets_filtered > sum->daq.packets_filtered)
+            sum->daq.packets_filtered = wt->daq.packets_filtered;
+    }
+    else
+    {
+        sum->daq.hw_packets_received += wt->daq.hw_packets_received;
+        sum->daq.hw_packets_dropped += wt->daq.hw_packets_dropped;
+        sum->daq.packets_received += wt->daq.packets_received;
+        sum->daq.packets_filtered += wt->daq.packets_filtered;
+    }
+    sum->daq.packets_injected += wt->daq.packets_injected;
+
+    for (i = 0; i < MAX_DAQ_VERDICT; i++)
+        sum->daq.verdicts[i] += wt->daq.verdicts[i];
+}
+
+void Workers_PublishStats(bool force)
+{
+    /* wall clock for every caller, packet time may be anything */
+    time_t now;
+
+    if (worker_id < 0)
+        return;
+
+    now = time(NULL);
+
+    if (!force && (now >= worker_last_publish) &&
+        (now - worker_last_publish < WORKER_PUBLISH_INTERVAL))
+        return;
+
+    worker_last_publish = now;
+    WorkerWriteSlot(WorkerSlotAt(worker_id));
+}
+
+void Workers_PublishPerf(const SFBASE *base, const SFBASE_SAMPLE *sample)
+{
+    WorkerSlot *slot;
+
+    if (worker_id < 0)
+        return;
+
+    slot = WorkerSlotAt(worker_id);
+
+    slot->seq++;
+    __sync_synchronize();
+
+    slot->perf_base = *base;
+    slot->perf_sample = *sample;
+    slot->perf_seq++;
+
+    __sync_synchronize();
+    slot->seq++;
+}
+
+void Workers_RegisterCounters(const char *keyword, void *counters, size_t size,
+    size_t width, WorkerCountersFunc update)
+{
+    WorkerCounters *wc;
+
+    /* the slot layout is fixed once the workers run */
+    if (worker_slots != NULL)
+        return;
+
+    if (((width != sizeof(uint32_t)) && (width != sizeof(uint64_t))) ||
+        (size == 0) || (size % width))
+    {
+        FatalError("Invalid worker counters for %s.\n", keyword);
+    }
+
+    for (wc = worker_counters; wc != NULL; wc = wc->next)
+        if (wc->counters == counters)
+            return;
+
+    wc = (WorkerCounters *)SnortAlloc(sizeof(*wc));
+    wc->keyword = SnortStrdup(keyword);
+    wc->counters = counters;
+    wc->size = size;
+    wc->width = width;
+    wc->update = update;
+    wc->offset = worker_counters_size;
+
+    worker_counters_size += (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+
+    wc->next = worker_counters;
+    worker_counters = wc;
+}
+
+bool Workers_MergedCounters(const char *keyword)
+{
+    WorkerCounters *wc;
+
+    if (!Workers_IsSupervisor())
+        return false;
+
+    for (wc = worker_counters; wc != NULL; wc = wc->next)
+        if (strcmp(wc->keyword, keyword) == 0)
+            return true;
+
+    return false;
+}
+
+/* Logs the sum of the workers' perfmonitor intervals once all running
+ * workers have ended the interval, or after a grace period; a worker only
+ * ends an interval when it sees packets. */
+static void WorkersLogPerf(bool flush)
+{
+    SFBASE sum;
+    SFBASE_SAMPLE sample;
+    unsigned i, ready = 0, waiting = 0;
+
+    if ((perfmon_config == NULL) || !(perfmon_config->perf_flags & SFPERF_BASE))
+        return;
+
+    if (IsSetRotatePerfFileFlag())
+    {
+        if (perfmon_config->fh != NULL)
+            sfRotateBaseStatsFile(perfmon_config);
+
+        ClearRotatePerfFileFlag();
+    }
+
+    for (i = 0; i < worker_count; i++)
+    {
+        const WorkerSlot *slot = WorkerSlotAt(i);
+
+        if (slot->perf_seq != worker_perf_logged[i])
+            ready++;
+        else if (slot->pid)
+            waiting++;
+    }
+
+    if (!ready)
+        return;
+
+    if (waiting && !flush)
+    {
+        time_t now = time(NULL);
+
+        if (!worker_perf_wait)
+            worker_perf_wait = now;
+
+        if (now - worker_perf_wait < WORKER_PERF_GRACE)
+            return;
+    }
+    worker_perf_wait = 0;
+
+    memset(&sum, 0, sizeof(sum));
+    memset(&sample, 0, sizeof(sample));
+
+    for (i = 0; i < worker_count; i++)
+    {
+        const WorkerSlot *wt;
+
+        if (WorkerSlotAt(i)->perf_seq == worker_perf_logged[i])
+            continue;
+
+        wt = WorkerReadSlot(WorkerSlotAt(i));
+        worker_perf_logged[i] = wt->perf_seq;
+
+        AddBaseStats(&sum, &sample, &wt->perf_base, &wt->perf_sample,
+            (worker_balance == WORKER_BALANCE__HASH));
+    }
+
+    sfProcessMergedBaseStats(perfmon_config, &sum, &sample);
+}
+
+void Workers_MergeStats(void)
+{
+    WorkerTotals sum;
+    WorkerCounters *wc;
+    unsigned i;
+
+    if (!Workers_IsSupervisor())
+        return;
+
+    sum = worker_retired;
+
+    for (wc = worker_counters; wc != NULL; wc = wc->next)
+        memcpy(wc->counters, worker_retired_counters + wc->offset, wc->size);
+
+    for (i = 0; i < worker_count; i++)
+    {
+        const WorkerSlot *wt = WorkerReadSlot(WorkerSlotAt(i));
+
+        WorkerAddTotals(&sum, wt);
+
+        for (wc = worker_counters; wc != NULL; wc = wc->next)
+            WorkerAddCounters(wc, (uint8_t *)wc->counters, wt);
+    }
+
+    /* packets a worker skipped were passed by it, not analyzed */
+    if (sum.daq.verdicts[DAQ_VERDICT_PASS] >= sum.skipped)
+        sum.daq.verdicts[DAQ_VERDICT_PASS] -= sum.skipped;
+
+    pc = sum.pc;
+    DAQ_SetMergedStats(&sum.daq);
+
+    WorkersLogPerf(true);
+}
+
+void Workers_PrintStats(void)
+{
+    unsigned i;
+
+    if (!Workers_IsSupervisor())
+        return;
+
+    LogMessage("Workers (%s balance):\n",
+        (worker_balance == WORKER_BALANCE__HASH) ? "hash" : "daq");
+    LogMessage("%7s %8s %12s %12s %12s %8s\n",
+        "Worker", "Pid", "Received", "Analyzed", "Skipped", "Restarts");
+
+    for (i = 0; i < worker_count; i++)
+    {
+        const WorkerSlot *wt = WorkerReadSlot(WorkerSlotAt(i));
+
+        LogMessage("%7u %8d " FMTu64("12") " " FMTu64("12") " " FMTu64("12") " %8u\n",
+            i, (int)wt->pid, wt->daq.packets_received,
+            wt->pc.total_from_daq, wt->skipped, wt->restarts);
+    }
+}
+
+//--------------------------------------------------------------------
+// software flow affinity
+//--------------------------------------------------------------------
+
+static inline uint32_t WorkerMix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline uint32_t WorkerHashBytes(uint32_t h, const uint8_t *b, unsigned n)
+{
+    while (n--)
+    {
+        h ^= *b++;
+        h *= 16777619;
+    }
+    return h;
+}
+
+/* Orders the endpoints so both directions of a flow hash the same. */
+static uint32_t WorkerHashFlow(
+    const uint8_t *a, const uint8_t *b, unsigned alen,
+    const uint8_t *ports, uint8_t proto)
+{
+    uint32_t h = 2166136261U;
+    uint8_t p[4] = { 0, 0, 0, 0 };
+    int cmp = memcmp(a, b, alen);
+
+    if (ports)
+        memcpy(p, ports, sizeof(p));
+
+    if ((cmp > 0) || ((cmp == 0) && (memcmp(p, p + 2, 2) > 0)))
+    {
+        const uint8_t *t = a;
+        uint8_t tp[2];
+
+        a = b;
+        b = t;
+
+        memcpy(tp, p, 2);
+        memcpy(p, p + 2, 2);
+        memcpy(p + 2, tp, 2);
+    }
+
+    h = WorkerHashBytes(h, a, alen);
+    h = WorkerHashBytes(h, p, 2);
+    h = WorkerHashBytes(h, b, alen);
+    h = WorkerHashBytes(h, p + 2, 2);
+    h = WorkerHashBytes(h, &proto, 1);
+
+    return WorkerMix(h);
+}
+
+static inline int WorkerHasPorts(uint8_t proto)
+{
+    return (proto == IPPROTO_TCP) || (proto == IPPROTO_UDP) || (proto == 132);
+}
+
+static int WorkerHashIp4(const uint8_t *ip, uint32_t len, uint32_t *hash)
+{
+    unsigned hlen;
+    uint16_t frag;
+    const uint8_t *ports = NULL;
+
+    if (len < 20)
+        return -1;
+
+    hlen = (ip[0] & 0x0f) << 2;
+
+    if (hlen < 20 || hlen > len)
+        return -1;
+
+    frag = (ip[6] << 8) | ip[7];
+
+    /* fragments of a datagram may lack ports so leave them out for all */
+    if (!(frag & 0x3fff) && WorkerHasPorts(ip[9]) && (len >= hlen + 4))
+        ports = ip + hlen;
+
+    *hash = WorkerHashFlow(ip + 12, ip + 16, 4, ports, ip[9]);
+    return 0;
+}
+
+static int WorkerHashIp6(const uint8_t *ip, uint32_t len, uint32_t *hash)
+{
+    uint32_t off = 40;
+    uint8_t next;
+    unsigned i;
+    const uint8_t *ports = NULL;
+
+    if (len < 40)
+        return -1;
+
+    next = ip[6];
+
+    for (i = 0; i < WORKER_MAX_IP6EXT; i++)
+    {
+        if ((next != 0) && (next != 43) && (next != 60) && (next != 44))
+            break;
+
+        if (len < off + 8)
+            return -1;
+
+        if (next == 44)
+        {
+            next = ip[off];
+            off = len;  /* no ports in fragments */
+            break;
+        }
+        next = ip[off];
+        off += (ip[off + 1] + 1) << 3;
+    }
+
+    if (WorkerHasPorts(next) && (len >= off + 4))
+        ports = ip + off;
+
+    *hash = WorkerHashFlow(ip + 8, ip + 24, 16, ports, next);
+    return 0;
+}
+
+static int WorkerHashIp(const uint8_t *ip, uint32_t len, uint32_t *hash)
+{
+    if (len < 1)
+        return -1;
+
+    switch (ip[0] >> 4)
+    {
+        case 4:
+            return WorkerHashIp4(ip, len, hash);
+
+        case 6:
+            return WorkerHashIp6(ip, len, hash);
+
+        default:
+            break;
+    }
+    return -1;
+}
+
+static int WorkerHashEth(const uint8_t *pkt, uint32_t len, uint32_t *hash)
+{
+    uint32_t off = 12;
+    uint16_t type;
+    unsigned i;
+
+    if (len < off + 2)
+        return -1;
+
+    type = (pkt[off] << 8) | pkt[off + 1];
+
+    for (i = 0; i < WORKER_MAX_VLAN; i++)
+    {
+        if ((type != ETHERNET_TYPE_8021Q) && (type != ETHERNET_TYPE_8021AD) &&
+            (type != ETHERNET_TYPE_QINQ))
+            break;
+
+        off += 4;
+
+        if (len < off + 2)
+            return -1;
+
+        type = (pkt[off] << 8) | pkt[off + 1];
+    }
+    off += 2;
+
+    if (type == ETHERNET_TYPE_MPLS)
+    {
+        for (i = 0; i < WORKER_MAX_MPLS; i++)
+        {
+            if (len < off + 4)
+                return -1;
+
+            off += 4;
+
+            if (pkt[off - 2] & 0x01)  /* bottom of stack */
+                return WorkerHashIp(pkt + off, len - off, hash);
+        }
+        return -1;
+    }
+
+    if ((type != ETHERNET_TYPE_IP) && (type != ETHERNET_TYPE_IPV6))
+        return -1;
+
+    return WorkerHashIp(pkt + off, len - off, hash);
+}
+
+int Workers_OwnsPacket(const DAQ_PktHdr_t *pkthdr, const uint8_t *pkt)
+{
+    uint32_t hash;
+    uint32_t len = pkthdr->caplen;
+    int rval;
+
+    if ((worker_id < 0) || (worker_balance != WORKER_BALANCE__HASH))
+        return 1;
+
+    switch (DAQ_GetBaseProtocol())
+    {
+        case DLT_EN10MB:
+            rval = WorkerHashEth(pkt, len, &hash);
+            break;
+
+#ifdef DLT_LINUX_SLL
+        case DLT_LINUX_SLL:
+            rval = (len > 16) ? WorkerHashIp(pkt + 16, len - 16, &hash) : -1;
+            break;
+#endif
+
+        case DLT_NULL:
+#ifdef DLT_LOOP
+        case DLT_LOOP:
+#endif
+            rval = (len > 4) ? WorkerHashIp(pkt + 4, len - 4, &hash) : -1;
+            break;
+
+        case DLT_RAW:
+#ifdef DLT_IPV4
+        case DLT_IPV4:
+#endif
+#ifdef DLT_IPV6
+        case DLT_IPV6:
+#endif
+            rval = WorkerHashIp(pkt, len, &hash);
+            break;
+
+        default:
+            rval = -1;
+            break;
+    }
+
+    /* anything we can't classify goes to the first worker */
+    if (rval)
+        hash = 0;
+
+    if ((hash % worker_count) == (uint32_t)worker_id)
+        return 1;
+
+    worker_skipped++;
+    return 0;
+}
+
+//--------------------------------------------------------------------
+// per worker configuration
+//--------------------------------------------------------------------
+
+static char * WorkerSubdir(const char *dir)
+{
+    char buf[PATH_MAX];
+    const char *sep = "/";
+    size_t len = strlen(dir);
+
+    if (len && (dir[len - 1] == '/'))
+        sep = "";
+
+    if (SnortSnprintf(buf, sizeof(buf), "%s%sworker%d", dir, sep, worker_id) !=
+        SNORT_SNPRINTF_SUCCESS)
+    {
+        FatalError("Worker %d: path too long for %s.\n", worker_id, dir);
+    }
+    return SnortStrdup(buf);
+}
+
+static void WorkerMakeDir(SnortConfig *sc, const char *dir)
+{
+    if ((mkdir(dir, 0700) != 0) && (errno != EEXIST))
+        FatalError("Worker %d: can't create %s: %s.\n", worker_id, dir, strerror(errno));
+
+#ifndef WIN32
+    if ((sc->user_id != -1) || (sc->group_id != -1))
+    {
+        if (chown(dir, sc->user_id, sc->group_id) != 0)
+            WarningMessage("Worker %d: can't change ownership of %s: %s.\n",
+                worker_id, dir, strerror(errno));
+    }
+#endif
+}
+
+void Workers_ConfigureWorker(SnortConfig *sc)
+{
+    char suffix[MAX_PIDFILE_SUFFIX + 1];
+
+    if ((sc == NULL) || (worker_id < 0))
+        return;
+
+    if (SnortSnprintf(suffix, sizeof(suffix), "%s_w%d", sc->pidfile_suffix, worker_id) !=
+        SNORT_SNPRINTF_SUCCESS)
+    {
+        FatalError("Worker %d: pid file suffix \"%s\" is too long for worker mode.\n",
+            worker_id, sc->pidfile_suffix);
+    }
+    SnortStrncpy(sc->pidfile_suffix, suffix, sizeof(sc->pidfile_suffix));
+
+    /* orig_log_dir is left alone so reload still compares the configured dir */
+    if (sc->log_dir != NULL)
+    {
+        char *dir = WorkerSubdir(sc->log_dir);
+        free(sc->log_dir);
+        sc->log_dir = dir;
+    }
+
+    if (sc->cs_dir != NULL)
+    {
+        char *dir = WorkerSubdir(sc->cs_dir);
+        free(sc->cs_dir);
+        sc->cs_dir = dir;
+    }
+}
+
+void Workers_FileName(char **name)
+{
+    char buf[PATH_MAX];
+
+    if ((worker_id < 0) || (name == NULL) || (*name == NULL))
+        return;
+
+    if (SnortSnprintf(buf, sizeof(buf), "%s.w%d", *name, worker_id) !=
+        SNORT_SNPRINTF_SUCCESS)
+    {
+        FatalError("Worker %d: path too long for %s.\n", worker_id, *name);
+    }
+    free(*name);
+    *name = SnortStrdup(buf);
+}
+
+/* Turns the inherited supervisor state into a fresh worker. */
+static void WorkerInit(int id)
+{
+    worker_id = id;
+    worker_skipped = 0;
+    worker_last_publish = 0;
+
+#ifdef PR_SET_PDEATHSIG
+    /* don't outlive the supervisor */
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+
+    memset(&pc, 0, sizeof(pc));
+
+    /* the supervisor's merged perfmonitor file; the worker opens its own */
+    if ((perfmon_config != NULL) && (perfmon_config->fh != NULL))
+    {
+        fclose(perfmon_config->fh);
+        perfmon_config->fh = NULL;
+    }
+
+    /* the supervisor owns the pid files it may have inherited */
+    ClosePidFile();
+    snort_conf->pid_filename[0] = '\0';
+    snort_conf->parent_pid = getppid();
+
+    Workers_ConfigureWorker(snort_conf);
+
+    if (snort_conf->log_dir != NULL)
+        WorkerMakeDir(snort_conf, snort_conf->log_dir);
+
+    if (snort_conf->cs_dir != NULL)
+    {
+        WorkerMakeDir(snort_conf, snort_conf->cs_dir);
+        ControlSocketResetDirectory();
+        ControlSocketConfigureDirectory(snort_conf->cs_dir);
+    }
+
+    LogMessage("Worker %d started, pid %d\n", worker_id, (int)getpid());
+}
+
+//--------------------------------------------------------------------
+// supervisor
+//--------------------------------------------------------------------
+
+static pid_t WorkerFork(int id)
+{
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+        ErrorMessage("Could not fork worker %d: %s.\n", id, strerror(errno));
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        WorkerInit(id);
+        return 0;
+    }
+
+    WorkerSlotAt(id)->pid = pid;
+    WorkerSlotAt(id)->started = time(NULL);
+
+    return pid;
+}
+
+int Workers_Spawn(SnortConfig *sc, const char *intf)
+{
+    unsigned i;
+
+    worker_count = sc->worker_count;
+    worker_balance = sc->worker_balance;
+
+    if ((worker_count == 0) || (worker_count > WORKERS_MAX))
+        FatalError("Invalid number of workers: %u.\n", worker_count);
+
+    if (ScReadMode())
+        worker_balance = WORKER_BALANCE__HASH;
+
+    if ((worker_balance == WORKER_BALANCE__HASH) && ScAdapterInlineMode())
+        FatalError("Worker hash balance can't be used inline; "
+            "configure the DAQ to distribute flows instead.\n");
+
+    worker_slot_size = sizeof(WorkerSlot) + worker_counters_size;
+    worker_slots_size = worker_count * worker_slot_size;
+    worker_slots = mmap(NULL, worker_slots_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (worker_slots == MAP_FAILED)
+        FatalError("Could not map worker stats: %s.\n", strerror(errno));
+
+    memset(worker_slots, 0, worker_slots_size);
+    memset(&worker_retired, 0, sizeof(worker_retired));
+    memset(worker_perf_logged, 0, sizeof(worker_perf_logged));
+
+    worker_snap = (WorkerSlot *)SnortAlloc(worker_slot_size);
+
+    if (worker_counters_size)
+        worker_retired_counters = (uint8_t *)SnortAlloc(worker_counters_size);
+
+    LogMessage("Starting %u workers on %s (%s balance)\n", worker_count,
+        intf ? intf : "default interface",
+        (worker_balance == WORKER_BALANCE__HASH) ? "hash" : "daq");
+
+    for (i = 0; i < worker_count; i++)
+    {
+        pid_t pid = WorkerFork(i);
+
+        if (pid == 0)
+            return i;
+
+        if (pid < 0)
+            FatalError("Could not start worker %u.\n", i);
+    }
+
+    return -1;
+}
+
+static int WorkersRunning(void)
+{
+    unsigned i;
+    int n = 0;
+
+    for (i = 0; i < worker_count; i++)
+        if (WorkerSlotAt(i)->pid)
+            n++;
+
+    return n;
+}
+
+static void WorkersSignal(int sig)
+{
+    unsigned i;
+
+    for (i = 0; i < worker_count; i++)
+    {
+        pid_t pid = WorkerSlotAt(i)->pid;
+
+        if (pid && kill(pid, sig))
+            ErrorMessage("Could not signal worker %u (%d): %s.\n",
+                i, (int)pid, strerror(errno));
+    }
+}
+
+static int WorkerFind(pid_t pid)
+{
+    unsigned i;
+
+    for (i = 0; i < worker_count; i++)
+        if (WorkerSlotAt(i)->pid == pid)
+            return (int)i;
+
+    return -1;
+}
+
+/* Returns the worker id in a replacement child, else -1. */
+static int WorkerReap(int id, int status, int exiting)
+{
+    WorkerSlot *slot = WorkerSlotAt(id);
+    time_t uptime = time(NULL) - slot->started;
+
+    slot->pid = 0;
+
+    if (WIFEXITED(status))
+    {
+        if (WEXITSTATUS(status))
+            ErrorMessage("Worker %d exited with status %d.\n", id, WEXITSTATUS(status));
+        else
+            LogMessage("Worker %d exited.\n", id);
+        return -1;
+    }
+
+    if (!WIFSIGNALED(status))
+        return -1;
+
+    ErrorMessage("Worker %d terminated by signal %d.\n", id, WTERMSIG(status));
+
+    if (exiting)
+        return -1;
+
+    if (uptime < WORKER_MIN_UPTIME)
+    {
+        ErrorMessage("Worker %d failed after %d seconds, not restarting.\n",
+            id, (int)uptime);
+        return -1;
+    }
+
+    {
+        /* keep what it counted before the crash */
+        const WorkerSlot *wt = WorkerReadSlot(slot);
+        WorkerCounters *wc;
+
+        WorkerAddTotals(&worker_retired, wt);
+
+        for (wc = worker_counters; wc != NULL; wc = wc->next)
+            WorkerAddCounters(wc, worker_retired_counters + wc->offset, wt);
+
+        memset(&slot->pc, 0, sizeof(slot->pc));
+        memset(&slot->daq, 0, sizeof(slot->daq));
+        memset(slot->counters, 0, worker_counters_size);
+        slot->skipped = 0;
+        slot->seq = 0;
+    }
+
+    slot->restarts++;
+    LogMessage("Restarting worker %d.\n", id);
+
+    if (WorkerFork(id) == 0)
+        return id;
+
+    return -1;
+}
+
+int Workers_Supervise(WorkerSignalFunc pending)
+{
+    int exiting = 0;
+
+    while (WorkersRunning())
+    {
+        int status;
+        pid_t pid;
+        int sig = pending();
+
+        if (sig)
+        {
+            if ((sig == SIGTERM) || (sig == SIGINT) || (sig == SIGQUIT))
+                exiting = 1;
+
+            WorkersSignal(sig);
+        }
+
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            int id = WorkerFind(pid);
+
+            if (id < 0)
+                continue;
+
+            if (WorkerReap(id, status, exiting) >= 0)
+                return id;
+        }
+
+        if ((pid < 0) && (errno == ECHILD))
+            break;
+
+        WorkersLogPerf(false);
+        nanosleep(&supervise_sleep, NULL);
+    }
+
+    return -1;
+}
+
+void Workers_Cleanup(void)
+{
+    if (Workers_IsSupervisor() && (perfmon_config != NULL))
+        sfCloseBaseStatsFile(perfmon_config);
+
+    if (worker_slots != NULL)
+    {
+        munmap(worker_slots, worker_slots_size);
+        worker_slots = NULL;
+    }
+
+    while (worker_counters != NULL)
+    {
+        WorkerCounters *wc = worker_counters;
+        worker_counters = wc->next;
+        free(wc->keyword);
+        free(wc);
+    }
+    worker_counters_size = 0;
+
+    free(worker_retired_counters);
+    worker_retired_counters = NULL;
+
+    free(worker_snap);
+    worker_snap = NULL;
+}
+
+int Workers_Id(void)
+{
+    return worker_id;
+}
+
+bool Workers_IsSupervisor(void)
+{
+    return (worker_slots != NULL) && (worker_id < 0);
+}
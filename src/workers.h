@@ -0,0 +1,106 @@
+/* $Id$ */
+/****************************************************************************
+ *
+ * Copyright (C) 2014-2015 Cisco and/or its affiliates. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation.  You may not use, modify or
+ * distribute this program under any other version of the GNU General
+ * Public License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ ****************************************************************************/
+
+/**
+ * @file   workers.h
+ *
+ * @brief  Multi-process packet workers.
+ *
+ * When "config workers: N" (or --workers N) is given, the main process
+ * forks N packet processing workers after configuration is complete and
+ * becomes a supervisor.  Each worker owns a private copy of the detection
+ * engine, session tables and preprocessor state, so there is no locking
+ * on the packet path.  Flow affinity is either delegated to the DAQ
+ * (fanout, cluster id, queue per worker) or done in software by hashing
+ * the 5-tuple symmetrically so both directions of a flow land on the same
+ * worker.
+ */
+
+#ifndef __WORKERS_H__
+#define __WORKERS_H__
+
+#include <sys/types.h>
+#include <daq.h>
+
+#include "sf_types.h"
+
+struct _SnortConfig;
+struct _SFBASE;
+struct _SFBASE_SAMPLE;
+
+#define WORKERS_MAX  64
+
+typedef enum _WorkerBalance
+{
+    WORKER_BALANCE__DAQ = 0,   /* daq delivers each flow to one worker */
+    WORKER_BALANCE__HASH       /* every worker sees all packets, keeps its share */
+
+} WorkerBalance;
+
+/* Returns the signal to forward to the workers, or 0 if none is pending. */
+typedef int (*WorkerSignalFunc)(void);
+
+/* Brings counts kept elsewhere into a block of counters before a worker
+ * publishes it. */
+typedef void (*WorkerCountersFunc)(void);
+
+/* Forks the workers.  Returns the worker id in the child and -1 in the
+ * supervisor. */
+int Workers_Spawn(struct _SnortConfig *, const char *intf);
+
+/* Runs the supervisor loop until all workers are gone.  Returns -1 when
+ * done or a worker id if a replacement worker was forked (in the child). */
+int Workers_Supervise(WorkerSignalFunc);
+
+/* Per worker adjustments of pid file, log and control socket paths. */
+void Workers_ConfigureWorker(struct _SnortConfig *);
+
+/* Appends the worker id to a file name that workers would otherwise share. */
+void Workers_FileName(char **);
+
+int Workers_OwnsPacket(const DAQ_PktHdr_t *, const uint8_t *pkt);
+void Workers_PublishStats(bool force);
+
+/* Hands a perfmonitor interval to the supervisor, which logs the sum of
+ * all workers' intervals. */
+void Workers_PublishPerf(const struct _SFBASE *, const struct _SFBASE_SAMPLE *);
+
+/* Registers a block of uint32_t or uint64_t counters (width) that the
+ * workers publish with their packet counts.  The supervisor sums the
+ * blocks into the same memory before it prints the stats of keyword.
+ * Blocks registered after the workers are started are ignored. */
+void Workers_RegisterCounters(const char *keyword, void *counters, size_t size,
+    size_t width, WorkerCountersFunc);
+
+/* True in the supervisor for the stats it has merged counters for. */
+bool Workers_MergedCounters(const char *keyword);
+
+/* Sums the worker counts into pc, the daq stats and the registered
+ * counters and logs the last perfmonitor interval (supervisor only). */
+void Workers_MergeStats(void);
+void Workers_PrintStats(void);
+void Workers_Cleanup(void);
+
+int Workers_Id(void);
+bool Workers_IsSupervisor(void);
+
+#endif /* __WORKERS_H__ */